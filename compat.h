@@ -153,7 +153,37 @@ int fdclosedir (DIR *dir);
 #ifndef HAVE_FSTATAT
 int fstatat (int fd, const char *path, struct stat *buf, int flag);
 #endif
+#ifndef HAVE_STRLCPY
+size_t strlcpy (char *dst, const char *src, size_t size);
+#endif
 
 __END_DECLS
 
+/*
+ * Simulator build: route kqueue(2) and file system calls made by library
+ * to in-memory model, see sim/sim.c
+ */
+#ifdef SIMULATOR
+#include "sim/sim.h"
+#define kqueue()                        sim_kqueue ()
+#define kevent(kq, cl, ncl, el, nel, t) sim_kevent (kq, cl, ncl, el, nel, t)
+#define openat(...)                     sim_openat (__VA_ARGS__)
+#define close(fd)                       sim_close (fd)
+#define close_range(lo, hi, flags)      sim_close_range (lo, hi, flags)
+#define dup(fd)                         sim_dup (fd)
+#define fcntl(...)                      sim_fcntl (__VA_ARGS__)
+#define lseek(fd, offset, whence)       sim_lseek (fd, offset, whence)
+#define fstat(fd, buf)                  sim_fstat (fd, buf)
+#define fstatat(fd, path, buf, flag)    sim_fstatat (fd, path, buf, flag)
+#define lstat(path, buf)                sim_lstat (path, buf)
+#define faccessat(fd, path, mode, flag) sim_faccessat (fd, path, mode, flag)
+#define fdopendir(fd)                   sim_fdopendir (fd)
+#define readdir(dir)                    sim_readdir (dir)
+#define rewinddir(dir)                  sim_rewinddir (dir)
+#define closedir(dir)                   sim_closedir (dir)
+#define fdclosedir(dir)                 sim_fdclosedir (dir)
+#define send(fd, buf, len, flags)       sim_send (fd, buf, len, flags)
+#define sendmsg(fd, msg, flags)         sim_sendmsg (fd, msg, flags)
+#endif
+
 #endif /* __COMPAT_H__ */
@@ -26,7 +26,6 @@
 
 #include <sys/types.h>
 #include <sys/queue.h>
-#include <sys/stat.h>
 #include <sys/event.h>
 
 #include <assert.h>
@@ -68,6 +67,7 @@ workerset_unlock (void)
 }
 
 static int     worker_exec (int fd, struct worker_cmd *cmd);
+static struct worker *worker_lookup (int fd);
 
 /**
  * Create a new inotify instance.
@@ -101,14 +101,21 @@ inotify_init1 (int flags)
     int lfd = -1;
 
 #ifdef O_CLOEXEC
-    if (flags & ~(IN_CLOEXEC|O_CLOEXEC|IN_NONBLOCK|O_NONBLOCK|IN_DIRECT)) {
+    if (flags & ~(IN_CLOEXEC|O_CLOEXEC|IN_NONBLOCK|O_NONBLOCK|IN_DIRECT|
+                  IN_TIMESTAMP|IN_RING)) {
 #else
-    if (flags & ~(IN_CLOEXEC|IN_NONBLOCK|O_NONBLOCK|IN_DIRECT)) {
+    if (flags & ~(IN_CLOEXEC|IN_NONBLOCK|O_NONBLOCK|IN_DIRECT|
+                  IN_TIMESTAMP|IN_RING)) {
 #endif
         errno = EINVAL;
         return -1;
     }
 
+    if ((flags & IN_DIRECT) && (flags & IN_RING)) {
+        errno = EINVAL;
+        return -1;
+    }
+
     if (atomic_fetch_add (&nworkers, 1) >= max_workers) {
         errno = EMFILE;
         atomic_fetch_sub (&nworkers, 1);
@@ -160,7 +167,6 @@ inotify_add_watch (int         fd,
                    const char *name,
                    uint32_t    mask)
 {
-    struct stat st;
     struct worker_cmd cmd;
 
     if (!is_opened (fd)) {
@@ -168,16 +174,10 @@ inotify_add_watch (int         fd,
     }
 
     /*
-     * this lstat() call guards worker from incorrectly specified path.
-     * E.g, it prevents catching of SIGSEGV when pathname points outside
-     * of the process's accessible address space
+     * Path is not touched before it is opened by worker, so incorrectly
+     * specified one, e.g. pointing outside of the process's accessible
+     * address space, is reported by open(2) with EFAULT there.
      */
-    if (lstat (name, &st) == -1) {
-        perror_msg (("failed to lstat watch %s",
-                     errno != EFAULT ? name : "<bad addr>"));
-        return -1;
-    }
-
     if (mask == 0) {
         perror_msg (("Failed to open watch %s. Bad event mask %x", name, mask));
         errno = EINVAL;
@@ -243,6 +243,19 @@ libinotify_set_param (int fd, int param, intptr_t value)
 
     case IN_SOCKBUFSIZE:
     case IN_MAX_QUEUED_EVENTS:
+    case IN_EVENT_LATENCY:
+    case IN_ELISION_WINDOW:
+    case IN_SOCKBUFSIZE_MAX:
+    case IN_BATCH_BYTES:
+    case IN_BATCH_EVENTS:
+    case IN_BATCH_DELAY:
+    case IN_WATCH_QUOTA:
+    case IN_MOVE_WINDOW:
+    case IN_PREFETCH_THREADS:
+    case IN_RECORD_FD:
+    case IN_REAP_THRESHOLD:
+    case IN_RESCAN_THREADS:
+    case IN_RESCAN_ASYNC:
         /* Or pass per-instance parameters to workers */
         if (!is_opened (fd)) {
             return -1;	/* errno = EBADF */
@@ -257,48 +270,254 @@ libinotify_set_param (int fd, int param, intptr_t value)
     return -1;
 }
 
-int libinotify_direct_readv (int fd, struct iovec **events, int size, int no_block)
+/**
+ * Get statistics of inotify instance.
+ *
+ * @param[in]  fd    Inotify instance file descriptor.
+ * @param[out] stats A pointer to statistics buffer to fill.
+ * @return 0 on success, -1 on failure.
+ **/
+int
+libinotify_get_stats (int fd, struct libinotify_stats *stats)
 {
-    int nevents;
-    struct timespec timeout = {0};
-    struct kevent received[size];
+    struct worker_cmd cmd;
 
-    do {
-        nevents = kevent (fd, NULL, 0, received, size, no_block ? &timeout : NULL);
-    } while (nevents < 0 && !no_block && errno == EINTR);
+    if (stats == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (!is_opened (fd)) {
+        return -1;	/* errno = EBADF */
+    }
+
+    worker_cmd_stats (&cmd, stats);
+    return worker_exec (fd, &cmd);
+}
 
-    if (nevents == -1) {
-        perror_msg (("libinotify_direct_drain failed"));
+/**
+ * Set or reset subfile name filter of a watch.
+ *
+ * @param[in] fd      Inotify instance file descriptor.
+ * @param[in] wd      Watch id.
+ * @param[in] pattern A fnmatch(3) pattern or NULL to remove all filters.
+ * @param[in] type    IN_FILTER_INCLUDE or IN_FILTER_EXCLUDE.
+ * @return 0 on success, -1 on failure.
+ **/
+int
+libinotify_set_filter (int fd, int wd, const char *pattern, int type)
+{
+    struct worker_cmd cmd;
+
+    if (wd < 0 || (pattern != NULL &&
+        type != IN_FILTER_INCLUDE && type != IN_FILTER_EXCLUDE)) {
+        errno = EINVAL;
         return -1;
     }
 
-    for (int i = 0; i < nevents; i++) {
-#ifdef __DragonFly__
-        /* DragonflyBSD does not copy udata */
-        events[i] = (struct iovec *)(intptr_t)received[i].data;
-#else
-        events[i] = (struct iovec *)received[i].udata;
-#endif
+    if (!is_opened (fd)) {
+        return -1;	/* errno = EBADF */
     }
 
-    return nevents;
+    worker_cmd_filter (&cmd, wd, pattern, type);
+    return worker_exec (fd, &cmd);
 }
 
-void libinotify_free_iovec (struct iovec *events)
+/**
+ * Get snapshot of directory entries of a watch.
+ *
+ * @param[in] fd  Inotify instance file descriptor.
+ * @param[in] wd  Watch id.
+ * @param[in] buf A buffer to store #libinotify_dirent records to.
+ * @param[in] len Size of the buffer.
+ * @return Size of the snapshot in bytes on success, -1 on failure.
+ *     Nothing is stored if it is greater than len.
+ **/
+ssize_t
+libinotify_snapshot (int fd, int wd, void *buf, size_t len)
+{
+    struct worker_cmd cmd;
+    size_t size;
+
+    if (wd < 0 || (buf == NULL && len != 0)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (!is_opened (fd)) {
+        return -1;	/* errno = EBADF */
+    }
+
+    worker_cmd_snapshot (&cmd, wd, buf, len, &size);
+    if (worker_exec (fd, &cmd) == -1) {
+        return -1;
+    }
+    return size;
+}
+
+/**
+ * Get a block of events from shared memory event ring.
+ *
+ * @param[in]  fd     Inotify instance file descriptor.
+ * @param[out] events A pointer to the first event of the block.
+ * @return Length of the block in bytes, 0 if no events available,
+ *     -1 on failure.
+ **/
+int
+libinotify_ring_peek (int fd, const struct inotify_event **events)
+{
+    struct worker *wrk;
+    int retval;
+
+    if (events == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    wrk = worker_lookup (fd);
+    if (wrk == NULL) {
+        return -1;
+    }
+
+    retval = worker_ring_peek (wrk, events);
+    worker_unref (wrk);
+    return retval;
+}
+
+/**
+ * Release events obtained with libinotify_ring_peek().
+ *
+ * @param[in] fd  Inotify instance file descriptor.
+ * @param[in] len Number of bytes to release.
+ * @return 0 on success, -1 on failure.
+ **/
+int
+libinotify_ring_release (int fd, int len)
 {
-    struct iovec *start = events;
+    struct worker *wrk;
+    int retval;
 
-    if (!events)
-        return;
+    if (len < 0) {
+        errno = EINVAL;
+        return -1;
+    }
 
-    while (events->iov_base) {
-        free (events->iov_base);
-        events++;
+    wrk = worker_lookup (fd);
+    if (wrk == NULL) {
+        return -1;
     }
 
-    free(start);
+    retval = worker_ring_release (wrk, len);
+    worker_unref (wrk);
+    return retval;
+}
+
+/**
+ * Wait for or consume pending notification of direct mode instance.
+ *
+ * @param[in] fd    Inotify instance file descriptor.
+ * @param[in] block Wait for notification if true.
+ * @return 1 if notification has been consumed, 0 if none pending,
+ *     -1 on failure.
+ **/
+static int
+direct_wait (int fd, bool block)
+{
+    struct timespec timeout = {0};
+    struct kevent received;
+    int pending;
+
+    do {
+        pending = kevent (fd, NULL, 0, &received, 1, block ? NULL : &timeout);
+    } while (pending < 0 && block && errno == EINTR);
+
+    if (pending == -1) {
+        perror_msg (("Waiting for direct mode events failed"));
+    }
+    return pending;
+}
+
+int libinotify_direct_readv (int fd, struct iovec **events, int size, int no_block)
+{
+    struct worker *wrk;
+    int nevents, pending;
+
+    for (;;) {
+        /* Consume pending notification. It is reposted if blocks remain */
+        pending = direct_wait (fd, false);
+        if (pending == -1) {
+            return -1;
+        }
+
+        wrk = worker_lookup (fd);
+        if (wrk == NULL) {
+            return -1;
+        }
+        nevents = worker_direct_pop (wrk, events, size);
+        worker_unref (wrk);
+
+        /* Do not block if caller has been told that fd is readable */
+        if (nevents != 0 || no_block || pending > 0) {
+            return nevents;
+        }
+
+        if (direct_wait (fd, true) == -1) {
+            return -1;
+        }
+    }
 }
 
+/**
+ * Read events of direct mode instance into a caller-supplied buffer.
+ *
+ * @param[in]  fd       Inotify instance file descriptor.
+ * @param[out] buf      A buffer to store events to.
+ * @param[in]  len      Size of the buffer.
+ * @param[in]  no_block Do not wait for events if none available.
+ * @return Number of bytes stored on success, -1 on failure.
+ **/
+ssize_t
+libinotify_direct_read (int fd, void *buf, size_t len, int no_block)
+{
+    struct worker *wrk;
+    ssize_t size;
+    int pending;
+
+    if (buf == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    for (;;) {
+        /* Consume pending notification. It is reposted if events remain */
+        pending = direct_wait (fd, false);
+        if (pending == -1) {
+            return -1;
+        }
+
+        wrk = worker_lookup (fd);
+        if (wrk == NULL) {
+            return -1;
+        }
+        size = worker_direct_read (wrk, buf, len);
+        worker_unref (wrk);
+
+        /* Do not block if caller has been told that fd is readable */
+        if (size != 0 || no_block || pending > 0) {
+            return size;
+        }
+
+        if (direct_wait (fd, true) == -1) {
+            return -1;
+        }
+    }
+}
+
+void libinotify_free_iovec (struct iovec *events)
+{
+    /* Events are allocated together with iovec array */
+    free (events);
+}
 int libinotify_direct_close (int fd)
 {
     struct worker_cmd cmd;
@@ -326,6 +545,34 @@ worker_erase (struct worker *wrk)
     workerset_unlock ();
 }
 
+/**
+ * Find a worker by inotify instance descriptor and hold a reference on it.
+ * Reference prevents worker memory from being freed and should be dropped
+ * with worker_unref().
+ *
+ * @param[in] fd Inotify instance file descriptor.
+ * @return A pointer to #worker on success, NULL on failure with errno set.
+ **/
+static struct worker *
+worker_lookup (int fd)
+{
+    struct worker *wrk;
+
+    workerset_rlock ();
+    SLIST_FOREACH (wrk, &workers, next) {
+        if (wrk->io[INOTIFY_FD] == fd) {
+            worker_ref (wrk);
+            break;
+        }
+    }
+    workerset_unlock ();
+
+    if (wrk == NULL) {
+        errno = EINVAL;
+    }
+    return wrk;
+}
+
 /**
  * Execute command in context of working thread.
  *
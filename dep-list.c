@@ -36,17 +36,25 @@
 #include "dep-list.h"
 #include "utils.h"
 
-static inline void di_free (struct dep_item *di);
-static int dep_item_cmp (struct dep_item *di1, struct dep_item *di2);
+static inline void di_free (struct dep_list *dl, struct dep_item *di);
+static int dep_item_cmp (const struct dep_item *di,
+                         const char *path,
+                         uint32_t hash);
 
-RB_GENERATE_INSERT_COLOR(dep_list, dep_item, u.tree_link, static)
-RB_GENERATE_REMOVE_COLOR(dep_list, dep_item, u.tree_link, static)
-RB_GENERATE_INSERT(dep_list, dep_item, u.tree_link, dep_item_cmp, static)
-RB_GENERATE_REMOVE(dep_list, dep_item, u.tree_link, static)
-RB_GENERATE_FIND(dep_list, dep_item, u.tree_link, dep_item_cmp, static)
+/*
+ * Chunk of dependency list item pool. Items are allocated sequentially and
+ * the chunk is freed when all its items are freed, so directory listings
+ * occupy contiguous memory without per-item allocator overhead.
+ */
+struct dl_chunk {
+    uint32_t size;  /* chunk size in bytes */
+    uint32_t used;  /* number of bytes allocated */
+    uint32_t live;  /* number of allocated items not yet freed */
+    uint32_t pad;
+};
 
 /**
- * Initialize a rb-tree based list.
+ * Initialize a list.
  *
  * @param[in] dl A pointer to a list.
  **/
@@ -54,7 +62,138 @@ void
 dl_init (struct dep_list* dl)
 {
     assert (dl != NULL);
-    RB_INIT (dl);
+    memset (dl, 0, sizeof (struct dep_list));
+}
+
+/**
+ * Calculate hash of a file name (32-bit FNV-1a).
+ *
+ * @param[in] path A name of a file.
+ * @return A hash value.
+ **/
+static inline uint32_t
+dl_hash (const char *path)
+{
+    uint32_t hash = 2166136261U;
+
+    while (*path != '\0') {
+        hash ^= (unsigned char)*path++;
+        hash *= 16777619U;
+    }
+    return hash;
+}
+
+/**
+ * Find position of item pool chunk in the sorted chunk array.
+ *
+ * @param[in] dl  A pointer to a list.
+ * @param[in] ptr An address to look for.
+ * @return A number of chunks starting at or below given address.
+ **/
+static size_t
+dl_chunk_pos (struct dep_list *dl, const void *ptr)
+{
+    size_t lo = 0, hi = dl->nchunks, mid;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if ((uintptr_t)dl->chunks[mid] <= (uintptr_t)ptr) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/**
+ * Return memory of an item pool chunk to the system.
+ *
+ * @param[in] dl A pointer to a list.
+ * @param[in] ch A pointer to a chunk. Must not have live items.
+ **/
+static void
+dl_chunk_free (struct dep_list *dl, struct dl_chunk *ch)
+{
+    size_t pos = dl_chunk_pos (dl, ch) - 1;
+
+    assert (ch->live == 0);
+    assert (dl->chunks[pos] == ch);
+
+    memmove (&dl->chunks[pos],
+             &dl->chunks[pos + 1],
+             (dl->nchunks - pos - 1) * sizeof (struct dl_chunk *));
+    --dl->nchunks;
+    free (ch);
+}
+
+/**
+ * Allocate memory for a list item from the item pool of a list.
+ *
+ * @param[in] dl   A pointer to a list.
+ * @param[in] size A size of the item.
+ * @return A pointer to allocated memory or NULL in the case of error.
+ **/
+static struct dep_item*
+dl_alloc (struct dep_list *dl, size_t size)
+{
+    struct dl_chunk *ch = dl->chunk;
+    struct dl_chunk **chunks;
+    struct dep_item *di;
+    size_t chunk_size, pos;
+
+    size = (size + 7) & ~(size_t)7;
+
+    if (ch != NULL && ch->live == 0) {
+        /* Reuse emptied chunk */
+        ch->used = sizeof (struct dl_chunk);
+    }
+
+    if (ch == NULL || ch->used + size > ch->size) {
+        /* Size new chunk to be proportional to the list */
+        chunk_size = DL_CHUNK_MIN;
+        while (chunk_size < DL_CHUNK_MAX && chunk_size < dl->pooled * size) {
+            chunk_size *= 2;
+        }
+        if (chunk_size < sizeof (struct dl_chunk) + size) {
+            chunk_size = sizeof (struct dl_chunk) + size;
+        }
+
+        chunks = realloc (dl->chunks,
+                          (dl->nchunks + 1) * sizeof (struct dl_chunk *));
+        if (chunks == NULL) {
+            return NULL;
+        }
+        dl->chunks = chunks;
+
+        ch = malloc (chunk_size);
+        if (ch == NULL) {
+            return NULL;
+        }
+        ch->size = chunk_size;
+        ch->used = sizeof (struct dl_chunk);
+        ch->live = 0;
+
+        pos = dl_chunk_pos (dl, ch);
+        memmove (&dl->chunks[pos + 1],
+                 &dl->chunks[pos],
+                 (dl->nchunks - pos) * sizeof (struct dl_chunk *));
+        dl->chunks[pos] = ch;
+        ++dl->nchunks;
+
+        /* Previous chunk is freed with the last of its items */
+        if (dl->chunk != NULL && dl->chunk->live == 0) {
+            dl_chunk_free (dl, dl->chunk);
+        }
+        dl->chunk = ch;
+    }
+
+    di = (struct dep_item *)((char *)ch + ch->used);
+    ch->used += size;
+    ++ch->live;
+    ++dl->pooled;
+
+    return di;
 }
 
 /**
@@ -62,72 +201,82 @@ dl_init (struct dep_list* dl)
  *
  * Create a new list item and initialize its fields.
  *
- * @param[in] path  A name of a file (the string is not copied!).
+ * @param[in] dl    A pointer to a list which pool the item is allocated from.
+ * @param[in] path  A name of a file.
+ * @param[in] hash  A hash of the name.
  * @param[in] inode A file's inode number.
  * @param[in] type  A file`s type (compatible with mode_t values)
  * @return A pointer to a new item or NULL in the case of error.
  **/
 static inline struct dep_item*
-di_create (const char *path, ino_t inode, mode_t type)
+di_create (struct dep_list *dl,
+           const char *path,
+           uint32_t hash,
+           ino_t inode,
+           mode_t type)
 {
     size_t pathlen = strlen (path) + 1;
 
-    struct dep_item *di = calloc (1, offsetof (struct dep_item, path) + pathlen);
+    struct dep_item *di = dl_alloc (dl, offsetof (struct dep_item, path) + pathlen);
     if (di == NULL) {
         perror_msg (("Failed to create a new dep-list item"));
         return NULL;
     }
 
-    strlcpy (di->path, path, pathlen);
+    memcpy (di->path, path, pathlen);
     di->inode = inode;
+    di->hash = hash;
     di->type = type;
     return di;
 }
 
 /**
- * Insert new item into list.
+ * Free the memory allocated for a list item.
  *
- * @param[in] dl A pointer to a list.
- * @param[in] di A pointer to a list item to be inserted.
+ * This function will return the memory used by a list item to the pool.
+ *
+ * @param[in] dl A pointer to a list which pool the item is allocated from.
+ * @param[in] di A pointer to a list item.
  **/
 static inline void
-dl_insert (struct dep_list* dl, struct dep_item* di)
+di_free (struct dep_list *dl, struct dep_item *di)
 {
-    assert (dl != NULL);
-    assert (di != NULL);
-    assert (RB_FIND (dep_list, dl, di) == NULL);
+    struct dl_chunk *ch = dl->chunks[dl_chunk_pos (dl, di) - 1];
 
-    RB_INSERT (dep_list, dl, di);
+    assert (ch->live > 0);
+    assert (dl->pooled > 0);
+
+    --dl->pooled;
+    if (--ch->live == 0 && ch != dl->chunk) {
+        dl_chunk_free (dl, ch);
+    }
 }
 
 /**
- * Remove specified item from a list.
+ * Make sure that a list can hold specified number of items.
  *
- * @param[in] dl A pointer to a list.
- * @param[in] di A pointer to a list item to remove.
+ * @param[in] dl    A pointer to a list.
+ * @param[in] count A number of items.
+ * @return 0 on success, -1 otherwise.
  **/
-static inline void
-dl_remove (struct dep_list* dl, struct dep_item* di)
+static int
+dl_reserve (struct dep_list *dl, size_t count)
 {
-    assert (dl != NULL);
-    assert (di != NULL);
-    assert (RB_FIND (dep_list, dl, di) != NULL);
+    struct dep_item **items;
+    size_t allocated;
 
-    RB_REMOVE (dep_list, dl, di);
-    di_free (di);
-}
+    if (count <= dl->allocated) {
+        return 0;
+    }
 
-/**
- * Free the memory allocated for a list item.
- *
- * This function will free the memory used by a list item.
- *
- * @param[in] dn A pointer to a list item. May be NULL.
- **/
-static inline void
-di_free (struct dep_item *di)
-{
-    free (di);
+    allocated = count + count / 8;
+    items = realloc (dl->items, allocated * sizeof (struct dep_item *));
+    if (items == NULL) {
+        return -1;
+    }
+    dl->items = items;
+    dl->allocated = allocated;
+    return 0;
 }
 
 /**
@@ -140,39 +289,85 @@ di_free (struct dep_item *di)
 void
 dl_free (struct dep_list *dl)
 {
-    struct dep_item *di;
+    size_t i;
 
     assert (dl != NULL);
 
-    while (!RB_EMPTY (dl)) {
-        di = RB_MIN (dep_list, dl);
-        dl_remove (dl, di);
+    for (i = 0; i < dl->nchunks; i++) {
+        free (dl->chunks[i]);
     }
+    free (dl->chunks);
+    free (dl->items);
+    dl_init (dl);
 }
 
 /**
- * Merge linked list based source directory listing into
- * target directory listing.
+ * Compare two change list items by name hash and name.
+ *
+ * @param[in] p1 A pointer to a first #chg_item.
+ * @param[in] p2 A pointer to a second #chg_item.
+ * @return An -1, 0, or +1 as for qsort().
+ **/
+static int
+chg_item_cmp (const void *p1, const void *p2)
+{
+    const struct dep_item *di1 = ((const struct chg_item *)p1)->di;
+    const struct dep_item *di2 = ((const struct chg_item *)p2)->di;
+
+    return dep_item_cmp (di1, di2->path, di2->hash);
+}
+
+/**
+ * Merge array based source directory listing into target directory listing.
+ * Source items must be allocated from the target list pool.
  *
  * This function will free all the memory used by a source list: both
  * list structure and the list data.
  *
  * @param[in] dl_target A pointer to a target list.
- * @param[in] dl_source A pointer to a source list (linked list based).
+ * @param[in] dl_source A pointer to a source list (array based).
  **/
 void
 dl_join (struct dep_list *dl_target, struct chg_list *dl_source)
 {
     struct dep_item *di;
+    size_t i, j, k;
 
     assert (dl_target != NULL);
     assert (dl_source != NULL);
 
-    while (!SLIST_EMPTY (dl_source)) {
-        di = SLIST_FIRST (dl_source);
-        SLIST_REMOVE_HEAD (dl_source, u.s.list_link);
-        dl_insert (dl_target, di);
+    /* Space is normally reserved by listing so this can not fail */
+    if (dl_reserve (dl_target, dl_target->count + dl_source->count) == -1) {
+        perror_msg (("Failed to grow list during join"));
+        for (i = 0; i < dl_source->count; i++) {
+            di_free (dl_target, dl_source->items[i].di);
+        }
+        goto out;
+    }
+
+    qsort (dl_source->items,
+           dl_source->count,
+           sizeof (struct chg_item),
+           chg_item_cmp);
+
+    /* Merge sorted arrays starting from the tail */
+    i = dl_target->count;
+    j = dl_source->count;
+    k = i + j;
+    while (j > 0) {
+        di = dl_source->items[j - 1].di;
+        if (i > 0 &&
+            dep_item_cmp (dl_target->items[i - 1], di->path, di->hash) > 0) {
+            dl_target->items[--k] = dl_target->items[--i];
+        } else {
+            dl_target->items[--k] = di;
+            --j;
+        }
     }
+    dl_target->count += dl_source->count;
+
+out:
+    free (dl_source->items);
     free (dl_source);
 }
 
@@ -184,13 +379,63 @@ dl_join (struct dep_list *dl_target, struct chg_list *dl_source)
 static inline void
 dl_clearflags (struct dep_list *dl)
 {
-    struct dep_item *di;
+    size_t i;
 
     assert (dl != NULL);
 
-    DL_FOREACH (di, dl) {
-        di->type &= S_IFMT;
+    for (i = 0; i < dl->count; i++) {
+        dl->items[i]->type &= S_IFMT;
+    }
+}
+
+/*
+ * Find position of dependency list item by filename and its hash.
+ *
+ * @param[in]  dl    A pointer to a list.
+ * @param[in]  path  A name of a file.
+ * @param[in]  hash  A hash of the name.
+ * @param[out] pos   A position of the item or of the first item greater.
+ * @return true if item is found, false otherwise.
+ */
+static bool
+dl_search (struct dep_list *dl, const char *path, uint32_t hash, size_t *pos)
+{
+    size_t lo = 0, hi = dl->count, mid;
+    int cmp;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        cmp = dep_item_cmp (dl->items[mid], path, hash);
+        if (cmp < 0) {
+            lo = mid + 1;
+        } else if (cmp > 0) {
+            hi = mid;
+        } else {
+            *pos = mid;
+            return true;
+        }
     }
+    *pos = lo;
+    return false;
+}
+
+/*
+ * Find dependency list item by filename and its hash.
+ *
+ * @param[in] dl    A pointer to a list.
+ * @param[in] path  A name of a file.
+ * @param[in] hash  A hash of the name.
+ * @return A pointer to a dep_item if item is found, NULL otherwise.
+ */
+static struct dep_item*
+dl_find_hashed (struct dep_list *dl, const char *path, uint32_t hash)
+{
+    size_t pos;
+
+    assert (dl != NULL);
+    assert (path != NULL);
+
+    return dl_search (dl, path, hash, &pos) ? dl->items[pos] : NULL;
 }
 
 /*
@@ -203,24 +448,69 @@ dl_clearflags (struct dep_list *dl)
 struct dep_item*
 dl_find (struct dep_list *dl, const char *path)
 {
-    struct dep_item find;
+    assert (path != NULL);
+
+    return dl_find_hashed (dl, path, dl_hash (path));
+}
+
+/*
+ * Find position of dependency list item by filename.
+ *
+ * @param[in] dl    A pointer to a list.
+ * @param[in] path  A name of a file.
+ * @return An index of the item or of the first item which would follow it.
+ */
+size_t
+dl_position (struct dep_list *dl, const char *path)
+{
+    size_t pos;
 
     assert (dl != NULL);
     assert (path != NULL);
 
-    find.type = DI_EXT_PATH;
-    find.u.ext_path = path;
+    dl_search (dl, path, dl_hash (path), &pos);
+    return pos;
+}
+
+/**
+ * Append an item to a change list.
+ *
+ * @param[in] cl       A pointer to a change list.
+ * @param[in] di       A pointer to a new item.
+ * @param[in] replacee A pointer to an item overwritten by the new one or NULL.
+ * @return 0 on success, -1 otherwise.
+ **/
+static int
+cl_append (struct chg_list *cl, struct dep_item *di, struct dep_item *replacee)
+{
+    struct chg_item *items;
+    size_t allocated;
+
+    if (cl->count == cl->allocated) {
+        allocated = cl->allocated == 0 ? 16 : cl->allocated * 2;
+        items = realloc (cl->items, allocated * sizeof (struct chg_item));
+        if (items == NULL) {
+            return -1;
+        }
+        cl->items = items;
+        cl->allocated = allocated;
+    }
 
-    return (RB_FIND (dep_list, dl, &find));
+    cl->items[cl->count].di = di;
+    cl->items[cl->count].replacee = replacee;
+    cl->items[cl->count].moved_from = NULL;
+    ++cl->count;
+    return 0;
 }
 
 /**
- * Create a directory listing from DIR stream and return it as a linked list.
+ * Create a directory listing from DIR stream and return it as an array.
  *
  * @param[in] dir    A pointer to valid directory stream created with opendir().
- * @param[in] before A pointer to previous directory listing. If nonNULL value
- *                   is specified, unchanged entries are not included in
- *                   resulting list but marked as unchanged in before list.
+ * @param[in] before A pointer to previous directory listing. Unchanged
+ *                   entries are not included in resulting list but marked
+ *                   as unchanged in before list. New items are allocated
+ *                   from its pool.
  * @return A pointer to a list. May return NULL, check errno in this case.
  **/
 struct chg_list*
@@ -230,15 +520,16 @@ dl_readdir (DIR *dir, struct dep_list* before)
     struct dep_item *item, *before_item;
     struct chg_list *head;
     mode_t type;
+    uint32_t hash;
 
     assert (dir != NULL);
+    assert (before != NULL);
 
-    head = calloc (1, sizeof (struct dep_list));
+    head = calloc (1, sizeof (struct chg_list));
     if (head == NULL) {
         perror_msg (("Failed to allocate list during directory listing"));
         return NULL;
     }
-    SLIST_INIT (head);
 
     while ((ent = readdir (dir)) != NULL) {
         if (!strcmp (ent->d_name, ".") || !strcmp (ent->d_name, "..")) {
@@ -258,16 +549,14 @@ dl_readdir (DIR *dir, struct dep_list* before)
          * The same items will be marked as UNCHANGED in previous list and
          * missed in returned set. Items are compared by name and inode number.
          */
-        before_item = NULL;
-        if (before != NULL) {
-            before_item = dl_find (before, ent->d_name);
-            if (before_item != NULL && before_item->inode == ent->d_ino) {
-                before_item->type |= DI_UNCHANGED;
-                continue;
-            }
+        hash = dl_hash (ent->d_name);
+        before_item = dl_find_hashed (before, ent->d_name, hash);
+        if (before_item != NULL && before_item->inode == ent->d_ino) {
+            before_item->type |= DI_UNCHANGED;
+            continue;
         }
 
-        item = di_create (ent->d_name, ent->d_ino, type);
+        item = di_create (before, ent->d_name, hash, ent->d_ino, type);
         if (item == NULL) {
             perror_msg (("Failed to allocate a new item during listing"));
             goto error;
@@ -276,23 +565,24 @@ dl_readdir (DIR *dir, struct dep_list* before)
         /* File was overwritten between scans. Cache reference on old entry. */
         if (before_item != NULL) {
             item->type |= DI_READDED;
-            item->u.s.replacee = before_item;
         }
 
-        SLIST_INSERT_HEAD (head, item, u.s.list_link);
+        if (cl_append (head, item, before_item) == -1) {
+            perror_msg (("Failed to grow list during directory listing"));
+            di_free (before, item);
+            goto error;
+        }
+    }
+
+    /* Reserve space to merge the listing with previous one */
+    if (dl_reserve (before, before->count + head->count) == -1) {
+        perror_msg (("Failed to grow list during directory listing"));
+        goto error;
     }
     return head;
 
 error:
-    if (before != NULL) {
-        dl_clearflags (before);
-    }
-    while (!SLIST_EMPTY (head)) {
-        item = SLIST_FIRST (head);
-        SLIST_REMOVE_HEAD (head, u.s.list_link);
-        di_free (item);
-    }
-    free (head);
+    dl_discard (before, head);
     return NULL;
 }
 
@@ -315,7 +605,6 @@ dl_listing (int fd, struct dep_list* before)
             /* ENOENT is skipped as the directory could be just deleted */
             head = calloc (1, sizeof (struct chg_list));
             if (head != NULL) {
-                SLIST_INIT (head);
                 return (head);
             }
             perror_msg (("Failed to allocate list during directory listing"));
@@ -335,6 +624,29 @@ dl_listing (int fd, struct dep_list* before)
     return head;
 }
 
+/**
+ * Discard a directory listing which has not been passed to dl_calculate().
+ * Previous directory contents are left intact.
+ *
+ * @param[in] before The previous contents of the directory.
+ * @param[in] after  The listing made against previous contents.
+ **/
+void
+dl_discard (struct dep_list *before, struct chg_list *after)
+{
+    size_t i;
+
+    assert (before != NULL);
+    assert (after != NULL);
+
+    dl_clearflags (before);
+    for (i = 0; i < after->count; i++) {
+        di_free (before, after->items[i].di);
+    }
+    free (after->items);
+    free (after);
+}
+
 
 /**
  * Recognize all the changes in the directory, invoke the appropriate callbacks.
@@ -353,8 +665,9 @@ dl_calculate (struct dep_list           *before,
               const struct traverse_cbs *cbs,
               void                      *udata)
 {
-    struct dep_item *di_from, *di_to, *tmp;
-    size_t n_moves = 0;
+    struct dep_item *di_from;
+    struct chg_item *ci_to;
+    size_t n_moves = 0, i, j;
 
     assert (before != NULL);
     assert (cbs != NULL);
@@ -371,24 +684,25 @@ dl_calculate (struct dep_list           *before,
      *             moved and then overwrote other file.
      */
     if (after != NULL) {
-        DL_FOREACH (di_from, before) {
+        for (i = 0; i < before->count; i++) {
+            di_from = before->items[i];
             /* Skip unchanged files. They do not produce any events. */
             if (di_from->type & DI_UNCHANGED) {
                 continue;
             }
 
             /* Detect and notify about moves in the watched directory. */
-            CL_FOREACH (di_to, after) {
-                if (di_from->inode == di_to->inode &&
-                    !(di_to->type & DI_MOVED)) {
+            CL_FOREACH (ci_to, after) {
+                if (di_from->inode == ci_to->di->inode &&
+                    !(ci_to->di->type & DI_MOVED)) {
                     /* Detect replacements in the watched directory */
-                    if (di_to->type & DI_READDED) {
-                        di_to->u.s.replacee->type |= DI_REPLACED;
+                    if (ci_to->di->type & DI_READDED) {
+                        ci_to->replacee->type |= DI_REPLACED;
                     }
 
                     /* Now we can mark item as moved in the watched directory */
-                    di_to->type |= DI_MOVED;
-                    di_to->u.s.moved_from = di_from;
+                    ci_to->di->type |= DI_MOVED;
+                    ci_to->moved_from = di_from;
                     di_from->type |= DI_MOVED;
                     ++n_moves;
                     break;
@@ -409,7 +723,8 @@ dl_calculate (struct dep_list           *before,
      * 3. Notify about all created files.
      */
     /* Notify about files that have been deleted or replaced */
-    DL_FOREACH (di_from, before) {
+    for (i = 0; i < before->count; i++) {
+        di_from = before->items[i];
         if (!(di_from->type & (DI_UNCHANGED | DI_MOVED))) {
             if (di_from->type & DI_REPLACED) {
                 cbs->replaced (udata, di_from);
@@ -434,16 +749,16 @@ dl_calculate (struct dep_list           *before,
         bool want_overlap = false;
         while (n_moves > 0) {
             size_t n_moves_prev = n_moves;
-            CL_FOREACH (di_to, after) {
-                bool is_overlap = di_to->type & DI_READDED &&
-                                  di_to->u.s.replacee->type & DI_MOVED;
-                if (di_to->type & DI_MOVED && di_to->u.s.moved_from != NULL &&
+            CL_FOREACH (ci_to, after) {
+                bool is_overlap = ci_to->di->type & DI_READDED &&
+                                  ci_to->replacee->type & DI_MOVED;
+                if (ci_to->di->type & DI_MOVED && ci_to->moved_from != NULL &&
                     (is_overlap == want_overlap)) {
-                    cbs->moved (udata, di_to->u.s.moved_from, di_to);
+                    cbs->moved (udata, ci_to->moved_from, ci_to->di);
 
                     /* Mark file as not participating in moves */
-                    di_to->u.s.moved_from->type &= ~DI_MOVED;
-                    di_to->u.s.moved_from = NULL;
+                    ci_to->moved_from->type &= ~DI_MOVED;
+                    ci_to->moved_from = NULL;
 
                     want_overlap = false;
                     --n_moves;
@@ -460,39 +775,61 @@ dl_calculate (struct dep_list           *before,
             }
         }
         /* Notify about newly created files */
-        CL_FOREACH (di_to, after) {
-            if (!(di_to->type & DI_MOVED)) {
-                cbs->added (udata, di_to);
+        CL_FOREACH (ci_to, after) {
+            if (!(ci_to->di->type & DI_MOVED)) {
+                cbs->added (udata, ci_to->di);
             }
         }
     }
 
     /* Replace all changed items from before list with items from after list */
-    DL_FOREACH_SAFE (di_from, before, tmp) {
-        if (!(di_from->type & DI_UNCHANGED)) {
-            dl_remove (before, di_from);
+    for (i = j = 0; i < before->count; i++) {
+        di_from = before->items[i];
+        if (di_from->type & DI_UNCHANGED) {
+            before->items[j++] = di_from;
+        } else {
+            di_free (before, di_from);
         }
     }
+    before->count = j;
     if (after != NULL) {
         dl_join (before, after);
     }
     dl_clearflags (before);
+
+    /* Return memory to the system if directory has shrunk considerably */
+    if (before->allocated > DL_CHUNK_MIN && before->count < before->allocated / 4) {
+        size_t allocated = before->count + before->count / 8;
+        struct dep_item **items;
+
+        /* Never shrink to zero size which realloc() may treat as free() */
+        if (allocated < DL_CHUNK_MIN) {
+            allocated = DL_CHUNK_MIN;
+        }
+        items = realloc (before->items, allocated * sizeof (struct dep_item *));
+        if (items != NULL) {
+            before->items = items;
+            before->allocated = allocated;
+        }
+    }
 }
 
 /**
- * Custom comparison function that can compare directory dependency list
- * entries through pointers passed by RB tree functions
+ * Compare directory dependency list entry with a name.
  *
- * @param[in] di1 A pointer to a first deplist item to compare
- * @param[in] di2 A pointer to a second deplist item to compare
- * @return An -1, 0, or +1 if the first inode is considered to be respectively
- *     less than, equal to, or greater than the second one.
+ * @param[in] di   A pointer to a deplist item to compare
+ * @param[in] path A name to compare with
+ * @param[in] hash A hash of the name
+ * @return An -1, 0, or +1 if the item is considered to be respectively
+ *     less than, equal to, or greater than the name.
  **/
 static int
-dep_item_cmp (struct dep_item *di1, struct dep_item *di2)
+dep_item_cmp (const struct dep_item *di, const char *path, uint32_t hash)
 {
-    const char *path1 = (di1->type == DI_EXT_PATH) ? di1->u.ext_path : di1->path;
-    const char *path2 = (di2->type == DI_EXT_PATH) ? di2->u.ext_path : di2->path;
+    /* Compare names only on hash collisions */
+    if (di->hash != hash) {
+        return ((di->hash > hash) - (di->hash < hash));
+    }
 
-    return strcmp (path1, path2);
+    return strcmp (di->path, path);
 }
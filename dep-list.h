@@ -26,7 +26,6 @@
 #define __DEP_LIST_H__
 
 #include <sys/types.h> /* ino_t */
-#include <sys/queue.h> /* SLIST */
 #include <sys/stat.h>  /* mode_t */
 
 #include "compat.h"
@@ -36,35 +35,56 @@
 #define DI_REPLACED  S_IROTH /* dep_item was replaced by other item */
 #define DI_READDED   DI_REPLACED /* dep_item replaced other item */
 #define DI_MOVED     S_IWOTH /* dep_item was renamed between listings */
-#define DI_EXT_PATH  S_IRWXO /* special dep_item intended for search only */
 
 #define DI_PARENT    NULL    /* Faked dependency item for parent watch */
 
 #define S_IFUNK 0000000 /* mode_t extension. File type is unknown */
 #define S_ISUNK(m) (((m) & S_IFMT) == S_IFUNK)
 
-#define CL_FOREACH(di, dl) SLIST_FOREACH ((di), (dl), u.s.list_link)
-#define DL_FOREACH(di, dl) RB_FOREACH ((di), dep_list, (dl))
-#define DL_FOREACH_SAFE(di, dl, tmp_di) \
-    RB_FOREACH_SAFE ((di), dep_list, (dl), (tmp_di))
+#define CL_FOREACH(ci, cl) \
+    for ((ci) = (cl)->items; (ci) < (cl)->items + (cl)->count; ++(ci))
+#define DL_FOREACH(di, dl, i) \
+    for ((i) = 0; (i) < (dl)->count && ((di) = (dl)->items[(i)], 1); ++(i))
+
+/* Item pool chunk size limits. Chunks grow with number of items in list */
+#define DL_CHUNK_MIN 256
+#define DL_CHUNK_MAX 65536
+
+struct dl_chunk;
 
 struct dep_item {
-    union {
-        RB_ENTRY(dep_item) tree_link;
-        struct {
-            SLIST_ENTRY(dep_item) list_link;
-            struct dep_item *replacee;
-            struct dep_item *moved_from;
-        } s;
-        const char *ext_path;
-    } u;
     ino_t inode;
+    uint32_t hash; /* name hash. Items are ordered by hash first */
     mode_t type;
     char path[FLEXIBLE_ARRAY_MEMBER];
 };
 
-RB_HEAD(dep_list, dep_item);
-SLIST_HEAD(chg_list, dep_item);
+/*
+ * Directory listing. Items are kept in array of pointers sorted by name hash
+ * and name and are allocated from the list own item pool.
+ */
+struct dep_list {
+    struct dep_item **items;  /* sorted array of items */
+    size_t count;             /* number of items in the list */
+    size_t allocated;         /* number of allocated array slots */
+    struct dl_chunk **chunks; /* item pool chunks sorted by address */
+    size_t nchunks;           /* number of item pool chunks */
+    struct dl_chunk *chunk;   /* pool chunk new items are allocated from */
+    size_t pooled;            /* number of items allocated from the pool */
+};
+
+/* Directory changes produced by listing. Unsorted */
+struct chg_item {
+    struct dep_item *di;
+    struct dep_item *replacee;   /* item of previous listing overwritten */
+    struct dep_item *moved_from; /* item of previous listing renamed */
+};
+
+struct chg_list {
+    struct chg_item *items;
+    size_t count;
+    size_t allocated;
+};
 
 typedef void (* single_entry_cb) (void *udata, struct dep_item *di);
 typedef void (* dual_entry_cb)   (void *udata,
@@ -83,8 +103,10 @@ void             dl_free    (struct dep_list *dl);
 void             dl_join    (struct dep_list *dl_target,
                              struct chg_list *dl_source);
 struct dep_item* dl_find    (struct dep_list *dl, const char *path);
+size_t           dl_position (struct dep_list *dl, const char *path);
 struct chg_list* dl_readdir (DIR *dir, struct dep_list *before);
 struct chg_list* dl_listing (int fd, struct dep_list *before);
+void             dl_discard (struct dep_list *before, struct chg_list *after);
 
 void
 dl_calculate (struct dep_list           *before,
@@ -98,7 +120,4 @@ di_settype (struct dep_item *di, mode_t type)
     di->type = (di->type & ~S_IFMT) | (type & S_IFMT);
 }
 
-RB_GENERATE_NEXT(dep_list, dep_item, u.tree_link, static inline)
-RB_GENERATE_MINMAX(dep_list, dep_item, u.tree_link, static inline)
-
 #endif /* __DEP_LIST_H__ */
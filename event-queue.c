@@ -40,9 +40,20 @@
 
 #include "config.h"
 #include "event-queue.h"
+#include "event-ring.h"
 #include "utils.h"
 #include "worker.h"
 
+static int eq_watch_cmp (struct eq_watch *w1, struct eq_watch *w2);
+
+RB_GENERATE_NEXT(eq_watches, eq_watch, link, static inline)
+RB_GENERATE_MINMAX(eq_watches, eq_watch, link, static inline)
+RB_GENERATE_INSERT_COLOR(eq_watches, eq_watch, link, static inline)
+RB_GENERATE_REMOVE_COLOR(eq_watches, eq_watch, link, static inline)
+RB_GENERATE_INSERT(eq_watches, eq_watch, link, eq_watch_cmp, static inline)
+RB_GENERATE_REMOVE(eq_watches, eq_watch, link, static inline)
+RB_GENERATE_FIND(eq_watches, eq_watch, link, eq_watch_cmp, static inline)
+
 /**
  * Initialize resources associated with inotify event queue.
  *
@@ -56,7 +67,32 @@ event_queue_init (struct event_queue *eq)
     eq->mem_events = 0;
     eq->iov = NULL;
     eq->last = NULL;
-    eq->user_ident = 0;
+    eq->blocks = NULL;
+    eq->timestamps = false;
+    eq->ring = NULL;
+    eq->produced = 0;
+    eq->coalesced = 0;
+    eq->dropped = 0;
+    eq->elided = 0;
+    eq->hiwat = 0;
+    eq->flushes = 0;
+    eq->flushed = 0;
+    eq->ts = NULL;
+    eq->now = 0;
+    eq->lat_hist = NULL;
+    eq->lat_count = 0;
+    eq->lat_max = 0;
+    eq->window = 0;
+    eq->hold = NULL;
+    eq->deadline = 0;
+    eq->move_window = 0;
+    eq->mem_bytes = 0;
+    eq->batch_bytes = 0;
+    eq->batch_events = 0;
+    eq->batch_delay = (uint64_t)IN_DEF_BATCH_DELAY * 1000000;
+    eq->batch_start = 0;
+    eq->quota = 0;
+    RB_INIT (&eq->watches);
     event_queue_set_max_events (eq, IN_DEF_MAX_QUEUED_EVENTS);
 }
 
@@ -70,11 +106,17 @@ event_queue_free (struct event_queue *eq)
 {
     int i;
 
+    event_queue_set_quota (eq, 0);
     for (i = 0; i < eq->mem_events; i++) {
         free (eq->iov[i].iov_base);
     }
     free (eq->iov);
     free (eq->last);
+    free (eq->ts);
+    free (eq->lat_hist);
+    free (eq->hold);
+    event_ring_free (eq->ring);
+    event_blocks_free (eq->blocks);
 }
 
 /**
@@ -96,6 +138,689 @@ event_queue_set_max_events (struct event_queue *eq, int max_events)
     return 0;
 }
 
+/**
+ * Enable or disable measurement of event delivery latency.
+ * Enabling of already enabled measurements resets collected data.
+ *
+ * @param[in] eq     A pointer to #event_queue.
+ * @param[in] enable true to enable measurements, false to disable.
+ * @return 0 on success, -1 otherwise.
+ **/
+int
+event_queue_set_latency (struct event_queue *eq, bool enable)
+{
+    uint64_t *ts = NULL, *hist = NULL;
+
+    if (enable) {
+        /* Events already present in queue are left without timestamps */
+        ts = calloc (eq->allocated > 0 ? eq->allocated : 1, sizeof (uint64_t));
+        hist = calloc (EQ_LAT_BUCKETS, sizeof (uint64_t));
+        if (ts == NULL || hist == NULL) {
+            perror_msg (("Failed to allocate latency histogram"));
+            free (ts);
+            free (hist);
+            return -1;
+        }
+    }
+
+    free (eq->ts);
+    free (eq->lat_hist);
+    eq->ts = ts;
+    eq->lat_hist = hist;
+    eq->lat_count = 0;
+    eq->lat_max = 0;
+    return 0;
+}
+
+/**
+ * Start watching a subfile which IN_CREATE event is no longer held.
+ *
+ * @param[in] eq A pointer to #event_queue.
+ * @param[in] ie A pointer to released IN_CREATE event.
+ **/
+static void
+event_queue_release (struct event_queue *eq, struct inotify_event *ie)
+{
+    if (ie->mask & IN_CREATE) {
+        worker_open_subwatch (EQ_TO_WRK(eq), ie->wd, ie->name);
+    }
+}
+
+/**
+ * Allocate or free hold deadlines of queued events depending on whether
+ * elision or move pairing is enabled. Held events are released on free.
+ *
+ * @param[in] eq A pointer to #event_queue.
+ * @return 0 on success, -1 otherwise.
+ **/
+static int
+event_queue_update_hold (struct event_queue *eq)
+{
+    bool enable = eq->window != 0 || eq->move_window != 0;
+    int i;
+
+    if (enable && eq->hold == NULL) {
+        eq->hold = calloc (eq->allocated > 0 ? eq->allocated : 1,
+                           sizeof (uint64_t));
+        if (eq->hold == NULL) {
+            perror_msg (("Failed to allocate hold deadlines"));
+            return -1;
+        }
+    }
+
+    if (!enable && eq->hold != NULL) {
+        for (i = 0; i < eq->mem_events; i++) {
+            if (eq->hold[i] != 0) {
+                event_queue_release (eq, eq->iov[i].iov_base);
+            }
+        }
+        free (eq->hold);
+        eq->hold = NULL;
+    }
+
+    eq->deadline = 0;
+    return 0;
+}
+
+/**
+ * Set transient file elision window.
+ *
+ * When enabled, IN_CREATE events are held in the queue during the window
+ * (as well as all the following events to keep ordering). IN_DELETE for the
+ * same name arrived within the window cancels both events. Subfiles are
+ * not opened until their IN_CREATE events are released.
+ *
+ * @param[in] eq     A pointer to #event_queue.
+ * @param[in] window A window length in nanoseconds. 0 disables elision.
+ * @return 0 on success, -1 otherwise.
+ **/
+int
+event_queue_set_elision (struct event_queue *eq, uint64_t window)
+{
+    uint64_t old = eq->window;
+
+    eq->window = window;
+    if (event_queue_update_hold (eq) == -1) {
+        eq->window = old;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Set cross-directory move pairing window.
+ *
+ * When enabled, IN_CREATE and IN_DELETE events are held in the queue during
+ * the window, so the worker can turn the pair produced by a rename between
+ * two watched directories into IN_MOVED_FROM/IN_MOVED_TO.
+ *
+ * @param[in] eq     A pointer to #event_queue.
+ * @param[in] window A window length in nanoseconds. 0 disables pairing.
+ * @return 0 on success, -1 otherwise.
+ **/
+int
+event_queue_set_move_window (struct event_queue *eq, uint64_t window)
+{
+    uint64_t old = eq->move_window;
+
+    eq->move_window = window;
+    if (event_queue_update_hold (eq) == -1) {
+        eq->move_window = old;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Compare two per-watch sub-queues by their watch ids.
+ *
+ * @param[in] w1 A pointer to the first sub-queue.
+ * @param[in] w2 A pointer to the second sub-queue.
+ * @return An integer less than, equal to, or greater than zero if w1 is
+ *     found, respectively, to be less than, to match, or be greater than w2.
+ **/
+static int
+eq_watch_cmp (struct eq_watch *w1, struct eq_watch *w2)
+{
+    return (w1->wd > w2->wd) - (w1->wd < w2->wd);
+}
+
+/**
+ * Find per-watch sub-queue.
+ *
+ * @param[in] eq A pointer to #event_queue.
+ * @param[in] wd A watch id.
+ * @return A pointer to the sub-queue or NULL if watch has no queued events.
+ **/
+static struct eq_watch *
+eq_watch_find (struct event_queue *eq, int wd)
+{
+    struct eq_watch find;
+
+    find.wd = wd;
+    return RB_FIND (eq_watches, &eq->watches, &find);
+}
+
+/**
+ * Account an event placed into the queue in its watch's sub-queue.
+ *
+ * @param[in] eq A pointer to #event_queue.
+ * @param[in] wd A watch id of the event.
+ * @return 0 on success, -1 otherwise.
+ **/
+static int
+eq_watch_get (struct event_queue *eq, int wd)
+{
+    struct eq_watch *w;
+
+    if (eq->quota == 0 || wd == -1) {
+        return 0;
+    }
+
+    w = eq_watch_find (eq, wd);
+    if (w == NULL) {
+        w = calloc (1, sizeof (struct eq_watch));
+        if (w == NULL) {
+            perror_msg (("Failed to allocate sub-queue of watch %d", wd));
+            return -1;
+        }
+        w->wd = wd;
+        RB_INSERT (eq_watches, &eq->watches, w);
+    }
+
+    ++w->events;
+    return 0;
+}
+
+/**
+ * Account an event removed from the queue in its watch's sub-queue.
+ *
+ * @param[in] eq A pointer to #event_queue.
+ * @param[in] ie A pointer to removed event.
+ **/
+static void
+eq_watch_put (struct event_queue *eq, struct inotify_event *ie)
+{
+    struct eq_watch *w;
+
+    if (eq->quota == 0 || ie->wd == -1) {
+        return;
+    }
+
+    w = eq_watch_find (eq, ie->wd);
+    assert (w != NULL);
+    if (--w->events == 0) {
+        RB_REMOVE (eq_watches, &eq->watches, w);
+        free (w);
+    } else if (w->events < eq->quota) {
+        /* Report next saturation of the sub-queue */
+        w->overflowed = false;
+    }
+}
+
+/**
+ * Set per-watch event quota.
+ *
+ * When enabled, every watch is limited to quota events in the queue. Events
+ * beyond the quota are dropped and reported with IN_Q_OVERFLOW once per
+ * saturation. Flushes which can not hand over whole queue interleave
+ * sub-queues of watches in round-robin order, keeping order of events
+ * within each sub-queue.
+ *
+ * @param[in] eq    A pointer to #event_queue.
+ * @param[in] quota Maximal number of events per watch. 0 disables quotas.
+ * @return 0 on success, -1 otherwise.
+ **/
+int
+event_queue_set_quota (struct event_queue *eq, int quota)
+{
+    struct eq_watch *w, *tmp;
+    int i;
+
+    if (quota < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    RB_FOREACH_SAFE (w, eq_watches, &eq->watches, tmp) {
+        RB_REMOVE (eq_watches, &eq->watches, w);
+        free (w);
+    }
+
+    eq->quota = quota;
+    /* Account events already present in queue. They may exceed the quota */
+    for (i = 0; quota != 0 && i < eq->mem_events; i++) {
+        struct inotify_event *ie = eq->iov[i].iov_base;
+        if (eq_watch_get (eq, ie->wd) == -1) {
+            event_queue_set_quota (eq, 0);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/* Move event of the queue head looked up for its counterpart */
+struct eq_move {
+    uint32_t cookie;   /* move cookie */
+    int index;         /* index of event in the queue */
+};
+
+/**
+ * Compare two move events by cookie and position in the queue.
+ *
+ * @param[in] p1 A pointer to a first #eq_move.
+ * @param[in] p2 A pointer to a second #eq_move.
+ * @return An -1, 0, or +1 as for qsort().
+ **/
+static int
+eq_move_cmp (const void *p1, const void *p2)
+{
+    const struct eq_move *m1 = p1;
+    const struct eq_move *m2 = p2;
+
+    if (m1->cookie != m2->cookie) {
+        return (m1->cookie > m2->cookie) - (m1->cookie < m2->cookie);
+    }
+    return (m1->index > m2->index) - (m1->index < m2->index);
+}
+
+/**
+ * Find IN_MOVED_FROM/IN_MOVED_TO pairs of a queue segment reported to
+ * different watches. Pairs within one watch are kept by its sub-queue.
+ * Kernel reported moves may come in either order.
+ *
+ * @param[in]  eq    A pointer to #event_queue.
+ * @param[in]  from  Index of the first event of the segment.
+ * @param[in]  to    Index following the last event of the segment.
+ * @param[in]  moves A scratch array of queue head size.
+ * @param[out] pair  Index of counterpart of every paired event, -1 if none.
+ **/
+static void
+event_queue_find_pairs (struct event_queue *eq,
+                        int from,
+                        int to,
+                        struct eq_move *moves,
+                        int *pair)
+{
+    struct inotify_event *ie, *mate;
+    int i, nmoves = 0;
+
+    for (i = from; i < to; i++) {
+        pair[i] = -1;
+        ie = eq->iov[i].iov_base;
+        if (ie->cookie != 0 && ie->mask & IN_MOVE) {
+            moves[nmoves].cookie = ie->cookie;
+            moves[nmoves].index = i;
+            ++nmoves;
+        }
+    }
+    if (nmoves < 2) {
+        return;
+    }
+
+    qsort (moves, nmoves, sizeof (struct eq_move), eq_move_cmp);
+    for (i = 1; i < nmoves; i++) {
+        ie = eq->iov[moves[i - 1].index].iov_base;
+        mate = eq->iov[moves[i].index].iov_base;
+        if (moves[i - 1].cookie == moves[i].cookie &&
+            pair[moves[i - 1].index] == -1 &&
+            (ie->mask & IN_MOVE) != (mate->mask & IN_MOVE) &&
+            ie->wd != mate->wd) {
+            pair[moves[i - 1].index] = moves[i].index;
+            pair[moves[i].index] = moves[i - 1].index;
+        }
+    }
+}
+
+/**
+ * Order a segment of the queue head which has no queue overflow events in
+ * round-robin order of per-watch sub-queues. Order of events within each
+ * sub-queue is kept. Halves of a move between watches keep their order and
+ * go one right after another unless events of both watches have come in
+ * between.
+ *
+ * @param[in]  eq    A pointer to #event_queue.
+ * @param[in]  from  Index of the first event of the segment.
+ * @param[in]  to    Index following the last event of the segment.
+ * @param[in]  pair  Counterparts of moves found by event_queue_find_pairs().
+ * @param[in]  rank  A scratch array of queue head size.
+ * @param[in]  start A scratch array of queue head size plus one.
+ * @param[out] order Queue indices of events in the new order.
+ **/
+static void
+event_queue_interleave_segment (struct event_queue *eq,
+                                int from,
+                                int to,
+                                const int *pair,
+                                int *rank,
+                                int *start,
+                                int *order)
+{
+    struct inotify_event *ie;
+    struct eq_watch *w, *mate;
+    int i, maxrank = 0;
+
+    /* Rank of event is its position in the sub-queue */
+    RB_FOREACH (w, eq_watches, &eq->watches) {
+        w->rank = 0;
+    }
+    for (i = from; i < to; i++) {
+        ie = eq->iov[i].iov_base;
+        w = eq_watch_find (eq, ie->wd);
+        assert (w != NULL);
+        mate = NULL;
+        if (pair[i] != -1) {
+            ie = eq->iov[pair[i]].iov_base;
+            mate = eq_watch_find (eq, ie->wd);
+            assert (mate != NULL);
+        }
+        if (pair[i] > i) {
+            /* Both sub-queues resume after the first half of the move */
+            rank[i] = w->rank > mate->rank ? w->rank : mate->rank;
+            w->rank = mate->rank = rank[i] + 1;
+        } else if (mate != NULL && (w->rank == rank[pair[i]] + 1 ||
+                                    mate->rank == rank[pair[i]] + 1)) {
+            if (w->rank != rank[pair[i]] + 1) {
+                /* Nothing of the other watch in between, so the first
+                 * half can be put after events of this watch */
+                rank[pair[i]] = w->rank;
+                w->rank = mate->rank = rank[pair[i]] + 1;
+                if (rank[pair[i]] > maxrank) {
+                    maxrank = rank[pair[i]];
+                }
+            }
+            /* Go right after the first half */
+            rank[i] = -1;
+            continue;
+        } else {
+            rank[i] = w->rank++;
+        }
+        if (rank[i] > maxrank) {
+            maxrank = rank[i];
+        }
+    }
+
+    /* Stable counting sort by rank */
+    memset (start, 0, sizeof (int) * (maxrank + 2));
+    for (i = from; i < to; i++) {
+        ++start[(rank[i] != -1 ? rank[i] : rank[pair[i]]) + 1];
+    }
+    for (i = 1; i <= maxrank; i++) {
+        start[i] += start[i - 1];
+    }
+    for (i = from; i < to; i++) {
+        if (rank[i] == -1) {
+            continue;
+        }
+        order[from + start[rank[i]]++] = i;
+        if (pair[i] > i && rank[pair[i]] == -1) {
+            order[from + start[rank[i]]++] = pair[i];
+        }
+    }
+}
+
+/**
+ * Interleave per-watch sub-queues in the head of the queue in round-robin
+ * order, so a noisy watch does not delay events of others. Order of events
+ * within each sub-queue is kept. Queue overflow events stay in place and
+ * events are never moved across them, so everything queued before an
+ * overflow is delivered before it. Moves between watches are not split.
+ *
+ * @param[in] eq    A pointer to #event_queue.
+ * @param[in] count Number of events in the head of the queue to reorder.
+ **/
+static void
+event_queue_interleave (struct event_queue *eq, int count)
+{
+    struct inotify_event *ie;
+    struct eq_move *moves;
+    struct iovec *iov;
+    uint64_t *tmp;
+    int *rank, *order, *pair, *start;
+    int i, from = 0;
+
+    rank = malloc (sizeof (int) * (4 * count + 1));
+    moves = malloc (sizeof (struct eq_move) * count);
+    iov = malloc (sizeof (struct iovec) * count);
+    tmp = malloc (sizeof (uint64_t) * count);
+    if (rank == NULL || moves == NULL || iov == NULL || tmp == NULL) {
+        /* Not fatal. Leave events in order of arrival */
+        free (rank);
+        free (moves);
+        free (iov);
+        free (tmp);
+        return;
+    }
+    order = rank + count;
+    pair = order + count;
+    start = pair + count;
+
+    for (i = 0; i <= count; i++) {
+        ie = i < count ? eq->iov[i].iov_base : NULL;
+        if (ie != NULL && ie->wd != -1) {
+            continue;
+        }
+        event_queue_find_pairs (eq, from, i, moves, pair);
+        event_queue_interleave_segment (eq, from, i, pair, rank, start, order);
+        if (ie != NULL) {
+            /* IN_Q_OVERFLOW is a barrier */
+            order[i] = i;
+        }
+        from = i + 1;
+    }
+
+    memcpy (iov, eq->iov, sizeof (struct iovec) * count);
+    for (i = 0; i < count; i++) {
+        eq->iov[i] = iov[order[i]];
+    }
+    if (eq->ts != NULL) {
+        memcpy (tmp, eq->ts, sizeof (uint64_t) * count);
+        for (i = 0; i < count; i++) {
+            eq->ts[i] = tmp[order[i]];
+        }
+    }
+    if (eq->hold != NULL) {
+        memcpy (tmp, eq->hold, sizeof (uint64_t) * count);
+        for (i = 0; i < count; i++) {
+            eq->hold[i] = tmp[order[i]];
+        }
+    }
+
+    free (rank);
+    free (moves);
+    free (iov);
+    free (tmp);
+}
+
+/**
+ * Remove an event from the middle of inotify event queue.
+ *
+ * @param[in] eq    A pointer to #event_queue.
+ * @param[in] index An index of the event to remove.
+ **/
+static void
+event_queue_remove (struct event_queue *eq, int index)
+{
+    int tail = eq->mem_events - index - 1;
+
+    eq->mem_bytes -= eq->iov[index].iov_len;
+    eq_watch_put (eq, eq->iov[index].iov_base);
+    free (eq->iov[index].iov_base);
+    memmove (&eq->iov[index], &eq->iov[index + 1], sizeof (struct iovec) * tail);
+    if (eq->ts != NULL) {
+        memmove (&eq->ts[index], &eq->ts[index + 1], sizeof (uint64_t) * tail);
+    }
+    if (eq->hold != NULL) {
+        memmove (&eq->hold[index], &eq->hold[index + 1], sizeof (uint64_t) * tail);
+    }
+    --eq->mem_events;
+}
+
+/**
+ * Cancel held IN_CREATE event for the file being deleted.
+ *
+ * @param[in] eq   A pointer to #event_queue.
+ * @param[in] wd   An associated watch's id.
+ * @param[in] name A name of deleted file.
+ * @return true if IN_CREATE has been found and cancelled, false otherwise.
+ **/
+static bool
+event_queue_elide (struct event_queue *eq, int wd, const char *name)
+{
+    struct inotify_event *ie;
+    int i;
+
+    /* Look for the latest event reported for this file */
+    for (i = eq->mem_events - 1; i >= 0; i--) {
+        ie = eq->iov[i].iov_base;
+        if (ie->wd == wd && ie->len > 0 && !strcmp (ie->name, name)) {
+            if (eq->hold[i] == 0 || !(ie->mask & IN_CREATE)) {
+                return false;
+            }
+            event_queue_remove (eq, i);
+            ++eq->elided;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Set consumer wakeup batching thresholds.
+ *
+ * When enabled, events are held in the queue until their total size or
+ * number reaches the threshold or the oldest of them is held for the delay.
+ *
+ * @param[in] eq     A pointer to #event_queue.
+ * @param[in] bytes  A threshold in bytes. 0 if none.
+ * @param[in] events A threshold in events. 0 if none.
+ * @param[in] delay  Maximal time to hold events in nanoseconds.
+ * @return 0 on success, -1 otherwise.
+ **/
+int
+event_queue_set_batch (struct event_queue *eq,
+                       size_t bytes,
+                       int events,
+                       uint64_t delay)
+{
+    if (events < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    eq->batch_bytes = bytes;
+    eq->batch_events = events;
+    eq->batch_delay = delay;
+    return 0;
+}
+
+/**
+ * Check if flush of the queue should be postponed to batch events.
+ *
+ * @param[in] eq A pointer to #event_queue.
+ * @return Time to flush the queue at, ns, or 0 if it should be flushed now.
+ **/
+uint64_t
+event_queue_batch_deadline (struct event_queue *eq)
+{
+    uint64_t deadline;
+
+    if (eq->batch_bytes == 0 && eq->batch_events == 0) {
+        return 0;
+    }
+    /* Either threshold reached releases the batch */
+    if ((eq->batch_bytes != 0 && eq->mem_bytes >= eq->batch_bytes) ||
+        (eq->batch_events != 0 && eq->mem_events >= eq->batch_events)) {
+        return 0;
+    }
+
+    deadline = eq->batch_start + eq->batch_delay;
+    return deadline > monotonic_ns () ? deadline : 0;
+}
+
+/**
+ * Get latency histogram bucket index for given value.
+ * Values below 2^EQ_LAT_SUB_BITS get a bucket each, every following
+ * power of 2 range is split to 2^EQ_LAT_SUB_BITS equal buckets.
+ *
+ * @param[in] value A latency value, ns.
+ * @return A bucket index.
+ **/
+static int
+lat_bucket (uint64_t value)
+{
+    int exp = 0;
+
+    if (value < (1 << EQ_LAT_SUB_BITS)) {
+        return value;
+    }
+
+    while ((value >> exp) > 1) {
+        ++exp;
+    }
+
+    return ((exp - EQ_LAT_SUB_BITS + 1) << EQ_LAT_SUB_BITS) +
+        ((value >> (exp - EQ_LAT_SUB_BITS)) & ((1 << EQ_LAT_SUB_BITS) - 1));
+}
+
+/**
+ * Get the highest value fitting in to latency histogram bucket.
+ *
+ * @param[in] bucket A bucket index.
+ * @return A latency value, ns.
+ **/
+static uint64_t
+lat_bucket_max (int bucket)
+{
+    int exp;
+    uint64_t sub;
+
+    if (bucket < (1 << EQ_LAT_SUB_BITS)) {
+        return bucket;
+    }
+
+    exp = (bucket >> EQ_LAT_SUB_BITS) + EQ_LAT_SUB_BITS - 1;
+    sub = (bucket & ((1 << EQ_LAT_SUB_BITS) - 1)) + 1;
+    return ((((uint64_t)1 << EQ_LAT_SUB_BITS) + sub)
+        << (exp - EQ_LAT_SUB_BITS)) - 1;
+}
+
+/**
+ * Get percentile of event delivery latency.
+ *
+ * @param[in] eq       A pointer to #event_queue.
+ * @param[in] permille A percentile to calculate, in 1/1000 units.
+ * @return A latency value (ns) which is not exceeded by the given part
+ *     of measured events. Resolution is 1/2^EQ_LAT_SUB_BITS of value.
+ **/
+uint64_t
+event_queue_get_latency (struct event_queue *eq, unsigned permille)
+{
+    uint64_t rank, seen = 0;
+    int i;
+
+    if (eq->lat_hist == NULL || eq->lat_count == 0) {
+        return 0;
+    }
+
+    rank = (eq->lat_count * permille + 999) / 1000;
+    if (rank == 0) {
+        rank = 1;
+    }
+
+    for (i = 0; i < EQ_LAT_BUCKETS; i++) {
+        seen += eq->lat_hist[i];
+        if (seen >= rank) {
+            uint64_t value = lat_bucket_max (i);
+            return value < eq->lat_max ? value : eq->lat_max;
+        }
+    }
+
+    return eq->lat_max;
+}
+
 /**
  * Extend inotify event queue space by one item.
  *
@@ -121,6 +846,27 @@ event_queue_extend (struct event_queue *eq)
             return -1;
         }
         eq->iov = ptr;
+
+        if (eq->ts != NULL) {
+            ptr = realloc (eq->ts, sizeof (uint64_t) * to_allocate);
+            if (ptr == NULL) {
+                perror_msg (("Failed to extend timestamps to %d items",
+                             to_allocate));
+                return -1;
+            }
+            eq->ts = ptr;
+        }
+
+        if (eq->hold != NULL) {
+            ptr = realloc (eq->hold, sizeof (uint64_t) * to_allocate);
+            if (ptr == NULL) {
+                perror_msg (("Failed to extend hold deadlines to %d items",
+                             to_allocate));
+                return -1;
+            }
+            eq->hold = ptr;
+        }
+
         eq->allocated = to_allocate;
     }
 
@@ -145,9 +891,17 @@ event_queue_enqueue (struct event_queue *eq,
                      const char         *name)
 {
     struct inotify_event *prev_ie;
+    uint64_t now;
     int retval = 0;
 
+    /* Transient file has been deleted before IN_CREATE is reported */
+    if (eq->window != 0 && mask & IN_DELETE && name != NULL &&
+        event_queue_elide (eq, wd, name)) {
+        return 0;
+    }
+
     if (eq->mem_events > eq->max_events) {
+        ++eq->dropped;
         return -1;
     }
 
@@ -156,6 +910,7 @@ event_queue_enqueue (struct event_queue *eq,
     }
 
     if (eq->mem_events == eq->max_events) {
+        ++eq->dropped;
         wd = -1;
         mask = IN_Q_OVERFLOW;
         cookie = 0;
@@ -163,6 +918,23 @@ event_queue_enqueue (struct event_queue *eq,
         retval = -1;
     }
 
+    /* Per-watch quota. Saturated sub-queue is reported once */
+    if (eq->quota != 0 && wd != -1) {
+        struct eq_watch *w = eq_watch_find (eq, wd);
+        if (w != NULL && w->events >= eq->quota) {
+            ++eq->dropped;
+            if (w->overflowed) {
+                return -1;
+            }
+            w->overflowed = true;
+            wd = -1;
+            mask = IN_Q_OVERFLOW;
+            cookie = 0;
+            name = NULL;
+            retval = -1;
+        }
+    }
+
     /*
      * Find previous reported event. If event queue is not empty, get last
      * event from tail. Otherwise get last event sent to communication pipe.
@@ -175,7 +947,7 @@ event_queue_enqueue (struct event_queue *eq,
         prev_ie->wd == wd &&
         prev_ie->mask == mask &&
         prev_ie->cookie == cookie &&
-      ((prev_ie->len == 0 && name == NULL) ||
+      ((name == NULL && (prev_ie->len == 0 || prev_ie->name[0] == '\0')) ||
        (prev_ie->len > 0 && name != NULL && !strcmp (prev_ie->name, name)))) {
 
             int fd = EQ_TO_WRK(eq)->io[INOTIFY_FD];
@@ -183,26 +955,147 @@ event_queue_enqueue (struct event_queue *eq,
 
             /* Events are identical and queue is not empty. Skip current. */
             if (eq->mem_events > 0) {
+                ++eq->coalesced;
                 return retval;
             }
             /* Event queue is empty. Check if any events remain in the pipe */
-            if (ioctl (fd, FIONREAD, &buffered) == 0 && buffered > 0) {
+            if (eq->ring != NULL ? !event_ring_empty (eq->ring) :
+                ioctl (fd, FIONREAD, &buffered) == 0 && buffered > 0) {
+                ++eq->coalesced;
                 return retval;
             }
     }
 
+    now = eq->now;
+    if (now == 0 && (eq->timestamps || eq->ts != NULL || eq->hold != NULL ||
+                     (eq->mem_events == 0 &&
+                      (eq->batch_bytes != 0 || eq->batch_events != 0)))) {
+        now = monotonic_ns ();
+    }
+
     eq->iov[eq->mem_events].iov_base = (void *)create_inotify_event (
-        wd, mask, cookie, name, &eq->iov[eq->mem_events].iov_len);
+        wd, mask, cookie, name, eq->timestamps ? &now : NULL,
+        &eq->iov[eq->mem_events].iov_len);
     if (eq->iov[eq->mem_events].iov_base == NULL) {
         perror_msg (("Failed to create a inotify event %x", mask));
         return -1;
     }
+    if (eq_watch_get (eq, wd) == -1) {
+        free (eq->iov[eq->mem_events].iov_base);
+        return -1;
+    }
 
+    if (eq->ts != NULL) {
+        eq->ts[eq->mem_events] = now;
+    }
+    if (eq->hold != NULL) {
+        uint64_t hold = 0;
+
+        if (eq->window != 0 && mask & IN_CREATE && name != NULL) {
+            hold = now + eq->window;
+        }
+        if (eq->move_window != 0 && mask & (IN_CREATE | IN_DELETE) &&
+            name != NULL && now + eq->move_window > hold) {
+            hold = now + eq->move_window;
+        }
+        eq->hold[eq->mem_events] = hold;
+    }
+
+    if (eq->mem_events == 0) {
+        eq->batch_start = now;
+    }
+    eq->mem_bytes += eq->iov[eq->mem_events].iov_len;
     ++eq->mem_events;
+    ++eq->produced;
+    if (eq->mem_events > eq->hiwat) {
+        eq->hiwat = eq->mem_events;
+    }
 
     return retval;
 }
 
+/**
+ * Rewrite held event of a file to the other event type.
+ *
+ * @param[in] eq     A pointer to #event_queue.
+ * @param[in] wd     An associated watch's id.
+ * @param[in] name   A file name.
+ * @param[in] from   An event type to look for.
+ * @param[in] to     A new event type or 0 to remove the event.
+ * @param[in] cookie A new event cookie.
+ * @return An index of the event in the queue or -1 if no held event of
+ *     the file has been found.
+ **/
+int
+event_queue_rewrite (struct event_queue *eq,
+                     int                 wd,
+                     const char         *name,
+                     uint32_t            from,
+                     uint32_t            to,
+                     uint32_t            cookie)
+{
+    struct inotify_event *ie;
+    int i;
+
+    if (eq->hold == NULL) {
+        return -1;
+    }
+
+    /* Look for the latest event reported for this file */
+    for (i = eq->mem_events - 1; i >= 0; i--) {
+        ie = eq->iov[i].iov_base;
+        if (ie->wd == wd && ie->len > 0 && !strcmp (ie->name, name)) {
+            if (eq->hold[i] == 0 || !(ie->mask & from)) {
+                return -1;
+            }
+            event_queue_release (eq, ie);
+            if (to == 0) {
+                event_queue_remove (eq, i);
+            } else {
+                ie->mask = (ie->mask & ~from) | to;
+                ie->cookie = cookie;
+                eq->hold[i] = 0;
+            }
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * Move the last enqueued event to the given position of the queue.
+ *
+ * @param[in] eq    A pointer to #event_queue.
+ * @param[in] index A new index of the event.
+ **/
+void
+event_queue_place (struct event_queue *eq, int index)
+{
+    int last = eq->mem_events - 1;
+    struct iovec iov;
+    uint64_t tmp;
+
+    assert (index >= 0 && index <= last);
+
+    iov = eq->iov[last];
+    memmove (&eq->iov[index + 1], &eq->iov[index],
+             sizeof (struct iovec) * (last - index));
+    eq->iov[index] = iov;
+    if (eq->ts != NULL) {
+        tmp = eq->ts[last];
+        memmove (&eq->ts[index + 1], &eq->ts[index],
+                 sizeof (uint64_t) * (last - index));
+        eq->ts[index] = tmp;
+    }
+    if (eq->hold != NULL) {
+        tmp = eq->hold[last];
+        memmove (&eq->hold[index + 1], &eq->hold[index],
+                 sizeof (uint64_t) * (last - index));
+        eq->hold[index] = tmp;
+    }
+}
+
 /**
  * Flush inotify events queue to socket
  *
@@ -219,6 +1112,7 @@ event_queue_flush (struct event_queue *eq, size_t sbspace)
     int fd = EQ_TO_WRK(eq)->io[KQUEUE_FD];
     size_t iovlen = 0;
     ssize_t size;
+    uint64_t now;
     int i;
     bool direct = fd == EQ_TO_WRK(eq)->io[INOTIFY_FD];
 
@@ -227,10 +1121,29 @@ event_queue_flush (struct event_queue *eq, size_t sbspace)
         iovmax = IOV_MAX;
     }
 
+    eq->deadline = 0;
+    now = eq->hold != NULL ? monotonic_ns () : 0;
+
+    /* Let every watch have its share of partial flush */
+    if (eq->quota != 0 && iovmax > 1) {
+        for (i = 0; i < iovmax; i++) {
+            iovlen += eq->iov[i].iov_len;
+        }
+        if (iovlen > sbspace || iovmax < eq->mem_events || eq->ring != NULL) {
+            event_queue_interleave (eq, iovmax);
+        }
+        iovlen = 0;
+    }
+
     for (iovcnt = 0; iovcnt < iovmax; iovcnt++) {
         if (iovlen + eq->iov[iovcnt].iov_len > sbspace) {
             break;
         }
+        /* Keep held IN_CREATE and following events in queue */
+        if (eq->hold != NULL && eq->hold[iovcnt] > now) {
+            eq->deadline = eq->hold[iovcnt];
+            break;
+        }
         iovlen += eq->iov[iovcnt].iov_len;
     }
 
@@ -238,11 +1151,38 @@ event_queue_flush (struct event_queue *eq, size_t sbspace)
         return 0;
     }
 
+    if (eq->ring != NULL) {
+        /* Ring may have less free space than socket buffer has */
+        iovcnt = event_ring_write (eq->ring, eq->iov, iovcnt);
+        if (iovcnt == 0) {
+            return 0;
+        }
+        for (iovlen = 0, i = 0; i < iovcnt; i++) {
+            iovlen += eq->iov[i].iov_len;
+        }
+    }
+
+    if (eq->hold != NULL) {
+        for (i = 0; i < iovcnt; i++) {
+            if (eq->hold[i] != 0) {
+                event_queue_release (eq, eq->iov[i].iov_base);
+                eq->hold[i] = 0;
+            }
+        }
+    }
+
 #if defined (MSG_NOSIGNAL)
     send_flags |= MSG_NOSIGNAL;
 #endif
 
-    if (!direct) {
+    if (eq->ring != NULL) {
+        /* Socket carries only a doorbell byte in ring mode */
+        if (event_ring_notify (eq->ring) &&
+            send (fd, "", 1, send_flags) == -1) {
+            perror_msg (("Failed to ring event ring doorbell"));
+        }
+        size = iovlen;
+    } else if (!direct) {
         size = sendv (fd, eq->iov, iovcnt, send_flags);
         if (size <= 0) {
             perror_msg (("Sending of inotify events to socket failed"));
@@ -250,54 +1190,27 @@ event_queue_flush (struct event_queue *eq, size_t sbspace)
         }
     } else {
 #ifdef EVFILT_USER
-        /* In the direct mode we hand over the event memory to the caller.
-         * It requires us to duplicate the iovec array. */
-        struct iovec* iov_copy = calloc (sizeof(struct iovec), iovcnt + 1); // NULL iovec as terminator
-        if (!iov_copy) {
-            perror_msg (("Direct sending of inotify events failed in calloc"));
-            return -1;
-        }
-        memcpy (iov_copy, eq->iov, sizeof(struct iovec) * iovcnt);
+        /* In the direct mode we hand over a copy of events to the caller */
+        struct iovec *block = event_blocks_pack (eq->iov, iovcnt);
+        struct kevent ke;
 
-        iov_copy[iovcnt - 1].iov_base = malloc (iov_copy[iovcnt - 1].iov_len);
-        if (!iov_copy[iovcnt - 1].iov_base) {
-            perror_msg (("Direct sending of inotify events failed in malloc"));
+        if (block == NULL) {
             return -1;
         }
-        memcpy (iov_copy[iovcnt - 1].iov_base, eq->iov[iovcnt - 1].iov_base, iov_copy[iovcnt - 1].iov_len);
-
-        /* Events are delivered to the user by triggering an EVFILT_USER
-         * We use monotonically increasing values as .ident to make
-         * the kernel to act as a natural queue for our events. */
-        struct kevent ke[2];
-        EV_SET (&ke[0],
-                eq->user_ident,
-                EVFILT_USER,
-                EV_ADD | EV_ONESHOT,
-                0, 0, 0);
-        EV_SET (&ke[1],
-                eq->user_ident,
-                EVFILT_USER,
-                0,
-                NOTE_TRIGGER,
-    #ifdef __DragonFly__
-                /* DragonflyBSD does not copy udata */
-                (intptr_t)iov_copy,
-                0
-    #else
-                0,
-                iov_copy
-    #endif
-                );
-        size = kevent (fd, ke, 2, NULL, 0, zero_tsp);
-        if (size < 0) {
-            free (iov_copy[iovcnt - 1].iov_base);
-            free (iov_copy);
-            perror_msg (("Direct sending of inotify events failed in kevent"));
-            return size;
+        if (!event_blocks_push (eq->blocks, block)) {
+            /* Wait for the caller to take queued blocks */
+            free (block);
+            return 0;
+        }
+
+        /* Events are delivered to the user by triggering an EVFILT_USER */
+        if (event_blocks_notify (eq->blocks)) {
+            EV_SET (&ke, EQ_DIRECT_IDENT, EVFILT_USER, 0, NOTE_TRIGGER, 0, 0);
+            if (kevent (fd, &ke, 1, NULL, 0, zero_tsp) == -1) {
+                perror_msg (("Direct sending of inotify events failed in kevent"));
+            }
         }
         size = iovlen;
-        eq->user_ident++;
 #else  /* !EVFILT_USER */
         perror_msg (("Direct sending of inotify events requires EVFILT_USER"));
         return -1;
@@ -306,22 +1219,50 @@ event_queue_flush (struct event_queue *eq, size_t sbspace)
 
     assert (size == iovlen || size == -1);
 
+    if (eq->ts != NULL) {
+        uint64_t now = monotonic_ns ();
+
+        for (i = 0; i < iovcnt; i++) {
+            /* Zero timestamp marks event queued before measurements start */
+            if (eq->ts[i] != 0) {
+                uint64_t latency = now > eq->ts[i] ? now - eq->ts[i] : 0;
+                ++eq->lat_hist[lat_bucket (latency)];
+                ++eq->lat_count;
+                if (latency > eq->lat_max) {
+                    eq->lat_max = latency;
+                }
+            }
+        }
+        memmove (&eq->ts[0],
+                 &eq->ts[iovcnt],
+                 sizeof (uint64_t) * (eq->mem_events - iovcnt));
+    }
+    if (eq->hold != NULL) {
+        memmove (&eq->hold[0],
+                 &eq->hold[iovcnt],
+                 sizeof (uint64_t) * (eq->mem_events - iovcnt));
+    }
+
     /* Save last event sent to communication pipe for coalecsing checks */
     free (eq->last);
     eq->last = (void *)eq->iov[iovcnt - 1].iov_base;
 
-    if (!direct) {
-        for (i = 0; i < iovcnt - 1; i++) {
-            free (eq->iov[i].iov_base);
-        }
-
-        memmove (&eq->iov[0],
-                &eq->iov[iovcnt],
-                sizeof(struct iovec) * (eq->mem_events - iovcnt));
+    for (i = 0; i < iovcnt; i++) {
+        eq_watch_put (eq, eq->iov[i].iov_base);
     }
+    for (i = 0; i < iovcnt - 1; i++) {
+        free (eq->iov[i].iov_base);
+    }
+
+    memmove (&eq->iov[0],
+            &eq->iov[iovcnt],
+            sizeof(struct iovec) * (eq->mem_events - iovcnt));
 
     eq->mem_events -= iovcnt;
+    eq->mem_bytes -= iovlen;
     eq->sb_events += iovcnt;
+    ++eq->flushes;
+    eq->flushed += size;
 
     return size;
 }
@@ -28,6 +28,24 @@
 #include <sys/uio.h>   /* iovec */
 
 #include "sys/inotify.h"
+#include "compat.h"
+
+/* Ident of EVFILT_USER event which notifies user in direct mode */
+#define EQ_DIRECT_IDENT 0
+
+/* Log-linear latency histogram: 2^EQ_LAT_SUB_BITS linear buckets per octave */
+#define EQ_LAT_SUB_BITS 3
+#define EQ_LAT_BUCKETS  (64 << EQ_LAT_SUB_BITS)
+
+/* Per-watch sub-queue accounting of fair queuing */
+struct eq_watch {
+    RB_ENTRY(eq_watch) link;
+    int wd;            /* watch id */
+    int events;        /* number of events of the watch enqueued in memory */
+    int rank;          /* number of events of the watch met by flush scan */
+    bool overflowed;   /* IN_Q_OVERFLOW has been reported for the watch */
+};
+RB_HEAD(eq_watches, eq_watch);
 
 struct event_queue {
     struct iovec *iov; /* inotify events to send */
@@ -36,19 +54,78 @@ struct event_queue {
     int allocated;     /* number of iovs allocated */
     int max_events;    /* max_queued_events */
     struct inotify_event *last; /* Last event sent to socket */
-    uint user_ident;   /* ident for EVFILT_USER events when operating in direct mode */
+    struct event_blocks *blocks; /* event blocks handed over to user in
+                                    direct mode or NULL */
+    bool timestamps;   /* append timestamps to events (IN_TIMESTAMP) */
+    struct event_ring *ring; /* shared memory event ring (IN_RING) or NULL */
+
+    /* Statistics */
+    uint64_t produced;  /* number of events placed into the queue */
+    uint64_t coalesced; /* number of events merged with the previous one */
+    uint64_t dropped;   /* number of events lost due to queue overflow */
+    uint64_t elided;    /* number of cancelled IN_CREATE/IN_DELETE pairs */
+    int hiwat;          /* max number of events enqueued in memory */
+    uint64_t flushes;   /* number of successful queue flushes */
+    uint64_t flushed;   /* number of bytes flushed */
+
+    /* Latency measurements */
+    uint64_t *ts;       /* kevent receipt timestamps of queued events, ns */
+    uint64_t now;       /* receipt timestamp of kevent being processed, ns.
+                           Used by IN_TIMESTAMP too */
+    uint64_t *lat_hist; /* event delivery latency histogram */
+    uint64_t lat_count; /* number of latency samples */
+    uint64_t lat_max;   /* maximal latency, ns */
+
+    /* Transient file elision */
+    uint64_t window;    /* IN_CREATE hold time, ns. 0 if elision is off */
+    uint64_t *hold;     /* hold deadlines of queued events, ns. 0 if none */
+    uint64_t deadline;  /* hold deadline which stopped last flush or 0 */
+
+    /* Cross-directory move pairing */
+    uint64_t move_window; /* IN_CREATE and IN_DELETE hold time, ns. 0 if
+                             pairing is off */
+
+    /* Consumer wakeup batching */
+    size_t mem_bytes;      /* size of events enqueued in memory */
+    size_t batch_bytes;    /* flush threshold in bytes. 0 if none */
+    int batch_events;      /* flush threshold in events. 0 if none */
+    uint64_t batch_delay;  /* max time to hold events below threshold, ns */
+    uint64_t batch_start;  /* enqueue time of the first event put into
+                              empty queue, ns */
+
+    /* Per-watch fair queuing */
+    int quota;                  /* max events per watch. 0 if off */
+    struct eq_watches watches;  /* per-watch sub-queues */
 };
 
 void event_queue_init (struct event_queue *eq);
 void event_queue_free (struct event_queue *eq);
 
 int event_queue_set_max_events (struct event_queue *eq, int max_events);
+int event_queue_set_latency    (struct event_queue *eq, bool enable);
+int event_queue_set_elision    (struct event_queue *eq, uint64_t window);
+int event_queue_set_move_window (struct event_queue *eq,
+                                 uint64_t window);
+int event_queue_set_quota      (struct event_queue *eq, int quota);
+int event_queue_set_batch      (struct event_queue *eq,
+                                size_t bytes,
+                                int events,
+                                uint64_t delay);
+uint64_t event_queue_get_latency (struct event_queue *eq, unsigned permille);
+uint64_t event_queue_batch_deadline (struct event_queue *eq);
 
 int  event_queue_enqueue       (struct event_queue *eq,
                                 int                 wd,
                                 uint32_t            mask,
                                 uint32_t            cookie,
                                 const char         *name);
+int  event_queue_rewrite       (struct event_queue *eq,
+                                int                 wd,
+                                const char         *name,
+                                uint32_t            from,
+                                uint32_t            to,
+                                uint32_t            cookie);
+void event_queue_place         (struct event_queue *eq, int index);
 ssize_t event_queue_flush      (struct event_queue *eq, size_t sbspace);
 void    event_queue_reset_last (struct event_queue *eq);
 
@@ -0,0 +1,547 @@
+/*******************************************************************************
+  Copyright (c) 2026 agent <agent@local>
+  SPDX-License-Identifier: MIT
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in
+  all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+  THE SOFTWARE.
+*******************************************************************************/
+
+#include "compat.h"
+
+#include <sys/types.h>
+#include <sys/mman.h>  /* mmap */
+#include <sys/uio.h>   /* iovec */
+
+#include <assert.h>    /* assert */
+#include <stddef.h>    /* offsetof */
+#include <stdlib.h>    /* malloc */
+#include <string.h>    /* memcpy */
+
+#include "sys/inotify.h"
+
+#include "event-ring.h"
+#include "utils.h"
+
+#ifndef MAP_ANON
+#define MAP_ANON MAP_ANONYMOUS
+#endif
+
+/*
+ * Atomically store a value to a variable modified only by the calling thread.
+ * Minimal atomics fallback provides no atomic_store, so emulate it.
+ */
+#define ring_store(object, value) \
+    atomic_fetch_add ((object), (value) - atomic_load (object))
+
+/**
+ * Create a shared memory event ring.
+ *
+ * @param[in] size A size of ring buffer in bytes. Must be a power of 2.
+ * @return A pointer to #event_ring on success, NULL otherwise.
+ **/
+struct event_ring *
+event_ring_create (unsigned int size)
+{
+    struct event_ring *er;
+
+    assert (size >= sizeof (struct inotify_event) + NAME_MAX + 8);
+    assert ((size & (size - 1)) == 0);
+
+    er = calloc (1, sizeof (struct event_ring));
+    if (er == NULL) {
+        perror_msg (("Failed to allocate event ring"));
+        return NULL;
+    }
+
+    er->data = mmap (NULL,
+                     size,
+                     PROT_READ | PROT_WRITE,
+                     MAP_ANON | MAP_PRIVATE,
+                     -1,
+                     0);
+    if (er->data == MAP_FAILED) {
+        perror_msg (("Failed to map %u bytes of event ring", size));
+        free (er);
+        return NULL;
+    }
+
+    er->size = size;
+    atomic_init (&er->head, 0);
+    atomic_init (&er->tail, 0);
+    /* No gap skipped yet. Point out of range of the first lap */
+    atomic_init (&er->pad_at, size);
+    atomic_init (&er->doorbell, 0);
+    atomic_init (&er->starved, 0);
+    return er;
+}
+
+/**
+ * Free a shared memory event ring.
+ *
+ * @param[in] er A pointer to #event_ring.
+ **/
+void
+event_ring_free (struct event_ring *er)
+{
+    if (er == NULL) {
+        return;
+    }
+
+    munmap (er->data, er->size);
+    free (er);
+}
+
+/**
+ * Copy inotify events to the ring. Producer side.
+ *
+ * If ring has not enough free space for all the events, the producer is
+ * marked starved and consumer is expected to wake it up on release.
+ *
+ * @param[in] er     A pointer to #event_ring.
+ * @param[in] iov    An array of iovec buffers each holding an inotify event.
+ * @param[in] iovcnt A number of iovec buffers.
+ * @return Number of events copied.
+ **/
+int
+event_ring_write (struct event_ring *er, const struct iovec iov[], int iovcnt)
+{
+    unsigned int head = atomic_load (&er->head);
+    unsigned int tail = atomic_load (&er->tail);
+    unsigned int start = head;
+    int i;
+
+    for (i = 0; i < iovcnt; i++) {
+        const struct inotify_event *ie = iov[i].iov_base;
+        uint32_t len = (ie->len + 7) & ~7;
+        unsigned int rec = offsetof (struct inotify_event, name) + len;
+        unsigned int off = head & (er->size - 1);
+        unsigned int gap = er->size - off;
+        unsigned int need = rec <= gap ? rec : gap + rec;
+        struct inotify_event *dst;
+
+        if (er->size - (head - tail) < need) {
+            tail = atomic_load (&er->tail);
+        }
+        if (er->size - (head - tail) < need) {
+            /* Ask consumer to wake us up and recheck to not miss release */
+            if (atomic_load (&er->starved) == 0) {
+                atomic_fetch_add (&er->starved, 1);
+            }
+            tail = atomic_load (&er->tail);
+            if (er->size - (head - tail) < need) {
+                break;
+            }
+        }
+
+        if (rec > gap) {
+            /* Consumer has passed previous gap as we have enough space */
+            ring_store (&er->pad_at, head);
+            head += gap;
+            off = 0;
+        }
+
+        dst = (struct inotify_event *)(er->data + off);
+        memcpy (dst, ie, offsetof (struct inotify_event, name) + ie->len);
+        memset (dst->name + ie->len, 0, len - ie->len);
+        dst->len = len;
+        head += rec;
+    }
+
+    if (head != start) {
+        /* Publish new records */
+        atomic_fetch_add (&er->head, head - start);
+    }
+
+    return i;
+}
+
+/**
+ * Check if consumer should be notified about new events. Producer side.
+ * Consumer is notified only once until it rearms notifications.
+ *
+ * @param[in] er A pointer to #event_ring.
+ * @return true if doorbell should be rung, false otherwise.
+ **/
+bool
+event_ring_notify (struct event_ring *er)
+{
+    return atomic_fetch_add (&er->doorbell, 1) == 0;
+}
+
+/**
+ * Check if all the events have been released by consumer.
+ *
+ * @param[in] er A pointer to #event_ring.
+ * @return true if ring is empty, false otherwise.
+ **/
+bool
+event_ring_empty (struct event_ring *er)
+{
+    return atomic_load (&er->head) == atomic_load (&er->tail);
+}
+
+/**
+ * Get contiguous block of events at the ring tail. Consumer side.
+ *
+ * @param[in]  er     A pointer to #event_ring.
+ * @param[out] events A pointer to the first event of the block.
+ * @param[out] wakeup Set to true if producer should be woken up.
+ * @return Length of the block in bytes, 0 if ring is empty.
+ **/
+int
+event_ring_peek (struct event_ring *er,
+                 const struct inotify_event **events,
+                 bool *wakeup)
+{
+    unsigned int head, tail, end, lap_end, pad_at;
+
+    for (;;) {
+        tail = atomic_load (&er->tail);
+        head = atomic_load (&er->head);
+        if (head == tail) {
+            return 0;
+        }
+
+        lap_end = (tail | (er->size - 1)) + 1;
+        end = head - tail < lap_end - tail ? head : lap_end;
+        pad_at = atomic_load (&er->pad_at);
+        /* Gap never starts at lap boundary, initial pad_at is not a gap */
+        if ((pad_at & (er->size - 1)) != 0 && pad_at - tail < end - tail) {
+            end = pad_at;
+        }
+
+        if (end != tail) {
+            *events = (const struct inotify_event *)
+                (er->data + (tail & (er->size - 1)));
+            return end - tail;
+        }
+
+        /* Skip gap at the buffer end */
+        if (event_ring_release (er, lap_end - tail)) {
+            *wakeup = true;
+        }
+    }
+}
+
+/**
+ * Check if events can be released from the ring tail. Consumer side.
+ * Released length must not exceed published events and must end on
+ * a record boundary.
+ *
+ * @param[in] er  A pointer to #event_ring.
+ * @param[in] len Number of bytes to release.
+ * @return true if len is valid, false otherwise.
+ **/
+bool
+event_ring_releasable (struct event_ring *er, unsigned int len)
+{
+    unsigned int tail = atomic_load (&er->tail);
+    unsigned int head = atomic_load (&er->head);
+    unsigned int pad_at = atomic_load (&er->pad_at);
+    unsigned int pos = tail;
+    const struct inotify_event *ie;
+
+    if (len > head - tail) {
+        return false;
+    }
+
+    while (pos - tail < len) {
+        if (pos == pad_at && (pad_at & (er->size - 1)) != 0) {
+            /* Skip gap at the buffer end */
+            pos = (pos | (er->size - 1)) + 1;
+        } else {
+            ie = (const struct inotify_event *)
+                (er->data + (pos & (er->size - 1)));
+            pos += offsetof (struct inotify_event, name) + ie->len;
+        }
+    }
+
+    return pos - tail == len;
+}
+
+/**
+ * Release events consumed from the ring tail. Consumer side.
+ *
+ * @param[in] er  A pointer to #event_ring.
+ * @param[in] len Number of bytes to release.
+ * @return true if producer waits for free space and should be woken up.
+ **/
+bool
+event_ring_release (struct event_ring *er, unsigned int len)
+{
+    atomic_fetch_add (&er->tail, len);
+
+    if (atomic_load (&er->starved) != 0) {
+        atomic_fetch_sub (&er->starved, 1);
+        return true;
+    }
+    return false;
+}
+
+/**
+ * Rearm consumer notifications. Consumer side.
+ * Caller should recheck the ring for events after rearming.
+ *
+ * @param[in] er A pointer to #event_ring.
+ **/
+void
+event_ring_rearm (struct event_ring *er)
+{
+    atomic_fetch_sub (&er->doorbell, atomic_load (&er->doorbell));
+}
+
+/**
+ * Create a queue of event blocks.
+ *
+ * @return A pointer to #event_blocks on success, NULL otherwise.
+ **/
+struct event_blocks *
+event_blocks_create (void)
+{
+    struct event_blocks *eb;
+
+    eb = calloc (1, sizeof (struct event_blocks));
+    if (eb == NULL) {
+        perror_msg (("Failed to allocate event block queue"));
+        return NULL;
+    }
+
+    atomic_init (&eb->head, 0);
+    atomic_init (&eb->tail, 0);
+    atomic_init (&eb->doorbell, 0);
+    atomic_init (&eb->starved, 0);
+    eb->consumed = 0;
+    return eb;
+}
+
+/**
+ * Free a queue of event blocks together with blocks not consumed by user.
+ *
+ * @param[in] eb A pointer to #event_blocks.
+ **/
+void
+event_blocks_free (struct event_blocks *eb)
+{
+    unsigned int i;
+
+    if (eb == NULL) {
+        return;
+    }
+
+    for (i = atomic_load (&eb->tail); i != atomic_load (&eb->head); i++) {
+        free (eb->block[i & (EVENT_BLOCKS_SIZE - 1)]);
+    }
+    free (eb);
+}
+
+/**
+ * Copy inotify events to a single memory block.
+ *
+ * @param[in] iov    An array of iovec buffers each holding an inotify event.
+ * @param[in] iovcnt A number of iovec buffers.
+ * @return NULL-terminated array of iovecs pointing to the copies of events
+ *     on success, NULL otherwise. Should be freed with a single free().
+ **/
+struct iovec *
+event_blocks_pack (const struct iovec iov[], int iovcnt)
+{
+    struct iovec *block;
+    size_t size = sizeof (struct iovec) * (iovcnt + 1);
+    char *data;
+    int i;
+
+    for (i = 0; i < iovcnt; i++) {
+        size += (iov[i].iov_len + 7) & ~7;
+    }
+
+    block = malloc (size);
+    if (block == NULL) {
+        perror_msg (("Failed to allocate event block of %zu bytes", size));
+        return NULL;
+    }
+
+    /* Keep events 8-byte aligned */
+    data = (char *)&block[iovcnt + 1];
+    for (i = 0; i < iovcnt; i++) {
+        memcpy (data, iov[i].iov_base, iov[i].iov_len);
+        block[i].iov_base = data;
+        block[i].iov_len = iov[i].iov_len;
+        data += (iov[i].iov_len + 7) & ~7;
+    }
+    block[iovcnt].iov_base = NULL;
+    block[iovcnt].iov_len = 0;
+
+    return block;
+}
+
+/**
+ * Put a block of events to the queue. Producer side.
+ *
+ * If queue is full, the producer is marked starved and consumer is expected
+ * to wake it up on pop.
+ *
+ * @param[in] eb    A pointer to #event_blocks.
+ * @param[in] block A block of events created with event_blocks_pack().
+ * @return true on success, false if queue is full.
+ **/
+bool
+event_blocks_push (struct event_blocks *eb, struct iovec *block)
+{
+    unsigned int head = atomic_load (&eb->head);
+
+    if (head - atomic_load (&eb->tail) == EVENT_BLOCKS_SIZE) {
+        /* Ask consumer to wake us up and recheck to not miss pop */
+        if (atomic_load (&eb->starved) == 0) {
+            atomic_fetch_add (&eb->starved, 1);
+        }
+        if (head - atomic_load (&eb->tail) == EVENT_BLOCKS_SIZE) {
+            return false;
+        }
+    }
+
+    eb->block[head & (EVENT_BLOCKS_SIZE - 1)] = block;
+    /* Publish new block */
+    atomic_fetch_add (&eb->head, 1);
+    return true;
+}
+
+/**
+ * Check if consumer should be notified about new blocks. Producer side.
+ * Consumer is notified only once until it rearms notifications.
+ *
+ * @param[in] eb A pointer to #event_blocks.
+ * @return true if consumer should be notified, false otherwise.
+ **/
+bool
+event_blocks_notify (struct event_blocks *eb)
+{
+    return atomic_fetch_add (&eb->doorbell, 1) == 0;
+}
+
+/**
+ * Check if all the blocks have been taken by consumer.
+ *
+ * @param[in] eb A pointer to #event_blocks.
+ * @return true if queue is empty, false otherwise.
+ **/
+bool
+event_blocks_empty (struct event_blocks *eb)
+{
+    return atomic_load (&eb->head) == atomic_load (&eb->tail);
+}
+
+/**
+ * Take blocks of events from the queue. Consumer side.
+ * Ownership of the blocks is passed to the caller.
+ *
+ * @param[in]  eb     A pointer to #event_blocks.
+ * @param[out] blocks An array to store blocks to.
+ * @param[in]  size   Size of the array.
+ * @param[out] wakeup Set to true if producer should be woken up.
+ * @return Number of blocks taken.
+ **/
+int
+event_blocks_pop (struct event_blocks *eb,
+                  struct iovec **blocks,
+                  int size,
+                  bool *wakeup)
+{
+    unsigned int tail = atomic_load (&eb->tail);
+    unsigned int head = atomic_load (&eb->head);
+    int i;
+
+    for (i = 0; i < size && tail + i != head; i++) {
+        blocks[i] = eb->block[(tail + i) & (EVENT_BLOCKS_SIZE - 1)];
+    }
+
+    if (i > 0) {
+        if (eb->consumed != 0) {
+            /* Drop events already copied out by event_blocks_read() */
+            struct iovec *iov = blocks[0] + eb->consumed;
+            int n = 0;
+
+            while (iov[n++].iov_base != NULL)
+                ;
+            memmove (blocks[0], iov, sizeof (struct iovec) * n);
+            eb->consumed = 0;
+        }
+        atomic_fetch_add (&eb->tail, i);
+        if (atomic_load (&eb->starved) != 0) {
+            atomic_fetch_sub (&eb->starved, 1);
+            *wakeup = true;
+        }
+    }
+    return i;
+}
+
+/**
+ * Copy events from the queue to a buffer in standard inotify layout.
+ * Consumer side. Blocks are freed once all their events are copied.
+ *
+ * @param[in]  eb     A pointer to #event_blocks.
+ * @param[out] buf    A buffer to store events to.
+ * @param[in]  len    Size of the buffer.
+ * @param[out] wakeup Set to true if producer should be woken up.
+ * @return Number of bytes copied on success, -1 if the buffer is too small
+ *     to hold the first event.
+ **/
+ssize_t
+event_blocks_read (struct event_blocks *eb,
+                   char *buf,
+                   size_t len,
+                   bool *wakeup)
+{
+    unsigned int tail = atomic_load (&eb->tail);
+    struct iovec *block, *iov;
+    size_t done = 0;
+
+    while (tail != atomic_load (&eb->head)) {
+        block = eb->block[tail & (EVENT_BLOCKS_SIZE - 1)];
+        for (iov = block + eb->consumed; iov->iov_base != NULL; iov++) {
+            if (iov->iov_len > len - done) {
+                return done == 0 ? -1 : done;
+            }
+            memcpy (buf + done, iov->iov_base, iov->iov_len);
+            done += iov->iov_len;
+            ++eb->consumed;
+        }
+
+        free (block);
+        eb->consumed = 0;
+        atomic_fetch_add (&eb->tail, 1);
+        if (atomic_load (&eb->starved) != 0) {
+            atomic_fetch_sub (&eb->starved, 1);
+            *wakeup = true;
+        }
+        ++tail;
+    }
+
+    return done;
+}
+
+/**
+ * Rearm consumer notifications. Consumer side.
+ * Caller should recheck the queue for blocks after rearming.
+ *
+ * @param[in] eb A pointer to #event_blocks.
+ **/
+void
+event_blocks_rearm (struct event_blocks *eb)
+{
+    atomic_fetch_sub (&eb->doorbell, atomic_load (&eb->doorbell));
+}
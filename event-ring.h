@@ -0,0 +1,107 @@
+/*******************************************************************************
+  Copyright (c) 2026 agent <agent@local>
+  SPDX-License-Identifier: MIT
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in
+  all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+  THE SOFTWARE.
+*******************************************************************************/
+
+#ifndef __EVENT_RING_H__
+#define __EVENT_RING_H__
+
+#include <sys/types.h> /* size_t */
+#include <sys/uio.h>   /* iovec */
+
+#include "compat.h"
+#include "sys/inotify.h"
+
+/* Size of shared memory event ring in bytes. Must be a power of 2 */
+#define EVENT_RING_SIZE (64 * 1024)
+/* Number of event blocks queued for direct mode. Must be a power of 2 */
+#define EVENT_BLOCKS_SIZE 64
+
+/**
+ * Single-producer/single-consumer ring of inotify events shared between
+ * worker thread (producer) and user thread (consumer).
+ *
+ * Events are stored contiguously in standard inotify_event layout, names are
+ * NUL-padded to make every record 8-byte aligned. Records never wrap around
+ * buffer end: the tail gap which is too short for the next record is skipped
+ * and its position is published in pad_at. Positions are free-running
+ * counters, so head == tail means empty ring.
+ **/
+struct event_ring {
+    char *data;            /* mmap`ed ring buffer */
+    unsigned int size;     /* size of ring buffer in bytes */
+    atomic_uint head;      /* producer position */
+    atomic_uint tail;      /* consumer position */
+    atomic_uint pad_at;    /* position of the latest skipped tail gap */
+    atomic_uint doorbell;  /* non-zero if consumer has been notified */
+    atomic_uint starved;   /* non-zero if producer waits for free space */
+};
+
+struct event_ring *event_ring_create (unsigned int size);
+void               event_ring_free   (struct event_ring *er);
+
+int  event_ring_write   (struct event_ring *er,
+                         const struct iovec iov[],
+                         int iovcnt);
+bool event_ring_notify  (struct event_ring *er);
+bool event_ring_empty   (struct event_ring *er);
+
+int  event_ring_peek    (struct event_ring *er,
+                         const struct inotify_event **events,
+                         bool *wakeup);
+bool event_ring_releasable (struct event_ring *er, unsigned int len);
+bool event_ring_release (struct event_ring *er, unsigned int len);
+void event_ring_rearm   (struct event_ring *er);
+
+/**
+ * Single-producer/single-consumer queue of event blocks handed over to user
+ * in direct mode. Every block is a single memory allocation holding
+ * NULL-terminated iovec array followed by inotify events it points to.
+ **/
+struct event_blocks {
+    struct iovec *block[EVENT_BLOCKS_SIZE];
+    atomic_uint head;      /* producer position */
+    atomic_uint tail;      /* consumer position */
+    atomic_uint doorbell;  /* non-zero if consumer has been notified */
+    atomic_uint starved;   /* non-zero if producer waits for free slot */
+    unsigned int consumed; /* number of events of the first block copied
+                              out by event_blocks_read(). Consumer only */
+};
+
+struct event_blocks *event_blocks_create (void);
+void                 event_blocks_free   (struct event_blocks *eb);
+
+struct iovec *event_blocks_pack (const struct iovec iov[], int iovcnt);
+bool event_blocks_push   (struct event_blocks *eb, struct iovec *block);
+bool event_blocks_notify (struct event_blocks *eb);
+bool event_blocks_empty  (struct event_blocks *eb);
+
+int  event_blocks_pop    (struct event_blocks *eb,
+                          struct iovec **blocks,
+                          int size,
+                          bool *wakeup);
+ssize_t event_blocks_read (struct event_blocks *eb,
+                           char *buf,
+                           size_t len,
+                           bool *wakeup);
+void event_blocks_rearm  (struct event_blocks *eb);
+
+#endif /* __EVENT_RING_H__ */
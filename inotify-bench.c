@@ -0,0 +1,1359 @@
+/*******************************************************************************
+  Copyright (c) 2026 agent <agent@local>
+  SPDX-License-Identifier: MIT
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in
+  all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+  THE SOFTWARE.
+*******************************************************************************/
+
+
+/*
+ * Benchmark of inotify implementation hot paths.
+ *
+ * Every scenario prints one line of JSON with its results to stdout, so
+ * runs against native Linux inotify and against libinotify (built on top
+ * of kqueue or its emulation) can be compared by scripts.
+ *
+ * Usage: inotify-bench [-n count] [scenario ...]
+ *        inotify-bench -s script    (simulator build only)
+ *        inotify-bench -r recording (simulator build only)
+ */
+
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <search.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/inotify.h>
+
+#if defined (BENCH_SIMULATOR)
+#define BACKEND "sim"
+#elif defined (BENCH_LIBINOTIFY)
+#define BACKEND "libinotify"
+#else
+#define BACKEND "native"
+#endif
+
+#ifdef BENCH_SIMULATOR
+/* File system is kept in memory of libinotify simulator build */
+#include "sim/sim.h"
+#define mkdir(path, mode)   sim_mkdir ((path), (mode))
+#define rename(from, to)    sim_rename ((from), (to))
+#define unlink(path)        sim_unlink ((path))
+#define utimes(path, times) sim_utimes ((path), (times))
+#include "recorder.h"
+#endif
+
+#define WORKDIR  "bench-working"
+#define IDLE_MS  2000 /* give up waiting for events after this time */
+#define DEPTH    64   /* number of nested directories in deep tree */
+#define NINST    64   /* number of instances in many instances scenario */
+#define NBUSY    16   /* number of directories in busy directories scenario */
+
+struct bench_result {
+    size_t count;        /* number of operations done by scenario */
+    size_t events;       /* number of events received */
+    size_t overflows;    /* number of IN_Q_OVERFLOW events received */
+    uint64_t elapsed;    /* time to receive events, ns */
+    uint64_t add_time;   /* total time of inotify_add_watch calls, ns */
+    size_t adds;         /* number of inotify_add_watch calls */
+    uint64_t rm_time;    /* total time of inotify_rm_watch calls, ns */
+    size_t rms;          /* number of inotify_rm_watch calls */
+    uint64_t rescan_time; /* time spent in directory rescans, ns */
+    size_t rescans;      /* number of directory rescans */
+    int fds;             /* number of open file descriptors at the peak */
+};
+
+static uint64_t
+now_ns (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int
+count_fds (void)
+{
+    int fd, max = getdtablesize (), count = 0;
+
+    for (fd = 0; fd < max; fd++) {
+        if (fcntl (fd, F_GETFD) != -1) {
+            ++count;
+        }
+    }
+    return count;
+}
+
+static void
+make_file (const char *fmt, ...)
+    __attribute__ ((format (printf, 1, 2)));
+
+static void
+make_file (const char *fmt, ...)
+{
+    char path[FILENAME_MAX];
+    va_list ap;
+    int fd;
+
+    va_start (ap, fmt);
+    vsnprintf (path, sizeof (path), fmt, ap);
+    va_end (ap);
+
+#ifdef BENCH_SIMULATOR
+    fd = sim_create (path, 0644);
+#else
+    fd = open (path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+#endif
+    if (fd == -1) {
+        perror (path);
+        exit (1);
+    }
+#ifndef BENCH_SIMULATOR
+    close (fd);
+#endif
+}
+
+static void
+cleanup (void)
+{
+#ifdef BENCH_SIMULATOR
+    sim_rmtree (WORKDIR);
+#else
+    system ("rm -rf " WORKDIR);
+#endif
+}
+
+static void
+setup (void)
+{
+    cleanup ();
+    if (mkdir (WORKDIR, 0755) == -1) {
+        perror (WORKDIR);
+        exit (1);
+    }
+}
+
+static int
+add_watch (int fd, const char *path, uint32_t mask, struct bench_result *r)
+{
+    uint64_t started = now_ns ();
+    int wd = inotify_add_watch (fd, path, mask);
+
+    if (wd == -1) {
+        perror (path);
+        exit (1);
+    }
+    r->add_time += now_ns () - started;
+    ++r->adds;
+    return wd;
+}
+
+static void
+rm_watch (int fd, int wd, struct bench_result *r)
+{
+    uint64_t started = now_ns ();
+
+    inotify_rm_watch (fd, wd);
+    r->rm_time += now_ns () - started;
+    ++r->rms;
+}
+
+/*
+ * Read events until the given number of events matching mask is received
+ * or no events arrive for IDLE_MS. Sleep for delay us between reads of
+ * len bytes to simulate slow consumer.
+ */
+static size_t
+drain (int fd, uint32_t mask, size_t want, size_t len, useconds_t delay,
+       struct bench_result *r)
+{
+    union {
+        uint64_t align;
+        char buf[65536];
+    } u;
+    struct inotify_event *ie;
+    struct pollfd pfd;
+    size_t matched = 0;
+    ssize_t got, off;
+
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    if (len > sizeof (u)) {
+        len = sizeof (u);
+    }
+
+    while (matched < want && poll (&pfd, 1, IDLE_MS) == 1) {
+        got = read (fd, u.buf, len);
+        if (got <= 0) {
+            break;
+        }
+        for (off = 0; off < got; off += sizeof (*ie) + ie->len) {
+            ie = (struct inotify_event *)(u.buf + off);
+            ++r->events;
+            if (ie->mask & IN_Q_OVERFLOW) {
+                ++r->overflows;
+            }
+            if (ie->mask & mask) {
+                ++matched;
+            }
+        }
+        if (delay != 0) {
+            usleep (delay);
+        }
+    }
+    return matched;
+}
+
+static void
+collect_stats (int fd, struct bench_result *r)
+{
+    int fds = count_fds ();
+
+    if (fds > r->fds) {
+        r->fds = fds;
+    }
+#ifdef BENCH_LIBINOTIFY
+    struct libinotify_stats stats;
+    if (libinotify_get_stats (fd, &stats) == 0) {
+        r->rescans += stats.rescans;
+        r->rescan_time += stats.rescan_time;
+    }
+#else
+    (void)fd;
+#endif
+}
+
+static void
+report (const char *scenario, const struct bench_result *r)
+{
+    struct rusage ru;
+    double secs = r->elapsed / 1e9;
+
+    getrusage (RUSAGE_SELF, &ru);
+    printf ("{\"scenario\":\"%s\",\"backend\":\"%s\",\"count\":%zu,"
+            "\"events\":%zu,\"overflows\":%zu,\"events_per_sec\":%.0f,"
+            "\"add_us\":%.1f,\"remove_us\":%.1f,\"rescan_us\":%.1f,"
+            "\"maxrss_kb\":%ld,\"fds\":%d}\n",
+            scenario, BACKEND, r->count, r->events, r->overflows,
+            secs > 0 ? r->events / secs : 0.0,
+            r->adds ? r->add_time / 1e3 / r->adds : 0.0,
+            r->rms ? r->rm_time / 1e3 / r->rms : 0.0,
+            r->rescans ? r->rescan_time / 1e3 / r->rescans : 0.0,
+            (long)ru.ru_maxrss, r->fds);
+    fflush (stdout);
+}
+
+/* Many files created in a watched directory */
+static void
+bench_create_storm (size_t n, struct bench_result *r)
+{
+    uint64_t started;
+    size_t i;
+    int fd, wd;
+
+    fd = inotify_init ();
+    wd = add_watch (fd, WORKDIR, IN_CREATE, r);
+
+    started = now_ns ();
+    for (i = 0; i < n; i++) {
+        make_file (WORKDIR "/%zu", i);
+    }
+    drain (fd, IN_CREATE, n, SIZE_MAX, 0, r);
+    r->elapsed = now_ns () - started;
+    r->count = n;
+
+    collect_stats (fd, r);
+    rm_watch (fd, wd, r);
+    close (fd);
+}
+
+/* Many files renamed inside a watched directory */
+static void
+bench_rename_storm (size_t n, struct bench_result *r)
+{
+    char from[FILENAME_MAX], to[FILENAME_MAX];
+    uint64_t started;
+    size_t i;
+    int fd, wd;
+
+    for (i = 0; i < n; i++) {
+        make_file (WORKDIR "/%zu", i);
+    }
+    fd = inotify_init ();
+    wd = add_watch (fd, WORKDIR, IN_MOVE, r);
+
+    started = now_ns ();
+    for (i = 0; i < n; i++) {
+        snprintf (from, sizeof (from), WORKDIR "/%zu", i);
+        snprintf (to, sizeof (to), WORKDIR "/%zu.new", i);
+        rename (from, to);
+    }
+    drain (fd, IN_MOVE, 2 * n, SIZE_MAX, 0, r);
+    r->elapsed = now_ns () - started;
+    r->count = n;
+
+    collect_stats (fd, r);
+    rm_watch (fd, wd, r);
+    close (fd);
+}
+
+/* Every directory of a deep tree watched like recursive watchers do */
+static void
+bench_deep_tree (size_t n, struct bench_result *r)
+{
+    char path[FILENAME_MAX];
+    int wds[DEPTH];
+    uint64_t started;
+    size_t i, j, len, width = n / DEPTH;
+    int fd;
+
+    strcpy (path, WORKDIR);
+    for (i = 0; i < DEPTH; i++) {
+        len = strlen (path);
+        snprintf (path + len, sizeof (path) - len, "/d");
+        mkdir (path, 0755);
+        for (j = 0; j < width; j++) {
+            make_file ("%s/%zu", path, j);
+        }
+    }
+
+    fd = inotify_init ();
+    strcpy (path, WORKDIR);
+    for (i = 0; i < DEPTH; i++) {
+        strcat (path, "/d");
+        wds[i] = add_watch (fd, path, IN_CREATE | IN_DELETE | IN_ATTRIB, r);
+    }
+
+    /* Touch a file on every level */
+    started = now_ns ();
+    strcpy (path, WORKDIR);
+    for (i = 0; i < DEPTH; i++) {
+        strcat (path, "/d");
+        make_file ("%s/new", path);
+    }
+    drain (fd, IN_CREATE, DEPTH, SIZE_MAX, 0, r);
+    r->elapsed = now_ns () - started;
+    r->count = DEPTH * (width + 1);
+
+    collect_stats (fd, r);
+    for (i = 0; i < DEPTH; i++) {
+        rm_watch (fd, wds[i], r);
+    }
+    close (fd);
+}
+
+/* Directory with large number of entries */
+static void
+bench_large_dir (size_t n, struct bench_result *r)
+{
+    uint64_t started;
+    size_t i;
+    int fd, wd;
+
+    for (i = 0; i < n; i++) {
+        make_file (WORKDIR "/file%07zu", i);
+    }
+
+    fd = inotify_init ();
+    wd = add_watch (fd, WORKDIR, IN_CREATE | IN_DELETE | IN_MOVE, r);
+
+    /* Every change makes libinotify rescan the whole directory */
+    started = now_ns ();
+    for (i = 0; i < 10; i++) {
+        make_file (WORKDIR "/new%zu", i);
+        drain (fd, IN_CREATE, 1, SIZE_MAX, 0, r);
+    }
+    r->elapsed = now_ns () - started;
+    r->count = n;
+
+    collect_stats (fd, r);
+    rm_watch (fd, wd, r);
+    close (fd);
+}
+
+/* Large directories changed at once, listed by the rescan thread pool */
+static void
+bench_busy_dirs (size_t n, struct bench_result *r)
+{
+    char path[FILENAME_MAX];
+    uint64_t started;
+    size_t i, j;
+    int fd, wds[NBUSY];
+
+    for (i = 0; i < NBUSY; i++) {
+        snprintf (path, sizeof (path), WORKDIR "/%zu", i);
+        mkdir (path, 0755);
+        for (j = 0; j < n; j++) {
+            make_file ("%s/file%07zu", path, j);
+        }
+    }
+
+    fd = inotify_init ();
+#ifdef BENCH_LIBINOTIFY
+    libinotify_set_param (fd, IN_RESCAN_ASYNC, 1);
+    libinotify_set_param (fd, IN_RESCAN_THREADS, 0);
+#endif
+    for (i = 0; i < NBUSY; i++) {
+        snprintf (path, sizeof (path), WORKDIR "/%zu", i);
+        wds[i] = add_watch (fd, path, IN_CREATE | IN_DELETE | IN_MOVE, r);
+    }
+
+    started = now_ns ();
+    for (j = 0; j < 10; j++) {
+        for (i = 0; i < NBUSY; i++) {
+            make_file (WORKDIR "/%zu/new%zu", i, j);
+        }
+        drain (fd, IN_CREATE, NBUSY, SIZE_MAX, 0, r);
+    }
+    r->elapsed = now_ns () - started;
+    r->count = n * NBUSY;
+
+    collect_stats (fd, r);
+    for (i = 0; i < NBUSY; i++) {
+        rm_watch (fd, wds[i], r);
+    }
+    close (fd);
+}
+
+/* Many inotify instances watching a directory each */
+static void
+bench_many_instances (size_t n, struct bench_result *r)
+{
+    int fds[NINST], wds[NINST];
+    char path[FILENAME_MAX];
+    uint64_t started;
+    size_t i, ninst;
+
+    (void)n;
+
+    for (i = 0; i < NINST; i++) {
+        snprintf (path, sizeof (path), WORKDIR "/%zu", i);
+        mkdir (path, 0755);
+        make_file ("%s/file", path);
+    }
+
+    /* Stop at per-user instance limit */
+    for (ninst = 0; ninst < NINST; ninst++) {
+        snprintf (path, sizeof (path), WORKDIR "/%zu", ninst);
+        fds[ninst] = inotify_init ();
+        if (fds[ninst] == -1) {
+            break;
+        }
+        wds[ninst] = add_watch (fds[ninst], path, IN_ATTRIB, r);
+    }
+
+    started = now_ns ();
+    for (i = 0; i < ninst; i++) {
+        snprintf (path, sizeof (path), WORKDIR "/%zu/file", i);
+        utimes (path, NULL);
+    }
+    for (i = 0; i < ninst; i++) {
+        drain (fds[i], IN_ATTRIB, 1, SIZE_MAX, 0, r);
+    }
+    r->elapsed = now_ns () - started;
+    r->count = ninst;
+
+    for (i = 0; i < ninst; i++) {
+        collect_stats (fds[i], r);
+    }
+    for (i = 0; i < ninst; i++) {
+        rm_watch (fds[i], wds[i], r);
+        close (fds[i]);
+    }
+}
+
+/* Consumer reading events in small portions with delays */
+static void
+bench_slow_consumer (size_t n, struct bench_result *r)
+{
+    uint64_t started;
+    size_t i;
+    int fd, wd;
+
+    fd = inotify_init ();
+    wd = add_watch (fd, WORKDIR, IN_CREATE | IN_DELETE, r);
+
+    started = now_ns ();
+    for (i = 0; i < n; i++) {
+        make_file (WORKDIR "/%zu", i);
+        if (i % 2) {
+            char path[FILENAME_MAX];
+            snprintf (path, sizeof (path), WORKDIR "/%zu", i);
+            unlink (path);
+        }
+    }
+    drain (fd, IN_CREATE | IN_DELETE, n + n / 2, 1024, 1000, r);
+    r->elapsed = now_ns () - started;
+    r->count = n;
+
+    collect_stats (fd, r);
+    rm_watch (fd, wd, r);
+    close (fd);
+}
+
+/* Watch mask repeatedly extended with IN_MASK_ADD and reset back */
+static void
+bench_mask_add_churn (size_t n, struct bench_result *r)
+{
+    size_t i, files = n / 10;
+    int fd, wd = -1;
+
+    for (i = 0; i < files; i++) {
+        make_file (WORKDIR "/%zu", i);
+    }
+
+    fd = inotify_init ();
+    for (i = 0; i < 100; i++) {
+        wd = add_watch (fd, WORKDIR, IN_CREATE, r);
+        add_watch (fd, WORKDIR, IN_ATTRIB | IN_MASK_ADD, r);
+    }
+    r->count = files;
+
+    collect_stats (fd, r);
+    rm_watch (fd, wd, r);
+    close (fd);
+}
+
+#ifdef BENCH_SIMULATOR
+/*
+ * File system calls made by inotify_add_watch of a file not watched yet:
+ * one open and one stat which is passed down to watch initialization.
+ */
+#define ADD_OPENS 1
+#define ADD_STATS 1
+/*
+ * Files added again are found with a single stat, only the first is opened.
+ * Unless watches are opened with O_PATH or O_EVTONLY, read permission is
+ * also checked with faccessat.
+ */
+#define READD_OPENS 1
+#define READD_STATS 2
+/*
+ * Directory watch mask change not altering subfile kqueue filters updates
+ * only the directory itself after the worker is woken up. Other changes
+ * are registered in batches.
+ */
+#define UPDATE_KEVENTS 2
+#define UPDATE_BATCH 64
+
+/*
+ * Watches added to many files and to a directory with many files. Fails
+ * if adding a watch costs more file system calls than expected.
+ */
+static void
+bench_add_syscalls (size_t n, struct bench_result *r)
+{
+    struct sim_syscalls before, after;
+    size_t i;
+    int fd, wd = -1;
+
+    mkdir (WORKDIR "/files", 0755);
+    mkdir (WORKDIR "/dir", 0755);
+    for (i = 0; i < n; i++) {
+        make_file (WORKDIR "/files/%zu", i);
+        make_file (WORKDIR "/dir/%zu", i);
+    }
+
+    fd = inotify_init ();
+    sim_get_syscalls (&before);
+    for (i = 0; i < n; i++) {
+        char path[FILENAME_MAX];
+        snprintf (path, sizeof (path), WORKDIR "/files/%zu", i);
+        add_watch (fd, path, IN_MODIFY, r);
+    }
+    sim_get_syscalls (&after);
+
+    if (after.opens - before.opens > n * ADD_OPENS ||
+        after.stats - before.stats > n * ADD_STATS) {
+        fprintf (stderr, "add_syscalls: %lu opens and %lu stats to watch "
+                 "%zu files\n", after.opens - before.opens,
+                 after.stats - before.stats, n);
+        exit (1);
+    }
+
+    /* Watches are updated after the first one is found to be added */
+    sim_get_syscalls (&before);
+    for (i = 0; i < n; i++) {
+        char path[FILENAME_MAX];
+        snprintf (path, sizeof (path), WORKDIR "/files/%zu", i);
+        add_watch (fd, path, IN_ATTRIB | IN_MASK_ADD, r);
+    }
+    sim_get_syscalls (&after);
+    collect_stats (fd, r);
+    close (fd);
+
+    if (after.opens - before.opens > READD_OPENS ||
+        after.stats - before.stats > n * READD_STATS + ADD_STATS) {
+        fprintf (stderr, "add_syscalls: %lu opens and %lu stats to update "
+                 "%zu watches\n", after.opens - before.opens,
+                 after.stats - before.stats, n);
+        exit (1);
+    }
+
+    /* Directory itself is opened once more to be read */
+    fd = inotify_init ();
+    sim_get_syscalls (&before);
+    wd = add_watch (fd, WORKDIR "/dir", IN_MODIFY, r);
+    sim_get_syscalls (&after);
+
+    if (after.opens - before.opens > (n + 1) * ADD_OPENS + 1 ||
+        after.stats - before.stats > (n + 1) * ADD_STATS) {
+        fprintf (stderr, "add_syscalls: %lu opens and %lu stats to watch "
+                 "directory of %zu files\n", after.opens - before.opens,
+                 after.stats - before.stats, n);
+        exit (1);
+    }
+
+    /* IN_MOVE_SELF is not reported for subfiles */
+    sim_get_syscalls (&before);
+    add_watch (fd, WORKDIR "/dir", IN_MOVE_SELF | IN_MASK_ADD, r);
+    sim_get_syscalls (&after);
+
+    if (after.kevents - before.kevents > UPDATE_KEVENTS) {
+        fprintf (stderr, "add_syscalls: %lu kevents to update directory "
+                 "watch\n", after.kevents - before.kevents);
+        exit (1);
+    }
+
+    sim_get_syscalls (&before);
+    add_watch (fd, WORKDIR "/dir", IN_ATTRIB | IN_MASK_ADD, r);
+    sim_get_syscalls (&after);
+    collect_stats (fd, r);
+    rm_watch (fd, wd, r);
+    close (fd);
+
+    if (after.kevents - before.kevents >
+        UPDATE_KEVENTS + (n + UPDATE_BATCH - 1) / UPDATE_BATCH) {
+        fprintf (stderr, "add_syscalls: %lu kevents to update directory "
+                 "watch of %zu files\n", after.kevents - before.kevents, n);
+        exit (1);
+    }
+    r->count = n;
+}
+
+/*
+ * Read events until the flag is raised by the thread changing simulated
+ * file system and no more events arrive for IDLE_MS.
+ */
+static void
+read_until_done (int fd, volatile bool *done, struct bench_result *r)
+{
+    union {
+        uint64_t align;
+        char buf[65536];
+    } u;
+    struct inotify_event *ie;
+    struct pollfd pfd;
+    ssize_t got, off;
+
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    while (!*done || poll (&pfd, 1, IDLE_MS) == 1) {
+        if (poll (&pfd, 1, 10) != 1) {
+            continue;
+        }
+        got = read (fd, u.buf, sizeof (u));
+        if (got <= 0) {
+            break;
+        }
+        for (off = 0; off < got; off += sizeof (*ie) + ie->len) {
+            ie = (struct inotify_event *)(u.buf + off);
+            ++r->events;
+            if (ie->mask & IN_Q_OVERFLOW) {
+                ++r->overflows;
+            }
+        }
+    }
+}
+
+struct script_run {
+    FILE *fp;
+    size_t lineno;     /* number of failed line */
+    int error;         /* errno of failed line or 0 */
+    uint64_t elapsed;  /* time to run the script and process events, ns */
+    volatile bool done;
+};
+
+static void *
+script_thread (void *arg)
+{
+    struct script_run *sr = arg;
+    uint64_t started = now_ns ();
+
+    if (sim_run_script (sr->fp, &sr->lineno) == -1) {
+        sr->error = errno;
+    }
+    sim_settle ();
+    sr->elapsed = now_ns () - started;
+    sr->done = true;
+    return NULL;
+}
+
+/*
+ * Workload replayed from the script against watched WORKDIR. Time is
+ * measured until the worker has processed all the vnode events.
+ */
+static int
+bench_script (const char *path, struct bench_result *r)
+{
+    struct script_run sr;
+    pthread_t thread;
+    int fd, wd;
+
+    memset (&sr, 0, sizeof (sr));
+    sr.fp = fopen (path, "r");
+    if (sr.fp == NULL) {
+        perror (path);
+        return -1;
+    }
+
+    fd = inotify_init ();
+    wd = add_watch (fd, WORKDIR, IN_ALL_EVENTS, r);
+
+    /* Read events while the script runs to not overflow the queue */
+    pthread_create (&thread, NULL, script_thread, &sr);
+    read_until_done (fd, &sr.done, r);
+    pthread_join (thread, NULL);
+    fclose (sr.fp);
+    r->elapsed = sr.elapsed;
+
+    collect_stats (fd, r);
+    rm_watch (fd, wd, r);
+    close (fd);
+
+    if (sr.error != 0) {
+        fprintf (stderr, "%s:%zu: %s\n", path, sr.lineno, strerror (sr.error));
+        return -1;
+    }
+    return 0;
+}
+
+/* Directory entry of replayed listing */
+struct replay_dirent {
+    uint64_t inode;
+    mode_t mode;
+    const char *name;   /* points into recording, not NUL-terminated */
+    size_t namelen;
+};
+
+/* Replayed watch, indexed by recorded watch descriptor */
+struct replay_watch {
+    int wd;             /* live watch descriptor, -1 if not added yet */
+    char *path;         /* path in simulated file system */
+    struct replay_dirent *ents;  /* last listing sorted by inode */
+    size_t nents;
+};
+
+/* Path of the recorded inode in simulated file system */
+struct replay_node {
+    uint64_t inode;
+    char *path;
+};
+
+struct replay_run {
+    const char *data;   /* recording */
+    size_t size;
+    const char *raw;    /* payload of current record in recording */
+    int fd;             /* inotify instance */
+    struct replay_watch *watches;
+    size_t nwatches;
+    void *nodes;        /* tsearch(3) tree of #replay_node */
+    size_t records;     /* number of replayed records */
+    int error;          /* errno of failed record or 0 */
+    uint64_t elapsed;   /* time to replay and process events, ns */
+    struct bench_result *r;
+    volatile bool done;
+};
+
+static int
+replay_node_cmp (const void *a, const void *b)
+{
+    const struct replay_node *na = a, *nb = b;
+
+    return na->inode < nb->inode ? -1 : na->inode > nb->inode;
+}
+
+static int
+replay_dirent_cmp (const void *a, const void *b)
+{
+    const struct replay_dirent *da = a, *db = b;
+
+    return da->inode < db->inode ? -1 : da->inode > db->inode;
+}
+
+static const char *
+replay_lookup (struct replay_run *rr, uint64_t inode)
+{
+    struct replay_node key, **node;
+
+    key.inode = inode;
+    node = tfind (&key, &rr->nodes, replay_node_cmp);
+    return node != NULL ? (*node)->path : NULL;
+}
+
+static void
+replay_map (struct replay_run *rr, uint64_t inode, const char *path)
+{
+    struct replay_node *node, **found;
+
+    node = malloc (sizeof (*node));
+    node->inode = inode;
+    node->path = strdup (path);
+    found = tsearch (node, &rr->nodes, replay_node_cmp);
+    if (*found != node) {
+        /* Inode is renamed or is a hard link. Latest name is used */
+        free ((*found)->path);
+        (*found)->path = node->path;
+        free (node);
+    }
+}
+
+static void
+replay_unmap (struct replay_run *rr, uint64_t inode)
+{
+    struct replay_node key, **found, *node;
+
+    key.inode = inode;
+    found = tfind (&key, &rr->nodes, replay_node_cmp);
+    if (found != NULL) {
+        node = *found;
+        tdelete (&key, &rr->nodes, replay_node_cmp);
+        free (node->path);
+        free (node);
+    }
+}
+
+static struct replay_watch *
+replay_watch (struct replay_run *rr, int wd)
+{
+    struct replay_watch *watches;
+    size_t i, n;
+
+    if (wd < 0) {
+        return NULL;
+    }
+    if ((size_t)wd >= rr->nwatches) {
+        n = wd + 16;
+        watches = realloc (rr->watches, n * sizeof (*watches));
+        if (watches == NULL) {
+            return NULL;
+        }
+        memset (watches + rr->nwatches, 0,
+                (n - rr->nwatches) * sizeof (*watches));
+        for (i = rr->nwatches; i < n; i++) {
+            watches[i].wd = -1;
+        }
+        rr->watches = watches;
+        rr->nwatches = n;
+    }
+    return &rr->watches[wd];
+}
+
+/* Create the recorded file in simulated file system */
+static void
+replay_create (const char *path, mode_t mode)
+{
+    if (S_ISDIR (mode)) {
+        sim_mkdir (path, 0755);
+    } else {
+        sim_create (path, 0644);
+    }
+}
+
+/* Create directory with all missing parents */
+static void
+replay_mkdirs (char *path)
+{
+    char *p;
+
+    for (p = strchr (path + 1, '/'); p != NULL; p = strchr (p + 1, '/')) {
+        *p = '\0';
+        sim_mkdir (path, 0755);
+        *p = '/';
+    }
+}
+
+static char *
+replay_join (const char *dir, const struct replay_dirent *de)
+{
+    char *path = malloc (strlen (dir) + de->namelen + 2);
+
+    if (path != NULL) {
+        sprintf (path, "%s/%.*s", dir, (int)de->namelen, de->name);
+    }
+    return path;
+}
+
+/*
+ * Bring directory content in line with the listing. Entries are matched
+ * by recorded inode numbers, so renames are replayed as renames.
+ */
+static void
+replay_apply_listing (struct replay_run *rr,
+                      struct replay_watch *rw,
+                      struct replay_dirent *ents,
+                      size_t nents)
+{
+    struct replay_dirent *old;
+    char *from, *to, tmp[FILENAME_MAX];
+    size_t i, j;
+    int cmp;
+
+    /* Removed entries first, renamed ones are moved out of the way */
+    for (i = 0, j = 0; i < rw->nents; i++) {
+        old = &rw->ents[i];
+        while (j < nents && ents[j].inode < old->inode) {
+            j++;
+        }
+        from = replay_join (rw->path, old);
+        if (j < nents && ents[j].inode == old->inode) {
+            if (ents[j].namelen != old->namelen ||
+                memcmp (ents[j].name, old->name, old->namelen) != 0) {
+                snprintf (tmp, sizeof (tmp), "%s/.replay.%zu", rw->path, i);
+                sim_rename (from, tmp);
+            }
+        } else {
+            sim_rmtree (from);
+            replay_unmap (rr, old->inode);
+        }
+        free (from);
+    }
+
+    /* Then renamed and created entries are put in place */
+    for (i = 0, j = 0; j < nents; j++) {
+        while (i < rw->nents && rw->ents[i].inode < ents[j].inode) {
+            i++;
+        }
+        cmp = i < rw->nents && rw->ents[i].inode == ents[j].inode;
+        to = replay_join (rw->path, &ents[j]);
+        if (!cmp) {
+            replay_create (to, ents[j].mode);
+            replay_map (rr, ents[j].inode, to);
+        } else if (ents[j].namelen != rw->ents[i].namelen ||
+                   memcmp (ents[j].name, rw->ents[i].name,
+                           ents[j].namelen) != 0) {
+            snprintf (tmp, sizeof (tmp), "%s/.replay.%zu", rw->path, i);
+            sim_rename (tmp, to);
+            replay_map (rr, ents[j].inode, to);
+        }
+        free (to);
+    }
+
+    free (rw->ents);
+    rw->ents = ents;
+    rw->nents = nents;
+}
+
+static int
+replay_listing (struct replay_run *rr, const char *p, size_t size)
+{
+    const struct rec_listing *rl = (const struct rec_listing *)p;
+    struct rec_dirent rd;
+    struct replay_dirent *ents;
+    struct replay_watch *rw;
+    size_t i, off = sizeof (*rl);
+
+    rw = replay_watch (rr, rl->wd);
+    if (rw == NULL) {
+        return -1;
+    }
+    ents = calloc (rl->count + 1, sizeof (*ents));
+    if (ents == NULL) {
+        return -1;
+    }
+    for (i = 0; i < rl->count; i++) {
+        if (off + sizeof (rd) > size) {
+            free (ents);
+            errno = EINVAL;
+            return -1;
+        }
+        /* Dirents are written unpadded */
+        memcpy (&rd, p + off, sizeof (rd));
+        ents[i].inode = rd.inode;
+        ents[i].mode = (mode_t)rd.type << 12;
+        /* Names are kept in place for the next listings to compare with */
+        ents[i].name = rr->raw + off + sizeof (rd);
+        ents[i].namelen = rd.namelen;
+        off += sizeof (rd) + rd.namelen;
+    }
+    qsort (ents, rl->count, sizeof (*ents), replay_dirent_cmp);
+
+    if (rw->wd == -1) {
+        /* Listing of the watch being added, it is populated on addition */
+        free (rw->ents);
+        rw->ents = ents;
+        rw->nents = rl->count;
+        return 0;
+    }
+    replay_apply_listing (rr, rw, ents, rl->count);
+    return 0;
+}
+
+static int
+replay_add (struct replay_run *rr, const char *p)
+{
+    const struct rec_add *ra = (const struct rec_add *)p;
+    const char *path = p + sizeof (*ra);
+    struct replay_watch *rw;
+    char *to;
+    size_t i;
+    uint64_t started;
+
+    rw = replay_watch (rr, ra->wd);
+    if (rw == NULL) {
+        return -1;
+    }
+
+    if (rw->wd == -1) {
+        /* Recorded paths are recreated under the working directory */
+        while (*path == '/') {
+            path++;
+        }
+        free (rw->path);
+        rw->path = malloc (strlen (WORKDIR) + strlen (path) + 2);
+        if (rw->path == NULL) {
+            return -1;
+        }
+        sprintf (rw->path, "%s/%s", WORKDIR, path);
+        replay_mkdirs (rw->path);
+        replay_create (rw->path, ra->mode);
+        replay_map (rr, ra->inode, rw->path);
+        for (i = 0; i < rw->nents; i++) {
+            to = replay_join (rw->path, &rw->ents[i]);
+            replay_create (to, rw->ents[i].mode);
+            replay_map (rr, rw->ents[i].inode, to);
+            free (to);
+        }
+        sim_settle ();
+    }
+
+    started = now_ns ();
+    rw->wd = inotify_add_watch (rr->fd, rw->path, ra->mask);
+    if (rw->wd == -1) {
+        return -1;
+    }
+    rr->r->add_time += now_ns () - started;
+    ++rr->r->adds;
+    return 0;
+}
+
+static int
+replay_remove (struct replay_run *rr, const char *p)
+{
+    const struct rec_remove *rm = (const struct rec_remove *)p;
+    struct replay_watch *rw;
+
+    rw = replay_watch (rr, rm->wd);
+    if (rw == NULL || rw->wd == -1) {
+        errno = EINVAL;
+        return -1;
+    }
+    rm_watch (rr->fd, rw->wd, rr->r);
+    rw->wd = -1;
+    free (rw->ents);
+    rw->ents = NULL;
+    rw->nents = 0;
+    return 0;
+}
+
+/*
+ * Reproduce the change of the file reported with kevent. Directory
+ * content changes are reproduced from the listings following them.
+ */
+static int
+replay_kevent (struct replay_run *rr, const char *p)
+{
+    const struct rec_kevent *rk = (const struct rec_kevent *)p;
+    const char *path = replay_lookup (rr, rk->inode);
+
+    if (path == NULL) {
+        /* The file has gone with its directory already */
+        return 0;
+    }
+    if (!S_ISDIR (rk->mode) && rk->fflags & (NOTE_WRITE | NOTE_EXTEND)) {
+        sim_write (path, 1);
+    }
+    if (rk->fflags & NOTE_ATTRIB) {
+        sim_utimes (path, NULL);
+    }
+    if (rk->fflags & NOTE_REVOKE) {
+        sim_revoke (path);
+    }
+    if (rk->fflags & NOTE_DELETE) {
+        sim_rmtree (path);
+        replay_unmap (rr, rk->inode);
+    }
+    return 0;
+}
+
+static int
+replay_record (struct replay_run *rr, const struct rec_entry *re, const char *p)
+{
+    const struct rec_param *rp;
+
+    switch (re->type) {
+    case REC_ADD:
+        return replay_add (rr, p);
+    case REC_REMOVE:
+        return replay_remove (rr, p);
+    case REC_PARAM:
+        rp = (const struct rec_param *)p;
+        return libinotify_set_param (rr->fd, rp->param, rp->value);
+    case REC_KEVENT:
+        return replay_kevent (rr, p);
+    case REC_LISTING:
+        return replay_listing (rr, p, re->size);
+    default:
+        /* Records of newer versions are skipped */
+        return 0;
+    }
+}
+
+static void *
+replay_thread (void *arg)
+{
+    struct replay_run *rr = arg;
+    struct rec_entry re;
+    uint64_t started = now_ns ();
+    size_t off = sizeof (struct rec_header);
+    char *payload = NULL;
+
+    while (off + sizeof (re) <= rr->size) {
+        memcpy (&re, rr->data + off, sizeof (re));
+        off += sizeof (re);
+        if (re.size > rr->size - off) {
+            rr->error = EINVAL;
+            break;
+        }
+        /* Copy payload out as records are not aligned */
+        free (payload);
+        payload = malloc (re.size + 1);
+        if (payload == NULL) {
+            rr->error = errno;
+            break;
+        }
+        memcpy (payload, rr->data + off, re.size);
+        payload[re.size] = '\0';
+        rr->raw = rr->data + off;
+        off += re.size;
+        ++rr->records;
+        if (replay_record (rr, &re, payload) == -1) {
+            rr->error = errno;
+            break;
+        }
+        sim_settle ();
+    }
+    free (payload);
+    sim_settle ();
+    rr->elapsed = now_ns () - started;
+    rr->done = true;
+    return NULL;
+}
+
+/*
+ * Worker input recorded with IN_RECORD_FD replayed against simulator.
+ * Watched files and directory content are recreated under WORKDIR, and
+ * recorded changes are reproduced in order. Time is measured until the
+ * worker has processed all the vnode events.
+ */
+static int
+bench_replay (const char *path, struct bench_result *r)
+{
+    struct rec_header header;
+    struct replay_node *node;
+    struct replay_run rr;
+    struct stat st;
+    pthread_t thread;
+    char *data;
+    size_t i;
+    FILE *fp;
+
+    fp = fopen (path, "r");
+    if (fp == NULL || fstat (fileno (fp), &st) == -1) {
+        perror (path);
+        return -1;
+    }
+    data = malloc (st.st_size + 1);
+    if (data == NULL ||
+        fread (data, 1, st.st_size, fp) != (size_t)st.st_size) {
+        perror (path);
+        fclose (fp);
+        free (data);
+        return -1;
+    }
+    fclose (fp);
+
+    memcpy (&header, data, sizeof (header));
+    if (st.st_size < (off_t)sizeof (header) ||
+        header.magic != REC_MAGIC || header.version != REC_VERSION) {
+        fprintf (stderr, "%s: not a libinotify recording\n", path);
+        free (data);
+        return -1;
+    }
+
+    memset (&rr, 0, sizeof (rr));
+    rr.data = data;
+    rr.size = st.st_size;
+    rr.r = r;
+    rr.fd = inotify_init ();
+
+    pthread_create (&thread, NULL, replay_thread, &rr);
+    read_until_done (rr.fd, &rr.done, r);
+    pthread_join (thread, NULL);
+    r->elapsed = rr.elapsed;
+    r->count = rr.records;
+
+    collect_stats (rr.fd, r);
+    close (rr.fd);
+
+    for (i = 0; i < rr.nwatches; i++) {
+        free (rr.watches[i].path);
+        free (rr.watches[i].ents);
+    }
+    free (rr.watches);
+    while (rr.nodes != NULL) {
+        node = *(struct replay_node **)rr.nodes;
+        tdelete (node, &rr.nodes, replay_node_cmp);
+        free (node->path);
+        free (node);
+    }
+    free (data);
+
+    if (rr.error != 0) {
+        fprintf (stderr, "%s: record %zu: %s\n",
+                 path, rr.records, strerror (rr.error));
+        return -1;
+    }
+    return 0;
+}
+#endif
+
+static const struct {
+    const char *name;
+    void (*run) (size_t n, struct bench_result *r);
+    size_t scale; /* multiplier of count */
+} scenarios[] = {
+    { "create_storm",   bench_create_storm,   1 },
+    { "rename_storm",   bench_rename_storm,   1 },
+    { "deep_tree",      bench_deep_tree,      1 },
+    { "large_dir",      bench_large_dir,      10 },
+    { "busy_dirs",      bench_busy_dirs,      1 },
+    { "many_instances", bench_many_instances, 1 },
+    { "slow_consumer",  bench_slow_consumer,  1 },
+    { "mask_add_churn", bench_mask_add_churn, 1 },
+#ifdef BENCH_SIMULATOR
+    { "add_syscalls",   bench_add_syscalls,   1 },
+#endif
+};
+
+int
+main (int argc, char *argv[])
+{
+    struct bench_result r;
+    struct rlimit rl;
+    const char *script = NULL, *recording = NULL;
+    size_t n = 10000, i;
+    int ch, j;
+
+    while ((ch = getopt (argc, argv, "n:r:s:")) != -1) {
+        switch (ch) {
+        case 'n':
+            n = strtoul (optarg, NULL, 10);
+            break;
+#ifdef BENCH_SIMULATOR
+        case 'r':
+            recording = optarg;
+            break;
+        case 's':
+            script = optarg;
+            break;
+#endif
+        default:
+            fprintf (stderr, "usage: %s [-n count] [scenario ...]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    /* Subfiles of watched directories are opened by libinotify */
+    if (getrlimit (RLIMIT_NOFILE, &rl) == 0) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit (RLIMIT_NOFILE, &rl);
+    }
+
+#ifdef BENCH_SIMULATOR
+    if (script != NULL) {
+        setup ();
+        memset (&r, 0, sizeof (r));
+        if (bench_script (script, &r) == -1) {
+            return 1;
+        }
+        report ("script", &r);
+        cleanup ();
+        return 0;
+    }
+    if (recording != NULL) {
+        setup ();
+        memset (&r, 0, sizeof (r));
+        if (bench_replay (recording, &r) == -1) {
+            return 1;
+        }
+        report ("replay", &r);
+        cleanup ();
+        return 0;
+    }
+#else
+    (void)script;
+    (void)recording;
+#endif
+
+    for (i = 0; i < sizeof (scenarios) / sizeof (scenarios[0]); i++) {
+        bool wanted = optind == argc;
+        for (j = optind; j < argc; j++) {
+            if (strcmp (argv[j], scenarios[i].name) == 0) {
+                wanted = true;
+            }
+        }
+        if (!wanted) {
+            continue;
+        }
+
+        setup ();
+        memset (&r, 0, sizeof (r));
+        scenarios[i].run (n * scenarios[i].scale, &r);
+        report (scenarios[i].name, &r);
+        cleanup ();
+    }
+
+    return 0;
+}
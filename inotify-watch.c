@@ -29,6 +29,8 @@
 #include <assert.h>    /* assert */
 #include <errno.h>     /* errno */
 #include <fcntl.h>     /* AT_FDCWD */
+#include <fnmatch.h>   /* fnmatch */
+#include <stddef.h>    /* offsetof */
 #include <stdlib.h>    /* calloc, free */
 #include <string.h>    /* strcmp */
 #include <unistd.h>    /* close */
@@ -36,11 +38,19 @@
 #include "sys/inotify.h"
 
 #include "inotify-watch.h"
+#include "subwatch-prefetch.h"
 #include "utils.h"
 #include "watch-set.h"
 #include "watch.h"
 #include "worker.h"
 
+static size_t iwatch_add_subwatches (struct i_watch *iw,
+                                     size_t from,
+                                     size_t count);
+static struct watch* iwatch_open_subwatch (struct i_watch *iw,
+                                           struct dep_item *di,
+                                           struct prefetch_item *pi);
+
 #ifdef SKIP_SUBFILES
 static const char *skip_fs_types[] = { SKIP_SUBFILES };
 
@@ -48,31 +58,91 @@ static const char *skip_fs_types[] = { SKIP_SUBFILES };
  * Check if watch descriptor belongs a filesystem
  * where opening of subfiles is inwanted.
  *
- * @param[in] fd A file descriptor of a watched entry.
+ * The result is cached per device number while there are directory watches
+ * on the file system, so statfs is called once per mounted file system.
+ *
+ * @param[in] iw A pointer to #i_watch of a directory.
  * @return true if watching for subfiles is unwanted, false otherwise.
  **/
 static bool
-iwatch_want_skip_subfiles (int fd)
+iwatch_want_skip_subfiles (struct i_watch *iw)
 {
+    struct fs_type_list *head = &iw->wrk->fs_types;
     struct STATFS st;
+    struct fs_type *fs;
+    bool skip = false;
     size_t i;
 
+    SLIST_FOREACH (fs, head, next) {
+        if (fs->dev == iw->dev) {
+            ++fs->refs;
+            iw->fs = fs;
+            return fs->skip_subfiles;
+        }
+    }
+
     memset (&st, 0, sizeof (st));
-    if (FSTATFS (fd, &st) == -1) {
-        perror_msg (("fstatfs failed on %d", fd));
+    if (FSTATFS (iw->fd, &st) == -1) {
+        perror_msg (("fstatfs failed on %d", iw->fd));
         return false;
     }
 
     for (i = 0; i < nitems (skip_fs_types); i++) {
         if (strcmp (st.f_fstypename, skip_fs_types[i]) == 0) {
-            return true;
+            skip = true;
+            break;
         }
     }
 
-    return false;
+    fs = calloc (1, sizeof (struct fs_type));
+    if (fs != NULL) {
+        fs->dev = iw->dev;
+        fs->skip_subfiles = skip;
+        fs->refs = 1;
+        SLIST_INSERT_HEAD (head, fs, next);
+        iw->fs = fs;
+    }
+
+    return skip;
+}
+
+/**
+ * Drop the reference to cached file system type check result.
+ *
+ * @param[in] iw A pointer to #i_watch.
+ **/
+static void
+iwatch_release_fs_type (struct i_watch *iw)
+{
+    if (iw->fs != NULL && --iw->fs->refs == 0) {
+        SLIST_REMOVE (&iw->wrk->fs_types, iw->fs, fs_type, next);
+        free (iw->fs);
+    }
+    iw->fs = NULL;
 }
 #endif
 
+static void iwatch_update_subwatches (struct i_watch *iw,
+                                      uint32_t old_flags,
+                                      bool refilter);
+
+/**
+ * Remove all subfile name filters of inotify watch.
+ *
+ * @param[in] iw A pointer to #i_watch.
+ **/
+static void
+iwatch_clear_filters (struct i_watch *iw)
+{
+    struct i_filter *f;
+
+    while (!SLIST_EMPTY (&iw->filters)) {
+        f = SLIST_FIRST (&iw->filters);
+        SLIST_REMOVE_HEAD (&iw->filters, next);
+        free (f);
+    }
+}
+
 /**
  * Preform minimal initialization required for opening watch descriptor
  *
@@ -85,7 +155,8 @@ iwatch_open (const char *path, uint32_t flags)
 {
     int fd = watch_open (AT_FDCWD, path, flags);
     if (fd == -1) {
-        perror_msg (("Failed to open inotify watch %s", path));
+        perror_msg (("Failed to open inotify watch %s",
+                     errno != EFAULT ? path : "<bad addr>"));
     }
 
     return fd;
@@ -98,24 +169,23 @@ iwatch_open (const char *path, uint32_t flags)
  *
  * @param[in] wrk    A pointer to #worker.
  * @param[in] fd     A file descriptor of a watched entry.
+ * @param[in] st     A pointer to status of the watched entry taken with fd.
  * @param[in] flags  A combination of inotify event flags.
  * @return A pointer to a created #i_watch on success NULL otherwise
  **/
 struct i_watch *
-iwatch_init (struct worker *wrk, int fd, uint32_t flags)
+iwatch_init (struct worker *wrk,
+             int fd,
+             const struct stat *st,
+             uint32_t flags)
 {
-    struct stat st;
     struct i_watch *iw;
     struct watch *parent;
     bool is_new = false;
 
     assert (wrk != NULL);
     assert (fd != -1);
-
-    if (fstat (fd, &st) == -1) {
-        perror_msg (("fstat failed on %d", fd));
-        return NULL;
-    }
+    assert (st != NULL);
 
     iw = calloc (1, sizeof (struct i_watch));
     if (iw == NULL) {
@@ -127,23 +197,25 @@ iwatch_init (struct worker *wrk, int fd, uint32_t flags)
     iw->wrk = wrk;
     iw->fd = fd;
     iw->flags = flags;
-    iw->mode = st.st_mode & S_IFMT;
-    iw->inode = st.st_ino;
-    iw->dev = st.st_dev;
+    iw->mode = st->st_mode & S_IFMT;
+    iw->inode = st->st_ino;
+    iw->dev = st->st_dev;
     iw->is_closed = false;
 
     dl_init (&iw->deps);
+    SLIST_INIT (&iw->filters);
 
-    if (S_ISDIR (st.st_mode)) {
-        struct chg_list *deps = dl_listing (fd, NULL);
+    if (S_ISDIR (st->st_mode)) {
+        struct chg_list *deps = dl_listing (fd, &iw->deps);
         if (deps == NULL) {
             perror_msg (("Directory listing of %d failed", fd));
             iwatch_free (iw);
             return NULL;
         }
         dl_join (&iw->deps, deps);
+        recorder_listing (&wrk->rec, iw->wd, &iw->deps);
 #ifdef SKIP_SUBFILES
-        iw->skip_subfiles = iwatch_want_skip_subfiles (fd);
+        iw->skip_subfiles = iwatch_want_skip_subfiles (iw);
 #endif
     }
 
@@ -166,14 +238,192 @@ iwatch_init (struct worker *wrk, int fd, uint32_t flags)
         watch_set_insert (&wrk->watches, parent);
     }
 
-    if (S_ISDIR (st.st_mode)) {
+    if (S_ISDIR (st->st_mode)) {
+        if (flags & IN_ADD_ASYNC) {
+            /* Subfiles are watched later by worker thread */
+            iw->populating = true;
+        } else {
+            iwatch_add_subwatches (iw, 0, iw->deps.count);
+        }
+    }
+    return iw;
+}
+
+/**
+ * Check if a subfile of a newly added directory watch is going to be opened.
+ *
+ * @param[in] iw A pointer to #i_watch.
+ * @param[in] di A dependency item of the subfile.
+ * @return true if the subfile should be opened, false otherwise.
+ **/
+static bool
+iwatch_want_prefetch (struct i_watch *iw, struct dep_item *di)
+{
+    if (iwatch_is_filtered (iw, di->path)) {
+        return false;
+    }
+    if (watch_set_find (&iw->wrk->watches, iw->dev, di->inode) != NULL) {
+        return false;
+    }
+    return S_ISUNK (di->type) ||
+           inotify_to_kqueue (iw->flags, di->type, false) != 0;
+}
 
-        struct dep_item *iter;
-        DL_FOREACH (iter, &iw->deps) {
+/**
+ * Check if a subfile is watched by inotify watch.
+ *
+ * @param[in] iw A pointer to #i_watch.
+ * @param[in] di A dependency item of the subfile.
+ * @return true if the subfile is watched, false otherwise.
+ **/
+static bool
+iwatch_is_subwatched (struct i_watch *iw, struct dep_item *di)
+{
+    struct watch *w = watch_set_find (&iw->wrk->watches, iw->dev, di->inode);
+
+    return w != NULL && watch_find_dep (w, iw, di) != NULL;
+}
+
+/**
+ * Start watching a range of subfiles of a directory watch.
+ *
+ * Subfiles of large directories are opened and stat`ed by a pool of helper
+ * threads first. Watches are created and registered by worker thread.
+ * Already watched subfiles are skipped.
+ *
+ * @param[in] iw    A pointer to #i_watch.
+ * @param[in] from  An index of the first dependency item to watch.
+ * @param[in] count A number of dependency items to watch.
+ * @return An index of the dependency item following the last processed one.
+ **/
+static size_t
+iwatch_add_subwatches (struct i_watch *iw, size_t from, size_t count)
+{
+    struct prefetch_item *items = NULL;
+    struct dep_item *iter;
+    size_t nitems = 0, i, j = 0, to;
+
+    to = count < iw->deps.count - from ? from + count : iw->deps.count;
+
+    if (to - from >= PREFETCH_MIN_ITEMS &&
+#ifdef SKIP_SUBFILES
+        !iw->skip_subfiles &&
+#endif
+        iw->wrk->prefetch_threads != 1) {
+        items = calloc (to - from, sizeof (struct prefetch_item));
+    }
+
+    if (items != NULL) {
+        for (i = from; i < to; i++) {
+            iter = iw->deps.items[i];
+            if (iwatch_want_prefetch (iw, iter)) {
+                items[nitems++].di = iter;
+            }
+        }
+        prefetch_run (iw->fd, items, nitems, iw->wrk->prefetch_threads);
+    }
+
+    for (i = from; i < to; i++) {
+        iter = iw->deps.items[i];
+        if (j < nitems && items[j].di == iter) {
+            iwatch_open_subwatch (iw, iter, &items[j]);
+            /* Subfile could be watched under other name (hardlink) */
+            if (items[j].fd != -1) {
+                close (items[j].fd);
+            }
+            ++j;
+        } else if (!iwatch_is_subwatched (iw, iter)) {
             iwatch_add_subwatch (iw, iter);
         }
     }
-    return iw;
+    free (items);
+
+    return to;
+}
+
+/**
+ * Make a step of background population of a directory watch added with
+ * IN_ADD_ASYNC flag.
+ *
+ * @param[in] iw A pointer to #i_watch.
+ * @return true if all the subfiles are watched, false otherwise.
+ **/
+bool
+iwatch_populate (struct i_watch *iw)
+{
+    assert (iw != NULL);
+    assert (iw->populating);
+
+    iw->populated = iwatch_add_subwatches (iw,
+                                           iw->populated,
+                                           IWATCH_POPULATE_STEP);
+    if (iw->populated < iw->deps.count) {
+        return false;
+    }
+
+    iw->populating = false;
+    return true;
+}
+
+/**
+ * Stop watching all the subfiles of inotify watch at once.
+ *
+ * Unlike iwatch_del_subwatch() called for every subfile, kqueue filter
+ * flags of subwatches shared with other inotify watches are calculated
+ * once after all the dependencies are removed and registered in batches.
+ * Descriptors of unneeded subwatches are collected and closed in one
+ * sweep by worker_reap_fds().
+ *
+ * @param[in] iw A pointer to #i_watch.
+ **/
+static void
+iwatch_del_subwatches (struct i_watch *iw)
+{
+    struct dep_item *iter;
+    struct watch *w;
+    struct watch_dep *wd;
+    struct watch_batch wb;
+    int *fds = NULL;
+    size_t nfds = 0, i;
+
+    watch_batch_init (&wb, iw->wrk->kq);
+
+    DL_FOREACH (iter, &iw->deps, i) {
+        w = watch_set_find (&iw->wrk->watches, iw->dev, iter->inode);
+        if (w == NULL || (wd = watch_find_dep (w, iw, iter)) == NULL) {
+            continue;
+        }
+        SLIST_REMOVE (&w->deps, wd, watch_dep, next);
+        free (wd);
+
+        if (watch_deps_empty (w)) {
+            if (fds == NULL) {
+                fds = malloc (iw->deps.count * sizeof (int));
+            }
+            if (fds != NULL) {
+                fds[nfds++] = w->fd;
+                w->fd = -1;
+            }
+            worker_drop_kevents (iw->wrk, w);
+            watch_set_delete (&iw->wrk->watches, w);
+            continue;
+        }
+
+        /* Subfile hardlinks are unwatched later in this loop */
+        WD_FOREACH (wd, w) {
+            if (wd->iw == iw) {
+                break;
+            }
+        }
+        if (wd == NULL) {
+            watch_batch_update (&wb, w);
+        }
+    }
+    watch_batch_flush (&wb);
+
+    if (fds != NULL) {
+        worker_reap_fds (iw->wrk, fds, nfds);
+    }
 }
 
 /**
@@ -184,15 +434,12 @@ iwatch_init (struct worker *wrk, int fd, uint32_t flags)
 void
 iwatch_free (struct i_watch *iw)
 {
-    struct dep_item *iter;
     struct watch *w;
 
     assert (iw != NULL);
 
     /* unwatch subfiles */
-    DL_FOREACH (iter, &iw->deps) {
-        iwatch_del_subwatch (iw, iter);
-    }
+    iwatch_del_subwatches (iw);
 
     /* unwatch parent */
     w = watch_set_find (&iw->wrk->watches, iw->dev, iw->inode);
@@ -201,7 +448,14 @@ iwatch_free (struct i_watch *iw)
         watch_del_dep (w, iw, DI_PARENT);
     }
 
+    if (iw->prelisted != NULL) {
+        dl_discard (&iw->deps, iw->prelisted);
+    }
     dl_free (&iw->deps);
+    iwatch_clear_filters (iw);
+#ifdef SKIP_SUBFILES
+    iwatch_release_fs_type (iw);
+#endif
     free (iw);
 }
 
@@ -214,6 +468,23 @@ iwatch_free (struct i_watch *iw)
  **/
 struct watch*
 iwatch_add_subwatch (struct i_watch *iw, struct dep_item *di)
+{
+    return iwatch_open_subwatch (iw, di, NULL);
+}
+
+/**
+ * Start watching a file or a directory which may be opened in advance.
+ *
+ * @param[in] iw A pointer to #i_watch.
+ * @param[in] di A dependency item with relative path to watch.
+ * @param[in] pi A pointer to prefetched file descriptor and status or NULL.
+ *               The descriptor is reset to -1 if it is taken by the watch.
+ * @return A pointer to a created watch.
+ **/
+static struct watch*
+iwatch_open_subwatch (struct i_watch *iw,
+                      struct dep_item *di,
+                      struct prefetch_item *pi)
 {
     struct stat st;
     struct watch *w;
@@ -226,6 +497,11 @@ iwatch_add_subwatch (struct i_watch *iw, struct dep_item *di)
         return NULL;
     }
 
+    /* Don`t open a watches for filtered out subfiles */
+    if (iwatch_is_filtered (iw, di->path)) {
+        return NULL;
+    }
+
 #ifdef SKIP_SUBFILES
     if (iw->skip_subfiles) {
         goto lstat;
@@ -258,16 +534,29 @@ iwatch_add_subwatch (struct i_watch *iw, struct dep_item *di)
         return NULL;
     }
 
-    fd = watch_open (iw->fd, di->path, IN_DONT_FOLLOW);
-    if (fd == -1) {
-        perror_msg (("Failed to open file %s", di->path));
-        goto lstat;
-    }
+    if (pi != NULL) {
+        fd = pi->fd;
+        pi->fd = -1;
+        if (fd == -1) {
+            errno = pi->error;
+            perror_msg (("Failed to open file %s", di->path));
+            goto lstat;
+        }
+        st.st_mode = pi->mode;
+        st.st_ino = pi->inode;
+        st.st_dev = pi->dev;
+    } else {
+        fd = watch_open (iw->fd, di->path, IN_DONT_FOLLOW);
+        if (fd == -1) {
+            perror_msg (("Failed to open file %s", di->path));
+            goto lstat;
+        }
 
-    if (fstat (fd, &st) == -1) {
-        perror_msg (("Failed to stat subwatch %s", di->path));
-        close (fd);
-        goto lstat;
+        if (fstat (fd, &st) == -1) {
+            perror_msg (("Failed to stat subwatch %s", di->path));
+            close (fd);
+            goto lstat;
+        }
     }
 
     di_settype (di, st.st_mode);
@@ -367,11 +656,81 @@ iwatch_move_subwatch (struct i_watch *iw,
     }
 }
 
+/**
+ * Check if change of inotify watch flags alters kqueue filter flags of
+ * subfiles of given type.
+ *
+ * @param[in] old_flags A previous combination of the inotify watch flags.
+ * @param[in] new_flags A new combination of the inotify watch flags.
+ * @param[in] type      A file type of subfile. S_IFUNK means all types.
+ * @return true if kqueue filter flags are changed, false otherwise.
+ **/
+static bool
+iwatch_subflags_changed (uint32_t old_flags, uint32_t new_flags, mode_t type)
+{
+    if (S_ISUNK (type)) {
+        return iwatch_subflags_changed (old_flags, new_flags, S_IFREG) ||
+               iwatch_subflags_changed (old_flags, new_flags, S_IFDIR) ||
+               iwatch_subflags_changed (old_flags, new_flags, S_IFLNK);
+    }
+
+    return inotify_to_kqueue (old_flags, type, false) !=
+           inotify_to_kqueue (new_flags, type, false);
+}
+
+/**
+ * Update kqueue watches of subfiles after change of inotify watch flags
+ * or filters. Start watching newly wanted subfiles and stop watching
+ * those we don`t need to watch anymore.
+ *
+ * Subfiles of known type which kqueue filter flags are not altered by
+ * flags change are skipped unless filters are changed. Filter flags
+ * updates are registered in kernel with batches.
+ *
+ * @param[in] iw        A pointer to #i_watch.
+ * @param[in] old_flags A previous combination of the inotify watch flags.
+ * @param[in] refilter  true if the subfile name filters have been changed.
+ **/
+static void
+iwatch_update_subwatches (struct i_watch *iw, uint32_t old_flags, bool refilter)
+{
+    struct dep_item *iter;
+    struct watch_batch wb;
+    size_t i;
+
+    watch_batch_init (&wb, iw->wrk->kq);
+
+    DL_FOREACH (iter, &iw->deps, i) {
+        struct watch *w;
+
+        if (!refilter && !S_ISUNK (iter->type) &&
+            !iwatch_subflags_changed (old_flags, iw->flags, iter->type)) {
+            continue;
+        }
+
+        w = watch_set_find (&iw->wrk->watches, iw->dev, iter->inode);
+        if (w == NULL || watch_find_dep (w, iw, iter) == NULL) {
+            /* try to watch  unwatched subfiles */
+            watch_batch_flush (&wb);
+            iwatch_add_subwatch (iw, iter);
+        } else if (inotify_to_kqueue (iw->flags, iter->type, false) == 0 ||
+                   iwatch_is_filtered (iw, iter->path)) {
+            /* Deletion can free or update batched watch (hardlink) */
+            watch_batch_flush (&wb);
+            watch_del_dep (w, iw, iter);
+        } else {
+            watch_batch_update (&wb, w);
+        }
+    }
+    watch_batch_flush (&wb);
+}
+
 /**
  * Update inotify watch flags.
  *
  * When called for a directory watch, update also the flags of all the
- * dependent (child) watches.
+ * dependent (child) watches. Pass over the children is skipped if flags
+ * change does not alter their kqueue filter flags.
  *
  * @param[in] iw    A pointer to #i_watch.
  * @param[in] flags A combination of the inotify watch flags.
@@ -380,7 +739,7 @@ void
 iwatch_update_flags (struct i_watch *iw, uint32_t flags)
 {
     struct watch *parent;
-    struct dep_item *iter;
+    uint32_t old_flags;
 
     assert (iw != NULL);
 
@@ -389,6 +748,7 @@ iwatch_update_flags (struct i_watch *iw, uint32_t flags)
         flags |= iw->flags;
     }
 
+    old_flags = iw->flags;
     iw->flags = flags;
 
     /* update parent kqueue watch */
@@ -397,16 +757,79 @@ iwatch_update_flags (struct i_watch *iw, uint32_t flags)
     assert (!watch_deps_empty (parent));
     watch_update_event (parent);
 
-    /* update kqueue subwatches or close those we dont need to watch */
-    DL_FOREACH (iter, &iw->deps) {
-        struct watch *w = watch_set_find (&iw->wrk->watches, iw->dev, iter->inode);
-        if (w == NULL || watch_find_dep (w, iw, iter) == NULL) {
-            /* try to watch  unwatched subfiles */
-            iwatch_add_subwatch (iw, iter);
-        } else if (inotify_to_kqueue (flags, iter->type, false) == 0) {
-            watch_del_dep (w, iw, iter);
-        } else {
-            watch_update_event (w);
+    if (iwatch_subflags_changed (old_flags, flags, S_IFUNK)) {
+        iwatch_update_subwatches (iw, old_flags, false);
+    }
+}
+
+/**
+ * Set or reset subfile name filter of inotify watch.
+ *
+ * Events for subfiles which names are filtered out are not reported and
+ * the subfiles themselves are not opened. A name passes the filters if it
+ * matches any of include patterns (or there are no include patterns at all)
+ * and matches none of exclude patterns.
+ *
+ * @param[in] iw      A pointer to #i_watch.
+ * @param[in] pattern A fnmatch(3) pattern to add. NULL removes all filters.
+ * @param[in] type    IN_FILTER_INCLUDE or IN_FILTER_EXCLUDE.
+ * @return 0 on success, -1 otherwise.
+ **/
+int
+iwatch_set_filter (struct i_watch *iw, const char *pattern, int type)
+{
+    struct i_filter *f;
+    size_t len;
+
+    assert (iw != NULL);
+
+    if (pattern == NULL) {
+        iwatch_clear_filters (iw);
+    } else {
+        len = strlen (pattern) + 1;
+        f = malloc (offsetof (struct i_filter, pattern) + len);
+        if (f == NULL) {
+            perror_msg (("Failed to allocate name filter %s", pattern));
+            return -1;
+        }
+        f->type = type;
+        memcpy (f->pattern, pattern, len);
+        SLIST_INSERT_HEAD (&iw->filters, f, next);
+    }
+
+    /* Start or stop watching subfiles according to new filters */
+    if (!iw->is_closed) {
+        iwatch_update_subwatches (iw, iw->flags, true);
+    }
+    return 0;
+}
+
+/**
+ * Check if subfile name is filtered out by inotify watch filters.
+ *
+ * @param[in] iw   A pointer to #i_watch.
+ * @param[in] name A subfile name.
+ * @return true if subfile should be ignored, false otherwise.
+ **/
+bool
+iwatch_is_filtered (const struct i_watch *iw, const char *name)
+{
+    struct i_filter *f;
+    bool has_include = false, included = false;
+
+    assert (iw != NULL);
+    assert (name != NULL);
+
+    SLIST_FOREACH (f, &iw->filters, next) {
+        if (f->type == IN_FILTER_INCLUDE) {
+            has_include = true;
+            if (!included && fnmatch (f->pattern, name, 0) == 0) {
+                included = true;
+            }
+        } else if (fnmatch (f->pattern, name, 0) == 0) {
+            return true;
         }
     }
+
+    return has_include && !included;
 }
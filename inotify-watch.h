@@ -24,12 +24,40 @@
 #ifndef __INOTIFY_WATCH_H__
 #define __INOTIFY_WATCH_H__
 
+#include <sys/types.h> /* dev_t */
+#include <sys/queue.h> /* SLIST, TAILQ */
+#include <sys/stat.h>  /* stat */
+
+#include <stdbool.h>
+
 #include "compat.h"
 
 #include "dep-list.h"
 
+/* Number of subfiles watched per step of background population */
+#define IWATCH_POPULATE_STEP 1024
+
 struct worker;
 
+/* Subfile name filter */
+SLIST_HEAD(i_filter_list, i_filter);
+struct i_filter {
+    int type;                   /* IN_FILTER_INCLUDE or IN_FILTER_EXCLUDE */
+    SLIST_ENTRY(i_filter) next; /* pointer to the next filter in list */
+    char pattern[FLEXIBLE_ARRAY_MEMBER]; /* fnmatch(3) pattern */
+};
+
+#ifdef SKIP_SUBFILES
+/* File system type check result shared by watches of the same device */
+SLIST_HEAD(fs_type_list, fs_type);
+struct fs_type {
+    dev_t dev;                  /* device number of the file system */
+    bool skip_subfiles;         /* Fs is not safe to start subwatches */
+    unsigned int refs;          /* number of directory watches using it */
+    SLIST_ENTRY(fs_type) next;  /* pointer to the next cached fs type */
+};
+#endif
+
 SLIST_HEAD(i_watch_list, i_watch);
 struct i_watch {
     int wd;                    /* watch descriptor */
@@ -38,20 +66,36 @@ struct i_watch {
     bool is_closed;            /* inotify watch is stopped but not freed yet */
 #ifdef SKIP_SUBFILES
     bool skip_subfiles;        /* Fs is not safe to start subwatches */
+    struct fs_type *fs;        /* cached fs type check result or NULL */
 #endif
     uint32_t flags;            /* flags in the inotify format */
     mode_t mode;               /* File status of the watched inode */
     ino_t inode;               /* inode number of watched inode */
     dev_t dev;                 /* device number of watched inode */
     struct dep_list deps;      /* dependence list of inotify watch */
+    struct chg_list *prelisted; /* listing made by rescan threads or NULL */
+    int rescan;                /* RESCAN_* state in worker rescan queue */
+    uint32_t rescan_fflags;    /* kqueue flags of the queued rescan */
+    TAILQ_ENTRY(i_watch) rescan_next; /* next directory in rescan queue */
+    struct i_filter_list filters; /* subfile name filters */
+    bool populating;           /* subfiles are being watched in background */
+    size_t populated;          /* number of deps processed by population */
     SLIST_ENTRY(i_watch) next; /* pointer to the next inotify watch in list */
 };
 
 int             iwatch_open (const char *path, uint32_t flags);
-struct i_watch *iwatch_init (struct worker *wrk, int fd, uint32_t flags);
+struct i_watch *iwatch_init (struct worker *wrk,
+                             int fd,
+                             const struct stat *st,
+                             uint32_t flags);
 void            iwatch_free (struct i_watch *iw);
 
 void     iwatch_update_flags    (struct i_watch *iw, uint32_t flags);
+int      iwatch_set_filter      (struct i_watch *iw,
+                                 const char *pattern,
+                                 int type);
+bool     iwatch_is_filtered     (const struct i_watch *iw, const char *name);
+bool     iwatch_populate        (struct i_watch *iw);
 
 struct watch* iwatch_add_subwatch  (struct i_watch *iw, struct dep_item *di);
 void          iwatch_del_subwatch  (struct i_watch *iw,
@@ -0,0 +1,189 @@
+/*******************************************************************************
+  Copyright (c) 2026 agent <agent@local>
+  SPDX-License-Identifier: MIT
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in
+  all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+  THE SOFTWARE.
+*******************************************************************************/
+
+
+#include <sys/types.h>
+#include <sys/queue.h>
+
+#include <assert.h>
+#include <stddef.h> /* offsetof */
+#include <stdlib.h> /* malloc */
+#include <string.h> /* strlen */
+
+#include "compat.h"
+#include "move-index.h"
+#include "utils.h"
+
+static int move_index_cmp (struct move_item *mi1, struct move_item *mi2);
+
+RB_GENERATE_NEXT(move_index_tree, move_item, link, static inline)
+RB_GENERATE_MINMAX(move_index_tree, move_item, link, static inline)
+RB_GENERATE_INSERT_COLOR(move_index_tree, move_item, link, static inline)
+RB_GENERATE_REMOVE_COLOR(move_index_tree, move_item, link, static inline)
+RB_GENERATE_INSERT(move_index_tree, move_item, link, move_index_cmp, static inline)
+RB_GENERATE_REMOVE(move_index_tree, move_item, link, static inline)
+RB_GENERATE_FIND(move_index_tree, move_item, link, move_index_cmp, static inline)
+
+/**
+ * Initialize the move index.
+ *
+ * @param[in] mi A pointer to #move_index.
+ **/
+void
+move_index_init (struct move_index *mi)
+{
+    assert (mi != NULL);
+
+    RB_INIT (&mi->tree);
+    TAILQ_INIT (&mi->list);
+}
+
+/**
+ * Free the memory allocated for the move index.
+ *
+ * @param[in] mi A pointer to #move_index.
+ **/
+void
+move_index_free (struct move_index *mi)
+{
+    struct move_item *item;
+
+    assert (mi != NULL);
+
+    while ((item = TAILQ_FIRST (&mi->list)) != NULL) {
+        move_index_delete (mi, item);
+    }
+}
+
+/**
+ * Remember a removed or added directory entry. An older entry with the
+ * same device and inode numbers is replaced.
+ *
+ * @param[in] mi       A pointer to #move_index.
+ * @param[in] dev      A device number of the entry.
+ * @param[in] inode    An inode number of the entry.
+ * @param[in] wd       A watch id of the parent directory.
+ * @param[in] mask     IN_DELETE or IN_CREATE.
+ * @param[in] name     A name of the entry.
+ * @param[in] deadline Expiration time of the entry, ns.
+ * @return A pointer to inserted item or NULL on failure.
+ **/
+struct move_item *
+move_index_insert (struct move_index *mi,
+                   dev_t dev,
+                   ino_t inode,
+                   int wd,
+                   uint32_t mask,
+                   const char *name,
+                   uint64_t deadline)
+{
+    struct move_item *item, *old;
+    size_t len;
+
+    assert (mi != NULL);
+    assert (name != NULL);
+
+    len = strlen (name) + 1;
+    item = malloc (offsetof (struct move_item, name) + len);
+    if (item == NULL) {
+        perror_msg (("Failed to allocate move index item for %s", name));
+        return NULL;
+    }
+
+    item->dev = dev;
+    item->inode = inode;
+    item->wd = wd;
+    item->mask = mask;
+    item->deadline = deadline;
+    memcpy (item->name, name, len);
+
+    old = RB_INSERT (move_index_tree, &mi->tree, item);
+    if (old != NULL) {
+        move_index_delete (mi, old);
+        RB_INSERT (move_index_tree, &mi->tree, item);
+    }
+    TAILQ_INSERT_TAIL (&mi->list, item, next);
+
+    return item;
+}
+
+/**
+ * Remove an item from the move index.
+ *
+ * @param[in] mi   A pointer to #move_index.
+ * @param[in] item A pointer to the item to remove.
+ **/
+void
+move_index_delete (struct move_index *mi, struct move_item *item)
+{
+    assert (mi != NULL);
+    assert (item != NULL);
+
+    RB_REMOVE (move_index_tree, &mi->tree, item);
+    TAILQ_REMOVE (&mi->list, item, next);
+    free (item);
+}
+
+/**
+ * Find a directory entry by its device and inode numbers. Expired entries
+ * are dropped from the index on the way.
+ *
+ * @param[in] mi    A pointer to #move_index.
+ * @param[in] dev   A device number of the entry.
+ * @param[in] inode An inode number of the entry.
+ * @param[in] now   Current time, ns.
+ * @return A pointer to the item if found, NULL otherwise.
+ **/
+struct move_item *
+move_index_find (struct move_index *mi, dev_t dev, ino_t inode, uint64_t now)
+{
+    struct move_item *item, find;
+
+    assert (mi != NULL);
+
+    /* Items are expired in order of insertion */
+    while ((item = TAILQ_FIRST (&mi->list)) != NULL && item->deadline <= now) {
+        move_index_delete (mi, item);
+    }
+
+    find.dev = dev;
+    find.inode = inode;
+    return RB_FIND (move_index_tree, &mi->tree, &find);
+}
+
+/**
+ * Compare two move index items by their device and inode numbers.
+ *
+ * @param[in] mi1 A pointer to a first item to compare.
+ * @param[in] mi2 A pointer to a second item to compare.
+ * @return An -1, 0, or +1 if the first item is considered to be respectively
+ * less than, equal to, or greater than the second one.
+ **/
+static int
+move_index_cmp (struct move_item *mi1, struct move_item *mi2)
+{
+    if (mi1->dev == mi2->dev) {
+        return ((mi1->inode > mi2->inode) - (mi1->inode < mi2->inode));
+    }
+    return ((mi1->dev > mi2->dev) - (mi1->dev < mi2->dev));
+}
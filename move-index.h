@@ -0,0 +1,72 @@
+/*******************************************************************************
+  Copyright (c) 2026 agent <agent@local>
+  SPDX-License-Identifier: MIT
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in
+  all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+  THE SOFTWARE.
+*******************************************************************************/
+
+
+#ifndef __MOVE_INDEX_H__
+#define __MOVE_INDEX_H__
+
+#include <sys/types.h> /* dev_t, ino_t */
+#include <sys/queue.h> /* TAILQ */
+
+#include <stdint.h>    /* uint32_t, uint64_t */
+
+#include "compat.h"
+#include "config.h"
+
+/* Recently removed or added directory entry awaiting its move counterpart */
+struct move_item {
+    RB_ENTRY(move_item) link;      /* (dev, inode) index link */
+    TAILQ_ENTRY(move_item) next;   /* expiration order link */
+    dev_t dev;                     /* device number of the entry */
+    ino_t inode;                   /* inode number of the entry */
+    int wd;                        /* watch id of the parent directory */
+    uint32_t mask;                 /* IN_DELETE or IN_CREATE */
+    uint64_t deadline;             /* expiration time, ns */
+    char name[FLEXIBLE_ARRAY_MEMBER]; /* entry name */
+};
+
+RB_HEAD(move_index_tree, move_item);
+TAILQ_HEAD(move_index_list, move_item);
+
+struct move_index {
+    struct move_index_tree tree;
+    struct move_index_list list;
+};
+
+void              move_index_init   (struct move_index *mi);
+void              move_index_free   (struct move_index *mi);
+struct move_item* move_index_insert (struct move_index *mi,
+                                     dev_t dev,
+                                     ino_t inode,
+                                     int wd,
+                                     uint32_t mask,
+                                     const char *name,
+                                     uint64_t deadline);
+void              move_index_delete (struct move_index *mi,
+                                     struct move_item *item);
+struct move_item* move_index_find   (struct move_index *mi,
+                                     dev_t dev,
+                                     ino_t inode,
+                                     uint64_t now);
+
+#endif /* __MOVE_INDEX_H__ */
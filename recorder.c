@@ -0,0 +1,358 @@
+/*******************************************************************************
+  Copyright (c) 2026 agent <agent@local>
+  SPDX-License-Identifier: MIT
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in
+  all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+  THE SOFTWARE.
+*******************************************************************************/
+
+
+#include <sys/types.h>
+#include <sys/stat.h>  /* S_IFMT */
+
+#include <assert.h>
+#include <errno.h>     /* errno */
+#include <stdlib.h>    /* malloc, free */
+#include <string.h>    /* memcpy, strlen */
+#include <unistd.h>    /* write, close */
+
+#include "compat.h"
+#include "config.h"
+#include "dep-list.h"
+#include "recorder.h"
+#include "utils.h"
+
+#define REC_BUFSIZE 65536 /* size of buffer records are collected in */
+
+/**
+ * Initialize the recorder in stopped state.
+ *
+ * @param[in] rec A pointer to #recorder.
+ **/
+void
+recorder_init (struct recorder *rec)
+{
+    assert (rec != NULL);
+
+    rec->fd = -1;
+    rec->buf = NULL;
+    rec->len = 0;
+}
+
+/**
+ * Write all the buffered records to the recording. Recording is stopped on
+ * write failure.
+ *
+ * @param[in] rec A pointer to #recorder.
+ **/
+void
+recorder_flush (struct recorder *rec)
+{
+    size_t off = 0;
+    ssize_t done;
+
+    assert (rec != NULL);
+
+    while (off < rec->len) {
+        done = write (rec->fd, rec->buf + off, rec->len - off);
+        if (done == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror_msg (("Failed to write recording, recording stopped"));
+            rec->len = 0;
+            recorder_stop (rec);
+            return;
+        }
+        off += done;
+    }
+    rec->len = 0;
+}
+
+/**
+ * Append data to the recording.
+ *
+ * @param[in] rec  A pointer to #recorder.
+ * @param[in] data A pointer to data.
+ * @param[in] len  A length of data.
+ **/
+static void
+recorder_write (struct recorder *rec, const void *data, size_t len)
+{
+    size_t chunk;
+
+    while (len > 0 && recorder_enabled (rec)) {
+        if (rec->len == REC_BUFSIZE) {
+            recorder_flush (rec);
+            continue;
+        }
+        chunk = REC_BUFSIZE - rec->len < len ? REC_BUFSIZE - rec->len : len;
+        memcpy (rec->buf + rec->len, data, chunk);
+        rec->len += chunk;
+        data = (const char *)data + chunk;
+        len -= chunk;
+    }
+}
+
+/**
+ * Append a record header to the recording.
+ *
+ * @param[in] rec  A pointer to #recorder.
+ * @param[in] type A type of the record.
+ * @param[in] size A size of the record payload.
+ **/
+static void
+recorder_entry (struct recorder *rec, rec_type_t type, size_t size)
+{
+    struct rec_entry entry;
+
+    memset (&entry, 0, sizeof (entry));
+    entry.type = type;
+    entry.size = size;
+    entry.time = monotonic_ns ();
+    recorder_write (rec, &entry, sizeof (entry));
+}
+
+/**
+ * Start recording. A previous recording is stopped.
+ *
+ * @param[in] rec A pointer to #recorder.
+ * @param[in] fd  A file descriptor opened for writing. It is duplicated.
+ * @return 0 on success, -1 otherwise.
+ **/
+int
+recorder_start (struct recorder *rec, int fd)
+{
+    struct rec_header header;
+    char *buf;
+    int newfd;
+
+    assert (rec != NULL);
+
+    buf = malloc (REC_BUFSIZE);
+    if (buf == NULL) {
+        perror_msg (("Failed to allocate recording buffer"));
+        return -1;
+    }
+
+    newfd = dup_cloexec (fd);
+    if (newfd == -1) {
+        perror_msg (("Failed to duplicate recording descriptor %d", fd));
+        free (buf);
+        return -1;
+    }
+
+    recorder_stop (rec);
+    rec->fd = newfd;
+    rec->buf = buf;
+    rec->len = 0;
+
+    memset (&header, 0, sizeof (header));
+    header.magic = REC_MAGIC;
+    header.version = REC_VERSION;
+    recorder_write (rec, &header, sizeof (header));
+    return 0;
+}
+
+/**
+ * Flush the recording and stop it.
+ *
+ * @param[in] rec A pointer to #recorder.
+ **/
+void
+recorder_stop (struct recorder *rec)
+{
+    assert (rec != NULL);
+
+    if (!recorder_enabled (rec)) {
+        return;
+    }
+
+    if (rec->len > 0) {
+        recorder_flush (rec);
+    }
+    /* recorder_flush stops recording on failure */
+    if (recorder_enabled (rec)) {
+        close (rec->fd);
+        rec->fd = -1;
+    }
+    free (rec->buf);
+    rec->buf = NULL;
+    rec->len = 0;
+}
+
+/**
+ * Record successful inotify_add_watch() call.
+ *
+ * @param[in] rec   A pointer to #recorder.
+ * @param[in] path  A path passed to inotify_add_watch().
+ * @param[in] mask  A mask passed to inotify_add_watch().
+ * @param[in] wd    A watch descriptor returned.
+ * @param[in] inode An inode number of the watched file.
+ * @param[in] mode  A file type of the watched file.
+ **/
+void
+recorder_add (struct recorder *rec,
+              const char *path,
+              uint32_t mask,
+              int wd,
+              ino_t inode,
+              mode_t mode)
+{
+    struct rec_add add;
+    size_t len;
+
+    assert (rec != NULL);
+    assert (path != NULL);
+
+    if (!recorder_enabled (rec)) {
+        return;
+    }
+
+    len = strlen (path) + 1;
+    memset (&add, 0, sizeof (add));
+    add.inode = inode;
+    add.wd = wd;
+    add.mask = mask;
+    add.mode = mode & S_IFMT;
+    recorder_entry (rec, REC_ADD, sizeof (add) + len);
+    recorder_write (rec, &add, sizeof (add));
+    recorder_write (rec, path, len);
+}
+
+/**
+ * Record successful inotify_rm_watch() call.
+ *
+ * @param[in] rec A pointer to #recorder.
+ * @param[in] wd  A watch descriptor removed.
+ **/
+void
+recorder_remove (struct recorder *rec, int wd)
+{
+    struct rec_remove rm;
+
+    assert (rec != NULL);
+
+    if (!recorder_enabled (rec)) {
+        return;
+    }
+
+    memset (&rm, 0, sizeof (rm));
+    rm.wd = wd;
+    recorder_entry (rec, REC_REMOVE, sizeof (rm));
+    recorder_write (rec, &rm, sizeof (rm));
+}
+
+/**
+ * Record successful libinotify_set_param() call.
+ *
+ * @param[in] rec   A pointer to #recorder.
+ * @param[in] param A parameter set.
+ * @param[in] value A value of the parameter.
+ **/
+void
+recorder_param (struct recorder *rec, int param, intptr_t value)
+{
+    struct rec_param rp;
+
+    assert (rec != NULL);
+
+    if (!recorder_enabled (rec)) {
+        return;
+    }
+
+    memset (&rp, 0, sizeof (rp));
+    rp.param = param;
+    rp.value = value;
+    recorder_entry (rec, REC_PARAM, sizeof (rp));
+    recorder_write (rec, &rp, sizeof (rp));
+}
+
+/**
+ * Record a vnode kevent harvested by the worker.
+ *
+ * @param[in] rec    A pointer to #recorder.
+ * @param[in] inode  An inode number of the watched file.
+ * @param[in] mode   A file type of the watched file.
+ * @param[in] fflags Kqueue vnode filter flags of the kevent.
+ * @param[in] flags  Flags of the kevent.
+ **/
+void
+recorder_kevent (struct recorder *rec,
+                 ino_t inode,
+                 mode_t mode,
+                 uint32_t fflags,
+                 uint32_t flags)
+{
+    struct rec_kevent ke;
+
+    assert (rec != NULL);
+
+    if (!recorder_enabled (rec)) {
+        return;
+    }
+
+    memset (&ke, 0, sizeof (ke));
+    ke.inode = inode;
+    ke.mode = mode & S_IFMT;
+    ke.fflags = fflags;
+    ke.flags = flags;
+    recorder_entry (rec, REC_KEVENT, sizeof (ke));
+    recorder_write (rec, &ke, sizeof (ke));
+}
+
+/**
+ * Record the directory content as listed by the worker.
+ *
+ * @param[in] rec A pointer to #recorder.
+ * @param[in] wd  A watch descriptor of the directory.
+ * @param[in] dl  A pointer to the directory listing.
+ **/
+void
+recorder_listing (struct recorder *rec, int wd, const struct dep_list *dl)
+{
+    struct rec_listing rl;
+    struct rec_dirent de;
+    size_t i, size = sizeof (rl);
+
+    assert (rec != NULL);
+    assert (dl != NULL);
+
+    if (!recorder_enabled (rec)) {
+        return;
+    }
+
+    for (i = 0; i < dl->count; i++) {
+        size += sizeof (de) + strlen (dl->items[i]->path);
+    }
+
+    memset (&rl, 0, sizeof (rl));
+    rl.wd = wd;
+    rl.count = dl->count;
+    recorder_entry (rec, REC_LISTING, size);
+    recorder_write (rec, &rl, sizeof (rl));
+
+    memset (&de, 0, sizeof (de));
+    for (i = 0; i < dl->count; i++) {
+        de.inode = dl->items[i]->inode;
+        de.type = (dl->items[i]->type & S_IFMT) >> 12;
+        de.namelen = strlen (dl->items[i]->path);
+        recorder_write (rec, &de, sizeof (de));
+        recorder_write (rec, dl->items[i]->path, de.namelen);
+    }
+}
@@ -0,0 +1,140 @@
+/*******************************************************************************
+  Copyright (c) 2026 agent <agent@local>
+  SPDX-License-Identifier: MIT
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in
+  all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+  THE SOFTWARE.
+*******************************************************************************/
+
+
+
+#ifndef __RECORDER_H__
+#define __RECORDER_H__
+
+#include <sys/types.h> /* ino_t, mode_t */
+
+#include <stdbool.h>
+#include <stddef.h>    /* size_t */
+#include <stdint.h>    /* uint32_t, uint64_t */
+
+struct dep_list;
+
+/*
+ * Recording of worker input. The file starts with #rec_header followed by
+ * records. Every record is #rec_entry followed by size bytes of payload.
+ * Integers are stored in host byte order, so recording is to be replayed on
+ * the same architecture. Header does not depend on library internals to be
+ * usable by the replay tool.
+ */
+#define REC_MAGIC   0x524b494c /* "LIKR" */
+#define REC_VERSION 1
+
+typedef enum {
+    REC_ADD = 1,     /* #rec_add, watch added or modified */
+    REC_REMOVE,      /* #rec_remove, watch removed */
+    REC_PARAM,       /* #rec_param, parameter set */
+    REC_KEVENT,      /* #rec_kevent, vnode kevent harvested */
+    REC_LISTING,     /* #rec_listing, directory listed */
+} rec_type_t;
+
+struct rec_header {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t reserved;
+};
+
+struct rec_entry {
+    uint16_t type;   /* #rec_type_t */
+    uint16_t reserved;
+    uint32_t size;   /* size of payload */
+    uint64_t time;   /* monotonic time of recording, ns */
+};
+
+struct rec_add {
+    uint64_t inode;  /* inode number of the watched file */
+    int32_t wd;      /* watch descriptor */
+    uint32_t mask;   /* inotify_add_watch() mask */
+    uint32_t mode;   /* file type of the watched file */
+    uint32_t reserved;
+    /* followed by NUL-terminated path passed to inotify_add_watch() */
+};
+
+struct rec_remove {
+    int32_t wd;
+};
+
+struct rec_param {
+    int64_t value;
+    int32_t param;
+    uint32_t reserved;
+};
+
+struct rec_kevent {
+    uint64_t inode;  /* inode number of the watched file */
+    uint32_t mode;   /* file type of the watched file */
+    uint32_t fflags; /* kqueue vnode filter flags */
+    uint32_t flags;  /* kevent flags */
+    uint32_t reserved;
+};
+
+struct rec_listing {
+    int32_t wd;      /* watch descriptor of the directory */
+    uint32_t count;  /* number of #rec_dirent following */
+};
+
+struct rec_dirent {
+    uint64_t inode;
+    uint16_t type;   /* file type, S_IFMT bits of st_mode >> 12 */
+    uint16_t namelen;
+    /* followed by namelen bytes of name, not NUL-terminated */
+};
+
+struct recorder {
+    int fd;          /* file descriptor to write recording to, -1 if off */
+    char *buf;       /* records not written yet */
+    size_t len;      /* length of data in buf */
+};
+
+void recorder_init    (struct recorder *rec);
+int  recorder_start   (struct recorder *rec, int fd);
+void recorder_stop    (struct recorder *rec);
+void recorder_flush   (struct recorder *rec);
+void recorder_add     (struct recorder *rec,
+                       const char *path,
+                       uint32_t mask,
+                       int wd,
+                       ino_t inode,
+                       mode_t mode);
+void recorder_remove  (struct recorder *rec, int wd);
+void recorder_param   (struct recorder *rec, int param, intptr_t value);
+void recorder_kevent  (struct recorder *rec,
+                       ino_t inode,
+                       mode_t mode,
+                       uint32_t fflags,
+                       uint32_t flags);
+void recorder_listing (struct recorder *rec,
+                       int wd,
+                       const struct dep_list *dl);
+
+static inline bool
+recorder_enabled (struct recorder *rec)
+{
+    return rec->fd != -1;
+}
+
+#endif /* __RECORDER_H__ */
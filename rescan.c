@@ -0,0 +1,550 @@
+/*******************************************************************************
+  Copyright (c) 2026 agent <agent@local>
+  SPDX-License-Identifier: MIT
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in
+  all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+  THE SOFTWARE.
+*******************************************************************************/
+
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/event.h>
+
+#include <assert.h>
+#include <errno.h>    /* EINVAL */
+#include <pthread.h>
+#include <signal.h>   /* sigfillset */
+#include <unistd.h>   /* sysconf */
+
+#include "compat.h"
+#include "dep-list.h"
+#include "inotify-watch.h"
+#include "rescan.h"
+#include "utils.h"
+
+/**
+ * List directories of the current round until there is nothing left to
+ * take. Called by the rescan thread and its helpers without mutex held.
+ *
+ * @param[in] rq A pointer to #rescan_queue.
+ **/
+static void
+rescan_list (struct rescan_queue *rq)
+{
+    struct i_watch *iw;
+    size_t i;
+
+    while ((i = atomic_fetch_add (&rq->next, 1)) < rq->round_count) {
+        iw = rq->round[i];
+        assert (iw->prelisted == NULL);
+        iw->prelisted = dl_listing (iw->fd, &iw->deps);
+        if (iw->prelisted == NULL) {
+            perror_msg (("Failed to create a listing for watch %d", iw->wd));
+        }
+    }
+}
+
+/**
+ * The helper thread routine. Takes a seat in every round offered by the
+ * rescan thread until the queue is stopped.
+ *
+ * @param[in] arg A pointer to #rescan_queue.
+ * @return NULL.
+ **/
+static void*
+rescan_helper_thread (void *arg)
+{
+    struct rescan_queue *rq = arg;
+
+    pthread_mutex_lock (&rq->mutex);
+    while (!rq->stop || rq->seats > 0) {
+        if (rq->seats == 0) {
+            pthread_cond_wait (&rq->helper_cv, &rq->mutex);
+            continue;
+        }
+        --rq->seats;
+        pthread_mutex_unlock (&rq->mutex);
+
+        rescan_list (rq);
+
+        pthread_mutex_lock (&rq->mutex);
+        if (--rq->busy == 0) {
+            pthread_cond_broadcast (&rq->helper_cv);
+        }
+    }
+    pthread_mutex_unlock (&rq->mutex);
+
+    return NULL;
+}
+
+/**
+ * Start helper threads up to the given number. Helpers live until the
+ * queue is stopped, so rounds do not pay for thread creation.
+ *
+ * @param[in] rq      A pointer to #rescan_queue.
+ * @param[in] helpers A number of helper threads wanted.
+ **/
+static void
+rescan_grow_helpers (struct rescan_queue *rq, int helpers)
+{
+    pthread_attr_t attr;
+    sigset_t set, oset;
+
+    if (rq->nhelpers >= helpers) {
+        return;
+    }
+
+    pthread_attr_init (&attr);
+    sigfillset (&set);
+    pthread_sigmask (SIG_BLOCK, &set, &oset);
+
+    while (rq->nhelpers < helpers) {
+        if (pthread_create (&rq->helpers[rq->nhelpers],
+                            &attr,
+                            rescan_helper_thread,
+                            rq) != 0) {
+            perror_msg (("Failed to start a rescan helper thread"));
+            break;
+        }
+        ++rq->nhelpers;
+    }
+
+    pthread_sigmask (SIG_SETMASK, &oset, NULL);
+    pthread_attr_destroy (&attr);
+}
+
+/**
+ * List a round of modified directories with the rescan thread and its
+ * helpers.
+ *
+ * Every directory is listed against its own dependency list by a single
+ * thread, so the lists are not shared. Listings are stored to prelisted
+ * field of #i_watch to be taken by produce_directory_diff() later. Diffs
+ * themselves and all the events are produced by the worker thread, which
+ * keeps per-watch ordering of events intact.
+ *
+ * @param[in] rq      A pointer to #rescan_queue.
+ * @param[in] iws     An array of directory watches to list.
+ * @param[in] count   A number of directory watches.
+ * @param[in] threads A number of threads to use including the rescan one.
+ *                    Zero means number of online CPUs.
+ **/
+static void
+rescan_run (struct rescan_queue *rq,
+            struct i_watch **iws,
+            size_t count,
+            int threads)
+{
+    assert (iws != NULL || count == 0);
+
+    if (threads == 0) {
+#ifdef _SC_NPROCESSORS_ONLN
+        threads = (int)sysconf (_SC_NPROCESSORS_ONLN);
+#endif
+    }
+    if (threads < 1) {
+        threads = 1;
+    }
+    if (threads > RESCAN_MAX_THREADS) {
+        threads = RESCAN_MAX_THREADS;
+    }
+    /* Do not wake helpers which would not get a directory */
+    if ((size_t)threads > count) {
+        threads = count;
+    }
+
+    rq->round = iws;
+    rq->round_count = count;
+    atomic_store (&rq->next, 0);
+
+    if (threads > 1) {
+        rescan_grow_helpers (rq, threads - 1);
+        pthread_mutex_lock (&rq->mutex);
+        rq->seats = rq->busy = threads - 1 < rq->nhelpers ?
+            threads - 1 : rq->nhelpers;
+        pthread_cond_broadcast (&rq->helper_cv);
+        pthread_mutex_unlock (&rq->mutex);
+    }
+
+    rescan_list (rq);
+
+    pthread_mutex_lock (&rq->mutex);
+    while (rq->busy > 0) {
+        pthread_cond_wait (&rq->helper_cv, &rq->mutex);
+    }
+    pthread_mutex_unlock (&rq->mutex);
+}
+
+/**
+ * Initialize a queue of directories listed by a dedicated thread.
+ *
+ * @param[in] rq A pointer to #rescan_queue.
+ **/
+void
+rescan_queue_init (struct rescan_queue *rq)
+{
+    assert (rq != NULL);
+
+    TAILQ_INIT (&rq->head);
+    rq->count = 0;
+    rq->threads = 1;
+    rq->time = 0;
+    rq->running = false;
+    rq->stop = false;
+    rq->kq = -1;
+    rq->nhelpers = 0;
+    rq->seats = 0;
+    rq->busy = 0;
+    rq->round = NULL;
+    rq->round_count = 0;
+    atomic_init (&rq->next, 0);
+    pthread_mutex_init (&rq->mutex, NULL);
+    pthread_cond_init (&rq->cv, NULL);
+    pthread_cond_init (&rq->helper_cv, NULL);
+}
+
+/**
+ * Stop the rescan thread and free the queue.
+ *
+ * @param[in] rq A pointer to #rescan_queue.
+ **/
+void
+rescan_queue_free (struct rescan_queue *rq)
+{
+    assert (rq != NULL);
+
+    rescan_queue_stop (rq);
+    pthread_cond_destroy (&rq->helper_cv);
+    pthread_cond_destroy (&rq->cv);
+    pthread_mutex_destroy (&rq->mutex);
+}
+
+/**
+ * Remove a directory from the queue. Should be called with mutex held.
+ *
+ * @param[in] rq A pointer to #rescan_queue.
+ * @param[in] iw A pointer to directory #i_watch.
+ **/
+static void
+rescan_queue_remove (struct rescan_queue *rq, struct i_watch *iw)
+{
+    assert (iw->rescan != RESCAN_NONE);
+    assert (rq->count > 0);
+
+    TAILQ_REMOVE (&rq->head, iw, rescan_next);
+    iw->rescan = RESCAN_NONE;
+    --rq->count;
+}
+
+/**
+ * The rescan thread routine. Lists submitted directories in rounds and
+ * triggers worker kqueue after every round.
+ *
+ * @param[in] arg A pointer to #rescan_queue.
+ * @return NULL.
+ **/
+static void*
+rescan_queue_thread (void *arg)
+{
+    struct rescan_queue *rq = arg;
+    struct i_watch *iws[RESCAN_QUEUE_ROUND], *iw;
+#ifdef EVFILT_USER
+    struct kevent ev;
+#endif
+    uint64_t started;
+    size_t count, i;
+    int threads;
+
+    pthread_mutex_lock (&rq->mutex);
+    while (!rq->stop) {
+        count = 0;
+        TAILQ_FOREACH (iw, &rq->head, rescan_next) {
+            if (iw->rescan == RESCAN_QUEUED && count < nitems (iws)) {
+                iw->rescan = RESCAN_LISTING;
+                iws[count++] = iw;
+            }
+        }
+        if (count == 0) {
+            pthread_cond_wait (&rq->cv, &rq->mutex);
+            continue;
+        }
+        threads = rq->threads;
+        pthread_mutex_unlock (&rq->mutex);
+
+        started = monotonic_ns ();
+        rescan_run (rq, iws, count, threads);
+
+        pthread_mutex_lock (&rq->mutex);
+        rq->time += monotonic_ns () - started;
+        for (i = 0; i < count; i++) {
+            iws[i]->rescan = RESCAN_LISTED;
+        }
+        pthread_cond_broadcast (&rq->cv);
+
+#ifdef EVFILT_USER
+        EV_SET (&ev, (uintptr_t)rq, EVFILT_USER, 0, NOTE_TRIGGER, 0, 0);
+        if (kevent (rq->kq, &ev, 1, NULL, 0, zero_tsp) == -1) {
+            perror_msg (("Failed to trigger rescan completion event"));
+        }
+#endif
+    }
+    pthread_mutex_unlock (&rq->mutex);
+
+    return NULL;
+}
+
+/**
+ * Start the rescan thread.
+ *
+ * @param[in] rq A pointer to #rescan_queue.
+ * @param[in] kq A kqueue to trigger EVFILT_USER event with ident equal to
+ *               the address of the queue at when directories are listed.
+ * @return 0 on success, -1 otherwise.
+ **/
+int
+rescan_queue_start (struct rescan_queue *rq, int kq)
+{
+#ifdef EVFILT_USER
+    pthread_attr_t attr;
+    sigset_t set, oset;
+    struct kevent ev;
+    int result;
+
+    assert (rq != NULL);
+
+    if (rq->running) {
+        return 0;
+    }
+
+    EV_SET (&ev, (uintptr_t)rq, EVFILT_USER, EV_ADD | EV_CLEAR, 0, 0, 0);
+    if (kevent (kq, &ev, 1, NULL, 0, zero_tsp) == -1) {
+        perror_msg (("Failed to register rescan completion event"));
+        return -1;
+    }
+
+    rq->kq = kq;
+    rq->stop = false;
+
+    pthread_attr_init (&attr);
+    sigfillset (&set);
+    pthread_sigmask (SIG_BLOCK, &set, &oset);
+    result = pthread_create (&rq->thread, &attr, rescan_queue_thread, rq);
+    pthread_sigmask (SIG_SETMASK, &oset, NULL);
+    pthread_attr_destroy (&attr);
+
+    if (result != 0) {
+        perror_msg (("Failed to start a rescan thread"));
+        EV_SET (&ev, (uintptr_t)rq, EVFILT_USER, EV_DELETE, 0, 0, 0);
+        kevent (kq, &ev, 1, NULL, 0, zero_tsp);
+        errno = result;
+        return -1;
+    }
+
+    rq->running = true;
+    return 0;
+#else
+    perror_msg (("Rescan thread requires support for EVFILT_USER"));
+    errno = EINVAL;
+    return -1;
+#endif
+}
+
+/**
+ * Stop the rescan thread and its helpers. Directories left in the queue are removed from
+ * it and their listings, if any, remain in prelisted field of #i_watch.
+ *
+ * @param[in] rq A pointer to #rescan_queue.
+ **/
+void
+rescan_queue_stop (struct rescan_queue *rq)
+{
+#ifdef EVFILT_USER
+    struct kevent ev;
+#endif
+
+    assert (rq != NULL);
+
+    if (!rq->running) {
+        return;
+    }
+
+    pthread_mutex_lock (&rq->mutex);
+    rq->stop = true;
+    pthread_cond_broadcast (&rq->cv);
+    pthread_cond_broadcast (&rq->helper_cv);
+    pthread_mutex_unlock (&rq->mutex);
+    pthread_join (rq->thread, NULL);
+    while (rq->nhelpers > 0) {
+        pthread_join (rq->helpers[--rq->nhelpers], NULL);
+    }
+    rq->running = false;
+
+    while (!TAILQ_EMPTY (&rq->head)) {
+        rescan_queue_remove (rq, TAILQ_FIRST (&rq->head));
+    }
+
+#ifdef EVFILT_USER
+    EV_SET (&ev, (uintptr_t)rq, EVFILT_USER, EV_DELETE, 0, 0, 0);
+    kevent (rq->kq, &ev, 1, NULL, 0, zero_tsp);
+#endif
+    rq->kq = -1;
+}
+
+/**
+ * Pass a directory to the rescan thread. Dependency list of the directory
+ * must not be touched until it is taken back from the queue.
+ *
+ * @param[in] rq      A pointer to #rescan_queue.
+ * @param[in] iw      A pointer to directory #i_watch not in the queue.
+ * @param[in] threads A number of threads listing one round of directories.
+ **/
+void
+rescan_queue_submit (struct rescan_queue *rq, struct i_watch *iw, int threads)
+{
+    assert (rq != NULL);
+    assert (rq->running);
+    assert (iw != NULL);
+    assert (iw->rescan == RESCAN_NONE);
+
+    pthread_mutex_lock (&rq->mutex);
+    iw->rescan = RESCAN_QUEUED;
+    TAILQ_INSERT_TAIL (&rq->head, iw, rescan_next);
+    ++rq->count;
+    rq->threads = threads;
+    pthread_cond_broadcast (&rq->cv);
+    pthread_mutex_unlock (&rq->mutex);
+}
+
+/**
+ * Take a directory back from the queue waiting for its listing if it is
+ * being made. Directory which listing has not been started yet is taken
+ * without a listing.
+ *
+ * @param[in] rq A pointer to #rescan_queue.
+ * @param[in] iw A pointer to directory #i_watch.
+ * @return true if the directory has been in the queue, false otherwise.
+ **/
+bool
+rescan_queue_wait (struct rescan_queue *rq, struct i_watch *iw)
+{
+    assert (rq != NULL);
+    assert (iw != NULL);
+
+    if (rescan_queue_empty (rq)) {
+        return false;
+    }
+
+    pthread_mutex_lock (&rq->mutex);
+    if (iw->rescan == RESCAN_NONE) {
+        pthread_mutex_unlock (&rq->mutex);
+        return false;
+    }
+    while (iw->rescan == RESCAN_LISTING) {
+        pthread_cond_wait (&rq->cv, &rq->mutex);
+    }
+    rescan_queue_remove (rq, iw);
+    pthread_mutex_unlock (&rq->mutex);
+
+    return true;
+}
+
+/**
+ * Wait for the rescan thread to list a directory but leave the listing in
+ * the queue. Dependency list of the directory can be read after return.
+ *
+ * @param[in] rq A pointer to #rescan_queue.
+ * @param[in] iw A pointer to directory #i_watch.
+ **/
+void
+rescan_queue_settle (struct rescan_queue *rq, struct i_watch *iw)
+{
+    assert (rq != NULL);
+    assert (iw != NULL);
+
+    if (rescan_queue_empty (rq)) {
+        return;
+    }
+
+    pthread_mutex_lock (&rq->mutex);
+    while (iw->rescan == RESCAN_QUEUED || iw->rescan == RESCAN_LISTING) {
+        pthread_cond_wait (&rq->cv, &rq->mutex);
+    }
+    pthread_mutex_unlock (&rq->mutex);
+}
+
+/**
+ * Take the oldest listed directory back from the queue.
+ *
+ * @param[in] rq   A pointer to #rescan_queue.
+ * @param[in] wait Take the oldest directory in the queue even if it has
+ *                 not been listed yet, as rescan_queue_wait() does.
+ * @return A pointer to #i_watch or NULL if there is nothing to take.
+ **/
+struct i_watch *
+rescan_queue_take (struct rescan_queue *rq, bool wait)
+{
+    struct i_watch *iw;
+
+    assert (rq != NULL);
+
+    if (rescan_queue_empty (rq)) {
+        return NULL;
+    }
+
+    pthread_mutex_lock (&rq->mutex);
+    if (wait) {
+        iw = TAILQ_FIRST (&rq->head);
+        while (iw->rescan == RESCAN_LISTING) {
+            pthread_cond_wait (&rq->cv, &rq->mutex);
+        }
+    } else {
+        TAILQ_FOREACH (iw, &rq->head, rescan_next) {
+            if (iw->rescan == RESCAN_LISTED) {
+                break;
+            }
+        }
+    }
+    if (iw != NULL) {
+        rescan_queue_remove (rq, iw);
+    }
+    pthread_mutex_unlock (&rq->mutex);
+
+    return iw;
+}
+
+/**
+ * Get time spent by the rescan thread in directory listing.
+ *
+ * @param[in] rq A pointer to #rescan_queue.
+ * @return Time in nanoseconds.
+ **/
+uint64_t
+rescan_queue_time (struct rescan_queue *rq)
+{
+    uint64_t time;
+
+    assert (rq != NULL);
+
+    pthread_mutex_lock (&rq->mutex);
+    time = rq->time;
+    pthread_mutex_unlock (&rq->mutex);
+
+    return time;
+}
@@ -0,0 +1,99 @@
+/*******************************************************************************
+  Copyright (c) 2026 agent <agent@local>
+  SPDX-License-Identifier: MIT
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in
+  all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+  THE SOFTWARE.
+*******************************************************************************/
+
+
+#ifndef __RESCAN_H__
+#define __RESCAN_H__
+
+#include <sys/queue.h> /* TAILQ */
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>    /* size_t */
+#include <stdint.h>    /* uint64_t */
+
+#include "compat.h"
+#include "config.h"
+#include "inotify-watch.h"
+
+/* Maximal number of threads listing one round of modified directories */
+#define RESCAN_MAX_THREADS 16
+
+/* Maximal number of directories listed by rescan thread in one round */
+#define RESCAN_QUEUE_ROUND 64
+
+/* States of directory submitted to rescan thread */
+#define RESCAN_NONE    0 /* not submitted */
+#define RESCAN_QUEUED  1 /* waits for rescan thread */
+#define RESCAN_LISTING 2 /* dependency list is owned by rescan thread */
+#define RESCAN_LISTED  3 /* listing is ready to be diffed by worker */
+
+TAILQ_HEAD(rescan_list, i_watch);
+
+/**
+ * Directories listed by a dedicated thread. A directory dependency list
+ * belongs to the thread from RESCAN_LISTING state until the worker takes
+ * the directory back from the queue.
+ **/
+struct rescan_queue {
+    struct rescan_list head; /* submitted directories in order */
+    size_t count;            /* number of submitted directories */
+    int threads;             /* threads listing one round of directories */
+    uint64_t time;           /* time spent in listing by the thread, ns */
+    bool running;            /* rescan thread is started */
+    bool stop;               /* rescan thread is asked to exit */
+    int kq;                  /* kqueue triggered when a round is listed */
+    pthread_t thread;        /* rescan thread */
+    pthread_mutex_t mutex;   /* queue access serializer */
+    pthread_cond_t cv;       /* new submissions and listed rounds */
+    pthread_t helpers[RESCAN_MAX_THREADS - 1]; /* persistent helper threads */
+    int nhelpers;            /* number of started helper threads */
+    int seats;               /* helpers still to join the current round */
+    int busy;                /* helpers not done with the current round */
+    struct i_watch **round;  /* directories of the current round */
+    size_t round_count;      /* number of directories of the round */
+    atomic_uint next;        /* index of first directory not yet taken */
+    pthread_cond_t helper_cv; /* new rounds and helper completion */
+};
+
+void            rescan_queue_init   (struct rescan_queue *rq);
+void            rescan_queue_free   (struct rescan_queue *rq);
+int             rescan_queue_start  (struct rescan_queue *rq, int kq);
+void            rescan_queue_stop   (struct rescan_queue *rq);
+void            rescan_queue_submit (struct rescan_queue *rq,
+                                     struct i_watch *iw,
+                                     int threads);
+bool            rescan_queue_wait   (struct rescan_queue *rq,
+                                     struct i_watch *iw);
+void            rescan_queue_settle (struct rescan_queue *rq,
+                                     struct i_watch *iw);
+struct i_watch *rescan_queue_take   (struct rescan_queue *rq, bool wait);
+uint64_t        rescan_queue_time   (struct rescan_queue *rq);
+
+static inline bool
+rescan_queue_empty (const struct rescan_queue *rq)
+{
+    return rq->count == 0;
+}
+
+#endif /* __RESCAN_H__ */
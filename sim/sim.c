@@ -0,0 +1,2501 @@
+/*******************************************************************************
+  Copyright (c) 2026 agent <agent@local>
+  SPDX-License-Identifier: MIT
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in
+  all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+  THE SOFTWARE.
+*******************************************************************************/
+
+
+/*
+ * In-memory model of a file system and of the kqueue(2) used to watch it.
+ *
+ * Files and directories live in memory only. Descriptors of simulated files
+ * and kqueues are real descriptors (of /dev/null and of a pipe) so they are
+ * counted, limited and inherited by the system as usual, the model state is
+ * attached to them through a table indexed by descriptor number. Events of
+ * EVFILT_VNODE are posted synchronously by the sim_* calls changing the file
+ * system, with the same notes FreeBSD UFS produces for them. EVFILT_USER and
+ * EVFILT_TIMER are implemented in the model, EVFILT_READ, EVFILT_WRITE and
+ * EVFILT_EMPTY poll(2) real descriptors, e.g. the inotify socket pair.
+ *
+ * All the state is guarded with single mutex, so the order of events is
+ * determined by the order of the calls only.
+ */
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/ioctl.h>  /* ioctl */
+#include <sys/queue.h>
+#include <sys/socket.h> /* getsockopt */
+#include <sys/stat.h>
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>     /* NAME_MAX */
+#include <poll.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "compat/tree.h"
+#include "sim.h"
+
+#ifndef IFTODT
+#define IFTODT(mode) (((mode) & 0170000) >> 12)
+#endif
+
+#define SIM_DEV       0x5157   /* device number of simulated file system */
+#define SIM_ROOT_INO  2        /* inode number of root directory */
+#define SIM_EMPTY_MS  1        /* interval of EVFILT_EMPTY polling */
+#define SIM_SCRIPT_MAX 4096    /* maximal length of script line */
+
+struct sim_knote;
+
+/* Directory entry */
+struct sim_dirent {
+    RB_ENTRY(sim_dirent) link;  /* directory entries tree */
+    struct sim_node *node;      /* file the entry refers to */
+    char *name;                 /* entry name, allocated with the entry */
+};
+RB_HEAD(sim_dirents, sim_dirent);
+
+/* File or directory */
+struct sim_node {
+    struct sim_dirents entries;       /* entries of directory */
+    struct sim_node *parent;          /* parent of directory */
+    LIST_HEAD(, sim_knote) knotes;    /* EVFILT_VNODE knotes */
+    ino_t ino;
+    mode_t mode;
+    nlink_t nlink;
+    off_t size;
+    time_t time;                      /* time of the last change */
+    unsigned int refs;                /* number of open descriptors */
+};
+
+/* Registered kevent */
+struct sim_knote {
+    RB_ENTRY(sim_knote) link;         /* kqueue's knote tree */
+    TAILQ_ENTRY(sim_knote) pending;   /* kqueue's list of triggered knotes */
+    LIST_ENTRY(sim_knote) entry;      /* node's or kqueue's polled knotes */
+    struct sim_kqueue *kq;
+    struct sim_node *node;            /* watched node of EVFILT_VNODE */
+    struct kevent kev;                /* registered kevent */
+    unsigned int fflags;              /* triggered fflags */
+    int64_t data;                     /* triggered data */
+    unsigned short flags;             /* triggered flags, e.g. EV_EOF */
+    bool queued;                      /* on pending list */
+    bool disabled;
+    int64_t last;                     /* last reported state of fd filters */
+    uint64_t deadline;                /* EVFILT_TIMER expiration time, ns */
+    uint64_t period;                  /* EVFILT_TIMER period, ns */
+};
+RB_HEAD(sim_knotes, sim_knote);
+
+/* Kernel event queue */
+struct sim_kqueue {
+    struct sim_knotes knotes;                /* all registered knotes */
+    TAILQ_HEAD(, sim_knote) pending;         /* triggered knotes */
+    LIST_HEAD(, sim_knote) polled;           /* knotes on real descriptors */
+    LIST_ENTRY(sim_kqueue) link;             /* list of all kqueues */
+    int wakefd;                              /* write end of wakeup pipe */
+    bool woken;                              /* wakeup pipe is not empty */
+    bool closed;
+    size_t vnodes;                           /* number of EVFILT_VNODE knotes */
+    unsigned int waiters;                    /* threads sleeping in kevent */
+    unsigned int users;                      /* threads inside kevent */
+};
+
+/* Open simulated file or kqueue */
+struct sim_file {
+    struct sim_node *node;
+    struct sim_kqueue *kq;
+};
+
+/* Directory stream */
+struct sim_dir {
+    int fd;
+    int pos;                     /* 0 - ".", 1 - "..", 2 - entries */
+    char last[NAME_MAX + 1];     /* name of entry returned last */
+    struct dirent ent;
+};
+
+static pthread_mutex_t sim_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sim_settle_cv = PTHREAD_COND_INITIALIZER;
+static struct sim_node *sim_root = NULL;
+static ino_t sim_ino = SIM_ROOT_INO;
+static time_t sim_time = 0;
+static struct sim_file **sim_files = NULL;
+static size_t sim_nfiles = 0;
+static struct sim_syscalls sim_calls;
+static LIST_HEAD(, sim_kqueue) sim_kqueues = LIST_HEAD_INITIALIZER(sim_kqueues);
+
+static int
+sim_dirent_cmp (struct sim_dirent *de1, struct sim_dirent *de2)
+{
+    return strcmp (de1->name, de2->name);
+}
+
+static int
+sim_knote_cmp (struct sim_knote *kn1, struct sim_knote *kn2)
+{
+    if (kn1->kev.filter != kn2->kev.filter)
+        return kn1->kev.filter < kn2->kev.filter ? -1 : 1;
+    if (kn1->kev.ident != kn2->kev.ident)
+        return kn1->kev.ident < kn2->kev.ident ? -1 : 1;
+    return 0;
+}
+
+RB_GENERATE_NEXT(sim_dirents, sim_dirent, link, static inline)
+RB_GENERATE_MINMAX(sim_dirents, sim_dirent, link, static inline)
+RB_GENERATE_INSERT_COLOR(sim_dirents, sim_dirent, link, static inline)
+RB_GENERATE_REMOVE_COLOR(sim_dirents, sim_dirent, link, static inline)
+RB_GENERATE_INSERT(sim_dirents, sim_dirent, link, sim_dirent_cmp, static inline)
+RB_GENERATE_REMOVE(sim_dirents, sim_dirent, link, static inline)
+RB_GENERATE_FIND(sim_dirents, sim_dirent, link, sim_dirent_cmp, static inline)
+RB_GENERATE_NFIND(sim_dirents, sim_dirent, link, sim_dirent_cmp, static inline)
+
+RB_GENERATE_NEXT(sim_knotes, sim_knote, link, static inline)
+RB_GENERATE_MINMAX(sim_knotes, sim_knote, link, static inline)
+RB_GENERATE_INSERT_COLOR(sim_knotes, sim_knote, link, static inline)
+RB_GENERATE_REMOVE_COLOR(sim_knotes, sim_knote, link, static inline)
+RB_GENERATE_INSERT(sim_knotes, sim_knote, link, sim_knote_cmp, static inline)
+RB_GENERATE_REMOVE(sim_knotes, sim_knote, link, static inline)
+RB_GENERATE_FIND(sim_knotes, sim_knote, link, sim_knote_cmp, static inline)
+
+static uint64_t
+sim_now (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * Allocate a new node. Called with simulator lock held.
+ *
+ * @param[in] mode A file type and permissions of the node.
+ * @return A pointer to the node or NULL if failed.
+ **/
+static struct sim_node *
+sim_node_alloc (mode_t mode)
+{
+    struct sim_node *node = calloc (1, sizeof (struct sim_node));
+
+    if (node == NULL) {
+        return NULL;
+    }
+
+    RB_INIT (&node->entries);
+    LIST_INIT (&node->knotes);
+    node->ino = sim_ino++;
+    node->mode = mode;
+    node->nlink = S_ISDIR (mode) ? 2 : 1;
+    node->time = sim_time;
+    return node;
+}
+
+/**
+ * Free the node if it is neither linked nor opened anymore.
+ *
+ * @param[in] node A pointer to the node.
+ **/
+static void
+sim_node_release (struct sim_node *node)
+{
+    if (node->nlink == 0 && node->refs == 0) {
+        assert (RB_EMPTY (&node->entries));
+        assert (LIST_EMPTY (&node->knotes));
+        free (node);
+    }
+}
+
+/**
+ * Get the root directory, create it on the first use.
+ *
+ * @return A pointer to the root directory node.
+ **/
+static struct sim_node *
+sim_get_root (void)
+{
+    if (sim_root == NULL) {
+        sim_root = sim_node_alloc (S_IFDIR | 0755);
+        if (sim_root == NULL) {
+            abort ();
+        }
+        sim_root->parent = sim_root;
+    }
+    return sim_root;
+}
+
+/**
+ * Get the model state attached to the descriptor.
+ *
+ * @param[in] fd A file descriptor.
+ * @return A pointer to the open file or NULL if fd is not simulated one.
+ **/
+static struct sim_file *
+sim_file_get (int fd)
+{
+    if (fd < 0 || (size_t)fd >= sim_nfiles) {
+        return NULL;
+    }
+    return sim_files[fd];
+}
+
+/**
+ * Attach the model state to the descriptor.
+ *
+ * @param[in] fd   A file descriptor.
+ * @param[in] file A pointer to the open file.
+ * @return 0 on success, -1 otherwise.
+ **/
+static int
+sim_file_set (int fd, struct sim_file *file)
+{
+    if ((size_t)fd >= sim_nfiles) {
+        size_t nfiles = sim_nfiles == 0 ? 64 : sim_nfiles;
+        struct sim_file **files;
+
+        while (nfiles <= (size_t)fd) {
+            nfiles *= 2;
+        }
+        files = realloc (sim_files, nfiles * sizeof (struct sim_file *));
+        if (files == NULL) {
+            return -1;
+        }
+        memset (files + sim_nfiles,
+                0,
+                (nfiles - sim_nfiles) * sizeof (struct sim_file *));
+        sim_files = files;
+        sim_nfiles = nfiles;
+    }
+
+    sim_files[fd] = file;
+    return 0;
+}
+
+/**
+ * Make the kqueue descriptor readable to wake up threads waiting for events
+ * in kevent(2) or in poll(2) on the kqueue descriptor itself.
+ *
+ * @param[in] kq A pointer to the kqueue.
+ **/
+static void
+sim_kq_wakeup (struct sim_kqueue *kq)
+{
+    char c = 0;
+
+    if (!kq->woken) {
+        if (write (kq->wakefd, &c, 1) == 1) {
+            kq->woken = true;
+        }
+    }
+}
+
+/**
+ * Put the knote on the list of triggered knotes of its kqueue.
+ *
+ * @param[in] kn A pointer to the knote.
+ **/
+static void
+sim_knote_activate (struct sim_knote *kn)
+{
+    if (!kn->queued) {
+        TAILQ_INSERT_TAIL (&kn->kq->pending, kn, pending);
+        kn->queued = true;
+    }
+    if (!kn->disabled) {
+        sim_kq_wakeup (kn->kq);
+    }
+}
+
+/**
+ * Unregister the knote and free it.
+ *
+ * @param[in] kn A pointer to the knote.
+ **/
+static void
+sim_knote_drop (struct sim_knote *kn)
+{
+    struct sim_kqueue *kq = kn->kq;
+
+    RB_REMOVE (sim_knotes, &kq->knotes, kn);
+    if (kn->queued) {
+        TAILQ_REMOVE (&kq->pending, kn, pending);
+    }
+    if (kn->kev.filter == EVFILT_VNODE) {
+        --kq->vnodes;
+    }
+    if (kn->kev.filter != EVFILT_USER) {
+        LIST_REMOVE (kn, entry);
+    }
+    free (kn);
+}
+
+/**
+ * Post vnode notes to all knotes watching the node.
+ *
+ * @param[in] node  A pointer to the node.
+ * @param[in] hint  A set of NOTE_* flags describing the change.
+ **/
+static void
+sim_post (struct sim_node *node, unsigned int hint)
+{
+    struct sim_knote *kn;
+
+    LIST_FOREACH (kn, &node->knotes, entry) {
+        unsigned int fflags = hint & kn->kev.fflags;
+        if (fflags != 0) {
+            kn->fflags |= fflags;
+            sim_knote_activate (kn);
+        }
+    }
+}
+
+/**
+ * Find a directory entry.
+ *
+ * @param[in] dir  A pointer to the directory node.
+ * @param[in] name A name of the entry.
+ * @return A pointer to the entry or NULL if not found.
+ **/
+static struct sim_dirent *
+sim_dir_find (struct sim_node *dir, const char *name)
+{
+    struct sim_dirent key;
+
+    key.name = (char *)name;
+    return RB_FIND (sim_dirents, &dir->entries, &key);
+}
+
+/**
+ * Add an entry to the directory.
+ *
+ * @param[in] dir  A pointer to the directory node.
+ * @param[in] name A name of the entry.
+ * @param[in] node A pointer to the node the entry refers to.
+ * @return 0 on success, -1 otherwise.
+ **/
+static int
+sim_dir_add (struct sim_node *dir, const char *name, struct sim_node *node)
+{
+    size_t len = strlen (name);
+    struct sim_dirent *de = malloc (sizeof (struct sim_dirent) + len + 1);
+
+    if (de == NULL) {
+        return -1;
+    }
+
+    de->node = node;
+    de->name = (char *)(de + 1);
+    memcpy (de->name, name, len + 1);
+    RB_INSERT (sim_dirents, &dir->entries, de);
+    if (S_ISDIR (node->mode)) {
+        node->parent = dir;
+        ++dir->nlink;
+    }
+    dir->time = sim_time;
+    return 0;
+}
+
+/**
+ * Remove the entry from the directory. Unlinks the file it refers to.
+ *
+ * @param[in] dir A pointer to the directory node.
+ * @param[in] de  A pointer to the entry.
+ * @return A pointer to the unlinked node.
+ **/
+static struct sim_node *
+sim_dir_remove (struct sim_node *dir, struct sim_dirent *de)
+{
+    struct sim_node *node = de->node;
+
+    RB_REMOVE (sim_dirents, &dir->entries, de);
+    free (de);
+    if (S_ISDIR (node->mode)) {
+        --dir->nlink;
+        node->nlink = 0;
+    } else {
+        --node->nlink;
+    }
+    node->time = sim_time;
+    dir->time = sim_time;
+    return node;
+}
+
+/**
+ * Get the directory relative paths are resolved from.
+ *
+ * @param[in] fd A file descriptor of a directory or AT_FDCWD.
+ * @return A pointer to the directory node or NULL with errno set.
+ **/
+static struct sim_node *
+sim_lookup_start (int fd)
+{
+    struct sim_file *file;
+
+    if (fd == AT_FDCWD) {
+        return sim_get_root ();
+    }
+
+    file = sim_file_get (fd);
+    if (file == NULL || file->node == NULL) {
+        errno = EBADF;
+        return NULL;
+    }
+    return file->node;
+}
+
+/**
+ * Resolve all the path components but the last one. Trailing slashes are
+ * stripped off the last component.
+ *
+ * @param[in]  fd   A file descriptor of a directory or AT_FDCWD.
+ * @param[in]  path A path to resolve.
+ * @param[out] name A buffer of NAME_MAX + 1 bytes for the last component.
+ *                  Empty name is returned for the root directory.
+ * @return A pointer to the parent directory or NULL with errno set.
+ **/
+static struct sim_node *
+sim_lookup_parent (int fd, const char *path, char *name)
+{
+    struct sim_node *dir;
+    const char *p = path, *end;
+    size_t len;
+
+    if (*path == '\0') {
+        errno = ENOENT;
+        return NULL;
+    }
+
+    dir = *path == '/' ? sim_get_root () : sim_lookup_start (fd);
+    if (dir == NULL) {
+        return NULL;
+    }
+
+    for (;;) {
+        while (*p == '/') {
+            ++p;
+        }
+        end = strchr (p, '/');
+        len = end != NULL ? (size_t)(end - p) : strlen (p);
+        if (len > NAME_MAX) {
+            errno = ENAMETOOLONG;
+            return NULL;
+        }
+        memcpy (name, p, len);
+        name[len] = '\0';
+        if (!S_ISDIR (dir->mode)) {
+            errno = ENOTDIR;
+            return NULL;
+        }
+
+        /* Skip trailing slashes */
+        p += len;
+        while (*p == '/') {
+            ++p;
+        }
+        if (*p == '\0') {
+            return dir;
+        }
+
+        if (strcmp (name, "..") == 0) {
+            dir = dir->parent;
+        } else if (strcmp (name, ".") != 0) {
+            struct sim_dirent *de = sim_dir_find (dir, name);
+            if (de == NULL) {
+                errno = ENOENT;
+                return NULL;
+            }
+            dir = de->node;
+        }
+    }
+}
+
+/**
+ * Resolve the last path component in its parent directory.
+ *
+ * @param[in] dir  A pointer to the parent directory node.
+ * @param[in] name A name of the last path component.
+ * @return A pointer to the node or NULL with errno set.
+ **/
+static struct sim_node *
+sim_lookup_name (struct sim_node *dir, const char *name)
+{
+    struct sim_dirent *de;
+
+    if (name[0] == '\0' || strcmp (name, ".") == 0) {
+        return dir;
+    }
+    if (strcmp (name, "..") == 0) {
+        return dir->parent;
+    }
+
+    de = sim_dir_find (dir, name);
+    if (de == NULL) {
+        errno = ENOENT;
+        return NULL;
+    }
+    return de->node;
+}
+
+/**
+ * Resolve the path.
+ *
+ * @param[in] fd   A file descriptor of a directory or AT_FDCWD.
+ * @param[in] path A path to resolve.
+ * @return A pointer to the node or NULL with errno set.
+ **/
+static struct sim_node *
+sim_lookup (int fd, const char *path)
+{
+    char name[NAME_MAX + 1];
+    struct sim_node *dir = sim_lookup_parent (fd, path, name);
+
+    return dir != NULL ? sim_lookup_name (dir, name) : NULL;
+}
+
+/**
+ * Resolve the path to be changed. The last component must be a real entry.
+ *
+ * @param[in]  path A path to resolve.
+ * @param[out] name A buffer of NAME_MAX + 1 bytes for the entry name.
+ * @param[out] de   A pointer to the entry or NULL if it does not exist.
+ * @return A pointer to the parent directory or NULL with errno set.
+ **/
+static struct sim_node *
+sim_lookup_entry (const char *path, char *name, struct sim_dirent **de)
+{
+    struct sim_node *dir = sim_lookup_parent (AT_FDCWD, path, name);
+
+    if (dir == NULL) {
+        return NULL;
+    }
+    if (name[0] == '\0' || strcmp (name, ".") == 0 || strcmp (name, "..") == 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    *de = sim_dir_find (dir, name);
+    return dir;
+}
+
+static void
+sim_fill_stat (struct sim_node *node, struct stat *buf)
+{
+    memset (buf, 0, sizeof (struct stat));
+    buf->st_dev = SIM_DEV;
+    buf->st_ino = node->ino;
+    buf->st_mode = node->mode;
+    buf->st_nlink = node->nlink;
+    buf->st_uid = getuid ();
+    buf->st_gid = getgid ();
+    buf->st_size = node->size;
+    buf->st_atime = node->time;
+    buf->st_mtime = node->time;
+    buf->st_ctime = node->time;
+}
+
+/**
+ * Create a directory.
+ *
+ * @param[in] path A path of the new directory.
+ * @param[in] mode Permissions of the new directory.
+ * @return 0 on success, -1 otherwise.
+ **/
+int
+sim_mkdir (const char *path, mode_t mode)
+{
+    char name[NAME_MAX + 1];
+    struct sim_dirent *de;
+    struct sim_node *dir, *node;
+    int retval = -1;
+
+    pthread_mutex_lock (&sim_mtx);
+    ++sim_time;
+    dir = sim_lookup_entry (path, name, &de);
+    if (dir == NULL) {
+        goto done;
+    }
+    if (de != NULL) {
+        errno = EEXIST;
+        goto done;
+    }
+
+    node = sim_node_alloc (S_IFDIR | (mode & 07777));
+    if (node == NULL) {
+        goto done;
+    }
+    if (sim_dir_add (dir, name, node) == -1) {
+        free (node);
+        goto done;
+    }
+    sim_post (dir, NOTE_WRITE | NOTE_LINK);
+    retval = 0;
+
+done:
+    pthread_mutex_unlock (&sim_mtx);
+    return retval;
+}
+
+/**
+ * Remove an empty directory. Called with simulator lock held.
+ **/
+static int
+sim_rmdir_locked (const char *path)
+{
+    char name[NAME_MAX + 1];
+    struct sim_dirent *de;
+    struct sim_node *dir, *node;
+
+    dir = sim_lookup_entry (path, name, &de);
+    if (dir == NULL) {
+        return -1;
+    }
+    if (de == NULL) {
+        errno = ENOENT;
+        return -1;
+    }
+
+    node = de->node;
+    if (!S_ISDIR (node->mode)) {
+        errno = ENOTDIR;
+        return -1;
+    }
+    if (!RB_EMPTY (&node->entries)) {
+        errno = ENOTEMPTY;
+        return -1;
+    }
+
+    sim_dir_remove (dir, de);
+    sim_post (node, NOTE_DELETE);
+    sim_post (dir, NOTE_WRITE | NOTE_LINK);
+    sim_node_release (node);
+    return 0;
+}
+
+/**
+ * Remove an empty directory.
+ *
+ * @param[in] path A path of the directory.
+ * @return 0 on success, -1 otherwise.
+ **/
+int
+sim_rmdir (const char *path)
+{
+    int retval;
+
+    pthread_mutex_lock (&sim_mtx);
+    ++sim_time;
+    retval = sim_rmdir_locked (path);
+    pthread_mutex_unlock (&sim_mtx);
+    return retval;
+}
+
+/**
+ * Create a regular file or truncate existing one, like creat(2) followed
+ * by close(2) does.
+ *
+ * @param[in] path A path of the file.
+ * @param[in] mode Permissions of the new file.
+ * @return 0 on success, -1 otherwise.
+ **/
+int
+sim_create (const char *path, mode_t mode)
+{
+    char name[NAME_MAX + 1];
+    struct sim_dirent *de;
+    struct sim_node *dir, *node;
+    int retval = -1;
+
+    pthread_mutex_lock (&sim_mtx);
+    ++sim_time;
+    dir = sim_lookup_entry (path, name, &de);
+    if (dir == NULL) {
+        goto done;
+    }
+
+    if (de != NULL) {
+        node = de->node;
+        if (S_ISDIR (node->mode)) {
+            errno = EISDIR;
+            goto done;
+        }
+        sim_post (node, node->size > 0 ? NOTE_WRITE | NOTE_ATTRIB : NOTE_ATTRIB);
+        node->size = 0;
+        node->time = sim_time;
+        retval = 0;
+        goto done;
+    }
+
+    node = sim_node_alloc (S_IFREG | (mode & 07777));
+    if (node == NULL) {
+        goto done;
+    }
+    if (sim_dir_add (dir, name, node) == -1) {
+        free (node);
+        goto done;
+    }
+    sim_post (dir, NOTE_WRITE);
+    retval = 0;
+
+done:
+    pthread_mutex_unlock (&sim_mtx);
+    return retval;
+}
+
+/**
+ * Append data to the regular file.
+ *
+ * @param[in] path A path of the file.
+ * @param[in] len  A number of bytes written.
+ * @return 0 on success, -1 otherwise.
+ **/
+int
+sim_write (const char *path, size_t len)
+{
+    struct sim_node *node;
+    int retval = -1;
+
+    pthread_mutex_lock (&sim_mtx);
+    ++sim_time;
+    node = sim_lookup (AT_FDCWD, path);
+    if (node == NULL) {
+        goto done;
+    }
+    if (S_ISDIR (node->mode)) {
+        errno = EISDIR;
+        goto done;
+    }
+
+    if (len > 0) {
+        node->size += len;
+        node->time = sim_time;
+        sim_post (node, NOTE_WRITE | NOTE_EXTEND);
+    }
+    retval = 0;
+
+done:
+    pthread_mutex_unlock (&sim_mtx);
+    return retval;
+}
+
+/**
+ * Change attributes of the file.
+ *
+ * @param[in] path A path of the file.
+ * @param[in] mode New file mode or 0 to leave it as is.
+ * @return 0 on success, -1 otherwise.
+ **/
+static int
+sim_setattr (const char *path, mode_t mode)
+{
+    struct sim_node *node;
+    int retval = -1;
+
+    pthread_mutex_lock (&sim_mtx);
+    ++sim_time;
+    node = sim_lookup (AT_FDCWD, path);
+    if (node != NULL) {
+        if (mode != 0) {
+            node->mode = (node->mode & S_IFMT) | (mode & 07777);
+        }
+        node->time = sim_time;
+        sim_post (node, NOTE_ATTRIB);
+        retval = 0;
+    }
+    pthread_mutex_unlock (&sim_mtx);
+    return retval;
+}
+
+/**
+ * Change access and modification times of the file. Times passed are
+ * ignored, the simulator clock is used instead.
+ *
+ * @param[in] path  A path of the file.
+ * @param[in] times Ignored.
+ * @return 0 on success, -1 otherwise.
+ **/
+int
+sim_utimes (const char *path, const struct timeval times[2])
+{
+    (void)times;
+    return sim_setattr (path, 0);
+}
+
+/**
+ * Change permissions of the file.
+ *
+ * @param[in] path A path of the file.
+ * @param[in] mode New permissions.
+ * @return 0 on success, -1 otherwise.
+ **/
+int
+sim_chmod (const char *path, mode_t mode)
+{
+    return sim_setattr (path, mode & 07777);
+}
+
+/**
+ * Remove a directory entry. Called with simulator lock held.
+ **/
+static int
+sim_unlink_locked (const char *path)
+{
+    char name[NAME_MAX + 1];
+    struct sim_dirent *de;
+    struct sim_node *dir, *node;
+
+    dir = sim_lookup_entry (path, name, &de);
+    if (dir == NULL) {
+        return -1;
+    }
+    if (de == NULL) {
+        errno = ENOENT;
+        return -1;
+    }
+    if (S_ISDIR (de->node->mode)) {
+        errno = EISDIR;
+        return -1;
+    }
+
+    node = sim_dir_remove (dir, de);
+    sim_post (node, NOTE_DELETE);
+    sim_post (dir, NOTE_WRITE);
+    sim_node_release (node);
+    return 0;
+}
+
+/**
+ * Remove a directory entry of non-directory file.
+ *
+ * @param[in] path A path of the file.
+ * @return 0 on success, -1 otherwise.
+ **/
+int
+sim_unlink (const char *path)
+{
+    int retval;
+
+    pthread_mutex_lock (&sim_mtx);
+    ++sim_time;
+    retval = sim_unlink_locked (path);
+    pthread_mutex_unlock (&sim_mtx);
+    return retval;
+}
+
+/**
+ * Make a hard link to the file.
+ *
+ * @param[in] from A path of existing file.
+ * @param[in] to   A path of the new link.
+ * @return 0 on success, -1 otherwise.
+ **/
+int
+sim_link (const char *from, const char *to)
+{
+    char name[NAME_MAX + 1];
+    struct sim_dirent *de;
+    struct sim_node *dir, *node;
+    int retval = -1;
+
+    pthread_mutex_lock (&sim_mtx);
+    ++sim_time;
+    node = sim_lookup (AT_FDCWD, from);
+    if (node == NULL) {
+        goto done;
+    }
+    if (S_ISDIR (node->mode)) {
+        errno = EPERM;
+        goto done;
+    }
+    dir = sim_lookup_entry (to, name, &de);
+    if (dir == NULL) {
+        goto done;
+    }
+    if (de != NULL) {
+        errno = EEXIST;
+        goto done;
+    }
+
+    if (sim_dir_add (dir, name, node) == -1) {
+        goto done;
+    }
+    ++node->nlink;
+    node->time = sim_time;
+    sim_post (node, NOTE_LINK);
+    sim_post (dir, NOTE_WRITE);
+    retval = 0;
+
+done:
+    pthread_mutex_unlock (&sim_mtx);
+    return retval;
+}
+
+/**
+ * Rename the file.
+ *
+ * @param[in] from A path of existing file.
+ * @param[in] to   A new path of the file. Existing file is replaced.
+ * @return 0 on success, -1 otherwise.
+ **/
+int
+sim_rename (const char *from, const char *to)
+{
+    char fname[NAME_MAX + 1], tname[NAME_MAX + 1];
+    struct sim_dirent *fde, *tde;
+    struct sim_node *fdir, *tdir, *node, *replaced = NULL, *p;
+    unsigned int hint = NOTE_WRITE;
+    int retval = -1;
+
+    pthread_mutex_lock (&sim_mtx);
+    ++sim_time;
+    fdir = sim_lookup_entry (from, fname, &fde);
+    if (fdir == NULL) {
+        goto done;
+    }
+    if (fde == NULL) {
+        errno = ENOENT;
+        goto done;
+    }
+    tdir = sim_lookup_entry (to, tname, &tde);
+    if (tdir == NULL) {
+        goto done;
+    }
+
+    node = fde->node;
+    if (tde != NULL) {
+        if (tde->node == node) {
+            retval = 0;
+            goto done;
+        }
+        if (S_ISDIR (node->mode) && !S_ISDIR (tde->node->mode)) {
+            errno = ENOTDIR;
+            goto done;
+        }
+        if (!S_ISDIR (node->mode) && S_ISDIR (tde->node->mode)) {
+            errno = EISDIR;
+            goto done;
+        }
+        if (!RB_EMPTY (&tde->node->entries)) {
+            errno = ENOTEMPTY;
+            goto done;
+        }
+    }
+    if (S_ISDIR (node->mode)) {
+        /* Directory can not be moved into its own subtree */
+        for (p = tdir; p != sim_root; p = p->parent) {
+            if (p == node) {
+                errno = EINVAL;
+                goto done;
+            }
+        }
+        if (fdir != tdir) {
+            hint |= NOTE_LINK;
+        }
+    }
+
+    if (tde != NULL) {
+        replaced = sim_dir_remove (tdir, tde);
+    }
+    /* Add the new entry first to keep a node linked all the time */
+    if (sim_dir_add (tdir, tname, node) == -1) {
+        goto done;
+    }
+    if (!S_ISDIR (node->mode)) {
+        ++node->nlink;
+    }
+    sim_dir_remove (fdir, sim_dir_find (fdir, fname));
+    if (S_ISDIR (node->mode)) {
+        /* sim_dir_remove has marked the moved directory unlinked */
+        node->nlink = 2;
+        RB_FOREACH (fde, sim_dirents, &node->entries) {
+            if (S_ISDIR (fde->node->mode)) {
+                ++node->nlink;
+            }
+        }
+        node->parent = tdir;
+    }
+
+    sim_post (fdir, hint);
+    if (tdir != fdir) {
+        sim_post (tdir, hint);
+    }
+    sim_post (node, NOTE_RENAME);
+    if (replaced != NULL) {
+        sim_post (replaced, NOTE_DELETE);
+        sim_node_release (replaced);
+    }
+    retval = 0;
+
+done:
+    pthread_mutex_unlock (&sim_mtx);
+    return retval;
+}
+
+/**
+ * Revoke access to the file, e.g. on forced unmount.
+ *
+ * @param[in] path A path of the file.
+ * @return 0 on success, -1 otherwise.
+ **/
+int
+sim_revoke (const char *path)
+{
+    struct sim_node *node;
+
+    pthread_mutex_lock (&sim_mtx);
+    node = sim_lookup (AT_FDCWD, path);
+    if (node != NULL) {
+        sim_post (node, NOTE_REVOKE);
+    }
+    pthread_mutex_unlock (&sim_mtx);
+    return node != NULL ? 0 : -1;
+}
+
+/**
+ * Remove the file or directory with all its content.
+ * Called with simulator lock held.
+ **/
+static int
+sim_rmtree_locked (char *path, size_t len)
+{
+    struct sim_node *node = sim_lookup (AT_FDCWD, path);
+    struct sim_dirent *de;
+
+    if (node == NULL) {
+        return -1;
+    }
+    if (!S_ISDIR (node->mode)) {
+        return sim_unlink_locked (path);
+    }
+
+    while ((de = RB_MIN (sim_dirents, &node->entries)) != NULL) {
+        size_t nlen = strlen (de->name);
+        if (len + nlen + 2 > PATH_MAX) {
+            errno = ENAMETOOLONG;
+            return -1;
+        }
+        path[len] = '/';
+        memcpy (path + len + 1, de->name, nlen + 1);
+        if (sim_rmtree_locked (path, len + nlen + 1) == -1) {
+            return -1;
+        }
+        path[len] = '\0';
+    }
+    return sim_rmdir_locked (path);
+}
+
+/**
+ * Remove the file or directory with all its content like rm -rf does.
+ *
+ * @param[in] path A path of the file or directory.
+ * @return 0 on success, -1 otherwise.
+ **/
+int
+sim_rmtree (const char *path)
+{
+    char buf[PATH_MAX];
+    size_t len = strlen (path);
+    int retval;
+
+    if (len >= sizeof (buf)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    memcpy (buf, path, len + 1);
+
+    pthread_mutex_lock (&sim_mtx);
+    ++sim_time;
+    retval = sim_rmtree_locked (buf, len);
+    pthread_mutex_unlock (&sim_mtx);
+    return retval;
+}
+
+/**
+ * Check if all the posted vnode events are taken by kqueue readers and they
+ * are sleeping waiting for new ones.
+ *
+ * @return true if kqueues with vnode knotes are idle.
+ **/
+static bool
+sim_settled (void)
+{
+    struct sim_kqueue *kq;
+    struct sim_knote *kn;
+
+    LIST_FOREACH (kq, &sim_kqueues, link) {
+        if (kq->vnodes == 0) {
+            continue;
+        }
+        if (kq->waiters == 0) {
+            return false;
+        }
+        TAILQ_FOREACH (kn, &kq->pending, pending) {
+            if (!kn->disabled) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/**
+ * Wait until every kqueue watching simulated files has fetched all the
+ * events and is waiting for new ones. Calling it after each change makes
+ * events from different changes never aggregated into single kevent.
+ **/
+void
+sim_settle (void)
+{
+    pthread_mutex_lock (&sim_mtx);
+    while (!sim_settled ()) {
+        pthread_cond_wait (&sim_settle_cv, &sim_mtx);
+    }
+    pthread_mutex_unlock (&sim_mtx);
+}
+
+/**
+ * Get numbers of file system calls made by the library so far.
+ *
+ * @param[out] calls A pointer to counters to fill.
+ **/
+void
+sim_get_syscalls (struct sim_syscalls *calls)
+{
+    pthread_mutex_lock (&sim_mtx);
+    *calls = sim_calls;
+    pthread_mutex_unlock (&sim_mtx);
+}
+
+/**
+ * Replace every %d in the script line argument with the iteration number.
+ *
+ * @param[in]  arg  A script line argument.
+ * @param[in]  iter An iteration number of repeat block.
+ * @param[out] buf  A buffer of PATH_MAX bytes.
+ * @return buf on success, NULL if the result is too long.
+ **/
+static char *
+sim_script_subst (const char *arg, long iter, char *buf)
+{
+    size_t len = 0;
+    int n;
+
+    while (*arg != '\0') {
+        if (arg[0] == '%' && arg[1] == 'd' && iter >= 0) {
+            n = snprintf (buf + len, PATH_MAX - len, "%ld", iter);
+            if (n < 0 || (size_t)n >= PATH_MAX - len) {
+                return NULL;
+            }
+            len += n;
+            arg += 2;
+        } else {
+            if (len + 1 >= PATH_MAX) {
+                return NULL;
+            }
+            buf[len++] = *arg++;
+        }
+    }
+    buf[len] = '\0';
+    return buf;
+}
+
+/**
+ * Execute single script command.
+ *
+ * @param[in] argv A NULL-terminated list of command words.
+ * @param[in] iter An iteration number of repeat block or -1.
+ * @return 0 on success, -1 otherwise.
+ **/
+static int
+sim_script_exec (char *argv[], long iter)
+{
+    char a1[PATH_MAX], a2[PATH_MAX];
+    const char *cmd = argv[0];
+    int argc;
+
+    for (argc = 0; argv[argc] != NULL; argc++)
+        ;
+
+    if (argc > 1 && sim_script_subst (argv[1], iter, a1) == NULL) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    if (argc > 2 && sim_script_subst (argv[2], iter, a2) == NULL) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    if (strcmp (cmd, "settle") == 0 && argc == 1) {
+        sim_settle ();
+        return 0;
+    } else if (strcmp (cmd, "mkdir") == 0 && argc == 2) {
+        return sim_mkdir (a1, 0755);
+    } else if (strcmp (cmd, "rmdir") == 0 && argc == 2) {
+        return sim_rmdir (a1);
+    } else if (strcmp (cmd, "create") == 0 && argc == 2) {
+        return sim_create (a1, 0644);
+    } else if (strcmp (cmd, "write") == 0 && (argc == 2 || argc == 3)) {
+        return sim_write (a1, argc == 3 ? strtoul (argv[2], NULL, 10) : 1);
+    } else if (strcmp (cmd, "touch") == 0 && argc == 2) {
+        return sim_utimes (a1, NULL);
+    } else if (strcmp (cmd, "chmod") == 0 && argc == 3) {
+        return sim_chmod (a2, strtoul (argv[1], NULL, 8));
+    } else if (strcmp (cmd, "unlink") == 0 && argc == 2) {
+        return sim_unlink (a1);
+    } else if (strcmp (cmd, "link") == 0 && argc == 3) {
+        return sim_link (a1, a2);
+    } else if (strcmp (cmd, "rename") == 0 && argc == 3) {
+        return sim_rename (a1, a2);
+    } else if (strcmp (cmd, "revoke") == 0 && argc == 2) {
+        return sim_revoke (a1);
+    } else if (strcmp (cmd, "rmtree") == 0 && argc == 2) {
+        return sim_rmtree (a1);
+    }
+
+    errno = EINVAL;
+    return -1;
+}
+
+/**
+ * Run the script changing the simulated file system.
+ *
+ * Every line holds a command followed by its arguments separated by blanks.
+ * Empty lines and lines starting with # are ignored. Commands are:
+ *
+ *   mkdir PATH, rmdir PATH, create PATH, write PATH [BYTES], touch PATH,
+ *   chmod MODE PATH, unlink PATH, link FROM TO, rename FROM TO,
+ *   revoke PATH, rmtree PATH - change file system like sim_* calls do;
+ *   settle - wait for kqueues to fetch all events, see #sim_settle;
+ *   repeat COUNT ... end - run enclosed commands COUNT times replacing %d in
+ *   their arguments with iteration number. Blocks can not be nested.
+ *
+ * @param[in]  fp     A stream to read the script from.
+ * @param[out] lineno A number of the failed line, may be NULL.
+ * @return 0 on success, -1 otherwise with errno set.
+ **/
+int
+sim_run_script (FILE *fp, size_t *lineno)
+{
+    char **lines = NULL, line[SIM_SCRIPT_MAX];
+    size_t nlines = 0, i, j, start = 0;
+    long count = 0, iter = -1;
+    int retval = -1, saved_errno;
+
+    /* Read the whole script to replay repeat blocks */
+    while (fgets (line, sizeof (line), fp) != NULL) {
+        char **tmp = realloc (lines, (nlines + 1) * sizeof (char *));
+        if (tmp == NULL) {
+            goto done;
+        }
+        lines = tmp;
+        lines[nlines] = strdup (line);
+        if (lines[nlines] == NULL) {
+            goto done;
+        }
+        ++nlines;
+    }
+    if (ferror (fp)) {
+        goto done;
+    }
+
+    for (i = 0; i < nlines; i++) {
+        char *argv[4], *word, *save = NULL;
+        size_t argc = 0;
+
+        if (lineno != NULL) {
+            *lineno = i + 1;
+        }
+
+        strcpy (line, lines[i]);
+        for (word = strtok_r (line, " \t\r\n", &save);
+             word != NULL && argc < 4;
+             word = strtok_r (NULL, " \t\r\n", &save)) {
+            argv[argc++] = word;
+        }
+        if (argc == 0 || argv[0][0] == '#') {
+            continue;
+        }
+        if (argc == 4) {
+            errno = EINVAL;
+            goto done;
+        }
+        argv[argc] = NULL;
+
+        if (strcmp (argv[0], "repeat") == 0 && argc == 2 && iter < 0) {
+            count = strtol (argv[1], NULL, 10);
+            if (count <= 0) {
+                /* Skip the block */
+                for (j = i + 1; j < nlines; j++) {
+                    if (strncmp (lines[j], "end", 3) == 0) {
+                        break;
+                    }
+                }
+                i = j;
+                continue;
+            }
+            start = i;
+            iter = 0;
+        } else if (strcmp (argv[0], "end") == 0 && argc == 1 && iter >= 0) {
+            if (++iter < count) {
+                i = start;
+            } else {
+                iter = -1;
+            }
+        } else if (sim_script_exec (argv, iter) == -1) {
+            goto done;
+        }
+    }
+    if (iter >= 0) {
+        errno = EINVAL;
+        goto done;
+    }
+    retval = 0;
+
+done:
+    saved_errno = errno;
+    for (i = 0; i < nlines; i++) {
+        free (lines[i]);
+    }
+    free (lines);
+    errno = saved_errno;
+    return retval;
+}
+
+/**
+ * Create a new kqueue.
+ *
+ * @return A kqueue file descriptor on success, -1 otherwise.
+ **/
+int
+sim_kqueue (void)
+{
+    struct sim_kqueue *kq;
+    struct sim_file *file;
+    int fds[2];
+
+    kq = calloc (1, sizeof (struct sim_kqueue));
+    file = calloc (1, sizeof (struct sim_file));
+    if (kq == NULL || file == NULL) {
+        goto failure;
+    }
+
+    if (pipe (fds) == -1) {
+        goto failure;
+    }
+    fcntl (fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl (fds[1], F_SETFD, FD_CLOEXEC);
+    fcntl (fds[0], F_SETFL, O_NONBLOCK);
+    fcntl (fds[1], F_SETFL, O_NONBLOCK);
+
+    RB_INIT (&kq->knotes);
+    TAILQ_INIT (&kq->pending);
+    LIST_INIT (&kq->polled);
+    kq->wakefd = fds[1];
+    file->kq = kq;
+
+    pthread_mutex_lock (&sim_mtx);
+    if (sim_file_set (fds[0], file) == -1) {
+        pthread_mutex_unlock (&sim_mtx);
+        close (fds[0]);
+        close (fds[1]);
+        goto failure;
+    }
+    LIST_INSERT_HEAD (&sim_kqueues, kq, link);
+    pthread_mutex_unlock (&sim_mtx);
+
+    return fds[0];
+
+failure:
+    free (kq);
+    free (file);
+    return -1;
+}
+
+/**
+ * Free the closed kqueue when the last thread leaves kevent.
+ *
+ * @param[in] kq A pointer to the kqueue.
+ **/
+static void
+sim_kq_release (struct sim_kqueue *kq)
+{
+    if (kq->closed && kq->users == 0) {
+        close (kq->wakefd);
+        free (kq);
+    }
+}
+
+/**
+ * Drop knotes attached to the file descriptor being closed.
+ *
+ * @param[in] fd A file descriptor.
+ **/
+static void
+sim_knotes_drop_fd (int fd)
+{
+    static const short filters[] = {
+        EVFILT_READ, EVFILT_WRITE, EVFILT_VNODE, EVFILT_EMPTY
+    };
+    struct sim_kqueue *kq;
+    struct sim_knote key, *kn;
+    size_t i;
+
+    key.kev.ident = fd;
+    LIST_FOREACH (kq, &sim_kqueues, link) {
+        for (i = 0; i < sizeof (filters) / sizeof (filters[0]); i++) {
+            key.kev.filter = filters[i];
+            kn = RB_FIND (sim_knotes, &kq->knotes, &key);
+            if (kn != NULL) {
+                sim_knote_drop (kn);
+            }
+        }
+    }
+}
+
+/**
+ * Register, modify or delete the knote.
+ *
+ * @param[in] kq  A pointer to the kqueue.
+ * @param[in] kev A pointer to the kevent change.
+ * @return 0 on success, errno value otherwise.
+ **/
+static int
+sim_kq_register (struct sim_kqueue *kq, const struct kevent *kev)
+{
+    struct sim_knote key, *kn;
+    struct sim_file *file = NULL;
+
+    key.kev.ident = kev->ident;
+    key.kev.filter = kev->filter;
+    kn = RB_FIND (sim_knotes, &kq->knotes, &key);
+
+    if (kev->flags & EV_DELETE) {
+        if (kn == NULL) {
+            return ENOENT;
+        }
+        sim_knote_drop (kn);
+        return 0;
+    }
+
+    if (kn == NULL) {
+        if (!(kev->flags & EV_ADD)) {
+            return ENOENT;
+        }
+
+        switch (kev->filter) {
+        case EVFILT_VNODE:
+            file = sim_file_get (kev->ident);
+            if (file == NULL || file->node == NULL) {
+                return EBADF;
+            }
+            break;
+        case EVFILT_READ:
+        case EVFILT_WRITE:
+        case EVFILT_EMPTY:
+            if (fcntl (kev->ident, F_GETFD) == -1) {
+                return EBADF;
+            }
+            break;
+        case EVFILT_TIMER:
+            if (kev->data < 0) {
+                return EINVAL;
+            }
+            break;
+        case EVFILT_USER:
+            break;
+        default:
+            return EINVAL;
+        }
+
+        kn = calloc (1, sizeof (struct sim_knote));
+        if (kn == NULL) {
+            return ENOMEM;
+        }
+        kn->kq = kq;
+        kn->kev = *kev;
+        kn->kev.flags &= EV_ONESHOT | EV_CLEAR | EV_DISPATCH;
+        kn->kev.fflags = 0;
+        kn->kev.data = 0;
+        RB_INSERT (sim_knotes, &kq->knotes, kn);
+
+        if (kev->filter == EVFILT_VNODE) {
+            kn->node = file->node;
+            LIST_INSERT_HEAD (&kn->node->knotes, kn, entry);
+            ++kq->vnodes;
+        } else if (kev->filter != EVFILT_USER) {
+            LIST_INSERT_HEAD (&kq->polled, kn, entry);
+        }
+    }
+
+    kn->kev.udata = kev->udata;
+    switch (kev->filter) {
+    case EVFILT_USER:
+        switch (kev->fflags & NOTE_FFCTRLMASK) {
+        case NOTE_FFAND:
+            kn->kev.fflags &= kev->fflags & NOTE_FFLAGSMASK;
+            break;
+        case NOTE_FFOR:
+            kn->kev.fflags |= kev->fflags & NOTE_FFLAGSMASK;
+            break;
+        case NOTE_FFCOPY:
+            kn->kev.fflags = kev->fflags & NOTE_FFLAGSMASK;
+            break;
+        }
+        if (kev->fflags & NOTE_TRIGGER) {
+            kn->data = kev->data;
+            sim_knote_activate (kn);
+        }
+        break;
+    case EVFILT_TIMER:
+        if (kev->flags & EV_ADD) {
+            uint64_t period = kev->data;
+            if (kev->fflags & NOTE_SECONDS) {
+                period *= 1000000000;
+            } else if (kev->fflags & NOTE_USECONDS) {
+                period *= 1000;
+            } else if (!(kev->fflags & NOTE_NSECONDS)) {
+                period *= 1000000;
+            }
+            kn->kev.fflags = kev->fflags;
+            kn->kev.data = kev->data;
+            kn->period = period;
+            kn->deadline = sim_now () + period;
+            kn->data = 0;
+            if (kn->queued) {
+                TAILQ_REMOVE (&kq->pending, kn, pending);
+                kn->queued = false;
+            }
+        }
+        break;
+    default:
+        if (kev->flags & EV_ADD) {
+            kn->kev.fflags = kev->fflags;
+            kn->kev.data = kev->data;
+        }
+        break;
+    }
+
+    if (kev->flags & EV_DISABLE) {
+        kn->disabled = true;
+    }
+    if (kev->flags & (EV_ADD | EV_ENABLE) && !(kev->flags & EV_DISABLE)) {
+        kn->disabled = false;
+        if (kn->queued) {
+            sim_kq_wakeup (kq);
+        }
+    }
+    return 0;
+}
+
+/**
+ * Get the number of bytes not taken by the peer from socket send buffer.
+ *
+ * @param[in] fd A file descriptor of the socket.
+ * @return A number of bytes or -1 on failure.
+ **/
+static int
+sim_sock_outq (int fd)
+{
+    int outq = 0;
+
+#if defined (FIONWRITE)
+    if (ioctl (fd, FIONWRITE, &outq) == -1) {
+        return -1;
+    }
+#elif defined (TIOCOUTQ)
+    if (ioctl (fd, TIOCOUTQ, &outq) == -1) {
+        return -1;
+    }
+#endif
+    return outq;
+}
+
+/**
+ * Get the amount of free space in socket send buffer.
+ *
+ * @param[in] fd A file descriptor of the socket.
+ * @return A number of bytes.
+ **/
+static int
+sim_sock_space (int fd)
+{
+    int sndbuf = 0, outq = sim_sock_outq (fd);
+    socklen_t len = sizeof (sndbuf);
+
+    getsockopt (fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, &len);
+    return sndbuf - (outq > 0 ? outq : 0);
+}
+
+/**
+ * Check state of timers and real descriptors, trigger knotes being ready.
+ *
+ * @param[in] kq A pointer to the kqueue.
+ **/
+static void
+sim_kq_poll (struct sim_kqueue *kq)
+{
+    struct sim_knote *kn;
+    struct pollfd pfd;
+    uint64_t now = 0;
+    int avail;
+
+    LIST_FOREACH (kn, &kq->polled, entry) {
+        int64_t lowat = kn->kev.fflags & NOTE_LOWAT ? kn->kev.data : 1;
+
+        if (kn->kev.filter == EVFILT_TIMER) {
+            if (now == 0) {
+                now = sim_now ();
+            }
+            if (now >= kn->deadline) {
+                uint64_t expired = 1;
+                if (kn->period > 0) {
+                    expired += (now - kn->deadline) / kn->period;
+                }
+                kn->data += expired;
+                kn->deadline += expired * (kn->period > 0 ? kn->period : 1);
+                sim_knote_activate (kn);
+            }
+            continue;
+        }
+
+        pfd.fd = kn->kev.ident;
+        pfd.events = kn->kev.filter == EVFILT_READ ? POLLIN : POLLOUT;
+        pfd.revents = 0;
+        poll (&pfd, 1, 0);
+
+        switch (kn->kev.filter) {
+        case EVFILT_READ:
+            avail = 0;
+            ioctl (kn->kev.ident, FIONREAD, &avail);
+            if (pfd.revents & (POLLHUP | POLLERR) ||
+                (pfd.revents & POLLIN && avail == 0)) {
+                kn->flags |= EV_EOF;
+            }
+            if ((kn->flags & EV_EOF && kn->last >= 0) ||
+                (avail >= lowat &&
+                 (!(kn->kev.flags & EV_CLEAR) || avail != kn->last))) {
+                kn->data = avail;
+                kn->last = kn->flags & EV_EOF ? -1 : avail;
+                sim_knote_activate (kn);
+            } else if (avail < lowat) {
+                kn->last = 0;
+            }
+            break;
+        case EVFILT_WRITE:
+            if (pfd.revents & (POLLHUP | POLLERR)) {
+                if (!(kn->flags & EV_EOF)) {
+                    kn->flags |= EV_EOF;
+                    sim_knote_activate (kn);
+                }
+            } else {
+                avail = pfd.revents & POLLOUT ? sim_sock_space (kn->kev.ident) : 0;
+                if (avail >= lowat &&
+                    (!(kn->kev.flags & EV_CLEAR) || kn->last == 0)) {
+                    kn->data = avail;
+                    sim_knote_activate (kn);
+                }
+                kn->last = avail >= lowat;
+            }
+            break;
+        case EVFILT_EMPTY:
+            if (pfd.revents & (POLLHUP | POLLERR)) {
+                if (!(kn->flags & EV_EOF)) {
+                    kn->flags |= EV_EOF;
+                    sim_knote_activate (kn);
+                }
+            } else {
+                bool empty = sim_sock_outq (kn->kev.ident) == 0;
+                if (empty && (!(kn->kev.flags & EV_CLEAR) || !kn->last)) {
+                    sim_knote_activate (kn);
+                }
+                kn->last = empty;
+            }
+            break;
+        }
+    }
+}
+
+/**
+ * Make the kqueue descriptor readable only if it has events to fetch.
+ *
+ * @param[in] kq   A pointer to the kqueue.
+ * @param[in] kqfd A kqueue file descriptor.
+ **/
+static void
+sim_kq_rearm (struct sim_kqueue *kq, int kqfd)
+{
+    struct sim_knote *kn;
+    char buf[64];
+
+    if (kq->woken) {
+        while (read (kqfd, buf, sizeof (buf)) > 0)
+            ;
+        kq->woken = false;
+    }
+    TAILQ_FOREACH (kn, &kq->pending, pending) {
+        if (!kn->disabled) {
+            sim_kq_wakeup (kq);
+            break;
+        }
+    }
+}
+
+/**
+ * Move triggered knotes to the event list.
+ *
+ * @param[in]  kq        A pointer to the kqueue.
+ * @param[out] eventlist An array to store events to.
+ * @param[in]  nevents   A size of the array.
+ * @return A number of stored events.
+ **/
+static int
+sim_kq_collect (struct sim_kqueue *kq, struct kevent *eventlist, int nevents)
+{
+    TAILQ_HEAD(, sim_knote) requeue = TAILQ_HEAD_INITIALIZER(requeue);
+    struct sim_knote *kn, *next;
+    int n = 0;
+
+    for (kn = TAILQ_FIRST (&kq->pending); kn != NULL && n < nevents; kn = next) {
+        struct kevent *ev = &eventlist[n];
+
+        next = TAILQ_NEXT (kn, pending);
+        if (kn->disabled) {
+            continue;
+        }
+        TAILQ_REMOVE (&kq->pending, kn, pending);
+        kn->queued = false;
+        if (kn->kev.filter == EVFILT_VNODE && kn->fflags == 0) {
+            continue;
+        }
+
+        *ev = kn->kev;
+        ev->flags |= kn->flags;
+        ev->data = kn->data;
+        if (kn->kev.filter == EVFILT_VNODE) {
+            ev->fflags = kn->fflags;
+        }
+        ++n;
+
+        if (kn->kev.flags & EV_ONESHOT) {
+            sim_knote_drop (kn);
+            continue;
+        }
+        if (kn->kev.flags & EV_DISPATCH) {
+            kn->disabled = true;
+        }
+        if (kn->kev.flags & (EV_CLEAR | EV_DISPATCH) ||
+            kn->kev.filter == EVFILT_TIMER) {
+            kn->fflags = 0;
+            kn->data = 0;
+        } else if (kn->kev.filter == EVFILT_VNODE ||
+                   kn->kev.filter == EVFILT_USER) {
+            /* Level triggered knotes stay active */
+            TAILQ_INSERT_TAIL (&requeue, kn, pending);
+            kn->queued = true;
+        }
+    }
+
+    TAILQ_CONCAT (&kq->pending, &requeue, pending);
+    return n;
+}
+
+/**
+ * Build poll(2) descriptor set to sleep on and calculate sleep time.
+ *
+ * @param[in]     kq       A pointer to the kqueue.
+ * @param[in]     kqfd     A kqueue file descriptor.
+ * @param[in]     deadline A time to return at, 0 if infinite.
+ * @param[in,out] pfds     A pointer to the array of descriptors to poll.
+ * @param[in,out] npfds    A pointer to the size of the array.
+ * @param[out]    timeout  A poll(2) timeout in milliseconds.
+ * @return A number of descriptors to poll or -1 on failure.
+ **/
+static int
+sim_kq_pollset (struct sim_kqueue *kq,
+                int kqfd,
+                uint64_t deadline,
+                struct pollfd **pfds,
+                size_t *npfds,
+                int *timeout)
+{
+    struct sim_knote *kn;
+    uint64_t now = sim_now (), wakeup = deadline;
+    size_t n = 1;
+
+    LIST_FOREACH (kn, &kq->polled, entry) {
+        ++n;
+    }
+    if (n > *npfds) {
+        struct pollfd *tmp = realloc (*pfds, n * sizeof (struct pollfd));
+        if (tmp == NULL) {
+            return -1;
+        }
+        *pfds = tmp;
+        *npfds = n;
+    }
+
+    (*pfds)[0].fd = kqfd;
+    (*pfds)[0].events = POLLIN;
+    n = 1;
+    LIST_FOREACH (kn, &kq->polled, entry) {
+        if (kn->disabled) {
+            continue;
+        }
+        switch (kn->kev.filter) {
+        case EVFILT_TIMER:
+            if (wakeup == 0 || kn->deadline < wakeup) {
+                wakeup = kn->deadline;
+            }
+            continue;
+        case EVFILT_EMPTY:
+            /* Draining of socket buffer by peer is not reported by poll */
+            if (!kn->last) {
+                uint64_t tick = now + SIM_EMPTY_MS * 1000000;
+                if (wakeup == 0 || tick < wakeup) {
+                    wakeup = tick;
+                }
+            }
+            (*pfds)[n].events = 0;
+            break;
+        case EVFILT_READ:
+            (*pfds)[n].events = POLLIN;
+            break;
+        case EVFILT_WRITE:
+            (*pfds)[n].events = 0;
+            if (kn->last) {
+                /* Wait for #sim_send to take the space */
+            } else if (!(kn->kev.fflags & NOTE_LOWAT) || kn->kev.data <= 1) {
+                (*pfds)[n].events = POLLOUT;
+            } else if (kn->kev.data <= sim_sock_space (kn->kev.ident) +
+                                      sim_sock_outq (kn->kev.ident)) {
+                /* poll(2) can not wait for low watermark */
+                uint64_t tick = now + SIM_EMPTY_MS * 1000000;
+                if (wakeup == 0 || tick < wakeup) {
+                    wakeup = tick;
+                }
+            }
+            break;
+        }
+        (*pfds)[n].fd = kn->kev.ident;
+        ++n;
+    }
+
+    if (wakeup == 0) {
+        *timeout = -1;
+    } else if (wakeup <= now) {
+        *timeout = 0;
+    } else {
+        *timeout = (wakeup - now + 999999) / 1000000;
+    }
+    return n;
+}
+
+/**
+ * Register changes and fetch events from the kqueue. Mimics kevent(2).
+ *
+ * @return A number of events placed in eventlist, -1 on failure.
+ **/
+int
+sim_kevent (int kqfd,
+            const struct kevent *changelist,
+            int nchanges,
+            struct kevent *eventlist,
+            int nevents,
+            const struct timespec *timeout)
+{
+    struct sim_kqueue *kq;
+    struct sim_file *file;
+    struct pollfd *pfds = NULL;
+    size_t npfds = 0;
+    uint64_t deadline = 0;
+    int i, n = 0, error = 0;
+
+    pthread_mutex_lock (&sim_mtx);
+    file = sim_file_get (kqfd);
+    if (file == NULL || file->kq == NULL) {
+        pthread_mutex_unlock (&sim_mtx);
+        errno = EBADF;
+        return -1;
+    }
+    kq = file->kq;
+    if (nchanges > 0) {
+        ++sim_calls.kevents;
+    }
+
+    for (i = 0; i < nchanges; i++) {
+        error = sim_kq_register (kq, &changelist[i]);
+        if (error != 0 || changelist[i].flags & EV_RECEIPT) {
+            if (n >= nevents) {
+                break;
+            }
+            eventlist[n] = changelist[i];
+            eventlist[n].flags = EV_ERROR;
+            eventlist[n].data = error;
+            ++n;
+            error = 0;
+        }
+    }
+    if (error != 0 || n > 0 || nevents == 0) {
+        pthread_mutex_unlock (&sim_mtx);
+        if (error != 0) {
+            errno = error;
+            return -1;
+        }
+        return n;
+    }
+
+    if (timeout != NULL) {
+        deadline = sim_now () + timeout->tv_sec * 1000000000 + timeout->tv_nsec;
+    }
+
+    ++kq->users;
+    for (;;) {
+        int nfds, ms;
+
+        sim_kq_poll (kq);
+        n = sim_kq_collect (kq, eventlist, nevents);
+        sim_kq_rearm (kq, kqfd);
+        if (n > 0 || (deadline != 0 && sim_now () >= deadline)) {
+            break;
+        }
+
+        nfds = sim_kq_pollset (kq, kqfd, deadline, &pfds, &npfds, &ms);
+        if (nfds == -1) {
+            error = errno;
+            n = -1;
+            break;
+        }
+
+        /* Sleep for changes */
+        ++kq->waiters;
+        pthread_cond_broadcast (&sim_settle_cv);
+        pthread_mutex_unlock (&sim_mtx);
+        i = poll (pfds, nfds, ms);
+        error = errno;
+        pthread_mutex_lock (&sim_mtx);
+        --kq->waiters;
+
+        if (kq->closed) {
+            error = EBADF;
+            n = -1;
+            break;
+        }
+        if (i == -1 && error == EINTR) {
+            n = -1;
+            break;
+        }
+    }
+    --kq->users;
+    sim_kq_release (kq);
+    pthread_mutex_unlock (&sim_mtx);
+    free (pfds);
+
+    if (n == -1) {
+        errno = error;
+    }
+    return n;
+}
+
+/**
+ * Note the data sent to the socket. Socket buffer drains silently for
+ * poll(2), so EVFILT_EMPTY and EVFILT_WRITE knotes are rearmed here.
+ *
+ * @param[in] fd A file descriptor of the socket.
+ **/
+static void
+sim_sock_sent (int fd)
+{
+    struct sim_kqueue *kq;
+    struct sim_knote key, *kn;
+
+    key.kev.ident = fd;
+    pthread_mutex_lock (&sim_mtx);
+    LIST_FOREACH (kq, &sim_kqueues, link) {
+        key.kev.filter = EVFILT_EMPTY;
+        kn = RB_FIND (sim_knotes, &kq->knotes, &key);
+        if (kn != NULL) {
+            kn->last = 0;
+            sim_kq_wakeup (kq);
+        }
+        key.kev.filter = EVFILT_WRITE;
+        kn = RB_FIND (sim_knotes, &kq->knotes, &key);
+        if (kn != NULL) {
+            kn->last = 0;
+            sim_kq_wakeup (kq);
+        }
+    }
+    pthread_mutex_unlock (&sim_mtx);
+}
+
+/**
+ * Send data to the socket. Mimics send(2).
+ **/
+ssize_t
+sim_send (int fd, const void *buf, size_t len, int flags)
+{
+    ssize_t retval = send (fd, buf, len, flags);
+
+    if (retval > 0) {
+        sim_sock_sent (fd);
+    }
+    return retval;
+}
+
+/**
+ * Send data to the socket. Mimics sendmsg(2).
+ **/
+ssize_t
+sim_sendmsg (int fd, const struct msghdr *msg, int flags)
+{
+    ssize_t retval = sendmsg (fd, msg, flags);
+
+    if (retval > 0) {
+        sim_sock_sent (fd);
+    }
+    return retval;
+}
+
+/**
+ * Open the simulated file. Mimics openat(2) with O_RDONLY. O_CREAT is
+ * not supported, simulated files are created with #sim_create.
+ *
+ * @return A file descriptor on success, -1 otherwise.
+ **/
+int
+sim_openat (int fd, const char *path, int flags, ...)
+{
+    struct sim_file *file = NULL;
+    struct sim_node *node;
+    int nfd = -1, oflags = O_RDONLY;
+
+    if (flags & O_CREAT) {
+        errno = EROFS;
+        return -1;
+    }
+#ifdef O_CLOEXEC
+    oflags |= flags & O_CLOEXEC;
+#endif
+
+    pthread_mutex_lock (&sim_mtx);
+    ++sim_calls.opens;
+#ifdef O_EMPTY_PATH
+    if (flags & O_EMPTY_PATH && *path == '\0') {
+        node = sim_lookup_start (fd);
+    } else
+#endif
+    node = sim_lookup (fd, path);
+    if (node == NULL) {
+        goto done;
+    }
+#ifdef O_DIRECTORY
+    if (flags & O_DIRECTORY && !S_ISDIR (node->mode)) {
+        errno = ENOTDIR;
+        goto done;
+    }
+#endif
+
+    file = calloc (1, sizeof (struct sim_file));
+    if (file == NULL) {
+        goto done;
+    }
+    nfd = open ("/dev/null", oflags);
+    if (nfd == -1) {
+        goto done;
+    }
+    if (sim_file_set (nfd, file) == -1) {
+        close (nfd);
+        nfd = -1;
+        goto done;
+    }
+    file->node = node;
+    ++node->refs;
+    file = NULL;
+
+done:
+    pthread_mutex_unlock (&sim_mtx);
+    free (file);
+    return nfd;
+}
+
+/**
+ * Close the file descriptor. Knotes attached to it are dropped as well.
+ *
+ * @param[in] fd A file descriptor.
+ * @return 0 on success, -1 otherwise.
+ **/
+int
+sim_close (int fd)
+{
+    struct sim_file *file;
+
+    pthread_mutex_lock (&sim_mtx);
+    sim_knotes_drop_fd (fd);
+    file = sim_file_get (fd);
+    if (file != NULL) {
+        sim_files[fd] = NULL;
+        if (file->node != NULL) {
+            --file->node->refs;
+            sim_node_release (file->node);
+        }
+        if (file->kq != NULL) {
+            struct sim_kqueue *kq = file->kq;
+            struct sim_knote *kn;
+
+            LIST_REMOVE (kq, link);
+            while ((kn = RB_MIN (sim_knotes, &kq->knotes)) != NULL) {
+                sim_knote_drop (kn);
+            }
+            kq->closed = true;
+            sim_kq_wakeup (kq);
+            pthread_cond_broadcast (&sim_settle_cv);
+            sim_kq_release (kq);
+        }
+        free (file);
+    }
+    pthread_mutex_unlock (&sim_mtx);
+
+    return close (fd);
+}
+
+/**
+ * Close the range of file descriptors. Mimics close_range(2) without flags.
+ *
+ * @param[in] lowfd  A lowest file descriptor to close.
+ * @param[in] highfd A highest file descriptor to close.
+ * @param[in] flags  Must be 0.
+ * @return 0 on success, -1 otherwise.
+ **/
+int
+sim_close_range (unsigned int lowfd, unsigned int highfd, int flags)
+{
+    unsigned int fd;
+
+    if (flags != 0 || lowfd > highfd) {
+        errno = EINVAL;
+        return -1;
+    }
+    for (fd = lowfd; fd <= highfd && fd <= INT_MAX; fd++) {
+        sim_close ((int)fd);
+    }
+    return 0;
+}
+
+/**
+ * Duplicate the file descriptor.
+ *
+ * @param[in] fd      A file descriptor.
+ * @param[in] cloexec Set close-on-exec flag on the new descriptor.
+ * @return A new file descriptor on success, -1 otherwise.
+ **/
+static int
+sim_dup_flags (int fd, bool cloexec)
+{
+    struct sim_file *file, *nfile;
+    int nfd;
+
+    pthread_mutex_lock (&sim_mtx);
+    file = sim_file_get (fd);
+    if (file != NULL && file->kq != NULL) {
+        /* kqueues are not inherited by dup(2) */
+        errno = EBADF;
+        nfd = -1;
+        goto done;
+    }
+
+    nfd = fcntl (fd, cloexec ? F_DUPFD_CLOEXEC : F_DUPFD, 0);
+    if (nfd == -1 || file == NULL) {
+        goto done;
+    }
+
+    nfile = calloc (1, sizeof (struct sim_file));
+    if (nfile == NULL || sim_file_set (nfd, nfile) == -1) {
+        free (nfile);
+        close (nfd);
+        nfd = -1;
+        goto done;
+    }
+    nfile->node = file->node;
+    ++nfile->node->refs;
+
+done:
+    pthread_mutex_unlock (&sim_mtx);
+    return nfd;
+}
+
+/**
+ * Duplicate the file descriptor. Mimics dup(2).
+ **/
+int
+sim_dup (int fd)
+{
+    return sim_dup_flags (fd, false);
+}
+
+/**
+ * Control the file descriptor. Mimics fcntl(2) for integer arguments.
+ **/
+int
+sim_fcntl (int fd, int cmd, ...)
+{
+    va_list ap;
+    int arg;
+
+    va_start (ap, cmd);
+    arg = va_arg (ap, int);
+    va_end (ap);
+
+    switch (cmd) {
+    case F_DUPFD:
+        return sim_dup_flags (fd, false);
+#ifdef F_DUPFD_CLOEXEC
+    case F_DUPFD_CLOEXEC:
+        return sim_dup_flags (fd, true);
+#endif
+    default:
+        return fcntl (fd, cmd, arg);
+    }
+}
+
+/**
+ * Reposition the file offset. Mimics lseek(2), a no-op for simulated files.
+ **/
+off_t
+sim_lseek (int fd, off_t offset, int whence)
+{
+    bool simulated;
+
+    pthread_mutex_lock (&sim_mtx);
+    simulated = sim_file_get (fd) != NULL;
+    pthread_mutex_unlock (&sim_mtx);
+
+    return simulated ? 0 : lseek (fd, offset, whence);
+}
+
+/**
+ * Get file status. Mimics fstat(2).
+ **/
+int
+sim_fstat (int fd, struct stat *buf)
+{
+    struct sim_file *file;
+    int retval = 0;
+
+    pthread_mutex_lock (&sim_mtx);
+    ++sim_calls.stats;
+    file = sim_file_get (fd);
+    if (file != NULL && file->node != NULL) {
+        sim_fill_stat (file->node, buf);
+    } else {
+        retval = fstat (fd, buf);
+    }
+    pthread_mutex_unlock (&sim_mtx);
+    return retval;
+}
+
+/**
+ * Get file status. Mimics fstatat(2).
+ **/
+int
+sim_fstatat (int fd, const char *path, struct stat *buf, int flag)
+{
+    struct sim_node *node;
+
+    pthread_mutex_lock (&sim_mtx);
+    ++sim_calls.stats;
+#ifdef AT_EMPTY_PATH
+    if (flag & AT_EMPTY_PATH && *path == '\0') {
+        node = sim_lookup_start (fd);
+    } else
+#endif
+    node = sim_lookup (fd, path);
+    if (node != NULL) {
+        sim_fill_stat (node, buf);
+    }
+    pthread_mutex_unlock (&sim_mtx);
+
+    (void)flag;
+    return node != NULL ? 0 : -1;
+}
+
+/**
+ * Get file status. Mimics lstat(2).
+ **/
+int
+sim_lstat (const char *path, struct stat *buf)
+{
+    return sim_fstatat (AT_FDCWD, path, buf, 0);
+}
+
+/**
+ * Check file accessibility. Mimics faccessat(2), simulated files are
+ * always accessible.
+ **/
+int
+sim_faccessat (int fd, const char *path, int mode, int flag)
+{
+    struct sim_node *node;
+
+    pthread_mutex_lock (&sim_mtx);
+    ++sim_calls.stats;
+#ifdef AT_EMPTY_PATH
+    if (flag & AT_EMPTY_PATH && *path == '\0') {
+        node = sim_lookup_start (fd);
+    } else
+#endif
+    node = sim_lookup (fd, path);
+    pthread_mutex_unlock (&sim_mtx);
+
+    (void)mode;
+    (void)flag;
+    return node != NULL ? 0 : -1;
+}
+
+/**
+ * Open a directory stream on the simulated directory. Mimics fdopendir(3).
+ **/
+DIR *
+sim_fdopendir (int fd)
+{
+    struct sim_file *file;
+    struct sim_dir *dir = NULL;
+
+    pthread_mutex_lock (&sim_mtx);
+    file = sim_file_get (fd);
+    if (file == NULL || file->node == NULL) {
+        errno = EBADF;
+    } else if (!S_ISDIR (file->node->mode)) {
+        errno = ENOTDIR;
+    } else {
+        dir = calloc (1, sizeof (struct sim_dir));
+        if (dir != NULL) {
+            dir->fd = fd;
+        }
+    }
+    pthread_mutex_unlock (&sim_mtx);
+
+    return (DIR *)dir;
+}
+
+/**
+ * Read the next directory entry. Mimics readdir(3). The position is kept
+ * as the name of the last returned entry, so entries added or removed
+ * while reading do not make others skipped or returned twice.
+ **/
+struct dirent *
+sim_readdir (DIR *dirp)
+{
+    struct sim_dir *dir = (struct sim_dir *)dirp;
+    struct sim_dirent key, *de = NULL;
+    struct sim_file *file;
+    struct sim_node *node = NULL;
+    struct dirent *ent = &dir->ent;
+    const char *name = NULL;
+
+    pthread_mutex_lock (&sim_mtx);
+    file = sim_file_get (dir->fd);
+    if (file == NULL || file->node == NULL) {
+        pthread_mutex_unlock (&sim_mtx);
+        errno = EBADF;
+        return NULL;
+    }
+
+    switch (dir->pos) {
+    case 0:
+        node = file->node;
+        name = ".";
+        break;
+    case 1:
+        node = file->node->parent;
+        name = "..";
+        break;
+    case 2:
+        de = RB_MIN (sim_dirents, &file->node->entries);
+        break;
+    default:
+        key.name = dir->last;
+        de = RB_NFIND (sim_dirents, &file->node->entries, &key);
+        if (de != NULL && strcmp (de->name, dir->last) == 0) {
+            de = RB_NEXT (sim_dirents, &file->node->entries, de);
+        }
+        break;
+    }
+    if (dir->pos >= 2) {
+        if (de == NULL) {
+            pthread_mutex_unlock (&sim_mtx);
+            return NULL;
+        }
+        node = de->node;
+        name = de->name;
+        strcpy (dir->last, name);
+    }
+    ++dir->pos;
+
+    memset (ent, 0, sizeof (struct dirent));
+    ent->d_ino = node->ino;
+    ent->d_reclen = sizeof (struct dirent);
+#ifdef HAVE_STRUCT_DIRENT_D_TYPE
+    ent->d_type = IFTODT (node->mode);
+#endif
+    strcpy (ent->d_name, name);
+    pthread_mutex_unlock (&sim_mtx);
+
+    return ent;
+}
+
+/**
+ * Reset the directory stream position. Mimics rewinddir(3).
+ **/
+void
+sim_rewinddir (DIR *dirp)
+{
+    struct sim_dir *dir = (struct sim_dir *)dirp;
+
+    dir->pos = 0;
+}
+
+/**
+ * Free the directory stream and return its file descriptor.
+ * Mimics fdclosedir(3).
+ **/
+int
+sim_fdclosedir (DIR *dirp)
+{
+    struct sim_dir *dir = (struct sim_dir *)dirp;
+    int fd = dir->fd;
+
+    free (dir);
+    return fd;
+}
+
+/**
+ * Close the directory stream and its file descriptor. Mimics closedir(3).
+ **/
+int
+sim_closedir (DIR *dirp)
+{
+    return sim_close (sim_fdclosedir (dirp));
+}
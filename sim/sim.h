@@ -0,0 +1,103 @@
+/*******************************************************************************
+  Copyright (c) 2026 agent <agent@local>
+  SPDX-License-Identifier: MIT
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in
+  all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+  THE SOFTWARE.
+*******************************************************************************/
+
+
+#ifndef __SIM_H__
+#define __SIM_H__
+
+/*
+ * In-memory file system and kqueue model the library is built on top of
+ * when configured with --enable-simulator. Library sources reach it through
+ * compat.h which routes file system and kqueue calls here. The program using
+ * the library changes the simulated file system with sim_* calls or scripts.
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h> /* msghdr */
+#include <sys/stat.h>
+#include <sys/time.h>   /* timeval */
+
+#include <dirent.h>     /* DIR */
+#include <stdio.h>      /* FILE */
+#include <time.h>       /* timespec */
+
+#include "sys/event.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Numbers of file system calls made by the library */
+struct sim_syscalls {
+    unsigned long opens;        /* openat(2) */
+    unsigned long stats;        /* fstat(2), fstatat(2), lstat(2), faccessat(2) */
+    unsigned long kevents;      /* kevent(2) with non-empty changelist */
+};
+
+/* Changes of simulated file system */
+int sim_mkdir   (const char *path, mode_t mode);
+int sim_rmdir   (const char *path);
+int sim_create  (const char *path, mode_t mode);
+int sim_write   (const char *path, size_t len);
+int sim_utimes  (const char *path, const struct timeval times[2]);
+int sim_chmod   (const char *path, mode_t mode);
+int sim_unlink  (const char *path);
+int sim_link    (const char *from, const char *to);
+int sim_rename  (const char *from, const char *to);
+int sim_revoke  (const char *path);
+int sim_rmtree  (const char *path);
+void sim_settle (void);
+int sim_run_script (FILE *fp, size_t *lineno);
+void sim_get_syscalls (struct sim_syscalls *calls);
+
+/* Replacements of system calls used by the library */
+int sim_kqueue      (void);
+int sim_kevent      (int kq,
+                     const struct kevent *changelist,
+                     int nchanges,
+                     struct kevent *eventlist,
+                     int nevents,
+                     const struct timespec *timeout);
+int sim_openat      (int fd, const char *path, int flags, ...);
+int sim_close       (int fd);
+int sim_close_range (unsigned int lowfd, unsigned int highfd, int flags);
+int sim_dup         (int fd);
+int sim_fcntl       (int fd, int cmd, ...);
+off_t sim_lseek     (int fd, off_t offset, int whence);
+int sim_fstat       (int fd, struct stat *buf);
+int sim_fstatat     (int fd, const char *path, struct stat *buf, int flag);
+int sim_lstat       (const char *path, struct stat *buf);
+int sim_faccessat   (int fd, const char *path, int mode, int flag);
+DIR *sim_fdopendir  (int fd);
+struct dirent *sim_readdir (DIR *dir);
+void sim_rewinddir  (DIR *dir);
+int sim_closedir    (DIR *dir);
+int sim_fdclosedir  (DIR *dir);
+ssize_t sim_send    (int fd, const void *buf, size_t len, int flags);
+ssize_t sim_sendmsg (int fd, const struct msghdr *msg, int flags);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SIM_H__ */
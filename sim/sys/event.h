@@ -0,0 +1,112 @@
+/*******************************************************************************
+  Copyright (c) 2026 agent <agent@local>
+  SPDX-License-Identifier: MIT
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in
+  all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+  THE SOFTWARE.
+*******************************************************************************/
+
+
+#ifndef __SIM_SYS_EVENT_H__
+#define __SIM_SYS_EVENT_H__
+
+/*
+ * kqueue(2) interface provided by the simulator. Constants and layout of
+ * struct kevent follow FreeBSD. Only filters and vnode notes implemented by
+ * sim/sim.c are defined so the library is built as for original kqueue.
+ */
+
+#include <sys/types.h>
+#include <stdint.h> /* int64_t */
+#include <time.h>   /* timespec */
+
+#define EVFILT_READ     (-1)
+#define EVFILT_WRITE    (-2)
+#define EVFILT_VNODE    (-4)
+#define EVFILT_TIMER    (-7)
+#define EVFILT_USER     (-11)
+#define EVFILT_EMPTY    (-13)
+
+/* actions */
+#define EV_ADD          0x0001  /* add event to kq (implies enable) */
+#define EV_DELETE       0x0002  /* delete event from kq */
+#define EV_ENABLE       0x0004  /* enable event */
+#define EV_DISABLE      0x0008  /* disable event (not reported) */
+
+/* flags */
+#define EV_ONESHOT      0x0010  /* only report one occurrence */
+#define EV_CLEAR        0x0020  /* clear event state after reporting */
+#define EV_RECEIPT      0x0040  /* force EV_ERROR on success, data=0 */
+#define EV_DISPATCH     0x0080  /* disable event after reporting */
+
+/* returned values */
+#define EV_ERROR        0x4000  /* error, data contains errno */
+#define EV_EOF          0x8000  /* EOF detected */
+
+/* data/hint flags for EVFILT_USER */
+#define NOTE_FFNOP      0x00000000      /* ignore input fflags */
+#define NOTE_FFAND      0x40000000      /* AND fflags */
+#define NOTE_FFOR       0x80000000      /* OR fflags */
+#define NOTE_FFCOPY     0xc0000000      /* copy fflags */
+#define NOTE_FFCTRLMASK 0xc0000000      /* masks for operations */
+#define NOTE_FFLAGSMASK 0x00ffffff
+#define NOTE_TRIGGER    0x01000000      /* Cause the event to be triggered */
+
+/* data/hint flags for EVFILT_{READ|WRITE} */
+#define NOTE_LOWAT      0x0001          /* low water mark */
+
+/* data/hint flags for EVFILT_VNODE */
+#define NOTE_DELETE     0x0001          /* vnode was removed */
+#define NOTE_WRITE      0x0002          /* data contents changed */
+#define NOTE_EXTEND     0x0004          /* size increased */
+#define NOTE_ATTRIB     0x0008          /* attributes changed */
+#define NOTE_LINK       0x0010          /* link count changed */
+#define NOTE_RENAME     0x0020          /* vnode was renamed */
+#define NOTE_REVOKE     0x0040          /* vnode access was revoked */
+
+/* data/hint flags for EVFILT_TIMER */
+#define NOTE_SECONDS    0x00000001      /* data is seconds */
+#define NOTE_MSECONDS   0x00000002      /* data is milliseconds */
+#define NOTE_USECONDS   0x00000004      /* data is microseconds */
+#define NOTE_NSECONDS   0x00000008      /* data is nanoseconds */
+
+struct kevent {
+    uintptr_t      ident;   /* identifier for this event */
+    short          filter;  /* filter for event */
+    unsigned short flags;   /* action flags for kqueue */
+    unsigned int   fflags;  /* filter flag value */
+    int64_t        data;    /* filter data value */
+    void           *udata;  /* opaque user data identifier */
+    uint64_t       ext[4];  /* extensions */
+};
+
+#define EV_SET(kevp_, a, b, c, d, e, f) do {    \
+    struct kevent *kevp = (kevp_);              \
+    (kevp)->ident = (a);                        \
+    (kevp)->filter = (b);                       \
+    (kevp)->flags = (c);                        \
+    (kevp)->fflags = (d);                       \
+    (kevp)->data = (e);                         \
+    (kevp)->udata = (f);                        \
+    (kevp)->ext[0] = 0;                         \
+    (kevp)->ext[1] = 0;                         \
+    (kevp)->ext[2] = 0;                         \
+    (kevp)->ext[3] = 0;                         \
+} while (0)
+
+#endif /* __SIM_SYS_EVENT_H__ */
@@ -0,0 +1,168 @@
+/*******************************************************************************
+  Copyright (c) 2026 agent <agent@local>
+  SPDX-License-Identifier: MIT
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in
+  all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+  THE SOFTWARE.
+*******************************************************************************/
+
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/stat.h> /* fstat */
+
+#include <assert.h>
+#include <errno.h>    /* errno */
+#include <pthread.h>
+#include <signal.h>   /* sigfillset */
+#include <stdlib.h>   /* calloc */
+#include <unistd.h>   /* close, sysconf */
+
+#include "sys/inotify.h"
+
+#include "compat.h"
+#include "subwatch-prefetch.h"
+#include "utils.h"
+#include "watch.h"
+
+/* Number of entries taken by a thread at once */
+#define PREFETCH_BATCH 32
+
+struct prefetch_ctx {
+    int dirfd;                   /* directory file descriptor */
+    struct prefetch_item *items; /* entries to open */
+    size_t count;                /* number of entries */
+    atomic_uint next;            /* index of first entry not yet taken */
+};
+
+/**
+ * Open and stat directory entries until there is nothing left to take.
+ *
+ * @param[in] arg A pointer to #prefetch_ctx.
+ * @return NULL.
+ **/
+static void*
+prefetch_thread (void *arg)
+{
+    struct prefetch_ctx *ctx = arg;
+    struct prefetch_item *pi;
+    struct stat st;
+    size_t i, last;
+
+    for (;;) {
+        i = atomic_fetch_add (&ctx->next, PREFETCH_BATCH);
+        if (i >= ctx->count) {
+            break;
+        }
+        last = i + PREFETCH_BATCH < ctx->count ? i + PREFETCH_BATCH : ctx->count;
+
+        for (; i < last; i++) {
+            pi = &ctx->items[i];
+            pi->fd = watch_open (ctx->dirfd, pi->di->path, IN_DONT_FOLLOW);
+            if (pi->fd == -1) {
+                pi->error = errno;
+                continue;
+            }
+            if (fstat (pi->fd, &st) == -1) {
+                pi->error = errno;
+                close (pi->fd);
+                pi->fd = -1;
+                continue;
+            }
+            pi->mode = st.st_mode;
+            pi->inode = st.st_ino;
+            pi->dev = st.st_dev;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Open and stat entries of a directory with a pool of helper threads.
+ *
+ * Only system calls are made by helper threads. All the data structures
+ * are left to the calling (worker) thread which takes part in work too.
+ *
+ * @param[in] dirfd   A file descriptor of the directory.
+ * @param[in] items   An array of entries to open.
+ * @param[in] count   A number of entries.
+ * @param[in] threads A number of threads to use including the calling one.
+ *                    Zero means number of online CPUs.
+ **/
+void
+prefetch_run (int dirfd, struct prefetch_item *items, size_t count, int threads)
+{
+    struct prefetch_ctx ctx;
+    pthread_t *tids = NULL;
+    pthread_attr_t attr;
+    sigset_t set, oset;
+    int i, started = 0;
+
+    assert (dirfd != -1);
+    assert (items != NULL || count == 0);
+
+    if (threads == 0) {
+#ifdef _SC_NPROCESSORS_ONLN
+        threads = (int)sysconf (_SC_NPROCESSORS_ONLN);
+#endif
+    }
+    if (threads < 1) {
+        threads = 1;
+    }
+    if (threads > PREFETCH_MAX_THREADS) {
+        threads = PREFETCH_MAX_THREADS;
+    }
+    /* Do not start threads which would not get a batch */
+    if ((size_t)threads > (count + PREFETCH_BATCH - 1) / PREFETCH_BATCH) {
+        threads = (count + PREFETCH_BATCH - 1) / PREFETCH_BATCH;
+    }
+
+    ctx.dirfd = dirfd;
+    ctx.items = items;
+    ctx.count = count;
+    atomic_init (&ctx.next, 0);
+
+    if (threads > 1) {
+        tids = calloc (threads - 1, sizeof (pthread_t));
+    }
+    if (tids != NULL) {
+        pthread_attr_init (&attr);
+        sigfillset (&set);
+        pthread_sigmask (SIG_BLOCK, &set, &oset);
+
+        for (i = 0; i < threads - 1; i++) {
+            if (pthread_create (&tids[i], &attr, prefetch_thread, &ctx) != 0) {
+                perror_msg (("Failed to start a prefetch thread"));
+                break;
+            }
+            ++started;
+        }
+
+        pthread_sigmask (SIG_SETMASK, &oset, NULL);
+        pthread_attr_destroy (&attr);
+    }
+
+    prefetch_thread (&ctx);
+
+    for (i = 0; i < started; i++) {
+        pthread_join (tids[i], NULL);
+    }
+    free (tids);
+}
@@ -0,0 +1,56 @@
+/*******************************************************************************
+  Copyright (c) 2026 agent <agent@local>
+  SPDX-License-Identifier: MIT
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in
+  all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+  THE SOFTWARE.
+*******************************************************************************/
+
+
+#ifndef __SUBWATCH_PREFETCH_H__
+#define __SUBWATCH_PREFETCH_H__
+
+#include <sys/types.h> /* dev_t, ino_t, mode_t */
+
+#include <stddef.h>    /* size_t */
+
+#include "compat.h"
+#include "config.h"
+#include "dep-list.h"
+
+/* Minimal number of directory entries to open them with helper threads */
+#define PREFETCH_MIN_ITEMS   256
+/* Maximal number of helper threads opening entries of a single directory */
+#define PREFETCH_MAX_THREADS 16
+
+/* Directory entry to be opened ahead of subwatch registration */
+struct prefetch_item {
+    struct dep_item *di; /* entry to open */
+    int fd;              /* opened file descriptor or -1 on failure */
+    int error;           /* errno value of failed open or fstat */
+    mode_t mode;         /* file mode reported by fstat */
+    ino_t inode;         /* inode number reported by fstat */
+    dev_t dev;           /* device number reported by fstat */
+};
+
+void prefetch_run (int dirfd,
+                   struct prefetch_item *items,
+                   size_t count,
+                   int threads);
+
+#endif /* __SUBWATCH_PREFETCH_H__ */
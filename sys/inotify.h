@@ -1,6 +1,8 @@
 #ifndef __BSD_INOTIFY_H__
 #define __BSD_INOTIFY_H__
 
+#include <sys/types.h> /* ssize_t */
+
 #if defined (__STDC_VERSION__) && (__STDC_VERSION__ >= 199901L)
 #include <stdint.h>
 #define LIBINOTIFY_FLEXIBLE_ARRAY_MEMBER /**/
@@ -33,12 +35,91 @@
 /* linux`s /proc/sys/fs/inotify/max_user_instances counterpart */
 #define IN_MAX_USER_INSTANCES		2
 #define IN_DEF_MAX_USER_INSTANCES	2147483646
+/*
+ * Libinotify-specific: Measure latency of events from kevent receipt to
+ * delivery to the communication socket. Non-zero value enables measurements
+ * and resets collected data, zero disables them. Results are reported by
+ * libinotify_get_stats().
+ */
+#define IN_EVENT_LATENCY		3
+/*
+ * Libinotify-specific: Transient file elision window in milliseconds.
+ * IN_CREATE events are held for this time and cancelled together with
+ * IN_DELETE for the same file arrived within the window. Zero disables.
+ */
+#define IN_ELISION_WINDOW		4
+/*
+ * Libinotify-specific: Upper limit of communication socket buffer size in
+ * bytes. If set, the buffer grows from IN_SOCKBUFSIZE up to this limit while
+ * events pile up in memory and shrinks back when the consumer keeps socket
+ * drained. Consumers should use read(2) buffers of this size to avoid partial
+ * event reads. Zero disables auto-tuning.
+ */
+#define IN_SOCKBUFSIZE_MAX		5
+/*
+ * Libinotify-specific: Consumer wakeup batching. Events are held until their
+ * total size reaches IN_BATCH_BYTES or their number reaches IN_BATCH_EVENTS,
+ * but not longer than IN_BATCH_DELAY milliseconds. Zero thresholds disable
+ * batching.
+ */
+#define IN_BATCH_BYTES			6
+#define IN_BATCH_EVENTS			7
+#define IN_BATCH_DELAY			8
+#define IN_DEF_BATCH_DELAY		10
+/*
+ * Libinotify-specific: Per-watch fair queuing. Limits number of events of
+ * every watch in the event queue. Events beyond the quota are dropped and
+ * reported with IN_Q_OVERFLOW. Events of different watches are handed over
+ * in round-robin order when they do not fit the socket buffer at once.
+ * Zero disables.
+ */
+#define IN_WATCH_QUOTA			9
+/*
+ * Libinotify-specific: Cross-directory move pairing window in milliseconds.
+ * IN_CREATE and IN_DELETE events are held for this time, and a file removed
+ * from one watched directory and added to another one within the window is
+ * reported as IN_MOVED_FROM/IN_MOVED_TO pair. Zero disables.
+ */
+#define IN_MOVE_WINDOW			10
+/*
+ * Libinotify-specific: Number of threads opening subfiles of large
+ * directories on watch addition. Zero selects number of online CPUs,
+ * one disables helper threads.
+ */
+#define IN_PREFETCH_THREADS		11
+/*
+ * Libinotify-specific: Record worker input to the given file descriptor.
+ * Descriptor is duplicated. -1 stops recording.
+ */
+#define IN_RECORD_FD			12
+/*
+ * Libinotify-specific: Number of file descriptors released by removal of
+ * a single watch at which they are closed by a background thread.
+ * Zero disables.
+ */
+#define IN_REAP_THRESHOLD		13
+/*
+ * Libinotify-specific: Number of threads listing one round of directories
+ * queued to the IN_RESCAN_ASYNC thread, no effect without it. Zero selects
+ * number of online CPUs, one (default) makes the rescan thread list
+ * directories by itself.
+ */
+#define IN_RESCAN_THREADS		14
+/*
+ * Libinotify-specific: One makes modified directories be listed by a
+ * dedicated thread while the worker thread processes other kqueue events.
+ */
+#define IN_RESCAN_ASYNC		15
 
 /* Flags for the parameter of inotify_init1. */
 #define IN_CLOEXEC	02000000	/* Linux x86 O_CLOEXEC */
 #define IN_NONBLOCK	00004000	/* Linux x86 O_NONBLOCK */
 /* libinotify-specific - Direct mode operation. See below. */
 #define	IN_DIRECT	0x80000000
+/* libinotify-specific - Append event timestamps. See below. */
+#define	IN_TIMESTAMP	0x40000000
+/* libinotify-specific - Shared memory event ring. See below. */
+#define	IN_RING		0x20000000
 
 /* Structure describing an inotify event. */
 __extension__ struct inotify_event
@@ -50,6 +131,18 @@ __extension__ struct inotify_event
     char name[LIBINOTIFY_FLEXIBLE_ARRAY_MEMBER];  /* Name.  */
 };
 
+/*
+ * Libinotify-specific: Event timestamps.
+ * If instance is created with IN_TIMESTAMP flag passed to inotify_init1(),
+ * every event carries CLOCK_MONOTONIC time (in nanoseconds) of the moment the
+ * change has been noticed by libinotify. The timestamp occupies the last
+ * 8 bytes of the name field, preceded by the NUL-terminated (possibly empty)
+ * name and zero padding, so len field is never zero and both len and event
+ * size are multiples of 8. Readers which are unaware of the format still see
+ * correct names. The buffer passed to read() must be 8-byte aligned.
+ */
+#define IN_EVENT_TIMESTAMP(ie) \
+	(*(const uint64_t *)(const void *)((ie)->name + (ie)->len - 8))
 
 /* Supported events suitable for MASK parameter of INOTIFY_ADD_WATCH.  */
 #define IN_ACCESS        0x00000001 /* File was accessed.  */
@@ -73,6 +166,17 @@ __extension__ struct inotify_event
 #define IN_UNMOUNT	 0x00002000	/* Backing fs was unmounted.  */
 #define IN_Q_OVERFLOW	 0x00004000	/* Event queued overflowed.  */
 #define IN_IGNORED	 0x00008000	/* File was ignored.  */
+/* Libinotify-specific: Watch added with IN_ADD_ASYNC is fully set up. */
+#define IN_WATCH_READY	 0x00200000
+
+/*
+ * Libinotify-specific: Do not wait for subfiles of a watched directory to be
+ * opened. The directory is still listed before inotify_add_watch() returns,
+ * so creations and removals of entries are reported from the beginning.
+ * Events of subfiles are reported as soon as they get watched in background.
+ * IN_WATCH_READY is reported when all the subfiles are watched.
+ */
+#define IN_ADD_ASYNC	 0x00100000
 
 #define IN_ONLYDIR	 0x01000000	/* Only watch the path if it is a
 					   directory.  */
@@ -113,6 +217,55 @@ int inotify_rm_watch (int fd, int wd) __THROW;
 int libinotify_set_param (int fd, int param, intptr_t value) __THROW;
 #define inotify_set_param(fd, p, v)	libinotify_set_param(fd, p, v)
 
+/* Libinotify-specific: Inotify instance statistics. */
+struct libinotify_stats
+{
+    uint64_t events_produced;  /* Events placed into the event queue.  */
+    uint64_t events_coalesced; /* Events merged with the preceding one.  */
+    uint64_t events_dropped;   /* Events lost due to event queue overflow.  */
+    uint64_t events_elided;    /* Cancelled IN_CREATE/IN_DELETE pairs.  */
+    uint64_t queue_hiwat;      /* Event queue depth high-water mark.  */
+    uint64_t flush_calls;      /* Event batches handed over to consumer.  */
+    uint64_t flush_bytes;      /* Bytes handed over to consumer.  */
+    uint64_t sockbufsize;      /* Current socket buffer size, bytes.  */
+    uint64_t rescans;          /* Directory rescans.  */
+    uint64_t rescan_time;      /* Time spent in directory rescans, ns.  */
+    uint64_t open_fds;         /* File descriptors held by kqueue watches.  */
+    uint64_t watches;          /* Active inotify watches.  */
+    uint64_t dep_items;        /* Directory entries tracked by watches.  */
+    uint64_t latency_samples;  /* Events with measured latency.  */
+    uint64_t latency_p50;      /* Event delivery latency median, ns.  */
+    uint64_t latency_p99;      /* 99th percentile of latency, ns.  */
+    uint64_t latency_p999;     /* 99.9th percentile of latency, ns.  */
+    uint64_t latency_max;      /* Maximal event delivery latency, ns.  */
+};
+
+/* Libinotify specific. Get statistics of inotify instance FD. */
+int libinotify_get_stats (int fd, struct libinotify_stats *stats) __THROW;
+
+/* Libinotify-specific: Subfile name filter types. */
+#define IN_FILTER_INCLUDE	1
+#define IN_FILTER_EXCLUDE	2
+
+/* Libinotify specific. Add subfile name filter PATTERN of TYPE to the watch
+   WD of inotify instance FD. NULL PATTERN removes all filters of the watch. */
+int libinotify_set_filter (int fd, int wd, const char *pattern, int type) __THROW;
+
+/* Libinotify-specific: Directory entry of a watch snapshot. */
+__extension__ struct libinotify_dirent
+{
+    uint64_t ino;    /* Inode number.  */
+    uint32_t type;   /* File type bits of st_mode or 0 if unknown.  */
+    uint32_t len;    /* Length (including NULs) of name, multiple of 8.  */
+    char name[LIBINOTIFY_FLEXIBLE_ARRAY_MEMBER];  /* Name.  */
+};
+
+/* Libinotify specific. Store entries of directory watched by the watch WD of
+   inotify instance FD as seen by libinotify into BUF of LEN bytes. Returns
+   the snapshot size in bytes. Nothing is stored if it exceeds LEN. Helps to
+   resynchronize after IN_Q_OVERFLOW without rescanning the directory. */
+ssize_t libinotify_snapshot (int fd, int wd, void *buf, size_t len) __THROW;
+
 struct iovec;
 
 /*
@@ -126,12 +279,21 @@ struct iovec;
 /* Wait or poll for events in direct mode. This call boils down to kevent().
  * Events are returned as an array of iovec structures, where iov_base points to
  * an inotify_event. Each vector is terminated with an item with iov_base = NULL.
- * The iovec's should be freed using libinotify_free_iovec.
+ * The iovec's should be freed using libinotify_free_iovec. The call does not
+ * block and may return 0 if fd has been reported readable before the call.
  */
 /* FIXME: __THROW ? */
 int libinotify_direct_readv (int fd, struct iovec **events, int size, int no_block);
 
-/* Frees a struct iovec obtained from the libinotify_direct_drain call. */
+/* Read events in direct mode into a caller-supplied buffer. Events are packed
+ * in the same layout as read() from inotify fd returns. Returns number of
+ * bytes stored, 0 if no events available or -1 with errno set to EINVAL if
+ * the buffer is too small for the next event. The call does not block if fd
+ * has been reported readable before the call.
+ */
+ssize_t libinotify_direct_read (int fd, void *buf, size_t len, int no_block);
+
+/* Frees a struct iovec obtained from the libinotify_direct_readv call. */
 void libinotify_free_iovec (struct iovec *events);
 
 /* Closes an inotify fd opened in direct mode.
@@ -139,6 +301,24 @@ void libinotify_free_iovec (struct iovec *events);
  * plain close() when operating in direct mode. */
 int libinotify_direct_close (int fd);
 
+/*
+ * Libinotify-specific: Shared memory event ring.
+ * In this mode the fd handed over to the user is still poll()able, but it
+ * carries only doorbell bytes while events are placed in a ring buffer shared
+ * with the caller. It saves a copy and a read() syscall per batch. The mode
+ * is activated by passing IN_RING to inotify_init1(). Do not read() the fd.
+ */
+
+/* Get a contiguous block of events from the ring. Events have 8-byte aligned
+ * size and are valid until released. Returns block length in bytes or 0 if
+ * the ring is empty. The call must be repeated until 0 is returned before
+ * waiting on the fd again.
+ */
+int libinotify_ring_peek (int fd, const struct inotify_event **events) __THROW;
+
+/* Release len bytes of events obtained from libinotify_ring_peek. */
+int libinotify_ring_release (int fd, int len) __THROW;
+
 __END_DECLS
 
 #endif /* __BSD_INOTIFY_H__ */
@@ -0,0 +1,69 @@
+/*******************************************************************************
+  Copyright (c) 2026 agent <agent@local>
+  SPDX-License-Identifier: MIT
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in
+  all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+  THE SOFTWARE.
+*******************************************************************************/
+
+#include <cstdlib>
+#include <unistd.h>
+
+#include "add_async_test.hh"
+
+add_async_test::add_async_test (journal &j)
+: test ("Asynchronous watch addition", j)
+{
+}
+
+void add_async_test::setup ()
+{
+    cleanup ();
+    system ("mkdir aat-working");
+    system ("cd aat-working && seq 1 300 | xargs touch");
+}
+
+void add_async_test::run (bool direct)
+{
+#ifndef __linux__
+    event_sequence populated, received;
+    int fd, wid;
+
+    /* Raw descriptors are tested, consumer mode does not apply */
+    if (direct)
+        return;
+
+    fd = inotify_init ();
+    wid = inotify_add_watch (fd, "aat-working", IN_ATTRIB | IN_ADD_ASYNC);
+    populated = inotify_client::receive_until_idle (fd, 1000);
+
+    system ("touch aat-working/300");
+    received = inotify_client::receive_until_idle (fd, 200);
+
+    should ("receive IN_WATCH_READY after background watch population",
+            wid != -1 && contains (populated, event ("", wid, IN_WATCH_READY)) &&
+            contains (received, event ("300", wid, IN_ATTRIB)));
+
+    close (fd);
+#endif
+}
+
+void add_async_test::cleanup ()
+{
+    system ("rm -rf aat-working");
+}
@@ -0,0 +1,73 @@
+/*******************************************************************************
+  Copyright (c) 2026 agent <agent@local>
+  SPDX-License-Identifier: MIT
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in
+  all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+  THE SOFTWARE.
+*******************************************************************************/
+
+#include <cstdlib>
+#include <poll.h>
+#include <unistd.h>
+
+#include "batching_test.hh"
+
+batching_test::batching_test (journal &j)
+: test ("Consumer wakeup batching", j)
+{
+}
+
+void batching_test::setup ()
+{
+    cleanup ();
+    system ("mkdir bat-working");
+    system ("touch bat-working/1");
+}
+
+void batching_test::run (bool direct)
+{
+#ifndef __linux__
+    struct pollfd pfd;
+    int held, released, wid;
+
+    /* Raw descriptors are tested, consumer mode does not apply */
+    if (direct)
+        return;
+
+    pfd.fd = inotify_init ();
+    pfd.events = POLLIN;
+    libinotify_set_param (pfd.fd, IN_BATCH_EVENTS, 4);
+    libinotify_set_param (pfd.fd, IN_BATCH_DELAY, 500);
+    wid = inotify_add_watch (pfd.fd, "bat-working", IN_ATTRIB);
+
+    system ("touch bat-working/1");
+    held = poll (&pfd, 1, 100);
+    released = poll (&pfd, 1, 1000);
+
+    should ("hold events below batching threshold up to max delay",
+            wid != -1 && held == 0 && released == 1 &&
+            !inotify_client::receive_until_idle (pfd.fd, 0).empty ());
+
+    close (pfd.fd);
+#endif
+}
+
+void batching_test::cleanup ()
+{
+    system ("rm -rf bat-working");
+}
@@ -69,3 +69,10 @@ bool contains (const events &ev, const event &ev_)
     events::iterator iter = std::find_if (ev.begin(), ev.end(), matcher);
     return (iter != ev.end());
 }
+
+bool contains (const event_sequence &ev, const event &ev_)
+{
+    event_matcher matcher (ev_);
+    event_sequence::const_iterator iter = std::find_if (ev.begin(), ev.end(), matcher);
+    return (iter != ev.end());
+}
@@ -25,6 +25,7 @@
 #define __EVENT_HH__
 
 #include <set>
+#include <vector>
 #include "platform.hh"
 
 struct event {
@@ -38,6 +39,7 @@ struct event {
 };
 
 typedef std::multiset<event> events;
+typedef std::vector<event> event_sequence; /* in order of arrival */
 
 class event_matcher {
     event ev;
@@ -48,5 +50,6 @@ public:
 };
 
 bool contains (const events &ev, const event &ev_);
+bool contains (const event_sequence &ev, const event &ev_);
 
 #endif // __EVENT_HH__
@@ -168,6 +168,49 @@ events inotify_client::receive_during (int timeout) const
     return received;
 }
 
+/*
+ * Read events of a plain inotify descriptor in order of their arrival until
+ * no event comes for timeout milliseconds.
+ */
+event_sequence inotify_client::receive_until_idle (int fd, int timeout)
+{
+    union {
+        uint64_t align;
+        char buf[IE_BUFSIZE];
+    } u;
+    event_sequence received;
+    struct pollfd pfd;
+    ssize_t avail;
+
+    memset (&pfd, 0, sizeof (struct pollfd));
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+
+    while (poll (&pfd, 1, timeout) == 1 &&
+           (avail = read (fd, u.buf, sizeof (u))) > 0) {
+        char *ptr = u.buf;
+
+        while (avail >= (ssize_t) sizeof (struct inotify_event)) {
+            struct inotify_event *ie = (struct inotify_event *) ptr;
+            event ev;
+
+            if (ie->len) {
+                ev.filename = ie->name;
+            }
+            ev.flags = ie->mask;
+            ev.watch = ie->wd;
+            ev.cookie = ie->cookie;
+            received.push_back (ev);
+
+            int offset = sizeof (struct inotify_event) + ie->len;
+            avail -= offset;
+            ptr += offset;
+        }
+    }
+
+    return received;
+}
+
 long inotify_client::bytes_available (int fd)
 {
     long int avail = 0;
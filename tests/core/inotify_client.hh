@@ -47,6 +47,7 @@ public:
     int get_fd ();
 
     static long bytes_available (int fd);
+    static event_sequence receive_until_idle (int fd, int timeout);
 };
 
 #endif // __INOTIFY_CLIENT_HH__
@@ -0,0 +1,83 @@
+/*******************************************************************************
+  Copyright (c) 2026 agent <agent@local>
+  SPDX-License-Identifier: MIT
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in
+  all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+  THE SOFTWARE.
+*******************************************************************************/
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <poll.h>
+
+#include "direct_read_test.hh"
+
+direct_read_test::direct_read_test (journal &j)
+: test ("Direct mode reads", j)
+{
+}
+
+void direct_read_test::setup ()
+{
+    cleanup ();
+    system ("mkdir drt-working");
+    system ("touch drt-working/1");
+}
+
+void direct_read_test::run (bool direct)
+{
+#ifndef __linux__
+    union {
+        uint64_t align;
+        char buf[IN_DEF_SOCKBUFSIZE];
+    } u;
+    struct inotify_event *ie = (struct inotify_event *) u.buf;
+    struct pollfd pfd;
+    ssize_t len, short_len;
+    int short_errno, wid;
+
+    /* Direct mode descriptor is created below */
+    if (direct)
+        return;
+
+    pfd.fd = inotify_init1 (IN_DIRECT);
+    pfd.events = POLLIN;
+    wid = inotify_add_watch (pfd.fd, "drt-working", IN_ATTRIB);
+
+    system ("touch drt-working/1");
+    poll (&pfd, 1, 1000);
+    short_len = libinotify_direct_read (pfd.fd, u.buf,
+                                        sizeof (struct inotify_event), 1);
+    short_errno = errno;
+    len = libinotify_direct_read (pfd.fd, u.buf, sizeof (u), 1);
+
+    should ("read direct mode events into caller-supplied buffer",
+            wid != -1 && short_len == -1 && short_errno == EINVAL &&
+            len >= (ssize_t) (sizeof (struct inotify_event) + ie->len) &&
+            ie->wd == wid && ie->mask == IN_ATTRIB &&
+            strcmp (ie->name, "1") == 0);
+
+    libinotify_direct_close (pfd.fd);
+#endif
+}
+
+void direct_read_test::cleanup ()
+{
+    system ("rm -rf drt-working");
+}
@@ -0,0 +1,76 @@
+/*******************************************************************************
+  Copyright (c) 2026 agent <agent@local>
+  SPDX-License-Identifier: MIT
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in
+  all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+  THE SOFTWARE.
+*******************************************************************************/
+
+#include <cstdlib>
+#include <unistd.h>
+
+#include "elision_test.hh"
+
+elision_test::elision_test (journal &j)
+: test ("Transient file elision", j)
+{
+}
+
+void elision_test::setup ()
+{
+    cleanup ();
+    system ("mkdir elt-working");
+}
+
+void elision_test::run (bool direct)
+{
+#ifndef __linux__
+    struct libinotify_stats stats;
+    event_sequence received;
+    int fd, wid;
+
+    /* Raw descriptors are tested, consumer mode does not apply */
+    if (direct)
+        return;
+
+    fd = inotify_init ();
+    libinotify_set_param (fd, IN_ELISION_WINDOW, 200);
+    wid = inotify_add_watch (fd, "elt-working", IN_CREATE | IN_DELETE);
+
+    system ("touch elt-working/tmp");
+    usleep (50000);
+    system ("rm elt-working/tmp");
+    usleep (50000);
+    system ("touch elt-working/keep");
+
+    received = inotify_client::receive_until_idle (fd, 500);
+    libinotify_get_stats (fd, &stats);
+
+    should ("cancel IN_CREATE/IN_DELETE pair of a transient file",
+            wid != -1 && contains (received, event ("keep", wid, IN_CREATE)) &&
+            !contains (received, event ("tmp", wid, IN_CREATE | IN_DELETE)) &&
+            stats.events_elided == 1);
+
+    close (fd);
+#endif
+}
+
+void elision_test::cleanup ()
+{
+    system ("rm -rf elt-working");
+}
@@ -60,6 +60,9 @@ void event_queue_test::run (bool direct)
     int wid = 0;
 
 
+#ifndef __linux__
+    libinotify_set_param (cons.get_fd (), IN_EVENT_LATENCY, 1);
+#endif
     cons.input.setup ("eqt-working", IN_ATTRIB);
     cons.output.wait ();
 
@@ -132,6 +135,24 @@ void event_queue_test::run (bool direct)
                 contains (received, event ("", -1, IN_Q_OVERFLOW)));
 
 
+#ifndef __linux__
+    struct libinotify_stats stats;
+    should ("get instance statistics",
+            libinotify_get_stats (cons.get_fd (), &stats) == 0 &&
+            stats.watches == 1 && stats.dep_items == 1 &&
+            stats.open_fds == 2 && stats.events_produced > 0 &&
+            stats.flush_calls > 0 && stats.flush_bytes > 0);
+    should ("get event delivery latency percentiles",
+            stats.latency_samples > 0 &&
+            stats.latency_p50 <= stats.latency_p99 &&
+            stats.latency_p99 <= stats.latency_p999 &&
+            stats.latency_p999 <= stats.latency_max);
+    if (!direct)
+        should ("count events lost on event queue overflow",
+                stats.events_dropped > 0);
+#endif
+
+
     cons.input.interrupt ();
 }
 
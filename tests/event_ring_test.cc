@@ -0,0 +1,102 @@
+/*******************************************************************************
+  Copyright (c) 2026 agent <agent@local>
+  SPDX-License-Identifier: MIT
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in
+  all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+  THE SOFTWARE.
+*******************************************************************************/
+
+#include <cstdlib>
+#include <cerrno>
+#include <cstring>
+#include <poll.h>
+#include <unistd.h>
+
+#include "event_ring_test.hh"
+
+event_ring_test::event_ring_test (journal &j)
+: test ("Shared memory event ring", j)
+{
+}
+
+void event_ring_test::setup ()
+{
+    cleanup ();
+    system ("mkdir rgt-working");
+    system ("touch rgt-working/1");
+}
+
+void event_ring_test::run (bool direct)
+{
+#ifndef __linux__
+    const struct inotify_event *rie, *ie;
+    bool ring_reported = false;
+    struct pollfd pfd;
+    int rlen, wid;
+
+    /* Raw descriptors are tested, consumer mode does not apply */
+    if (direct)
+        return;
+
+    pfd.fd = inotify_init1 (IN_RING);
+    pfd.events = POLLIN;
+    wid = inotify_add_watch (pfd.fd, "rgt-working", IN_ATTRIB);
+
+    system ("touch rgt-working/1");
+    poll (&pfd, 1, 1000);
+    while ((rlen = libinotify_ring_peek (pfd.fd, &rie)) > 0) {
+        for (int off = 0; off < rlen;
+             off += sizeof (struct inotify_event) + ie->len) {
+            ie = (const struct inotify_event *) ((const char *) rie + off);
+            if (ie->wd == wid && ie->mask == IN_ATTRIB &&
+                strcmp (ie->name, "1") == 0)
+                ring_reported = true;
+        }
+        libinotify_ring_release (pfd.fd, rlen);
+    }
+
+    should ("receive IN_ATTRIB through shared memory event ring",
+            wid != -1 && rlen == 0 && ring_reported);
+
+
+    bool over_rejected, partial_rejected, released = false;
+
+    system ("touch rgt-working/1");
+    poll (&pfd, 1, 1000);
+    rlen = libinotify_ring_peek (pfd.fd, &rie);
+    over_rejected = rlen > 0 &&
+        libinotify_ring_release (pfd.fd, rlen + 8) == -1 && errno == EINVAL;
+    partial_rejected = rlen > 0 &&
+        libinotify_ring_release (pfd.fd, 8) == -1 && errno == EINVAL;
+    if (rlen > 0)
+        released = libinotify_ring_release (pfd.fd, rlen) == 0;
+
+    should ("reject release of more bytes than peeked from event ring",
+            over_rejected);
+    should ("reject release of event ring record part", partial_rejected);
+    should ("release peeked events after rejected release",
+            released && libinotify_ring_peek (pfd.fd, &rie) == 0);
+
+    close (pfd.fd);
+#endif
+}
+
+void event_ring_test::cleanup ()
+{
+    system ("rm -rf rgt-working");
+}
@@ -0,0 +1,124 @@
+/*******************************************************************************
+  Copyright (c) 2026 agent <agent@local>
+  SPDX-License-Identifier: MIT
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in
+  all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+  THE SOFTWARE.
+*******************************************************************************/
+
+#include <cstdlib>
+#include <unistd.h>
+
+#include "move_pairing_test.hh"
+
+move_pairing_test::move_pairing_test (journal &j)
+: test ("Cross-directory moves", j)
+{
+}
+
+void move_pairing_test::setup ()
+{
+    cleanup ();
+    system ("mkdir mpt-working mpt-working/from mpt-working/to");
+    system ("touch mpt-working/from/f");
+    system ("mkdir mpt-working/noise mpt-working/qfrom mpt-working/qto");
+    system ("cd mpt-working/noise && "
+            "seq -f %040g 1 16 | xargs touch");
+    system ("touch mpt-working/qfrom/a mpt-working/qfrom/f");
+}
+
+void move_pairing_test::run (bool direct)
+{
+#ifndef __linux__
+    event_sequence received;
+    uint32_t from_cookie = 0, to_cookie = 0;
+    bool unpaired = false;
+    size_t from_pos, to_pos;
+    int fd, wid, twid;
+
+    /* Raw descriptors are tested, consumer mode does not apply */
+    if (direct)
+        return;
+
+    fd = inotify_init ();
+    libinotify_set_param (fd, IN_MOVE_WINDOW, 100);
+    wid = inotify_add_watch (fd, "mpt-working/from",
+                             IN_MOVE | IN_CREATE | IN_DELETE);
+    twid = inotify_add_watch (fd, "mpt-working/to",
+                              IN_MOVE | IN_CREATE | IN_DELETE);
+
+    system ("mv mpt-working/from/f mpt-working/to/f");
+
+    received = inotify_client::receive_until_idle (fd, 500);
+    for (size_t i = 0; i < received.size (); i++) {
+        if (received[i].watch == wid && received[i].flags == IN_MOVED_FROM)
+            from_cookie = received[i].cookie;
+        else if (received[i].watch == twid && received[i].flags == IN_MOVED_TO)
+            to_cookie = received[i].cookie;
+        else
+            unpaired = true;
+    }
+
+    should ("pair rename between watched directories into move events",
+            wid != -1 && twid != -1 && !unpaired &&
+            from_cookie != 0 && from_cookie == to_cookie);
+
+    close (fd);
+
+
+    fd = inotify_init ();
+    libinotify_set_param (fd, IN_MOVE_WINDOW, 100);
+    libinotify_set_param (fd, IN_SOCKBUFSIZE, 256);
+    libinotify_set_param (fd, IN_WATCH_QUOTA, 8);
+    inotify_add_watch (fd, "mpt-working/noise", IN_ATTRIB);
+    wid = inotify_add_watch (fd, "mpt-working/qfrom", IN_ATTRIB | IN_MOVE);
+    twid = inotify_add_watch (fd, "mpt-working/qto", IN_MOVE);
+
+    /* Fill socket buffer, so the rest is interleaved in memory */
+    system ("touch mpt-working/noise/*");
+    system ("touch mpt-working/qfrom/a");
+    /* Let IN_ATTRIB go ahead of the move, events of one kevent batch
+     * may come in any order */
+    usleep (100000);
+    system ("mv mpt-working/qfrom/f mpt-working/qto/f");
+    usleep (200000);
+
+    received = inotify_client::receive_until_idle (fd, 500);
+    from_pos = to_pos = received.size ();
+    for (size_t i = 0; i < received.size (); i++) {
+        if (received[i].watch == wid && received[i].flags == IN_MOVED_FROM)
+            from_pos = i;
+        else if (received[i].watch == twid && received[i].flags == IN_MOVED_TO)
+            to_pos = i;
+    }
+
+    should ("keep move pair between watches together with per-watch quota",
+            wid != -1 && twid != -1 &&
+            from_pos < received.size () && to_pos < received.size () &&
+            (to_pos == from_pos + 1 || from_pos == to_pos + 1) &&
+            received[to_pos].cookie != 0 &&
+            received[from_pos].cookie == received[to_pos].cookie);
+
+    close (fd);
+#endif
+}
+
+void move_pairing_test::cleanup ()
+{
+    system ("rm -rf mpt-working");
+}
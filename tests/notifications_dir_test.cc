@@ -50,6 +50,8 @@ void notifications_dir_test::setup ()
     system ("mkdir ntfsdt-cache");
     system ("touch ntfsdt-cache/bar");
 
+    system ("mkdir ntfsdt-filter ntfsdt-oneshot");
+
     system ("mkdir ntfsdt-bugs");
     system ("touch ntfsdt-bugs/1");
     system ("touch ntfsdt-bugs/2");
@@ -403,6 +405,85 @@ void notifications_dir_test::run (bool direct)
             contains (received, event ("", wid, IN_IGNORED)));
 
 
+#ifndef __linux__
+    /* Subfile name filters */
+    cons.input.setup ("ntfsdt-cache", IN_ATTRIB | IN_CREATE);
+    cons.output.wait ();
+    wid = cons.output.added_watch_id ();
+
+    should ("subfile name filter is added successfully",
+            libinotify_set_filter (cons.get_fd (), wid, "*.o",
+                                   IN_FILTER_EXCLUDE) == 0);
+
+    cons.output.reset ();
+    cons.input.receive ();
+
+    system ("touch ntfsdt-cache/baz ntfsdt-cache/baz.o");
+
+    cons.output.wait ();
+    received = cons.output.registered ();
+    should ("receive IN_CREATE for a file passing name filter",
+            contains (received, event ("baz", wid, IN_CREATE)));
+    should ("not receive IN_CREATE for a file filtered out by name",
+            !contains (received, event ("baz.o", wid, IN_CREATE)));
+
+
+    cons.output.reset ();
+    cons.input.receive ();
+
+    libinotify_set_filter (cons.get_fd (), wid, NULL, 0);
+    system ("touch ntfsdt-cache/baz.o");
+
+    cons.output.wait ();
+    received = cons.output.registered ();
+    should ("receive IN_ATTRIB for a file after name filter removal",
+            contains (received, event ("baz.o", wid, IN_ATTRIB)));
+
+
+    cons.output.reset ();
+    cons.input.setup ("ntfsdt-filter", IN_CREATE);
+    cons.output.wait ();
+    wid = cons.output.added_watch_id ();
+
+    should ("include name filter is added successfully",
+            libinotify_set_filter (cons.get_fd (), wid, "*.c",
+                                   IN_FILTER_INCLUDE) == 0);
+
+    cons.output.reset ();
+    cons.input.receive ();
+
+    system ("touch ntfsdt-filter/qux.c ntfsdt-filter/qux.h");
+
+    cons.output.wait ();
+    received = cons.output.registered ();
+    should ("receive IN_CREATE for a file matching include filter",
+            contains (received, event ("qux.c", wid, IN_CREATE)));
+    should ("not receive IN_CREATE for a file not matching include filter",
+            !contains (received, event ("qux.h", wid, IN_CREATE)));
+
+
+    cons.output.reset ();
+    cons.input.setup ("ntfsdt-oneshot", IN_CREATE | IN_ONESHOT);
+    cons.output.wait ();
+    wid = cons.output.added_watch_id ();
+    libinotify_set_filter (cons.get_fd (), wid, "*.o", IN_FILTER_EXCLUDE);
+
+    cons.output.reset ();
+    cons.input.receive (1000);
+
+    /* Filtered out file comes first and must not consume the watch */
+    system ("touch ntfsdt-oneshot/quux.o; sleep 0.2; "
+            "touch ntfsdt-oneshot/quux");
+
+    cons.output.wait ();
+    received = cons.output.registered ();
+    should ("not receive IN_CREATE for a filtered out file on IN_ONESHOT",
+            !contains (received, event ("quux.o", wid, IN_CREATE)));
+    should ("receive IN_CREATE after a filtered out file on IN_ONESHOT",
+            contains (received, event ("quux", wid, IN_CREATE)));
+#endif
+
+
     cons.input.interrupt ();
 }
 
@@ -411,5 +492,6 @@ void notifications_dir_test::cleanup ()
     system ("rm -rf ntfsdt-working-2");
     system ("rm -rf ntfsdt-working");
     system ("rm -rf ntfsdt-cache");
+    system ("rm -rf ntfsdt-filter ntfsdt-oneshot");
     system ("rm -rf ntfsdt-bugs");
 }
@@ -0,0 +1,71 @@
+/*******************************************************************************
+  Copyright (c) 2026 agent <agent@local>
+  SPDX-License-Identifier: MIT
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in
+  all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+  THE SOFTWARE.
+*******************************************************************************/
+
+#include <cstdlib>
+#include <unistd.h>
+
+#include "prefetch_test.hh"
+
+prefetch_test::prefetch_test (journal &j)
+: test ("Subfile prefetch", j)
+{
+}
+
+void prefetch_test::setup ()
+{
+    cleanup ();
+    system ("mkdir pft-working");
+    system ("cd pft-working && seq 1 300 | xargs touch");
+}
+
+void prefetch_test::run (bool direct)
+{
+#ifndef __linux__
+    struct libinotify_stats stats;
+    event_sequence received;
+    int fd, wid;
+
+    /* Raw descriptors are tested, consumer mode does not apply */
+    if (direct)
+        return;
+
+    fd = inotify_init ();
+    libinotify_set_param (fd, IN_PREFETCH_THREADS, 4);
+    wid = inotify_add_watch (fd, "pft-working", IN_ATTRIB);
+    libinotify_get_stats (fd, &stats);
+
+    system ("touch pft-working/150");
+    received = inotify_client::receive_until_idle (fd, 200);
+
+    should ("watch subfiles of large directory opened by helper threads",
+            wid != -1 && stats.open_fds == 301 &&
+            contains (received, event ("150", wid, IN_ATTRIB)));
+
+    close (fd);
+#endif
+}
+
+void prefetch_test::cleanup ()
+{
+    system ("rm -rf pft-working");
+}
@@ -0,0 +1,82 @@
+/*******************************************************************************
+  Copyright (c) 2026 agent <agent@local>
+  SPDX-License-Identifier: MIT
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in
+  all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+  THE SOFTWARE.
+*******************************************************************************/
+
+#include <cstdlib>
+#include <unistd.h>
+
+#include "reaper_test.hh"
+
+reaper_test::reaper_test (journal &j)
+: test ("Descriptor reaper", j)
+{
+}
+
+void reaper_test::setup ()
+{
+    cleanup ();
+    system ("mkdir rpt-working");
+    system ("cd rpt-working && seq 1 300 | xargs touch");
+}
+
+void reaper_test::run (bool direct)
+{
+#ifndef __linux__
+    struct libinotify_stats stats;
+    event_sequence received;
+    bool ignored_reported = false, stale = false;
+    int fd, wid, twid;
+
+    /* Raw descriptors are tested, consumer mode does not apply */
+    if (direct)
+        return;
+
+    fd = inotify_init ();
+    libinotify_set_param (fd, IN_REAP_THRESHOLD, 100);
+    wid = inotify_add_watch (fd, "rpt-working", IN_ATTRIB);
+    twid = inotify_add_watch (fd, "rpt-working/1", IN_ATTRIB);
+    inotify_rm_watch (fd, wid);
+
+    system ("touch rpt-working/1 rpt-working/2");
+
+    received = inotify_client::receive_until_idle (fd, 200);
+    for (size_t i = 0; i < received.size (); i++) {
+        if (received[i].watch == wid && received[i].flags == IN_IGNORED)
+            ignored_reported = true;
+        else if (received[i].watch == wid)
+            stale = true;
+    }
+    libinotify_get_stats (fd, &stats);
+
+    should ("close descriptors of removed watch by background thread",
+            wid != -1 && twid != -1 && ignored_reported && !stale &&
+            contains (received, event ("", twid, IN_ATTRIB)) &&
+            stats.open_fds == 1);
+
+    close (fd);
+#endif
+}
+
+void reaper_test::cleanup ()
+{
+    system ("rm -rf rpt-working");
+}
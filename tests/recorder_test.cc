@@ -0,0 +1,82 @@
+/*******************************************************************************
+  Copyright (c) 2026 agent <agent@local>
+  SPDX-License-Identifier: MIT
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in
+  all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+  THE SOFTWARE.
+*******************************************************************************/
+
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+
+#include "recorder_test.hh"
+
+recorder_test::recorder_test (journal &j)
+: test ("Input recorder", j)
+{
+}
+
+void recorder_test::setup ()
+{
+    cleanup ();
+    system ("mkdir rct-working");
+}
+
+void recorder_test::run (bool direct)
+{
+#ifndef __linux__
+    union {
+        uint64_t align;
+        char buf[IN_DEF_SOCKBUFSIZE];
+    } u;
+    uint32_t magic = 0;
+    ssize_t len, recorded = 0;
+    int rec[2], fd, wid;
+
+    /* Raw descriptors are tested, consumer mode does not apply */
+    if (direct)
+        return;
+
+    pipe (rec);
+    fd = inotify_init ();
+    libinotify_set_param (fd, IN_RECORD_FD, rec[1]);
+    close (rec[1]);
+    wid = inotify_add_watch (fd, "rct-working", IN_ATTRIB);
+    system ("touch rct-working");
+    inotify_client::receive_until_idle (fd, 200);
+    /* Stopping recording flushes it and closes the descriptor */
+    libinotify_set_param (fd, IN_RECORD_FD, -1);
+    while ((len = read (rec[0], u.buf, sizeof (u))) > 0) {
+        if (recorded == 0 && len >= (ssize_t)sizeof (magic))
+            memcpy (&magic, u.buf, sizeof (magic));
+        recorded += len;
+    }
+
+    should ("record worker input to descriptor set with IN_RECORD_FD",
+            wid != -1 && magic == 0x524b494c && recorded > 64);
+
+    close (rec[0]);
+    close (fd);
+#endif
+}
+
+void recorder_test::cleanup ()
+{
+    system ("rm -rf rct-working");
+}
@@ -0,0 +1,106 @@
+/*******************************************************************************
+  Copyright (c) 2026 agent <agent@local>
+  SPDX-License-Identifier: MIT
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in
+  all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+  THE SOFTWARE.
+*******************************************************************************/
+
+#include <cstdlib>
+#include <unistd.h>
+
+#include "rescan_test.hh"
+
+rescan_test::rescan_test (journal &j)
+: test ("Directory rescan thread", j)
+{
+}
+
+void rescan_test::setup ()
+{
+    cleanup ();
+    system ("mkdir rst-working rst-working/ra rst-working/rb");
+}
+
+void rescan_test::run (bool direct)
+{
+#ifndef __linux__
+    event_sequence received;
+    int fd, wid, twid, async_set, step = 0;
+
+    /* Raw descriptors are tested, consumer mode does not apply */
+    if (direct)
+        return;
+
+    fd = inotify_init ();
+    libinotify_set_param (fd, IN_RESCAN_ASYNC, 1);
+    libinotify_set_param (fd, IN_RESCAN_THREADS, 2);
+    wid = inotify_add_watch (fd, "rst-working/ra", IN_CREATE);
+    twid = inotify_add_watch (fd, "rst-working/rb", IN_CREATE);
+
+    system ("touch rst-working/ra/f rst-working/rb/f");
+    received = inotify_client::receive_until_idle (fd, 500);
+
+    should ("receive IN_CREATE in directories listed by rescan threads",
+            wid != -1 && twid != -1 &&
+            contains (received, event ("f", wid, IN_CREATE)) &&
+            contains (received, event ("f", twid, IN_CREATE)));
+
+    close (fd);
+
+
+    fd = inotify_init ();
+    async_set = libinotify_set_param (fd, IN_RESCAN_ASYNC, 1);
+    wid = inotify_add_watch (fd, "rst-working/ra",
+                             IN_CREATE | IN_DELETE | IN_ATTRIB);
+
+    /* Let each change be listed before the next one */
+    system ("touch rst-working/ra/g");
+    usleep (100000);
+    system ("chmod 750 rst-working/ra");
+    usleep (100000);
+    system ("rm rst-working/ra/g");
+
+    received = inotify_client::receive_until_idle (fd, 500);
+    for (size_t i = 0; i < received.size (); i++) {
+        const event &ev = received[i];
+        /* Skip IN_ATTRIB reported for the subfile itself */
+        if (ev.watch != wid || (ev.flags & IN_ATTRIB && ev.filename != ""))
+            continue;
+        /* Diff events keep their place around directory IN_ATTRIB */
+        if (step == 0 && ev.flags == IN_CREATE && ev.filename == "g")
+            step = 1;
+        else if (step == 1 && ev.flags & IN_ATTRIB)
+            step = 2;
+        else if (step == 2 && ev.flags == IN_DELETE && ev.filename == "g")
+            step = 3;
+        else
+            step = -1;
+    }
+
+    should ("receive directory events in order with rescan thread",
+            async_set == 0 && wid != -1 && step == 3);
+
+    close (fd);
+#endif
+}
+
+void rescan_test::cleanup ()
+{
+    system ("rm -rf rst-working");
+}
@@ -0,0 +1,83 @@
+/*******************************************************************************
+  Copyright (c) 2026 agent <agent@local>
+  SPDX-License-Identifier: MIT
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in
+  all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+  THE SOFTWARE.
+*******************************************************************************/
+
+#include <cstdlib>
+#include <cstring>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "snapshot_test.hh"
+
+snapshot_test::snapshot_test (journal &j)
+: test ("Directory snapshot", j)
+{
+}
+
+void snapshot_test::setup ()
+{
+    cleanup ();
+    system ("mkdir snt-working");
+    system ("touch snt-working/1");
+}
+
+void snapshot_test::run (bool direct)
+{
+#ifndef __linux__
+    union {
+        uint64_t align;
+        char buf[IN_DEF_SOCKBUFSIZE];
+    } u;
+    struct libinotify_dirent *de;
+    ssize_t len, snap_len;
+    bool snap_found = false;
+    int fd, wid;
+
+    /* Raw descriptors are tested, consumer mode does not apply */
+    if (direct)
+        return;
+
+    fd = inotify_init ();
+    wid = inotify_add_watch (fd, "snt-working", IN_ATTRIB);
+
+    snap_len = libinotify_snapshot (fd, wid, NULL, 0);
+    len = libinotify_snapshot (fd, wid, u.buf, sizeof (u));
+    for (ssize_t off = 0; off < len;
+         off += sizeof (struct libinotify_dirent) + de->len) {
+        de = (struct libinotify_dirent *) (u.buf + off);
+        if (strcmp (de->name, "1") == 0 &&
+            (de->type == S_IFREG || de->type == 0) && de->len % 8 == 0)
+            snap_found = true;
+    }
+
+    should ("get directory snapshot of a watch",
+            wid != -1 && snap_len > 0 && len == snap_len && snap_found &&
+            libinotify_snapshot (fd, wid + 1, u.buf, sizeof (u)) == -1);
+
+    close (fd);
+#endif
+}
+
+void snapshot_test::cleanup ()
+{
+    system ("rm -rf snt-working");
+}
@@ -0,0 +1,74 @@
+/*******************************************************************************
+  Copyright (c) 2026 agent <agent@local>
+  SPDX-License-Identifier: MIT
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in
+  all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+  THE SOFTWARE.
+*******************************************************************************/
+
+#include <cstdlib>
+#include <unistd.h>
+
+#include "sockbuf_test.hh"
+
+sockbuf_test::sockbuf_test (journal &j)
+: test ("Socket buffer auto-tuning", j)
+{
+}
+
+void sockbuf_test::setup ()
+{
+    cleanup ();
+    system ("mkdir sbt-working");
+    system ("touch sbt-working/1");
+}
+
+void sockbuf_test::run (bool direct)
+{
+#ifndef __linux__
+    struct libinotify_stats stats;
+    int fd, wid;
+
+    /* Raw descriptors are tested, consumer mode does not apply */
+    if (direct)
+        return;
+
+    fd = inotify_init ();
+    libinotify_set_param (fd, IN_SOCKBUFSIZE, 256);
+    libinotify_set_param (fd, IN_SOCKBUFSIZE_MAX, IN_DEF_SOCKBUFSIZE);
+    wid = inotify_add_watch (fd, "sbt-working", IN_ATTRIB);
+
+    for (int i = 0; i < 32; i++) {
+        system ("touch sbt-working");
+        system ("touch sbt-working/1");
+    }
+    inotify_client::receive_until_idle (fd, 200);
+    libinotify_get_stats (fd, &stats);
+
+    should ("grow socket buffer when events pile up in memory",
+            wid != -1 && stats.sockbufsize > 256 &&
+            stats.sockbufsize <= IN_DEF_SOCKBUFSIZE);
+
+    close (fd);
+#endif
+}
+
+void sockbuf_test::cleanup ()
+{
+    system ("rm -rf sbt-working");
+}
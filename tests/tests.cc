@@ -33,6 +33,20 @@
 #include "symlink_test.hh"
 #include "bugs_test.hh"
 #include "event_queue_test.hh"
+#include "timestamp_test.hh"
+#include "elision_test.hh"
+#include "event_ring_test.hh"
+#include "direct_read_test.hh"
+#include "sockbuf_test.hh"
+#include "batching_test.hh"
+#include "watch_quota_test.hh"
+#include "snapshot_test.hh"
+#include "move_pairing_test.hh"
+#include "prefetch_test.hh"
+#include "add_async_test.hh"
+#include "reaper_test.hh"
+#include "rescan_test.hh"
+#include "recorder_test.hh"
 
 #define CONCURRENT
 
@@ -51,6 +65,20 @@ int main (int argc, char *argv[]) {
         new fail_test (j),
         new bugs_test (j),
         new event_queue_test (j),
+        new timestamp_test (j),
+        new elision_test (j),
+        new event_ring_test (j),
+        new direct_read_test (j),
+        new sockbuf_test (j),
+        new batching_test (j),
+        new watch_quota_test (j),
+        new snapshot_test (j),
+        new move_pairing_test (j),
+        new prefetch_test (j),
+        new add_async_test (j),
+        new reaper_test (j),
+        new rescan_test (j),
+        new recorder_test (j),
     };
     const int num_tests = sizeof(tests)/sizeof(tests[0]);
 
@@ -0,0 +1,87 @@
+/*******************************************************************************
+  Copyright (c) 2026 agent <agent@local>
+  SPDX-License-Identifier: MIT
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in
+  all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+  THE SOFTWARE.
+*******************************************************************************/
+
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <poll.h>
+#include <unistd.h>
+
+#include "timestamp_test.hh"
+
+timestamp_test::timestamp_test (journal &j)
+: test ("Event timestamps", j)
+{
+}
+
+void timestamp_test::setup ()
+{
+    cleanup ();
+    system ("mkdir tst-working");
+    system ("touch tst-working/1");
+}
+
+void timestamp_test::run (bool direct)
+{
+#ifndef __linux__
+    struct timespec ts;
+    uint64_t before, after;
+    union {
+        uint64_t align;
+        char buf[IN_DEF_SOCKBUFSIZE];
+    } u;
+    struct inotify_event *ie = (struct inotify_event *) u.buf;
+    struct pollfd pfd;
+    ssize_t len;
+    int wid;
+
+    /* Raw descriptors are tested, consumer mode does not apply */
+    if (direct)
+        return;
+
+    pfd.fd = inotify_init1 (IN_TIMESTAMP);
+    pfd.events = POLLIN;
+    wid = inotify_add_watch (pfd.fd, "tst-working", IN_ATTRIB);
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    before = (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+    system ("touch tst-working/1");
+    len = poll (&pfd, 1, 1000) == 1 ? read (pfd.fd, u.buf, sizeof (u)) : -1;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    after = (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+
+    should ("receive timestamped IN_ATTRIB with IN_TIMESTAMP flag",
+            wid != -1 && len > 0 &&
+            ie->wd == wid && ie->mask == IN_ATTRIB &&
+            ie->len % 8 == 0 && strcmp (ie->name, "1") == 0 &&
+            IN_EVENT_TIMESTAMP (ie) >= before &&
+            IN_EVENT_TIMESTAMP (ie) <= after);
+
+    close (pfd.fd);
+#endif
+}
+
+void timestamp_test::cleanup ()
+{
+    system ("rm -rf tst-working");
+}
@@ -0,0 +1,78 @@
+/*******************************************************************************
+  Copyright (c) 2026 agent <agent@local>
+  SPDX-License-Identifier: MIT
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in
+  all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+  THE SOFTWARE.
+*******************************************************************************/
+
+#include <cstdlib>
+#include <unistd.h>
+
+#include "watch_quota_test.hh"
+
+watch_quota_test::watch_quota_test (journal &j)
+: test ("Per-watch event quota", j)
+{
+}
+
+void watch_quota_test::setup ()
+{
+    cleanup ();
+    system ("mkdir wqt-working");
+    system ("touch wqt-working/1 wqt-working/2");
+}
+
+void watch_quota_test::run (bool direct)
+{
+#ifndef __linux__
+    event_sequence received;
+    int fd, wid, qwid;
+
+    /* Raw descriptors are tested, consumer mode does not apply */
+    if (direct)
+        return;
+
+    fd = inotify_init ();
+    libinotify_set_param (fd, IN_SOCKBUFSIZE, 256);
+    libinotify_set_param (fd, IN_WATCH_QUOTA, 4);
+    wid = inotify_add_watch (fd, "wqt-working", IN_ATTRIB);
+    qwid = inotify_add_watch (fd, "wqt-working/2", IN_ATTRIB);
+
+    for (int i = 0; i < 32; i++) {
+        system ("touch wqt-working");
+        system ("touch wqt-working/1");
+    }
+    system ("touch wqt-working/2");
+    usleep (100000);
+
+    received = inotify_client::receive_until_idle (fd, 200);
+
+    should ("limit events of noisy watch with per-watch quota",
+            wid != -1 && qwid != -1 &&
+            contains (received, event ("", qwid, IN_ATTRIB)) &&
+            contains (received, event ("", -1, IN_Q_OVERFLOW)));
+
+    close (fd);
+#endif
+}
+
+void watch_quota_test::cleanup ()
+{
+    system ("rm -rf wqt-working");
+}
@@ -22,6 +22,8 @@
   THE SOFTWARE.
 *******************************************************************************/
 
+#include "config.h"
+
 #include <sys/types.h>
 #include <sys/event.h> /* kqueue[1] */
 #include <sys/socket.h>/* send, sendmsg */
@@ -35,12 +37,12 @@
 #include <stdio.h>
 #include <stdlib.h> /* malloc */
 #include <string.h> /* strlen */
+#include <time.h>   /* clock_gettime */
 #include <unistd.h> /* read, write */
 
 #include "sys/inotify.h"
 
 #include "compat.h"
-#include "config.h"
 #include "utils.h"
 
 static const struct timespec zero_ts = { 0, 0 };
@@ -81,6 +83,24 @@ kqueue_init (void)
     return kq;
 }
 
+/**
+ * Read monotonic clock.
+ *
+ * @return Current value of the monotonic clock in nanoseconds.
+ **/
+uint64_t
+monotonic_ns (void)
+{
+    struct timespec ts;
+
+#ifdef CLOCK_MONOTONIC
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+#else
+    clock_gettime (CLOCK_REALTIME, &ts);
+#endif
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
 /**
  * Create a new inotify event.
  *
@@ -88,6 +108,8 @@ kqueue_init (void)
  * @param[in] mask   An inotify watch mask.
  * @param[in] cookie Event cookie.
  * @param[in] name   File name (may be NULL).
+ * @param[in] timestamp Event timestamp to append after the name
+ *     (may be NULL). See IN_EVENT_TIMESTAMP in sys/inotify.h for layout.
  * @param[out] event_len The length of the created event, in bytes.
  * @return A pointer to a created event on NULL on a failure.
  **/
@@ -96,10 +118,17 @@ create_inotify_event (int         wd,
                       uint32_t    mask,
                       uint32_t    cookie,
                       const char *name,
+                      const uint64_t *timestamp,
                       size_t     *event_len)
 {
     struct inotify_event *event = NULL;
     size_t name_len = name ? strlen (name) + 1 : 0;
+
+    if (timestamp != NULL) {
+        /* Round NUL-terminated name up to 8 bytes and reserve the trailer */
+        name_len = ((name_len > 0 ? name_len : 1) + 7) / 8 * 8;
+        name_len += sizeof (uint64_t);
+    }
     *event_len = offsetof (struct inotify_event, name) + name_len;
     event = calloc (1, *event_len);
 
@@ -118,6 +147,11 @@ create_inotify_event (int         wd,
     if (name) {
         strlcpy (event->name, name, name_len);
     }
+    if (timestamp != NULL) {
+        memcpy (event->name + name_len - sizeof (uint64_t),
+                timestamp,
+                sizeof (uint64_t));
+    }
 
     return event;
 }
@@ -323,3 +357,42 @@ fdreopendir (int oldd)
 
     return dir;
 }
+
+static int
+fd_cmp (const void *a, const void *b)
+{
+    int fa = *(const int *)a, fb = *(const int *)b;
+
+    return (fa > fb) - (fa < fb);
+}
+
+/**
+ * Close a set of file descriptors in one sweep. Descriptors are sorted
+ * in place and runs of consecutive ones are closed with single
+ * close_range(2) call where it is available.
+ *
+ * @param[in] fds  An array of file descriptors to close.
+ * @param[in] nfds A number of file descriptors in the array.
+ **/
+void
+close_fds (int *fds, size_t nfds)
+{
+    size_t i, j, k;
+
+    assert (fds != NULL || nfds == 0);
+
+    qsort (fds, nfds, sizeof (int), fd_cmp);
+
+    for (i = 0; i < nfds; i = j) {
+        for (j = i + 1; j < nfds && fds[j] == fds[j - 1] + 1; j++);
+#ifdef HAVE_CLOSE_RANGE
+        if (j - i > 1 &&
+            close_range ((unsigned)fds[i], (unsigned)fds[j - 1], 0) == 0) {
+            continue;
+        }
+#endif
+        for (k = i; k < j; k++) {
+            close (fds[k]);
+        }
+    }
+}
@@ -66,11 +66,13 @@ do {                                                                    \
 #endif
 
 int kqueue_init (void);
+uint64_t monotonic_ns (void);
 
 struct inotify_event* create_inotify_event (int         wd,
                                             uint32_t    mask,
                                             uint32_t    cookie,
                                             const char *name,
+                                            const uint64_t *timestamp,
                                             size_t     *event_len);
 
 ssize_t sendv (int fd, struct iovec iov[], int iovcnt, int flags);
@@ -82,5 +84,6 @@ int set_nonblock_flag (int fd, int value);
 int set_sndbuf_size (int fd, int len);
 int dup_cloexec (int oldd);
 DIR *fdreopendir (int oldd);
+void close_fds (int *fds, size_t nfds);
 
 #endif /* __UTILS_H__ */
@@ -27,9 +27,11 @@
 
 #include <assert.h>
 #include <stddef.h> /* NULL */
+#include <stdlib.h> /* malloc, free */
 
 #include "compat.h"
 #include "inotify-watch.h"
+#include "utils.h"
 #include "watch-set.h"
 #include "watch.h"
 
@@ -57,7 +59,8 @@ watch_set_init (struct watch_set *ws)
 }
 
 /**
- * Free the memory allocated for the watch set.
+ * Free the memory allocated for the watch set. Descriptors of the watches
+ * are closed in one sweep.
  *
  * @param[in] ws A pointer the the watch set.
  **/
@@ -65,12 +68,29 @@ void
 watch_set_free (struct watch_set *ws)
 {
     struct watch *w, *tmp;
+    int *fds;
+    size_t nfds = 0;
 
     assert (ws != NULL);
 
+    RB_FOREACH (w, watch_set, ws) {
+        ++nfds;
+    }
+    fds = nfds > 0 ? malloc (nfds * sizeof (int)) : NULL;
+
+    nfds = 0;
     RB_FOREACH_SAFE (w, watch_set, ws, tmp) {
+        if (fds != NULL && w->fd != -1) {
+            fds[nfds++] = w->fd;
+            w->fd = -1;
+        }
         watch_set_delete (ws, w);
     }
+
+    if (fds != NULL) {
+        close_fds (fds, nfds);
+        free (fds);
+    }
 }
 
 /**
@@ -130,6 +150,28 @@ watch_set_find (struct watch_set *ws, dev_t dev, ino_t inode)
 
     return RB_FIND (watch_set, ws, &find);
 }
+
+/**
+ * Count watches in the watch set.
+ *
+ * @param[in] ws A pointer to #watch_set.
+ * @return A number of kqueue watches (and opened file descriptors) in the set.
+ **/
+size_t
+watch_set_count (struct watch_set *ws)
+{
+    struct watch *w;
+    size_t count = 0;
+
+    assert (ws != NULL);
+
+    RB_FOREACH (w, watch_set, ws) {
+        ++count;
+    }
+
+    return count;
+}
+
 /**
  * Custom comparison function that can compare kqueue watch inode values
  * through pointers passed by RB tree functions
@@ -39,5 +39,6 @@ void          watch_set_free   (struct watch_set *ws);
 void          watch_set_delete (struct watch_set *ws, struct watch *w);
 void          watch_set_insert (struct watch_set *ws, struct watch *w);
 struct watch *watch_set_find   (struct watch_set *ws, dev_t dev, ino_t inode);
+size_t        watch_set_count  (struct watch_set *ws);
 
 #endif /* __WATCH_SET_H__ */
@@ -203,15 +203,13 @@ watch_register_event (struct watch *w, int kq, uint32_t fflags)
 
 /**
  * Calculates kqueue filter flags for a #watch with traversing depedencies.
- * and register vnode kqueue watch in kernel kqueue(2) subsystem
  *
  * @param[in] w  A pointer to the #watch.
- * @return 1 on success, -1 on error and 0 if no events have been registered
+ * @return kqueue filter flags wanted by all the #watch dependencies.
  **/
-int
-watch_update_event (struct watch *w)
+static uint32_t
+watch_calc_fflags (struct watch *w)
 {
-    int kq;
     mode_t mode;
     uint32_t fflags = 0;
     struct watch_dep *wd;
@@ -219,7 +217,6 @@ watch_update_event (struct watch *w)
     assert (w != NULL);
     assert (!watch_deps_empty (w));
 
-    kq = SLIST_FIRST(&w->deps)->iw->wrk->kq;
     mode = watch_get_mode (w);
 
     WD_FOREACH (wd, w) {
@@ -230,7 +227,178 @@ watch_update_event (struct watch *w)
     }
     assert (fflags != 0);
 
-    return (watch_register_event (w, kq, fflags));
+    return fflags;
+}
+
+/**
+ * Calculates kqueue filter flags for a #watch with traversing depedencies.
+ * and register vnode kqueue watch in kernel kqueue(2) subsystem
+ *
+ * @param[in] w  A pointer to the #watch.
+ * @return 1 on success, -1 on error and 0 if no events have been registered
+ **/
+int
+watch_update_event (struct watch *w)
+{
+    int kq;
+
+    assert (w != NULL);
+    assert (!watch_deps_empty (w));
+
+    kq = SLIST_FIRST(&w->deps)->iw->wrk->kq;
+
+    return (watch_register_event (w, kq, watch_calc_fflags (w)));
+}
+
+/**
+ * Initialize a batch of kqueue filter flags updates.
+ *
+ * @param[in] wb A pointer to the #watch_batch.
+ * @param[in] kq A kqueue descriptor to apply updates to.
+ **/
+void
+watch_batch_init (struct watch_batch *wb, int kq)
+{
+    assert (wb != NULL);
+    assert (kq != -1);
+
+    wb->kq = kq;
+    wb->count = 0;
+}
+
+/**
+ * Calculates kqueue filter flags for a #watch like watch_update_event()
+ * does but queues the change to the batch rather than register it in
+ * kernel at once. The batch is flushed when it gets full.
+ *
+ * Batched #watch must not be freed or updated with watch_update_event()
+ * until the batch is flushed.
+ *
+ * @param[in] wb A pointer to the #watch_batch.
+ * @param[in] w  A pointer to the #watch.
+ * @return 0 on success, -1 if flushing of full batch failed.
+ **/
+int
+watch_batch_update (struct watch_batch *wb, struct watch *w)
+{
+    uint32_t fflags;
+
+    assert (wb != NULL);
+    assert (w != NULL);
+
+    fflags = watch_calc_fflags (w);
+    if (fflags == w->fflags) {
+        return 0;
+    }
+
+    EV_SET (&wb->changes[wb->count],
+            w->fd,
+            EVFILT_VNODE,
+            EV_ADD | EV_ENABLE | EV_CLEAR,
+            fflags,
+            0,
+            PTR_TO_UDATA (w));
+    wb->watches[wb->count] = w;
+
+    if (++wb->count == WATCH_BATCH_SIZE) {
+        return (watch_batch_flush (wb));
+    }
+    return 0;
+}
+
+/**
+ * Register all the queued kqueue filter flags updates in kernel with
+ * single kevent() call where EV_RECEIPT is supported.
+ *
+ * @param[in] wb A pointer to the #watch_batch.
+ * @return 0 on success, -1 if any of updates failed.
+ **/
+int
+watch_batch_flush (struct watch_batch *wb)
+{
+    size_t i;
+    int result = 0;
+#ifdef EV_RECEIPT
+    struct kevent receipts[WATCH_BATCH_SIZE];
+    int n;
+#endif
+
+    assert (wb != NULL);
+
+    if (wb->count == 0) {
+        return 0;
+    }
+
+#ifdef EV_RECEIPT
+    for (i = 0; i < wb->count; i++) {
+        wb->changes[i].flags |= EV_RECEIPT;
+    }
+
+    n = kevent (wb->kq,
+                wb->changes,
+                wb->count,
+                receipts,
+                wb->count,
+                zero_tsp);
+    if (n == -1) {
+        perror_msg (("Failed to register %zu kqueue watches", wb->count));
+        wb->count = 0;
+        return -1;
+    }
+
+    /* Receipts are returned in order of changelist */
+    for (i = 0; i < (size_t)n; i++) {
+        assert (receipts[i].ident == wb->changes[i].ident);
+        if (receipts[i].flags & EV_ERROR && receipts[i].data != 0) {
+            errno = receipts[i].data;
+            perror_msg (("Failed to register kqueue watch for fd %d",
+                         wb->watches[i]->fd));
+            result = -1;
+        } else {
+            wb->watches[i]->fflags = wb->changes[i].fflags;
+        }
+    }
+#else
+    for (i = 0; i < wb->count; i++) {
+        if (kevent (wb->kq, &wb->changes[i], 1, NULL, 0, zero_tsp) == -1) {
+            perror_msg (("Failed to register kqueue watch for fd %d",
+                         wb->watches[i]->fd));
+            result = -1;
+        } else {
+            wb->watches[i]->fflags = wb->changes[i].fflags;
+        }
+    }
+#endif
+
+    wb->count = 0;
+    return result;
+}
+
+/**
+ * Checks that watch_open() would not be refused for lack of permissions.
+ *
+ * Lets callers reuse an already opened watch for a path without opening
+ * it again while still honouring the access checks done by open(2).
+ *
+ * @param[in] dirfd A filedes of parent directory or AT_FDCWD.
+ * @param[in] path  A pointer to filename
+ * @param[in] flags A watch flags in inotify format
+ * @return true if the file can be opened for watching, false otherwise
+ **/
+bool
+watch_may_open (int dirfd, const char *path, uint32_t flags)
+{
+    assert (path != NULL);
+
+#if (defined(HAVE_O_PATH) && READDIR_DOES_OPENDIR == 2) || defined(O_EVTONLY)
+    /* Lookup permissions are already checked by the caller's stat */
+    return true;
+#elif defined(HAVE_FACCESSAT)
+    return faccessat (dirfd, path, R_OK, AT_EACCESS |
+                      (flags & IN_DONT_FOLLOW ? AT_SYMLINK_NOFOLLOW : 0)) == 0;
+#else
+    return false;
+#endif
 }
 
 /**
@@ -453,6 +621,7 @@ watch_del_dep (struct watch *w, struct i_watch *iw, const struct dep_item *di)
         SLIST_REMOVE (&w->deps, wd, watch_dep, next);
         free (wd);
         if (watch_deps_empty (w)) {
+            worker_drop_kevents (iw->wrk, w);
             watch_set_delete (&iw->wrk->watches, w);
         } else {
             watch_update_event (w);
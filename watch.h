@@ -26,6 +26,7 @@
 #define __WATCH_H__
 
 #include <sys/types.h>
+#include <sys/event.h> /* kevent */
 #include <sys/queue.h>
 #include <sys/stat.h>  /* stat */
 
@@ -53,6 +54,16 @@ struct watch {
     RB_ENTRY(watch) link;     /* RB tree links */
 };
 
+/* Number of kqueue filter updates registered with single kevent() call */
+#define WATCH_BATCH_SIZE 64
+
+struct watch_batch {
+    int kq;                   /* kqueue descriptor updates are applied to */
+    size_t count;             /* number of queued updates */
+    struct kevent changes[WATCH_BATCH_SIZE];
+    struct watch *watches[WATCH_BATCH_SIZE];
+};
+
 uint32_t inotify_to_kqueue (uint32_t flags, mode_t mode, bool is_subwatch);
 uint32_t kqueue_to_inotify (uint32_t flags,
                             mode_t mode,
@@ -60,6 +71,7 @@ uint32_t kqueue_to_inotify (uint32_t flags,
                             bool is_deleted);
 
 int           watch_open     (int dirfd, const char *path, uint32_t flags);
+bool          watch_may_open (int dirfd, const char *path, uint32_t flags);
 struct watch* watch_init     (int fd);
 void          watch_free     (struct watch *w);
 
@@ -80,6 +92,10 @@ struct watch_dep *watch_chg_dep  (struct watch *w,
 int    watch_register_event (struct watch *w, int kq, uint32_t fflags);
 int    watch_update_event   (struct watch *w);
 
+void   watch_batch_init     (struct watch_batch *wb, int kq);
+int    watch_batch_update   (struct watch_batch *wb, struct watch *w);
+int    watch_batch_flush    (struct watch_batch *wb);
+
 /**
  * Checks if #watch is associated with any file dependency or not.
  *
@@ -26,10 +26,12 @@
 
 #include <sys/types.h>
 #include <sys/event.h>
+#include <sys/stat.h> /* fstatat */
 
 #include <stddef.h> /* NULL */
 #include <assert.h>
 #include <errno.h>  /* errno */
+#include <fcntl.h>  /* AT_SYMLINK_NOFOLLOW */
 #include <stdlib.h> /* calloc, realloc */
 #include <string.h> /* memset */
 #include <stdio.h>
@@ -41,10 +43,16 @@
 #include "config.h"
 #include "dep-list.h"
 #include "inotify-watch.h"
+#include "move-index.h"
+#include "rescan.h"
 #include "utils.h"
 #include "watch.h"
 #include "worker.h"
 
+/* Events reported after directory diff by produce_notifications() */
+#define IN_AFTER_DIFF \
+    (IN_CLOSE | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF | IN_UNMOUNT)
+
 void worker_erase (struct worker *wrk);
 static void handle_moved (void *udata,
                           struct dep_item *from_di,
@@ -78,6 +86,11 @@ enqueue_event (struct i_watch *iw, uint32_t mask, const struct dep_item *di)
         return 0;
     }
 
+    /* Filtered out subfiles must not consume IN_ONESHOT watch */
+    if (di != DI_PARENT && iwatch_is_filtered (iw, di->path)) {
+        return 0;
+    }
+
     if (iw->flags & IN_ONESHOT) {
         iw->is_closed = true;
     }
@@ -100,6 +113,46 @@ enqueue_event (struct i_watch *iw, uint32_t mask, const struct dep_item *di)
     return 0;
 }
 
+/**
+ * Record successfully executed worker command.
+ *
+ * @param[in] wrk A pointer to #worker.
+ * @param[in] cmd A pointer to executed #worker_cmd.
+ **/
+static void
+record_command (struct worker *wrk, struct worker_cmd *cmd)
+{
+    struct i_watch *iw;
+
+    switch (cmd->type) {
+    case WCMD_ADD:
+        SLIST_FOREACH (iw, &wrk->head, next) {
+            if (iw->wd == cmd->retval) {
+                recorder_add (&wrk->rec,
+                              cmd->cmd.add.filename,
+                              cmd->cmd.add.mask,
+                              iw->wd,
+                              iw->inode,
+                              iw->mode);
+                break;
+            }
+        }
+        break;
+    case WCMD_REMOVE:
+        recorder_remove (&wrk->rec, cmd->cmd.rm_id);
+        break;
+    case WCMD_PARAM:
+        if (cmd->cmd.param.param != IN_RECORD_FD) {
+            recorder_param (&wrk->rec,
+                            cmd->cmd.param.param,
+                            cmd->cmd.param.value);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
 /**
  * Process a worker command.
  *
@@ -128,6 +181,25 @@ process_command (struct worker *wrk, struct worker_cmd *cmd)
                                         cmd->cmd.param.value);
         cmd->error = errno;
         break;
+    case WCMD_STATS:
+        cmd->retval = worker_get_stats (wrk, cmd->cmd.stats);
+        cmd->error = errno;
+        break;
+    case WCMD_FILTER:
+        cmd->retval = worker_set_filter (wrk,
+                                         cmd->cmd.filter.wd,
+                                         cmd->cmd.filter.pattern,
+                                         cmd->cmd.filter.type);
+        cmd->error = errno;
+        break;
+    case WCMD_SNAPSHOT:
+        cmd->retval = worker_snapshot (wrk,
+                                       cmd->cmd.snapshot.wd,
+                                       cmd->cmd.snapshot.buf,
+                                       cmd->cmd.snapshot.len,
+                                       cmd->cmd.snapshot.size);
+        cmd->error = errno;
+        break;
     default:
         perror_msg (("Worker processing a command without a command - "
                     "something went wrong."));
@@ -135,6 +207,10 @@ process_command (struct worker *wrk, struct worker_cmd *cmd)
         cmd->error = EINVAL;
     }
 
+    if (cmd->retval != -1 && recorder_enabled (&wrk->rec)) {
+        record_command (wrk, cmd);
+    }
+
     worker_post (wrk);
 }
 
@@ -148,6 +224,85 @@ struct handle_context {
     uint32_t fflags;
 };
 
+/**
+ * Pair the file removed from one watched directory and added to other one
+ * within move pairing window into IN_MOVED_FROM/IN_MOVED_TO notifications.
+ * Unpaired files are remembered in the move index to be paired later.
+ *
+ * @param[in] ctx  A pointer to #handle_context.
+ * @param[in] di   File name & inode number of the file.
+ * @param[in] mask IN_CREATE for added file or IN_DELETE for removed one.
+ * @return true if move notifications have been produced, false otherwise.
+ **/
+static bool
+pair_move (struct handle_context *ctx, struct dep_item *di, uint32_t mask)
+{
+    struct i_watch *iw = ctx->iw, *other;
+    struct worker *wrk = iw->wrk;
+    struct move_item *item;
+    uint32_t cookie = di->inode & 0x00000000FFFFFFFF;
+    uint32_t to = 0;
+    uint64_t now;
+    int index, queued;
+
+    if (wrk->eq.move_window == 0) {
+        return false;
+    }
+#ifdef HAVE_NOTE_EXTEND_ON_MOVE_TO
+    /* Moves are reported by kernel */
+    if (mask == IN_CREATE && ctx->fflags & NOTE_EXTEND) {
+        return false;
+    }
+#endif
+#ifdef HAVE_NOTE_EXTEND_ON_MOVE_FROM
+    if (mask == IN_DELETE && ctx->fflags & NOTE_EXTEND) {
+        return false;
+    }
+#endif
+
+    now = monotonic_ns ();
+    item = move_index_find (&wrk->moves, iw->dev, di->inode, now);
+    if (item == NULL || item->wd == iw->wd || item->mask == mask) {
+        move_index_insert (&wrk->moves, iw->dev, di->inode, iw->wd, mask,
+                           di->path, now + wrk->eq.move_window);
+        return false;
+    }
+
+    /* The other half of the pair is reported only if it is watched for */
+    SLIST_FOREACH (other, &wrk->head, next) {
+        if (other->wd == item->wd) {
+            if (!other->is_closed) {
+                to = other->flags &
+                    (mask == IN_CREATE ? IN_MOVED_FROM : IN_MOVED_TO);
+            }
+            break;
+        }
+    }
+
+    index = event_queue_rewrite (&wrk->eq,
+                                 item->wd,
+                                 item->name,
+                                 mask == IN_CREATE ? IN_DELETE : IN_CREATE,
+                                 to,
+                                 cookie);
+    move_index_delete (&wrk->moves, item);
+
+    if (mask == IN_CREATE) {
+        iwatch_add_subwatch (iw, di);
+        enqueue_event (iw, IN_MOVED_TO, di);
+    } else {
+        /* Target directory has been rescanned first. Keep pair order */
+        queued = wrk->eq.mem_events;
+        enqueue_event (iw, IN_MOVED_FROM, di);
+        if (index != -1 && wrk->eq.mem_events == queued + 1) {
+            event_queue_place (&wrk->eq, index);
+        }
+        iwatch_del_subwatch (iw, di);
+    }
+
+    return true;
+}
+
 /**
  * Produce an IN_CREATE notification for a new file and start wathing on it.
  *
@@ -165,6 +320,30 @@ handle_added (void *udata, struct dep_item *di)
     assert (ctx != NULL);
     assert (ctx->iw != NULL);
 
+    if (pair_move (ctx, di, IN_CREATE)) {
+        return;
+    }
+
+    /*
+     * In transient file elision mode IN_CREATE is held in event queue and
+     * the file is opened only on IN_CREATE release, if it still exists.
+     */
+    if (ctx->iw->wrk->eq.window != 0 && ctx->iw->flags & IN_CREATE
+#ifdef HAVE_NOTE_EXTEND_ON_MOVE_TO
+        && !(ctx->fflags & NOTE_EXTEND)
+#endif
+        ) {
+        struct stat st;
+
+        if (S_ISUNK (di->type) &&
+            fstatat (ctx->iw->fd, di->path, &st, AT_SYMLINK_NOFOLLOW) != -1) {
+            di_settype (di, st.st_mode);
+        }
+        if (enqueue_event (ctx->iw, IN_CREATE, di) == 0) {
+            return;
+        }
+    }
+
     iwatch_add_subwatch (ctx->iw, di);
 #ifdef HAVE_NOTE_EXTEND_ON_MOVE_TO
     if (ctx->fflags & NOTE_EXTEND) {
@@ -191,6 +370,10 @@ handle_removed (void *udata, struct dep_item *di)
     assert (ctx != NULL);
     assert (ctx->iw != NULL);
 
+    if (pair_move (ctx, di, IN_DELETE)) {
+        return;
+    }
+
 #ifdef HAVE_NOTE_EXTEND_ON_MOVE_FROM
     if (ctx->fflags & NOTE_EXTEND) {
         enqueue_event (ctx->iw, IN_MOVED_FROM, di);
@@ -263,29 +446,133 @@ static const struct traverse_cbs cbs = {
  * This function is top-level and it operates with other specific routines
  * to notify about different sets of events in a different conditions.
  *
- * @param[in] iw    A pointer to #i_watch.
- * @param[in] event A pointer to the received kqueue event.
+ * @param[in] iw     A pointer to #i_watch.
+ * @param[in] fflags Filter flags of the received kqueue event.
  **/
 void
-produce_directory_diff (struct i_watch *iw, struct kevent *event)
+produce_directory_diff (struct i_watch *iw, uint32_t fflags)
 {
     struct handle_context ctx;
     struct chg_list *changes;
+    char *resume = NULL;
+    uint64_t started;
 
     assert (iw != NULL);
-    assert (event != NULL);
 
-    changes = dl_listing (iw->fd, &iw->deps);
+    started = monotonic_ns ();
+    ++iw->wrk->rescans;
+
+    /* Take a listing made by the rescan thread if any */
+    changes = iw->prelisted;
+    iw->prelisted = NULL;
+    if (changes == NULL) {
+        changes = dl_listing (iw->fd, &iw->deps);
+    }
     if (changes == NULL) {
         perror_msg (("Failed to create a listing for watch %d", iw->wd));
+        iw->wrk->rescan_time += monotonic_ns () - started;
         return;
     }
 
     memset (&ctx, 0, sizeof (ctx));
     ctx.iw = iw;
-    ctx.fflags = event->fflags;
+    ctx.fflags = fflags;
+
+    /*
+     * Remember where background population has stopped as listing is
+     * reordered by diff. Entries added by diff are watched by callbacks.
+     */
+    if (iw->populating && iw->populated < iw->deps.count) {
+        resume = strdup (iw->deps.items[iw->populated]->path);
+        if (resume == NULL) {
+            /* Start over. Watched entries are skipped anyway */
+            iw->populated = 0;
+        }
+    }
 
     dl_calculate (&iw->deps, changes, &cbs, &ctx);
+    recorder_listing (&iw->wrk->rec, iw->wd, &iw->deps);
+
+    if (resume != NULL) {
+        iw->populated = dl_position (&iw->deps, resume);
+        free (resume);
+    } else if (iw->populating && iw->populated != 0) {
+        iw->populated = iw->deps.count;
+    }
+    iw->wrk->rescan_time += monotonic_ns () - started;
+}
+
+/**
+ * Produce a diff of a directory taken back from the rescan thread.
+ *
+ * @param[in] wrk A pointer to #worker.
+ * @param[in] iw  A pointer to directory #i_watch.
+ **/
+static void
+finish_rescan (struct worker *wrk, struct i_watch *iw)
+{
+    struct watch *w;
+
+    produce_directory_diff (iw, iw->rescan_fflags);
+
+    /* Mask events produced by the listing, see produce_notifications() */
+    w = watch_set_find (&wrk->watches, iw->dev, iw->inode);
+    if (w != NULL) {
+        w->skip_next = true;
+    }
+
+    /* IN_ONESHOT watch is removed after the first event */
+    if (iw->is_closed) {
+        worker_remove_iwatch (wrk, iw);
+    }
+}
+
+/**
+ * Produce diffs of all directories passed to the rescan thread. Listings
+ * which are being made are waited for.
+ *
+ * @param[in] wrk A pointer to #worker.
+ **/
+static void
+finish_rescans (struct worker *wrk)
+{
+    struct i_watch *iw;
+
+    while ((iw = rescan_queue_take (&wrk->rescan, true)) != NULL) {
+        finish_rescan (wrk, iw);
+    }
+}
+
+/**
+ * Produce diffs of directories passed to the rescan thread which have
+ * events to be reported by a received kqueue event, so the diff events
+ * precede them as if the directories were not passed.
+ *
+ * @param[in] wrk   A pointer to #worker.
+ * @param[in] event A pointer to the received kqueue event.
+ **/
+static void
+finish_watch_rescans (struct worker *wrk, struct kevent *event)
+{
+    struct watch *w;
+    struct watch_dep *wd;
+    bool found;
+
+    do {
+        found = false;
+        /* Diff can free the watch or change its dependencies */
+        w = (struct watch *)event->udata;
+        if (w == NULL) {
+            break;
+        }
+        WD_FOREACH (wd, w) {
+            if (rescan_queue_wait (&wrk->rescan, wd->iw)) {
+                finish_rescan (wrk, wd->iw);
+                found = true;
+                break;
+            }
+        }
+    } while (found);
 }
 
 /**
@@ -337,6 +624,7 @@ produce_notifications (struct worker *wrk, struct kevent *event)
 
     flags = event->fflags;
     mode = watch_get_mode (w);
+    recorder_kevent (&wrk->rec, watch_get_inode (w), mode, flags, event->flags);
 
     /* Set deleted flag if no more links exist */
     if (flags & NOTE_DELETE && (!S_ISREG (mode) || is_deleted (w->fd))) {
@@ -387,8 +675,17 @@ produce_notifications (struct worker *wrk, struct kevent *event)
                     nanosleep (&timeout, NULL);
                 }
 #endif
-                produce_directory_diff (iw, event);
-                w->skip_next = true;
+                if (wrk->rescan.running && !(i_flags & IN_AFTER_DIFF) &&
+                    !iw->is_closed) {
+                    /* Nothing else is reported until the diff is made */
+                    iw->rescan_fflags = event->fflags;
+                    rescan_queue_submit (&wrk->rescan,
+                                         iw,
+                                         wrk->rescan_threads);
+                } else {
+                    produce_directory_diff (iw, event->fflags);
+                    w->skip_next = true;
+                }
 
             } else if (i_flags & ie_order[i]) {
 
@@ -435,19 +732,30 @@ worker_thread (void *arg)
     struct worker_cmd *cmd;
 #define SBEMPTY SIZE_MAX
     size_t sbspace = SBEMPTY;
-#define MAXEVENTS 1
-    struct kevent received[MAXEVENTS];
+    struct kevent received[WORKER_BATCH_KEVENTS];
     bool direct = wrk->io[KQUEUE_FD] == wrk->io[INOTIFY_FD];
 
     assert (wrk != NULL);
 
     for (;;) {
+        struct i_watch *iw;
         size_t i;
         int nevents;
+        uint64_t batch;
 
-        if (sbspace > 0 && wrk->eq.mem_events > 0) {
+        /* Shrink auto-tuned socket buffer when it is empty for a while */
+        if (wrk->sockbuf_idle != 0 && sbspace == SBEMPTY) {
+            worker_tune_sockbufsize (wrk, false);
+        }
+
+        batch = sbspace > 0 && wrk->eq.mem_events > 0 ?
+            event_queue_batch_deadline (&wrk->eq) : 0;
+        if (batch != 0) {
+            /* Hold small batch back to save consumer wakeups */
+            worker_set_timer (wrk, batch);
+        } else if (sbspace > 0 && wrk->eq.mem_events > 0) {
             ssize_t sent;
-            if (sbspace == SBEMPTY && !direct) {
+            if (sbspace == SBEMPTY && !direct && wrk->eq.ring == NULL) {
                 /* Try to track sockbufsize changes on the fly */
                 sbspace = wrk->sockbufsize;
             }
@@ -459,25 +767,71 @@ worker_thread (void *arg)
                     sent = 0; /* Ignore nonfatal errors */
                 }
             }
-            if (!direct)
-                sbspace = wrk->eq.mem_events == 0 ? sbspace - sent : 0;
+            if (wrk->eq.ring != NULL)
+                /* Leftover events wait for space released in the ring */
+                sbspace = wrk->eq.mem_events == 0 || wrk->eq.deadline != 0 ?
+                    SBEMPTY : 0;
+            else if (!direct)
+                sbspace = wrk->eq.mem_events == 0 || wrk->eq.deadline != 0 ?
+                    sbspace - sent : 0;
+            /* Wake up when held events are to be released */
+            if (wrk->eq.deadline != 0) {
+                worker_set_timer (wrk, wrk->eq.deadline);
+            }
+        }
+        if (wrk->sockbuf_idle != 0 && sbspace == SBEMPTY) {
+            worker_set_timer (wrk, wrk->sockbuf_idle);
+        }
+
+        /* Write the recording out before going to sleep */
+        if (recorder_enabled (&wrk->rec) && wrk->populating == 0) {
+            recorder_flush (&wrk->rec);
         }
 
-        nevents = kevent (wrk->kq, NULL, 0, received, MAXEVENTS, NULL);
+        /* Do not sleep while there are watches to populate */
+        nevents = kevent (wrk->kq, NULL, 0, received,
+                          wrk->rescan.running ? WORKER_BATCH_KEVENTS : 1,
+                          wrk->populating > 0 ? zero_tsp : NULL);
         if (nevents == -1) {
             perror_msg (("kevent failed"));
             continue;
         }
+        /* Watches freed while processing are dropped from the rest */
+        wrk->received = received;
+        wrk->nreceived = nevents;
+        /* Stamp events produced from received kevents */
+        wrk->eq.now = wrk->eq.timestamps || wrk->eq.ts != NULL ?
+            monotonic_ns () : 0;
         for (i = 0; i < nevents; i++) {
+#ifdef EVFILT_USER
+            if (received[i].filter == EVFILT_USER &&
+                received[i].ident == (uintptr_t)&wrk->eq) {
+                /* User has taken some events from the ring or queue */
+                sbspace = SBEMPTY;
+                continue;
+            }
+            if (received[i].filter == EVFILT_USER &&
+                received[i].ident == (uintptr_t)&wrk->rescan) {
+                /* Rescan thread has listed some directories */
+                while ((iw = rescan_queue_take (&wrk->rescan, false)) != NULL) {
+                    finish_rescan (wrk, iw);
+                }
+                continue;
+            }
+#endif
             if (received[i].ident == wrk->io[KQUEUE_FD]) {
                 if (received[i].flags & EV_EOF) {
                     goto die;
+                } else if (received[i].filter == EVFILT_TIMER) {
+                    /* Held events are to be flushed on the next iteration */
+                    wrk->timer = 0;
 #ifdef EVFILT_EMPTY
                 } else if (received[i].filter == EVFILT_EMPTY) {
 #else
                 } else if (received[i].filter == EVFILT_WRITE) {
                     assert (received[i].data >= wrk->sockbufsize);
 #endif
+                    worker_tune_sockbufsize (wrk, true);
                     sbspace = SBEMPTY;
                     /* Tell event queue about empty communication pipe */
                     event_queue_reset_last (&wrk->eq);
@@ -489,9 +843,11 @@ worker_thread (void *arg)
 #else
                     cmd = received[i].udata;
 #endif
-                    if (cmd->type != WCMD_CLOSE)
+                    if (cmd->type != WCMD_CLOSE) {
+                        /* Commands see all the directories diffed */
+                        finish_rescans (wrk);
                         process_command (wrk, cmd);
-                    else
+                    } else
                         goto die;
 #else
                 } else if (received[i].filter == EVFILT_READ) {
@@ -500,10 +856,20 @@ worker_thread (void *arg)
                     }
 #endif
                 }
-            } else {
-                produce_notifications (wrk, &received[i]);
+            } else if ((struct watch *)received[i].udata != NULL) {
+                if (!rescan_queue_empty (&wrk->rescan)) {
+                    finish_watch_rescans (wrk, &received[i]);
+                }
+                if ((struct watch *)received[i].udata != NULL) {
+                    produce_notifications (wrk, &received[i]);
+                }
             }
         }
+        wrk->nreceived = 0;
+        if (wrk->populating > 0) {
+            finish_rescans (wrk);
+            worker_populate (wrk);
+        }
     }
 die:
     worker_erase (wrk);
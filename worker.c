@@ -43,7 +43,9 @@
 
 #include "compat.h"
 #include "event-queue.h"
+#include "event-ring.h"
 #include "inotify-watch.h"
+#include "move-index.h"
 #include "utils.h"
 #include "watch.h"
 #include "worker-thread.h"
@@ -51,6 +53,12 @@
 
 static void
 worker_cmd_reset (struct worker_cmd *cmd);
+static int
+worker_ring_init (struct worker *wrk);
+static int
+worker_direct_init (struct worker *wrk);
+static void
+worker_direct_repost (struct worker *wrk, bool wakeup);
 
 
 /**
@@ -106,6 +114,71 @@ worker_cmd_param (struct worker_cmd *cmd, int param, intptr_t value)
     cmd->cmd.param.value = value;
 }
 
+/**
+ * Prepare a command with the data of the libinotify_get_stats() call.
+ *
+ * @param[in] cmd   A pointer to #worker_cmd
+ * @param[in] stats A pointer to statistics buffer to fill.
+ **/
+void
+worker_cmd_stats (struct worker_cmd *cmd, struct libinotify_stats *stats)
+{
+    assert (cmd != NULL);
+    worker_cmd_reset (cmd);
+
+    cmd->type = WCMD_STATS;
+    cmd->cmd.stats = stats;
+}
+
+/**
+ * Prepare a command with the data of the libinotify_set_filter() call.
+ *
+ * @param[in] cmd     A pointer to #worker_cmd
+ * @param[in] wd      An ID of the watch to set filter for.
+ * @param[in] pattern A fnmatch(3) pattern or NULL to reset filters.
+ * @param[in] type    IN_FILTER_INCLUDE or IN_FILTER_EXCLUDE.
+ **/
+void
+worker_cmd_filter (struct worker_cmd *cmd,
+                   int wd,
+                   const char *pattern,
+                   int type)
+{
+    assert (cmd != NULL);
+    worker_cmd_reset (cmd);
+
+    cmd->type = WCMD_FILTER;
+    cmd->cmd.filter.wd = wd;
+    cmd->cmd.filter.pattern = pattern;
+    cmd->cmd.filter.type = type;
+}
+
+/**
+ * Prepare a command with the data of the libinotify_snapshot() call.
+ *
+ * @param[in]  cmd  A pointer to #worker_cmd
+ * @param[in]  wd   An ID of the watch to get snapshot of.
+ * @param[in]  buf  A buffer to store directory entries to.
+ * @param[in]  len  Size of the buffer.
+ * @param[out] size A pointer to the snapshot size.
+ **/
+void
+worker_cmd_snapshot (struct worker_cmd *cmd,
+                     int wd,
+                     void *buf,
+                     size_t len,
+                     size_t *size)
+{
+    assert (cmd != NULL);
+    worker_cmd_reset (cmd);
+
+    cmd->type = WCMD_SNAPSHOT;
+    cmd->cmd.snapshot.wd = wd;
+    cmd->cmd.snapshot.buf = buf;
+    cmd->cmd.snapshot.len = len;
+    cmd->cmd.snapshot.size = size;
+}
+
 /**
  * Prepare a command that signals the worker shutdown.
  *
@@ -247,6 +320,47 @@ worker_set_sockbufsize (struct worker *wrk, int bufsize)
     return 0;
 }
 
+/**
+ * Adjust communication socket buffer size to the consumer drain rate.
+ * Buffer is grown if events piled up in memory while the consumer has been
+ * draining the socket and is shrunk back after the socket has been idle for
+ * WORKER_SOCKBUF_IDLE_TIME.
+ *
+ * @param[in] wrk     A pointer to #worker.
+ * @param[in] drained true if called on socket drain, false to check idle time.
+ **/
+void
+worker_tune_sockbufsize (struct worker *wrk, bool drained)
+{
+    int bufsize = wrk->sockbufsize;
+    uint64_t now;
+
+    if (wrk->sockbufsize_max == 0) {
+        return;
+    }
+
+    now = monotonic_ns ();
+    if (drained && wrk->eq.mem_events > 0) {
+        /* Consumer keeps up, but socket is a bottleneck */
+        bufsize = bufsize > wrk->sockbufsize_max / 2 ?
+            wrk->sockbufsize_max : bufsize * 2;
+        wrk->sockbuf_idle = 0;
+    } else if (drained) {
+        if (bufsize > wrk->sockbufsize_min && wrk->sockbuf_idle == 0) {
+            wrk->sockbuf_idle = now + WORKER_SOCKBUF_IDLE_TIME;
+        }
+    } else if (wrk->sockbuf_idle != 0 && now >= wrk->sockbuf_idle) {
+        bufsize = bufsize / 2 < wrk->sockbufsize_min ?
+            wrk->sockbufsize_min : bufsize / 2;
+        wrk->sockbuf_idle = bufsize > wrk->sockbufsize_min ?
+            now + WORKER_SOCKBUF_IDLE_TIME : 0;
+    }
+
+    if (bufsize != wrk->sockbufsize) {
+        worker_set_sockbufsize (wrk, bufsize);
+    }
+}
+
 /**
  * Create communication pipe
  *
@@ -327,6 +441,8 @@ worker_create (int flags)
 
     wrk->io[INOTIFY_FD] = -1;
     wrk->io[KQUEUE_FD] = -1;
+    recorder_init (&wrk->rec);
+    rescan_queue_init (&wrk->rescan);
 
     wrk->kq = kqueue_init ();
     if (wrk->kq == -1) {
@@ -360,9 +476,13 @@ worker_create (int flags)
         if (worker_set_sockbufsize(wrk, IN_DEF_SOCKBUFSIZE) == -1) {
             goto failure;
         }
+        wrk->sockbufsize_min = IN_DEF_SOCKBUFSIZE;
     }
 
     SLIST_INIT (&wrk->head);
+#ifdef SKIP_SUBFILES
+    SLIST_INIT (&wrk->fs_types);
+#endif
 
 #ifdef EVFILT_USER
     EV_SET (&ev[0], wrk->io[KQUEUE_FD], EVFILT_USER, EV_ADD | EV_CLEAR, 0, 0, 0);
@@ -404,6 +524,10 @@ worker_create (int flags)
 
     wrk->wd_last = 0;
     wrk->wd_overflow = false;
+    wrk->rescans = 0;
+    wrk->rescan_time = 0;
+    wrk->timer = 0;
+    wrk->rescan_threads = 1;
 
     pthread_mutex_init (&wrk->cmd_mtx, NULL);
     atomic_init (&wrk->mutex_rc, 0);
@@ -411,6 +535,14 @@ worker_create (int flags)
     pthread_cond_init (&wrk->cv, NULL);
     wrk->sema = 0;
     event_queue_init (&wrk->eq);
+    move_index_init (&wrk->moves);
+    wrk->eq.timestamps = flags & IN_TIMESTAMP;
+    if ((flags & IN_RING) && worker_ring_init (wrk) == -1) {
+        goto failure;
+    }
+    if (direct && worker_direct_init (wrk) == -1) {
+        goto failure;
+    }
     watch_set_init (&wrk->watches);
 
     /* create a run a worker thread */
@@ -442,6 +574,76 @@ failure:
     return NULL;
 }
 
+/**
+ * Subscribe worker thread to notifications about events taken by user
+ * thread in event ring and direct modes.
+ *
+ * @param[in] wrk A pointer to #worker.
+ * @return 0 on success, -1 on failure.
+ **/
+static int
+worker_wakeup_init (struct worker *wrk)
+{
+#ifdef EVFILT_USER
+    struct kevent ev;
+
+    EV_SET (&ev, (uintptr_t)&wrk->eq, EVFILT_USER, EV_ADD | EV_CLEAR, 0, 0, 0);
+    if (kevent (wrk->kq, &ev, 1, NULL, 0, zero_tsp) == -1) {
+        perror_msg (("Failed to register worker wakeup event"));
+        return -1;
+    }
+    return 0;
+#else
+    perror_msg (("Worker wakeup requires support for EVFILT_USER"));
+    errno = EINVAL;
+    return -1;
+#endif
+}
+
+/**
+ * Create a shared memory event ring.
+ *
+ * @param[in] wrk A pointer to #worker.
+ * @return 0 on success, -1 on failure.
+ **/
+static int
+worker_ring_init (struct worker *wrk)
+{
+    wrk->eq.ring = event_ring_create (EVENT_RING_SIZE);
+    if (wrk->eq.ring == NULL) {
+        return -1;
+    }
+
+    return worker_wakeup_init (wrk);
+}
+
+/**
+ * Create a queue of event blocks for direct mode and register persistent
+ * EVFILT_USER event used to notify user about queued blocks.
+ *
+ * @param[in] wrk A pointer to #worker.
+ * @return 0 on success, -1 on failure.
+ **/
+static int
+worker_direct_init (struct worker *wrk)
+{
+#ifdef EVFILT_USER
+    struct kevent ev;
+
+    wrk->eq.blocks = event_blocks_create ();
+    if (wrk->eq.blocks == NULL) {
+        return -1;
+    }
+
+    EV_SET (&ev, EQ_DIRECT_IDENT, EVFILT_USER, EV_ADD | EV_CLEAR, 0, 0, 0);
+    if (kevent (wrk->io[KQUEUE_FD], &ev, 1, NULL, 0, zero_tsp) == -1) {
+        perror_msg (("Failed to register direct mode event"));
+        return -1;
+    }
+#endif
+    return worker_wakeup_init (wrk);
+}
+
 /**
  * Free a worker and all the associated memory.
  *
@@ -455,6 +657,9 @@ worker_free (struct worker *wrk)
 
     assert (wrk != NULL);
 
+    /* Rescan thread may read watched directories and trigger kqueue */
+    rescan_queue_free (&wrk->rescan);
+
     if (wrk->io[KQUEUE_FD] != -1) {
         close (wrk->io[KQUEUE_FD]);
         wrk->io[KQUEUE_FD] = -1;
@@ -483,6 +688,8 @@ worker_free (struct worker *wrk)
     pthread_cond_destroy (&wrk->cv);
     pthread_mutex_destroy (&wrk->mutex);
     event_queue_free (&wrk->eq);
+    move_index_free (&wrk->moves);
+    recorder_stop (&wrk->rec);
     free (wrk);
 }
 
@@ -518,9 +725,54 @@ worker_allocate_wd (struct worker *wrk)
     return wrk->wd_last;
 }
 
+/**
+ * Find an inotify watch the kqueue watch is a parent of.
+ *
+ * @param[in] w A pointer to #watch of the file.
+ * @return A pointer to #i_watch if the file is watched itself, NULL otherwise.
+ **/
+static struct i_watch *
+worker_find_iwatch (struct watch *w)
+{
+    struct watch_dep *wd;
+
+    WD_FOREACH (wd, w) {
+        if (watch_dep_is_parent (wd)) {
+            return wd->iw;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Modify flags of an existing inotify watch.
+ *
+ * @param[in] wrk   A pointer to #worker.
+ * @param[in] iw    A pointer to #i_watch.
+ * @param[in] flags A combination of inotify watch flags.
+ * @return An id of the watch.
+ **/
+static int
+worker_modify (struct worker *wrk, struct i_watch *iw, uint32_t flags)
+{
+    wrk->readd = true;
+    iwatch_update_flags (iw, flags);
+    if (flags & IN_ADD_ASYNC && !iw->populating) {
+        event_queue_enqueue (&wrk->eq, iw->wd, IN_WATCH_READY, 0, NULL);
+    }
+    return iw->wd;
+}
+
 /**
  * Add or modify a watch.
  *
+ * When previous call has hit an existing watch, the path is stat`ed first,
+ * so repeatedly added watches are updated without opening the file. The
+ * access rights open(2) would check are verified with watch_may_open(),
+ * a denied path falls back to the open and fails as before. The
+ * path can not be looked up in user space before the kernel checks it,
+ * as a bad address must be reported with EFAULT.
+ *
  * @param[in] wrk   A pointer to #worker.
  * @param[in] path  A file path to watch.
  * @param[in] flags A combination of inotify watch flags.
@@ -539,6 +791,21 @@ worker_add_or_modify (struct worker *wrk,
     assert (path != NULL);
     assert (wrk != NULL);
 
+    if (wrk->readd) {
+        if (fstatat (AT_FDCWD, path, &st,
+                     flags & IN_DONT_FOLLOW ? AT_SYMLINK_NOFOLLOW : 0) == -1) {
+            perror_msg (("Failed to stat file %s",
+                         errno != EFAULT ? path : "<bad addr>"));
+            return -1;
+        }
+        w = watch_set_find (&wrk->watches, st.st_dev, st.st_ino);
+        if (w != NULL && (iw = worker_find_iwatch (w)) != NULL &&
+            (!(flags & IN_ONLYDIR) || S_ISDIR (st.st_mode)) &&
+            watch_may_open (AT_FDCWD, path, flags)) {
+            return worker_modify (wrk, iw, flags);
+        }
+    }
+
     /* Open inotify watch descriptor */
     fd = iwatch_open (path, flags);
     if (fd == -1) {
@@ -554,19 +821,17 @@ worker_add_or_modify (struct worker *wrk,
     /* look up for an entry with these inode&device numbers */
     w = watch_set_find (&wrk->watches, st.st_dev, st.st_ino);
     if (w != NULL) {
-        struct watch_dep *wd;
         close (fd);
         fd = w->fd;
-        WD_FOREACH (wd, w) {
-            if (watch_dep_is_parent (wd)) {
-                iwatch_update_flags (wd->iw, flags);
-                return wd->iw->wd;
-            }
+        iw = worker_find_iwatch (w);
+        if (iw != NULL) {
+            return worker_modify (wrk, iw, flags);
         }
     }
 
     /* create a new entry if watch is not found */
-    iw = iwatch_init (wrk, fd, flags);
+    wrk->readd = false;
+    iw = iwatch_init (wrk, fd, &st, flags);
     if (iw == NULL) {
         return -1;
     }
@@ -574,6 +839,12 @@ worker_add_or_modify (struct worker *wrk,
     /* add inotify watch to worker`s watchlist */
     SLIST_INSERT_HEAD (&wrk->head, iw, next);
 
+    if (iw->populating) {
+        ++wrk->populating;
+    } else if (flags & IN_ADD_ASYNC) {
+        event_queue_enqueue (&wrk->eq, iw->wd, IN_WATCH_READY, 0, NULL);
+    }
+
     return iw->wd;
 }
 
@@ -616,10 +887,154 @@ worker_remove_iwatch (struct worker *wrk, struct i_watch *iw)
     assert (iw != NULL);
 
     event_queue_enqueue (&wrk->eq, iw->wd, IN_IGNORED, 0, NULL);
+    if (iw->populating) {
+        --wrk->populating;
+    }
+    /* Get dependency list back from rescan thread. Listing is discarded */
+    rescan_queue_wait (&wrk->rescan, iw);
     SLIST_REMOVE (&wrk->head, iw, i_watch, next);
     iwatch_free (iw);
 }
 
+/**
+ * Forget a watch which is being freed in kevents received by the worker
+ * but not processed yet, so they are skipped rather than refer to freed
+ * memory.
+ *
+ * @param[in] wrk A pointer to #worker.
+ * @param[in] w   A pointer to the #watch.
+ **/
+void
+worker_drop_kevents (struct worker *wrk, struct watch *w)
+{
+    int i;
+
+    assert (wrk != NULL);
+    assert (w != NULL);
+
+    for (i = 0; i < wrk->nreceived; i++) {
+        if (wrk->received[i].filter == EVFILT_VNODE &&
+            (struct watch *)wrk->received[i].udata == w) {
+            wrk->received[i].udata = 0;
+        }
+    }
+}
+
+struct reap_job {
+    int *fds;
+    size_t nfds;
+};
+
+/**
+ * The reaper thread routine. Closes and frees the descriptors of the job.
+ *
+ * @param[in] arg A pointer to #reap_job.
+ * @return NULL.
+ **/
+static void*
+worker_reaper (void *arg)
+{
+    struct reap_job *job = arg;
+
+    close_fds (job->fds, job->nfds);
+    free (job->fds);
+    free (job);
+    return NULL;
+}
+
+/**
+ * Delete vnode kqueue notes of file descriptors without closing them,
+ * so events of freed watches can not be received after descriptors are
+ * handed to the reaper thread.
+ *
+ * @param[in] wrk  A pointer to #worker.
+ * @param[in] fds  An array of file descriptors.
+ * @param[in] nfds A number of file descriptors in the array.
+ * @return 0 on success, -1 otherwise.
+ **/
+static int
+worker_detach_fds (struct worker *wrk, const int *fds, size_t nfds)
+{
+#ifdef EV_RECEIPT
+    struct kevent changes[WORKER_REAP_BATCH];
+    struct kevent receipts[WORKER_REAP_BATCH];
+    size_t i, j, n;
+
+    for (i = 0; i < nfds; i += n) {
+        n = nfds - i < WORKER_REAP_BATCH ? nfds - i : WORKER_REAP_BATCH;
+        for (j = 0; j < n; j++) {
+            EV_SET (&changes[j],
+                    fds[i + j],
+                    EVFILT_VNODE,
+                    EV_DELETE | EV_RECEIPT,
+                    0,
+                    0,
+                    0);
+        }
+        /* Per-descriptor errors are returned as receipts and ignored */
+        if (kevent (wrk->kq, changes, n, receipts, n, zero_tsp) == -1) {
+            perror_msg (("Failed to detach %zu kqueue watches", n));
+            return -1;
+        }
+    }
+    return 0;
+#else
+    errno = ENOTSUP;
+    return -1;
+#endif
+}
+
+/**
+ * Close file descriptors of removed watches in one sweep. If number of
+ * descriptors reaches IN_REAP_THRESHOLD they are detached from kqueue and
+ * closed by background thread, so the worker does not stall on closing
+ * many vnodes.
+ *
+ * @param[in] wrk  A pointer to #worker.
+ * @param[in] fds  A malloc'ed array of file descriptors. Freed on return.
+ * @param[in] nfds A number of file descriptors in the array.
+ **/
+void
+worker_reap_fds (struct worker *wrk, int *fds, size_t nfds)
+{
+    struct reap_job *job;
+    pthread_attr_t attr;
+    pthread_t thread;
+    sigset_t set, oset;
+    int result;
+
+    assert (wrk != NULL);
+    assert (fds != NULL);
+
+    if (wrk->reap_threshold != 0 && nfds >= wrk->reap_threshold &&
+        worker_detach_fds (wrk, fds, nfds) != -1) {
+        job = malloc (sizeof (struct reap_job));
+        if (job != NULL) {
+            job->fds = fds;
+            job->nfds = nfds;
+
+            pthread_attr_init (&attr);
+            pthread_attr_setdetachstate (&attr, PTHREAD_CREATE_DETACHED);
+            sigfillset (&set);
+            pthread_sigmask (SIG_BLOCK, &set, &oset);
+
+            result = pthread_create (&thread, &attr, worker_reaper, job);
+
+            pthread_sigmask (SIG_SETMASK, &oset, NULL);
+            pthread_attr_destroy (&attr);
+
+            if (result == 0) {
+                return;
+            }
+            perror_msg (("Failed to start a reaper thread"));
+            free (job);
+        }
+    }
+
+    close_fds (fds, nfds);
+    free (fds);
+}
+
 /**
  * Prepare a command with the data of the libinotify_set_param() call.
  *
@@ -635,14 +1050,532 @@ worker_set_param (struct worker *wrk, int param, intptr_t value)
 
     switch (param) {
     case IN_SOCKBUFSIZE:
-        if(wrk->io[KQUEUE_FD] != wrk->io[INOTIFY_FD]) /* we have no sockets in direct mode */
-            return worker_set_sockbufsize (wrk, value);
-        else
+        if(wrk->io[KQUEUE_FD] == wrk->io[INOTIFY_FD]) /* we have no sockets in direct mode */
+            return 0;
+        if (wrk->sockbufsize_max != 0 && value > wrk->sockbufsize_max) {
+            errno = EINVAL;
+            return -1;
+        }
+        if (worker_set_sockbufsize (wrk, value) == -1) {
+            return -1;
+        }
+        wrk->sockbufsize_min = value;
+        wrk->sockbuf_idle = 0;
+        return 0;
+    case IN_SOCKBUFSIZE_MAX:
+        /* Socket does not carry events in direct and event ring modes */
+        if (wrk->io[KQUEUE_FD] == wrk->io[INOTIFY_FD] || wrk->eq.ring != NULL)
             return 0;
+        if (value < 0 || value > INT_MAX ||
+           (value != 0 && value < wrk->sockbufsize_min)) {
+            errno = EINVAL;
+            return -1;
+        }
+        wrk->sockbufsize_max = value;
+        /* Return to user set size if new limit is lower than current one */
+        if (wrk->sockbufsize > wrk->sockbufsize_min &&
+            (value == 0 || value < wrk->sockbufsize)) {
+            wrk->sockbuf_idle = 0;
+            return worker_set_sockbufsize (wrk, wrk->sockbufsize_min);
+        }
+        return 0;
     case IN_MAX_QUEUED_EVENTS:
         return event_queue_set_max_events (&wrk->eq, value);
+    case IN_EVENT_LATENCY:
+        return event_queue_set_latency (&wrk->eq, value != 0);
+    case IN_ELISION_WINDOW:
+        if (value < 0) {
+            errno = EINVAL;
+            return -1;
+        }
+        return event_queue_set_elision (&wrk->eq, (uint64_t)value * 1000000);
+    case IN_BATCH_BYTES:
+        if (value < 0) {
+            errno = EINVAL;
+            return -1;
+        }
+        return event_queue_set_batch (&wrk->eq,
+                                      value,
+                                      wrk->eq.batch_events,
+                                      wrk->eq.batch_delay);
+    case IN_BATCH_EVENTS:
+        if (value < 0 || value > INT_MAX) {
+            errno = EINVAL;
+            return -1;
+        }
+        return event_queue_set_batch (&wrk->eq,
+                                      wrk->eq.batch_bytes,
+                                      value,
+                                      wrk->eq.batch_delay);
+    case IN_BATCH_DELAY:
+        if (value < 0) {
+            errno = EINVAL;
+            return -1;
+        }
+        return event_queue_set_batch (&wrk->eq,
+                                      wrk->eq.batch_bytes,
+                                      wrk->eq.batch_events,
+                                      (uint64_t)value * 1000000);
+    case IN_MOVE_WINDOW:
+        if (value < 0) {
+            errno = EINVAL;
+            return -1;
+        }
+        if (event_queue_set_move_window (&wrk->eq,
+                                         (uint64_t)value * 1000000) == -1) {
+            return -1;
+        }
+        if (value == 0) {
+            move_index_free (&wrk->moves);
+        }
+        return 0;
+    case IN_WATCH_QUOTA:
+        if (value < 0 || value > INT_MAX) {
+            errno = EINVAL;
+            return -1;
+        }
+        return event_queue_set_quota (&wrk->eq, value);
+    case IN_PREFETCH_THREADS:
+        if (value < 0 || value > INT_MAX) {
+            errno = EINVAL;
+            return -1;
+        }
+        wrk->prefetch_threads = value;
+        return 0;
+    case IN_RECORD_FD:
+        if (value < -1 || value > INT_MAX) {
+            errno = EINVAL;
+            return -1;
+        }
+        if (value == -1) {
+            recorder_stop (&wrk->rec);
+            return 0;
+        }
+        return recorder_start (&wrk->rec, value);
+    case IN_RESCAN_THREADS:
+        if (value < 0 || value > INT_MAX) {
+            errno = EINVAL;
+            return -1;
+        }
+        wrk->rescan_threads = value;
+        return 0;
+    case IN_REAP_THRESHOLD:
+        if (value < 0 || value > INT_MAX) {
+            errno = EINVAL;
+            return -1;
+        }
+        wrk->reap_threshold = value;
+        return 0;
+    case IN_RESCAN_ASYNC:
+        if (value != 0 && value != 1) {
+            errno = EINVAL;
+            return -1;
+        }
+        if (value != 0) {
+            return rescan_queue_start (&wrk->rescan, wrk->kq);
+        }
+        /* Queue has been emptied before the command processing */
+        assert (rescan_queue_empty (&wrk->rescan));
+        rescan_queue_stop (&wrk->rescan);
+        return 0;
     default:
         errno = EINVAL;
     }
     return -1;
 }
+
+/**
+ * Fill inotify instance statistics in.
+ *
+ * @param[in]  wrk   A pointer to #worker.
+ * @param[out] stats A pointer to statistics buffer to fill.
+ * @return 0 on success, -1 on failure.
+ **/
+int
+worker_get_stats (struct worker *wrk, struct libinotify_stats *stats)
+{
+    struct i_watch *iw;
+
+    assert (wrk != NULL);
+    assert (stats != NULL);
+
+    memset (stats, 0, sizeof (struct libinotify_stats));
+
+    stats->events_produced = wrk->eq.produced;
+    stats->events_coalesced = wrk->eq.coalesced;
+    stats->events_dropped = wrk->eq.dropped;
+    stats->events_elided = wrk->eq.elided;
+    stats->queue_hiwat = wrk->eq.hiwat;
+    stats->flush_calls = wrk->eq.flushes;
+    stats->flush_bytes = wrk->eq.flushed;
+    stats->sockbufsize = wrk->sockbufsize;
+    stats->rescans = wrk->rescans;
+    stats->rescan_time = wrk->rescan_time + rescan_queue_time (&wrk->rescan);
+    stats->open_fds = watch_set_count (&wrk->watches);
+    stats->latency_samples = wrk->eq.lat_count;
+    stats->latency_p50 = event_queue_get_latency (&wrk->eq, 500);
+    stats->latency_p99 = event_queue_get_latency (&wrk->eq, 990);
+    stats->latency_p999 = event_queue_get_latency (&wrk->eq, 999);
+    stats->latency_max = wrk->eq.lat_max;
+
+    SLIST_FOREACH (iw, &wrk->head, next) {
+        ++stats->watches;
+        stats->dep_items += iw->deps.count;
+    }
+
+    return 0;
+}
+
+/**
+ * Set or reset subfile name filter of a watch.
+ *
+ * @param[in] wrk     A pointer to #worker.
+ * @param[in] wd      An ID of the watch.
+ * @param[in] pattern A fnmatch(3) pattern or NULL to reset filters.
+ * @param[in] type    IN_FILTER_INCLUDE or IN_FILTER_EXCLUDE.
+ * @return 0 on success, -1 on failure.
+ **/
+int
+worker_set_filter (struct worker *wrk, int wd, const char *pattern, int type)
+{
+    struct i_watch *iw;
+
+    assert (wrk != NULL);
+
+    SLIST_FOREACH (iw, &wrk->head, next) {
+        if (iw->wd == wd) {
+            return iwatch_set_filter (iw, pattern, type);
+        }
+    }
+    errno = EINVAL;
+    return -1;
+}
+
+/**
+ * Serialize directory entries of a watch. Entries excluded by subfile name
+ * filters are skipped. Nothing is stored if the buffer is too small.
+ *
+ * @param[in]  wrk  A pointer to #worker.
+ * @param[in]  wd   An ID of the watch.
+ * @param[in]  buf  A buffer to store #libinotify_dirent records to.
+ * @param[in]  len  Size of the buffer.
+ * @param[out] size Size of the whole snapshot in bytes.
+ * @return 0 on success, -1 on failure.
+ **/
+int
+worker_snapshot (struct worker *wrk,
+                 int wd,
+                 void *buf,
+                 size_t len,
+                 size_t *size)
+{
+    struct libinotify_dirent *de;
+    struct i_watch *iw;
+    struct dep_item *di;
+    size_t name_len, offset, i;
+
+    assert (wrk != NULL);
+    assert (size != NULL);
+
+    SLIST_FOREACH (iw, &wrk->head, next) {
+        if (iw->wd == wd) {
+            break;
+        }
+    }
+    if (iw == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    /* Calculate size first to store consistent snapshot or nothing */
+    *size = 0;
+    DL_FOREACH (di, &iw->deps, i) {
+        if (!iwatch_is_filtered (iw, di->path)) {
+            name_len = (strlen (di->path) + 8) & ~(size_t)7;
+            *size += sizeof (struct libinotify_dirent) + name_len;
+        }
+    }
+    if (*size > len) {
+        return 0;
+    }
+
+    offset = 0;
+    DL_FOREACH (di, &iw->deps, i) {
+        if (iwatch_is_filtered (iw, di->path)) {
+            continue;
+        }
+        name_len = (strlen (di->path) + 8) & ~(size_t)7;
+        de = (struct libinotify_dirent *)((char *)buf + offset);
+        de->ino = di->inode;
+        de->type = di->type & S_IFMT;
+        de->len = name_len;
+        memset (de->name, 0, name_len);
+        strcpy (de->name, di->path);
+        offset += sizeof (struct libinotify_dirent) + name_len;
+    }
+
+    return 0;
+}
+
+/**
+ * Start watching a subfile which watch opening has been postponed.
+ *
+ * @param[in] wrk  A pointer to #worker.
+ * @param[in] wd   An ID of the parent directory watch.
+ * @param[in] name A subfile name.
+ **/
+void
+worker_open_subwatch (struct worker *wrk, int wd, const char *name)
+{
+    struct i_watch *iw;
+    struct dep_item *di;
+    struct watch *w;
+
+    assert (wrk != NULL);
+    assert (name != NULL);
+
+    SLIST_FOREACH (iw, &wrk->head, next) {
+        if (iw->wd == wd) {
+            /* Dependency list can be owned by rescan thread */
+            rescan_queue_settle (&wrk->rescan, iw);
+            di = dl_find (&iw->deps, name);
+            if (di == NULL) {
+                return;
+            }
+            w = watch_set_find (&wrk->watches, iw->dev, di->inode);
+            if (w == NULL || watch_find_dep (w, iw, di) == NULL) {
+                iwatch_add_subwatch (iw, di);
+            }
+            return;
+        }
+    }
+}
+
+/**
+ * Make a step of background population of the oldest watch added with
+ * IN_ADD_ASYNC flag and report IN_WATCH_READY event when it is completed.
+ *
+ * @param[in] wrk A pointer to #worker.
+ **/
+void
+worker_populate (struct worker *wrk)
+{
+    struct i_watch *iw, *oldest = NULL;
+
+    assert (wrk != NULL);
+
+    SLIST_FOREACH (iw, &wrk->head, next) {
+        if (iw->populating) {
+            oldest = iw;
+        }
+    }
+    assert (oldest != NULL);
+
+    if (iwatch_populate (oldest)) {
+        --wrk->populating;
+        event_queue_enqueue (&wrk->eq, oldest->wd, IN_WATCH_READY, 0, NULL);
+    }
+}
+
+/**
+ * Arm one-shot timer waking worker thread up at given time. Timer is not
+ * rearmed if it is already set to fire earlier.
+ *
+ * @param[in] wrk      A pointer to #worker.
+ * @param[in] deadline A CLOCK_MONOTONIC time to wake up at, ns.
+ * @return 0 on success, -1 on failure.
+ **/
+int
+worker_set_timer (struct worker *wrk, uint64_t deadline)
+{
+    struct kevent ev;
+    uint64_t now;
+    intptr_t msec;
+
+    assert (wrk != NULL);
+
+    if (wrk->timer != 0 && wrk->timer <= deadline) {
+        return 0;
+    }
+
+    now = monotonic_ns ();
+    msec = deadline > now ? (deadline - now + 999999) / 1000000 : 0;
+
+    EV_SET (&ev,
+            wrk->io[KQUEUE_FD],
+            EVFILT_TIMER,
+            EV_ADD | EV_ONESHOT,
+            0,
+            msec,
+            0);
+    if (kevent (wrk->kq, &ev, 1, NULL, 0, zero_tsp) == -1) {
+        perror_msg (("Failed to arm worker timer"));
+        return -1;
+    }
+
+    wrk->timer = deadline;
+    return 0;
+}
+
+/**
+ * Get a block of events from shared memory event ring. Called from user
+ * thread. Rearms doorbell notification if the ring is found empty.
+ *
+ * @param[in]  wrk    A pointer to #worker.
+ * @param[out] events A pointer to the first event of the block.
+ * @return Length of the block in bytes, 0 if ring is empty, -1 on failure.
+ **/
+int
+worker_ring_peek (struct worker *wrk, const struct inotify_event **events)
+{
+    struct event_ring *er = wrk->eq.ring;
+    bool wakeup = false;
+    char buf[64];
+    int len;
+
+    if (er == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    len = event_ring_peek (er, events, &wakeup);
+    if (len == 0) {
+        /* Rearm doorbell, discard stale rings and recheck */
+        event_ring_rearm (er);
+        while (recv (wrk->io[INOTIFY_FD], buf, sizeof (buf), MSG_DONTWAIT) > 0)
+            ;
+        len = event_ring_peek (er, events, &wakeup);
+    }
+
+    if (wakeup) {
+        worker_wakeup (wrk);
+    }
+    return len;
+}
+
+/**
+ * Release events consumed from shared memory event ring. Called from user
+ * thread. Wakes worker thread up if it waits for free space in the ring.
+ *
+ * @param[in] wrk A pointer to #worker.
+ * @param[in] len Number of bytes to release.
+ * @return 0 on success, -1 on failure.
+ **/
+int
+worker_ring_release (struct worker *wrk, int len)
+{
+    struct event_ring *er = wrk->eq.ring;
+
+    if (er == NULL || len < 0 || !event_ring_releasable (er, len)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (event_ring_release (er, len)) {
+        worker_wakeup (wrk);
+    }
+    return 0;
+}
+
+/**
+ * Repost direct mode notification if some blocks are left in queue after
+ * user thread has taken events. Wake worker thread up if it waits for free
+ * space in the queue.
+ *
+ * @param[in] wrk    A pointer to #worker.
+ * @param[in] wakeup true if worker thread should be woken up.
+ **/
+static void
+worker_direct_repost (struct worker *wrk, bool wakeup)
+{
+    struct event_blocks *eb = wrk->eq.blocks;
+
+#ifdef EVFILT_USER
+    if (!event_blocks_empty (eb) && event_blocks_notify (eb)) {
+        struct kevent ev;
+
+        EV_SET (&ev, EQ_DIRECT_IDENT, EVFILT_USER, 0, NOTE_TRIGGER, 0, 0);
+        if (kevent (wrk->io[KQUEUE_FD], &ev, 1, NULL, 0, zero_tsp) == -1) {
+            perror_msg (("Failed to repost direct mode event"));
+        }
+    }
+#endif
+
+    if (wakeup) {
+        worker_wakeup (wrk);
+    }
+}
+
+/**
+ * Take blocks of events queued in direct mode. Called from user thread.
+ *
+ * @param[in]  wrk    A pointer to #worker.
+ * @param[out] events An array to store blocks to.
+ * @param[in]  size   Size of the array.
+ * @return Number of blocks taken on success, -1 on failure.
+ **/
+int
+worker_direct_pop (struct worker *wrk, struct iovec **events, int size)
+{
+    struct event_blocks *eb = wrk->eq.blocks;
+    bool wakeup = false;
+    int nblocks;
+
+    if (eb == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    event_blocks_rearm (eb);
+    nblocks = event_blocks_pop (eb, events, size, &wakeup);
+    worker_direct_repost (wrk, wakeup);
+    return nblocks;
+}
+
+/**
+ * Copy events queued in direct mode to a buffer. Called from user thread.
+ *
+ * @param[in]  wrk A pointer to #worker.
+ * @param[out] buf A buffer to store events to.
+ * @param[in]  len Size of the buffer.
+ * @return Number of bytes copied on success, -1 on failure.
+ **/
+ssize_t
+worker_direct_read (struct worker *wrk, void *buf, size_t len)
+{
+    struct event_blocks *eb = wrk->eq.blocks;
+    bool wakeup = false;
+    ssize_t size;
+
+    if (eb == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    event_blocks_rearm (eb);
+    size = event_blocks_read (eb, buf, len, &wakeup);
+    worker_direct_repost (wrk, wakeup);
+    if (size == -1) {
+        /* Buffer is too small to hold the next event */
+        errno = EINVAL;
+    }
+    return size;
+}
+
+/**
+ * Notify worker thread about events taken by user thread.
+ *
+ * @param[in] wrk A pointer to #worker.
+ **/
+void
+worker_wakeup (struct worker *wrk)
+{
+#ifdef EVFILT_USER
+    struct kevent ev;
+
+    EV_SET (&ev, (uintptr_t)&wrk->eq, EVFILT_USER, 0, NOTE_TRIGGER, 0, 0);
+    if (kevent (wrk->kq, &ev, 1, NULL, 0, zero_tsp) == -1) {
+        perror_msg (("Failed to wake up worker thread"));
+    }
+#endif
+}
@@ -35,11 +35,24 @@
 #include "compat.h"
 #include "event-queue.h"
 #include "inotify-watch.h"
+#include "move-index.h"
+#include "recorder.h"
+#include "rescan.h"
 #include "watch-set.h"
 
 /* Optimized watch destruction on freeing of worker thread */
 #define WORKER_FAST_WATCHSET_DESTROY 1
 
+/* Number of kevents received at once when directories are listed by
+ * the rescan thread */
+#define WORKER_BATCH_KEVENTS 64
+
+/* Number of kqueue notes deleted with one kevent() before reaping fds */
+#define WORKER_REAP_BATCH 128
+
+/* Time of drained socket after which its auto-tuned buffer is shrunk, ns */
+#define WORKER_SOCKBUF_IDLE_TIME 1000000000
+
 #define INOTIFY_FD 0
 #define KQUEUE_FD  1
 
@@ -48,6 +61,9 @@ typedef enum {
     WCMD_ADD,        /* add or modify a watch */
     WCMD_REMOVE,     /* remove a watch */
     WCMD_PARAM,      /* set worker thread parameter */
+    WCMD_STATS,      /* get worker statistics */
+    WCMD_FILTER,     /* set watch subfile name filter */
+    WCMD_SNAPSHOT,   /* get directory snapshot of a watch */
     WCMD_CLOSE       /* signal worker thread to shutdown itself */
 } worker_cmd_type_t;
 
@@ -72,6 +88,21 @@ struct worker_cmd {
             int param;
             intptr_t value;
         } param;
+
+        struct libinotify_stats *stats;
+
+        struct {
+            int wd;
+            const char *pattern;
+            int type;
+        } filter;
+
+        struct {
+            int wd;
+            void *buf;
+            size_t len;
+            size_t *size;
+        } snapshot;
     } cmd;
 
 };
@@ -81,6 +112,17 @@ void worker_cmd_add    (struct worker_cmd *cmd,
                         uint32_t mask);
 void worker_cmd_remove (struct worker_cmd *cmd, int watch_id);
 void worker_cmd_param  (struct worker_cmd *cmd, int param, intptr_t value);
+void worker_cmd_stats  (struct worker_cmd *cmd,
+                        struct libinotify_stats *stats);
+void worker_cmd_filter (struct worker_cmd *cmd,
+                        int wd,
+                        const char *pattern,
+                        int type);
+void worker_cmd_snapshot (struct worker_cmd *cmd,
+                          int wd,
+                          void *buf,
+                          size_t len,
+                          size_t *size);
 void worker_cmd_close  (struct worker_cmd *cmd);
 
 SLIST_HEAD(workers_list, worker);
@@ -89,10 +131,28 @@ struct worker {
     int kq;                /* kqueue descriptor */
     int io[2];             /* a socket pair */
     int sockbufsize;       /* socket buffer size */
+    int sockbufsize_min;   /* socket buffer size set by user */
+    int sockbufsize_max;   /* socket buffer auto-tuning limit. 0 if off */
+    uint64_t sockbuf_idle; /* time to shrink socket buffer at, ns. 0 if none */
     pthread_t thread;      /* worker thread */
     struct i_watch_list head; /* linked list of inotify watches */
     int wd_last;           /* last allocated inotify watch descriptor */
     bool wd_overflow;      /* if watch descriptor have been overflown */
+    uint64_t rescans;      /* number of directory rescans */
+    uint64_t rescan_time;  /* time spent in directory rescans, ns */
+    uint64_t timer;        /* deadline of armed wakeup timer, ns. 0 if none */
+    int prefetch_threads;  /* subfile opening threads. 0 if number of CPUs */
+    size_t reap_threshold; /* fds closed by reaper thread. 0 if disabled */
+    int rescan_threads;    /* rescan round listing threads. 0 if CPUs number */
+    struct kevent *received; /* kevents being processed by worker thread */
+    int nreceived;         /* number of kevents being processed */
+    struct rescan_queue rescan; /* directories listed by rescan thread */
+    int populating;        /* number of watches populated in background */
+    bool readd;            /* last added path has been watched already */
+    struct recorder rec;   /* worker input recorder */
+#ifdef SKIP_SUBFILES
+    struct fs_type_list fs_types; /* fs type checks cached per device */
+#endif
 
     pthread_mutex_t cmd_mtx;  /* worker command execution serializer */
     atomic_uint mutex_rc;     /* worker mutexes sleepers/holders refcount */
@@ -101,6 +161,7 @@ struct worker {
     pthread_cond_t cv;        /* worker <-> user syncronization condvar */
     struct event_queue eq;    /* inotify events queue */
     struct watch_set watches; /* kqueue watches */
+    struct move_index moves;  /* recently removed and added subfiles */
     SLIST_ENTRY(worker) next; /* next worker */
 };
 
@@ -119,7 +180,32 @@ int     worker_add_or_modify  (struct worker *wrk,
 int     worker_allocate_wd    (struct worker *wrk);
 int     worker_remove         (struct worker *wrk, int id);
 void    worker_remove_iwatch  (struct worker *wrk, struct i_watch *iw);
+void    worker_reap_fds       (struct worker *wrk, int *fds, size_t nfds);
+void    worker_drop_kevents   (struct worker *wrk, struct watch *w);
 int     worker_set_param      (struct worker *wrk, int param, intptr_t value);
+int     worker_get_stats      (struct worker *wrk,
+                               struct libinotify_stats *stats);
+int     worker_set_filter     (struct worker *wrk,
+                               int wd,
+                               const char *pattern,
+                               int type);
+int     worker_snapshot       (struct worker *wrk,
+                               int wd,
+                               void *buf,
+                               size_t len,
+                               size_t *size);
+void    worker_open_subwatch  (struct worker *wrk, int wd, const char *name);
+void    worker_populate       (struct worker *wrk);
+int     worker_set_timer      (struct worker *wrk, uint64_t deadline);
+void    worker_tune_sockbufsize (struct worker *wrk, bool drained);
+int     worker_ring_peek      (struct worker *wrk,
+                               const struct inotify_event **events);
+int     worker_ring_release   (struct worker *wrk, int len);
+int     worker_direct_pop     (struct worker *wrk,
+                               struct iovec **events,
+                               int size);
+ssize_t worker_direct_read    (struct worker *wrk, void *buf, size_t len);
+void    worker_wakeup         (struct worker *wrk);
 
 static inline void
 worker_cmd_lock (struct worker *wrk)